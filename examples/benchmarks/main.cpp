@@ -0,0 +1,297 @@
+// Headless benchmarks of the dx11 factory on a WARP device. Build and run the Release configuration, every benchmark
+// prints the mean time of one iteration.
+#include <windows.h>
+#include <d3d11.h>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <random>
+#include <vector>
+
+#pragma comment(lib, "d3d11.lib")
+
+#include "..\..\factories\dx11\renderer_dx11.hpp"
+#include "portable_benchmarks.hpp"
+
+static ID3D11Device *g_pd3dDevice = nullptr;
+
+static ID3D11Device *GetDevice()
+{
+    if (!g_pd3dDevice)
+    {
+        detail::ThrowIfFailed(D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_WARP, nullptr, 0, nullptr, 0,
+                                                D3D11_SDK_VERSION, &g_pd3dDevice, nullptr, nullptr));
+    }
+
+    return g_pd3dDevice;
+}
+
+void BenchmarkAddFont()
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "crf_benchmarks_font_cache";
+    const int iterations = 10;
+
+    std::shared_ptr<Renderer> renderer;
+
+    // no cache directory, the basic charset is rasterized by GDI
+    Report("AddFont without cache",
+           Measure(
+               iterations, [&] { renderer = std::make_shared<Renderer>(GetDevice(), 4096); },
+               [&] { renderer->AddFont(L"Tahoma", 15); }));
+
+    // the cache is empty, rasterizes and writes the file
+    Report("AddFont cold cache",
+           Measure(
+               iterations,
+               [&] {
+                   std::filesystem::remove_all(directory);
+                   std::filesystem::create_directories(directory);
+                   renderer = std::make_shared<Renderer>(GetDevice(), 4096);
+                   renderer->SetFontCacheDirectory(directory.wstring());
+               },
+               [&] { renderer->AddFont(L"Tahoma", 15); }));
+
+    // the file written by the last cold iteration is mapped
+    Report("AddFont cached",
+           Measure(
+               iterations,
+               [&] {
+                   renderer = std::make_shared<Renderer>(GetDevice(), 4096);
+                   renderer->SetFontCacheDirectory(directory.wstring());
+               },
+               [&] { renderer->AddFont(L"Tahoma", 15); }));
+
+    renderer.reset();
+    std::filesystem::remove_all(directory);
+}
+
+void BenchmarkAddTextFormat()
+{
+    const int iterations = 100;
+    const int labels = 1000;
+
+    auto renderer = std::make_shared<Renderer>(GetDevice(), 4096);
+    const FontHandle font = renderer->AddFont(L"Tahoma", 15);
+    auto renderList = std::make_shared<RenderList>(4096);
+
+    // a frame of player labels, formatting into a stack buffer
+    Report("AddTextFormat x1000",
+           Measure(
+               iterations, [&] { renderList->Clear(); },
+               [&] {
+                   for (int i = 0; i < labels; i++)
+                   {
+                       renderer->AddTextFormat(renderList, font, 10.f, 10.f, Color(255, 255, 255), TEXT_FLAG_NONE,
+                                               Color(0, 0, 0), 2.f, "{} [{}m] {}hp", "player", i, 100 - i % 100);
+                   }
+               }));
+
+    // the same with a std::string built for every label
+    Report("std::format + AddText x1000",
+           Measure(
+               iterations, [&] { renderList->Clear(); },
+               [&] {
+                   for (int i = 0; i < labels; i++)
+                   {
+                       renderer->AddText(renderList, font, std::format("{} [{}m] {}hp", "player", i, 100 - i % 100),
+                                         10.f, 10.f, Color(255, 255, 255));
+                   }
+               }));
+}
+
+void BenchmarkProjectPoints()
+{
+    const int iterations = 100;
+
+    DirectX::XMFLOAT4X4 m;
+    DirectX::XMStoreFloat4x4(&m, DirectX::XMMatrixPerspectiveFovLH(1.2f, 16.f / 9.f, 0.1f, 1000.f));
+
+    std::mt19937 rng(41);
+    std::uniform_real_distribution<float> coordinate(-100.f, 100.f);
+
+    for (size_t count : {size_t(1000), size_t(10000), size_t(100000)})
+    {
+        std::vector<DirectX::XMFLOAT3> in(count);
+        std::vector<DirectX::XMFLOAT2> out(count);
+        std::vector<uint8_t> visible(count);
+
+        for (DirectX::XMFLOAT3 &point : in)
+        {
+            point = DirectX::XMFLOAT3(coordinate(rng), coordinate(rng), coordinate(rng));
+        }
+
+        char label[64];
+
+        // what projecting them one by one costs, e.g. a WorldToScreen per bone
+        snprintf(label, sizeof(label), "one by one x%zu", count);
+        Report(label, Measure(iterations, [&] {
+                   for (size_t i = 0; i < count; i++)
+                   {
+                       detail::ProjectPointsScalar(m, &in[i], &out[i], &visible[i], 1, 1920.f, 1080.f);
+                   }
+               }));
+
+        snprintf(label, sizeof(label), "ProjectPointsScalar x%zu", count);
+        Report(label, Measure(iterations, [&] {
+                   detail::ProjectPointsScalar(m, in.data(), out.data(), visible.data(), count, 1920.f, 1080.f);
+               }));
+
+        snprintf(label, sizeof(label), "ProjectPoints x%zu", count);
+        Report(label, Measure(iterations, [&] {
+                   detail::ProjectPoints(m, in.data(), out.data(), visible.data(), count, 1920.f, 1080.f);
+               }));
+    }
+}
+
+// Background, ESP and menu list of a frame, moved by frame so every frame has to be uploaded.
+static void RecordOverlay(const std::shared_ptr<Renderer> &renderer, FontHandle font,
+                          const std::vector<RenderListPtr> &renderLists, int frame)
+{
+    const float offset = static_cast<float>(frame % 16);
+
+    for (const RenderListPtr &renderList : renderLists)
+    {
+        renderList->Clear();
+    }
+
+    for (int i = 0; i < 64; i++)
+    {
+        const float x = static_cast<float>(i % 8) * 100.f + offset;
+        const float y = static_cast<float>(i / 8) * 100.f;
+        renderer->AddRectFilled(renderLists[0], Vec2(x, y), Vec2(x + 90.f, y + 90.f), Color(20, 20, 20, 128));
+    }
+
+    for (int i = 0; i < 256; i++)
+    {
+        const float x = static_cast<float>(i % 16) * 50.f + offset;
+        const float y = static_cast<float>(i / 16) * 40.f;
+        renderer->AddRect(renderLists[1], Vec2(x, y), Vec2(x + 30.f, y + 35.f), Color(255, 0, 0));
+        renderer->AddLine(renderLists[1], Vec2(960.f, 1080.f), Vec2(x + 15.f, y + 35.f), Color(255, 255, 0));
+        renderer->AddText(renderLists[1], font, L"enemy", x, y - 15.f, Color(255, 255, 255));
+    }
+
+    renderer->AddRectFilled(renderLists[2], Vec2(100.f, 100.f), Vec2(500.f, 600.f), Color(30, 30, 30));
+    for (int i = 0; i < 24; i++)
+    {
+        renderer->AddText(renderLists[2], font, L"Menu entry", 110.f, 110.f + static_cast<float>(i) * 20.f + offset,
+                          Color(255, 255, 255));
+    }
+}
+
+void BenchmarkMultiListRender()
+{
+    const int iterations = 200;
+
+    auto renderer = std::make_shared<Renderer>(GetDevice(), 65536);
+    const FontHandle font = renderer->AddFont(L"Tahoma", 15);
+
+    const std::vector<RenderListPtr> renderLists = {
+        std::make_shared<RenderList>(4096), std::make_shared<RenderList>(65536), std::make_shared<RenderList>(4096)};
+
+    int frame = 0;
+    RenderStats stats;
+
+    // one Render() per list maps every buffer once per list
+    const double separate = Measure(
+        iterations, [&] { RecordOverlay(renderer, font, renderLists, frame++); },
+        [&] {
+            renderer->BeginFrame();
+            for (const RenderListPtr &renderList : renderLists)
+            {
+                renderer->Render(renderList);
+            }
+            stats = renderer->GetRenderStats();
+            renderer->EndFrame();
+        });
+
+    Report("Render() per list", separate);
+    printf("  %-40s %12zu maps %9zu bytes\n", "  per frame", stats.bufferMaps, stats.uploadedBytes);
+
+    // all lists in one Render() share a single mapping of every buffer
+    const double combined = Measure(
+        iterations, [&] { RecordOverlay(renderer, font, renderLists, frame++); },
+        [&] {
+            renderer->BeginFrame();
+            renderer->Render(renderLists);
+            stats = renderer->GetRenderStats();
+            renderer->EndFrame();
+        });
+
+    Report("Render() of all lists", combined);
+    printf("  %-40s %12zu maps %9zu bytes\n", "  per frame", stats.bufferMaps, stats.uploadedBytes);
+}
+
+void BenchmarkDiffChunks()
+{
+    const int iterations = 100;
+    // 64k vertices, changes come in runs of 64 like a label or a box moving
+    const size_t vertexCount = 65536;
+    const size_t runLength = 64;
+
+    std::vector<Vertex> previous(vertexCount);
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        previous[i] = Vertex(static_cast<float>(i % 1920), static_cast<float>(i / 1920), Color(255, 255, 255));
+    }
+
+    const size_t bytes = vertexCount * sizeof(Vertex);
+    std::vector<uint8_t> copy(bytes);
+
+    Report("memcpy of the whole buffer", Measure(iterations, [&] { memcpy(copy.data(), previous.data(), bytes); }));
+
+    std::mt19937 rng(49);
+    std::vector<std::pair<size_t, size_t>> ranges;
+    std::vector<size_t> gaps;
+
+    for (int percent : {1, 10, 100})
+    {
+        std::vector<Vertex> current = previous;
+        const size_t runs = vertexCount / runLength;
+
+        for (size_t run = 0; run < runs; run++)
+        {
+            if (static_cast<int>(rng() % 100) < percent)
+            {
+                for (size_t i = run * runLength; i < (run + 1) * runLength; i++)
+                {
+                    current[i].pos.x += 1.f;
+                }
+            }
+        }
+
+        char label[64];
+        snprintf(label, sizeof(label), "DiffChunks + MergeRanges %d%% changed", percent);
+        Report(label, Measure(iterations, [&] {
+                   detail::DiffChunks(reinterpret_cast<const uint8_t *>(previous.data()), bytes,
+                                      reinterpret_cast<const uint8_t *>(current.data()), bytes, g_uploadChunkSize,
+                                      ranges);
+                   detail::MergeRanges(ranges, g_uploadMaxRanges, gaps);
+               }));
+
+        size_t dirtyBytes = 0;
+        for (const auto &range : ranges)
+        {
+            dirtyBytes += range.second - range.first;
+        }
+
+        printf("  %-40s %12zu ranges %9zu of %zu bytes\n", "  written", ranges.size(), dirtyBytes, bytes);
+    }
+}
+
+static const Benchmark g_Benchmarks[] = {
+    {"AddFont with and without the font cache", BenchmarkAddFont},
+    {"AddTextFormat against std::format and AddText", BenchmarkAddTextFormat},
+    {"ProjectPoints against the scalar projection", BenchmarkProjectPoints},
+    {"Render() of three lists one by one and at once", BenchmarkMultiListRender},
+    {"DiffChunks on scenes with 1%, 10% and 100% change", BenchmarkDiffChunks},
+};
+
+int main()
+{
+    const int failed = RunBenchmarks(g_PortableBenchmarks) + RunBenchmarks(g_Benchmarks);
+
+    detail::SafeRelease(&g_pd3dDevice);
+
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+// Benchmarks of the parts shared by the factories, see factories/common/renderer_common.hpp. The dx11 benchmarks run
+// them first and portable_main.cpp runs them on any platform.
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "../../factories/common/renderer_common.hpp"
+
+using namespace CheatRenderFramework;
+
+// Mean microseconds of one call to measured, prepare runs before every call and is not timed
+template <typename Prepare, typename Measured>
+static double Measure(int iterations, Prepare &&prepare, Measured &&measured)
+{
+    std::chrono::steady_clock::duration total{};
+
+    for (int i = 0; i < iterations; i++)
+    {
+        prepare();
+
+        const auto start = std::chrono::steady_clock::now();
+        measured();
+        total += std::chrono::steady_clock::now() - start;
+    }
+
+    return std::chrono::duration<double, std::micro>(total).count() / iterations;
+}
+
+template <typename Measured> static double Measure(int iterations, Measured &&measured)
+{
+    return Measure(iterations, [] {}, measured);
+}
+
+static void Report(const char *label, double microseconds)
+{
+    printf("  %-40s %12.2f us\n", label, microseconds);
+}
+
+void BenchmarkTextLayout()
+{
+    const int iterations = 1000;
+
+    // 5 to 9 pixel wide glyphs like the test font
+    std::array<GlyphMetrics, 128> metrics{};
+    for (uint32_t c = 0; c < metrics.size(); c++)
+    {
+        metrics[c].width = static_cast<long>(4 + c % 5);
+        metrics[c].advance = metrics[c].width;
+        metrics[c].valid = true;
+    }
+
+    const auto measure = [&](uint32_t c) { return c < metrics.size() ? &metrics[c] : nullptr; };
+
+    std::wstring text;
+    for (int i = 0; i < 64; i++)
+    {
+        text += L"{#ff8000ff}lorem{#ffffffff} ipsum dolor sit amet, consectetur adipiscing elit ";
+    }
+
+    TextLayout layout;
+    const auto breakLines = [&](uint32_t flags) {
+        layout.BreakLines(std::wstring_view(text), 0xffffffff, flags, 1.f, 300.f, measure);
+    };
+
+    Report("BreakLines 5k chars word wrap", Measure(iterations, [&] { breakLines(TEXT_FLAG_WORD_WRAP); }));
+    printf("  %-40s %12zu lines\n", "  wrapped", layout.GetLines().size());
+
+    Report("BreakLines 5k chars ellipsis", Measure(iterations, [&] { breakLines(TEXT_FLAG_ELLIPSIS); }));
+}
+
+void BenchmarkGlyphCache()
+{
+    const int iterations = 20;
+    const int glyphs = 1000;
+
+    std::mt19937 rng(30);
+    std::uniform_int_distribution<long> size(6, 24);
+    const std::vector<uint8_t> texels(24 * 24, 0x80);
+
+    GlyphCache cache(1024, 1024, 1, g_fontAtlasPadding);
+    uint64_t key = 0;
+    size_t failed = 0;
+
+    // a frame of glyphs nobody drew before, once the atlas is full every insert evicts
+    const auto insertFrame = [&] {
+        for (int i = 0; i < glyphs; i++)
+        {
+            const long width = size(rng);
+            const long height = size(rng);
+            if (!cache.Insert(key++, width, height, texels.data(), 24))
+            {
+                failed++;
+            }
+        }
+    };
+
+    Report("Insert x1000 new glyphs per frame", Measure(iterations, [&] { cache.NewFrame(); }, insertFrame));
+
+    // every level below the modified rect is rebuilt, the upload is left out
+    const auto insertNextFrame = [&] {
+        cache.NewFrame();
+        insertFrame();
+    };
+    const auto discard = [](long, const detail::AtlasRect &, const uint8_t *, long) {};
+
+    Report("Flush after x1000 inserts", Measure(iterations, insertNextFrame, [&] { cache.Flush(discard); }));
+
+    const AtlasStats stats = cache.GetStats();
+    printf("  %-40s %12zu glyphs %8.1f%% %zu failed\n", "  atlas", stats.glyphCount, stats.occupancy * 100.f, failed);
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)();
+};
+
+static const Benchmark g_PortableBenchmarks[] = {
+    {"TextLayout::BreakLines on a long paragraph", BenchmarkTextLayout},
+    {"GlyphCache inserts with LRU eviction and flushes", BenchmarkGlyphCache},
+};
+
+// Runs every benchmark and prints its results, returns how many threw.
+static int RunBenchmarks(std::span<const Benchmark> benchmarks)
+{
+    int failed = 0;
+
+    for (const Benchmark &benchmark : benchmarks)
+    {
+        printf("%s\n", benchmark.name);
+
+        try
+        {
+            benchmark.run();
+        }
+        catch (const std::exception &e)
+        {
+            printf("  exception: %s\n", e.what());
+            failed++;
+        }
+    }
+
+    return failed;
+}
@@ -0,0 +1,8 @@
+// Benchmarks of the shared parts of the factories, built by the CMake project on any platform. Build the Release
+// configuration, every benchmark prints the mean time of one iteration.
+#include "portable_benchmarks.hpp"
+
+int main()
+{
+    return RunBenchmarks(g_PortableBenchmarks) == 0 ? 0 : 1;
+}
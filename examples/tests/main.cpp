@@ -0,0 +1,958 @@
+// Headless tests of the dx11 factory. Every failed check is printed, the exit code is non-zero if any failed.
+#include <windows.h>
+#include <d3d11.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <thread>
+
+#pragma comment(lib, "d3d11.lib")
+
+#include "..\..\factories\dx11\renderer_dx11.hpp"
+#include "portable_tests.hpp"
+
+// WARP device of the tests which need one, created on first use
+static ID3D11Device *g_pd3dDevice = nullptr;
+
+static ID3D11Device *GetDevice()
+{
+    if (!g_pd3dDevice)
+    {
+        detail::ThrowIfFailed(D3D11CreateDevice(nullptr, D3D_DRIVER_TYPE_WARP, nullptr, 0, nullptr, 0,
+                                                D3D11_SDK_VERSION, &g_pd3dDevice, nullptr, nullptr));
+    }
+
+    return g_pd3dDevice;
+}
+
+// Exposes what the renderer recorded into a list.
+class TestRenderList : public RenderList
+{
+  public:
+    using RenderList::RenderList;
+
+    const std::vector<Vertex> &GetVertices() const
+    {
+        return this->_vertices;
+    }
+
+    const std::vector<GlyphInstance> &GetGlyphInstances() const
+    {
+        return this->_glyphInstances;
+    }
+
+    const std::shared_ptr<FontAtlas> &GetGlyphAtlas() const
+    {
+        return this->_glyphAtlas;
+    }
+};
+
+void TestFontSourceBacksFont()
+{
+    auto source = std::make_shared<TestFontSource>();
+    auto renderer = std::make_shared<Renderer>(GetDevice(), 4096);
+    const FontHandle font = renderer->AddFont(source);
+
+    // the basic charset is baked up front, the space has no pixels
+    const int preloaded = g_charRangeMax - g_charRangeMin - 1;
+    CHECK(source->GetRasterizedCount() == preloaded);
+    CHECK(renderer->GetAtlasStats().glyphCount == static_cast<size_t>(preloaded));
+
+    const Vec2 extent = renderer->CalculateTextExtent(font, L"Ab c");
+    CHECK(extent.x == TestFontSource::Advance('A') + TestFontSource::Advance('b') + TestFontSource::Advance(' ') +
+                          TestFontSource::Advance('c'));
+    CHECK(extent.y == 12.f);
+
+    // anything else is rasterized by the source the first time it is drawn
+    auto renderList = std::make_shared<RenderList>(64);
+    renderer->AddText(renderList, font, L"\u00e9\u00e9", 0.f, 0.f, Color(255, 255, 255));
+    CHECK(source->GetRasterizedCount() == preloaded + 1);
+}
+
+void TestFontCacheRoundTrip()
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "crf_tests_font_cache";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+
+    auto baked = std::make_shared<TestFontSource>(L"test|cache");
+    auto renderer = std::make_shared<Renderer>(GetDevice(), 4096);
+    renderer->SetFontCacheDirectory(directory.wstring());
+    const FontHandle bakedFont = renderer->AddFont(baked);
+
+    CHECK(baked->GetRasterizedCount() > 0);
+    CHECK(std::distance(std::filesystem::directory_iterator(directory), std::filesystem::directory_iterator()) == 1);
+
+    // a second start maps the file instead of rasterizing anything
+    auto cached = std::make_shared<TestFontSource>(L"test|cache");
+    auto cachedRenderer = std::make_shared<Renderer>(GetDevice(), 4096);
+    cachedRenderer->SetFontCacheDirectory(directory.wstring());
+    const FontHandle cachedFont = cachedRenderer->AddFont(cached);
+
+    CHECK(cached->GetRasterizedCount() == 0);
+    CHECK(cachedRenderer->GetAtlasStats().glyphCount == renderer->GetAtlasStats().glyphCount);
+    CHECK(cachedRenderer->GetAtlasStats().occupancy == renderer->GetAtlasStats().occupancy);
+
+    const Vec2 bakedExtent = renderer->CalculateTextExtent(bakedFont, L"Cached glyphs");
+    const Vec2 cachedExtent = cachedRenderer->CalculateTextExtent(cachedFont, L"Cached glyphs");
+    CHECK(bakedExtent.x == cachedExtent.x && bakedExtent.y == cachedExtent.y);
+
+    // another source never picks up the file
+    auto other = std::make_shared<TestFontSource>(L"test|other");
+    auto otherRenderer = std::make_shared<Renderer>(GetDevice(), 4096);
+    otherRenderer->SetFontCacheDirectory(directory.wstring());
+    otherRenderer->AddFont(other);
+
+    CHECK(other->GetRasterizedCount() == baked->GetRasterizedCount());
+
+    std::filesystem::remove_all(directory);
+}
+
+void TestAsyncBakeMatchesSync()
+{
+    auto syncSource = std::make_shared<TestFontSource>();
+    auto syncRenderer = std::make_shared<Renderer>(GetDevice(), 4096);
+    const FontHandle syncFont = syncRenderer->AddFont(syncSource);
+
+    auto asyncSource = std::make_shared<TestFontSource>();
+    auto asyncRenderer = std::make_shared<Renderer>(GetDevice(), 4096);
+    const FontHandle asyncFont = asyncRenderer->AddFontAsync(asyncSource);
+
+    const auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!asyncRenderer->IsFontReady(asyncFont) && std::chrono::steady_clock::now() < timeout)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    CHECK(syncRenderer->IsFontReady(syncFont));
+    CHECK(asyncRenderer->IsFontReady(asyncFont));
+
+    // the chunks are rasterized by clones sharing the counter, every glyph exactly once
+    CHECK(asyncSource->GetRasterizedCount() == syncSource->GetRasterizedCount());
+    CHECK(asyncRenderer->GetAtlasStats().glyphCount == syncRenderer->GetAtlasStats().glyphCount);
+    CHECK(asyncRenderer->GetAtlasStats().occupancy == syncRenderer->GetAtlasStats().occupancy);
+
+    // the chunks may be packed in any order, so only the layout is compared and not the atlas slots
+    const wchar_t *text = L"The quick brown fox\njumps over the lazy dog 0123456789";
+
+    auto syncList = std::make_shared<TestRenderList>(64);
+    auto asyncList = std::make_shared<TestRenderList>(64);
+    const Vec2 syncExtent = syncRenderer->AddText(syncList, syncFont, text, 3.f, 5.f, Color(255, 255, 255));
+    const Vec2 asyncExtent = asyncRenderer->AddText(asyncList, asyncFont, text, 3.f, 5.f, Color(255, 255, 255));
+
+    CHECK(syncExtent.x == asyncExtent.x && syncExtent.y == asyncExtent.y);
+    CHECK(!syncList->GetGlyphInstances().empty());
+    CHECK(syncList->GetGlyphInstances().size() == asyncList->GetGlyphInstances().size());
+
+    for (size_t i = 0; i < min(syncList->GetGlyphInstances().size(), asyncList->GetGlyphInstances().size()); i++)
+    {
+        const GlyphInstance &expected = syncList->GetGlyphInstances()[i];
+        const GlyphInstance &actual = asyncList->GetGlyphInstances()[i];
+        CHECK(expected.pos.x == actual.pos.x && expected.pos.y == actual.pos.y);
+    }
+
+    // both bake the same glyphs afterwards
+    syncRenderer->AddText(syncList, syncFont, L"\u00e9", 0.f, 0.f, Color(255, 255, 255));
+    asyncRenderer->AddText(asyncList, asyncFont, L"\u00e9", 0.f, 0.f, Color(255, 255, 255));
+    CHECK(asyncSource->GetRasterizedCount() == syncSource->GetRasterizedCount());
+}
+
+void TestUtf8TextMatchesWideText()
+{
+    auto renderer = std::make_shared<Renderer>(GetDevice(), 4096);
+    const FontHandle font = renderer->AddFont(std::make_shared<TestFontSource>());
+
+    auto wideList = std::make_shared<TestRenderList>(64);
+    auto utf8List = std::make_shared<TestRenderList>(64);
+
+    const wchar_t wide[] = {L'A', 0xe9, L' ', 0x20ac, L'\n', 0xd83d, 0xde00, L'z', 0};
+    const Vec2 wideExtent = renderer->AddText(wideList, font, wide, 1.f, 2.f, Color(255, 255, 255));
+    const Vec2 utf8Extent =
+        renderer->AddText(utf8List, font, "A\xc3\xa9 \xe2\x82\xac\n\xf0\x9f\x98\x80z", 1.f, 2.f, Color(255, 255, 255));
+
+    CHECK(wideExtent.x == utf8Extent.x && wideExtent.y == utf8Extent.y);
+    CHECK(wideList->GetGlyphInstances().size() == utf8List->GetGlyphInstances().size());
+    CHECK(memcmp(wideList->GetGlyphInstances().data(), utf8List->GetGlyphInstances().data(),
+                 min(wideList->GetGlyphInstances().size(), utf8List->GetGlyphInstances().size()) *
+                     sizeof(GlyphInstance)) == 0);
+}
+
+void TestAddTextFormat()
+{
+    auto renderer = std::make_shared<Renderer>(GetDevice(), 4096);
+    const FontHandle font = renderer->AddFont(std::make_shared<TestFontSource>());
+
+    auto formatted = std::make_shared<TestRenderList>(64);
+    auto expected = std::make_shared<TestRenderList>(64);
+
+    renderer->AddTextFormat(formatted, font, 1.f, 2.f, Color(255, 255, 255), TEXT_FLAG_NONE, Color(0, 0, 0), 2.f,
+                            "{} [{}m] {}hp", "name", 42, 100);
+    renderer->AddText(expected, font, std::format("{} [{}m] {}hp", "name", 42, 100), 1.f, 2.f, Color(255, 255, 255));
+
+    renderer->AddTextFormat(formatted, font, 1.f, 2.f, Color(255, 255, 255), TEXT_FLAG_NONE, Color(0, 0, 0), 2.f,
+                            L"{}|{}", L"wide", 255);
+    renderer->AddText(expected, font, std::format(L"{}|{}", L"wide", 255), 1.f, 2.f, Color(255, 255, 255));
+
+    // scaled and wrapped like AddText()
+    renderer->AddTextFormat(formatted, font, 1.f, 30.f, Color(255, 255, 255), TEXT_FLAG_WORD_WRAP, Color(0, 0, 0), 2.f,
+                            1.5f, 60.f, "{} {} {}", "wrapped", "label", 7);
+    renderer->AddText(expected, font, "wrapped label 7", 1.f, 30.f, Color(255, 255, 255), TEXT_FLAG_WORD_WRAP,
+                      Color(0, 0, 0), 2.f, 1.5f, 60.f);
+
+    renderer->AddTextFormat(formatted, font, 1.f, 80.f, Color(255, 255, 255), TEXT_FLAG_ELLIPSIS, Color(0, 0, 0), 2.f,
+                            2.f, 50.f, L"{} {}", L"cut", L"off");
+    renderer->AddText(expected, font, L"cut off", 1.f, 80.f, Color(255, 255, 255), TEXT_FLAG_ELLIPSIS, Color(0, 0, 0),
+                      2.f, 2.f, 50.f);
+
+    CHECK(!expected->GetGlyphInstances().empty());
+    CHECK(formatted->GetGlyphInstances().size() == expected->GetGlyphInstances().size());
+    CHECK(memcmp(formatted->GetGlyphInstances().data(), expected->GetGlyphInstances().data(),
+                 min(formatted->GetGlyphInstances().size(), expected->GetGlyphInstances().size()) *
+                     sizeof(GlyphInstance)) == 0);
+
+    // output past the buffer is cut before the character it would split instead of drawing U+FFFD
+    auto truncated = std::make_shared<TestRenderList>(64);
+    const std::string filler(g_textFormatBufferSize - 1, 'a');
+    renderer->AddTextFormat(truncated, font, 0.f, 0.f, Color(255, 255, 255), TEXT_FLAG_NONE, Color(0, 0, 0), 2.f,
+                            "{}\xc3\xa9tail", filler);
+
+    CHECK(truncated->GetGlyphInstances().size() == filler.size());
+}
+
+// Lays text out against maxWidth and checks it against the expected lines drawn one below the other without flags.
+static void CheckLines(const std::shared_ptr<Renderer> &renderer, FontHandle font, const wchar_t *text,
+                       uint32_t flags, float maxWidth, std::initializer_list<const wchar_t *> lines)
+{
+    auto actual = std::make_shared<TestRenderList>(64);
+    auto expected = std::make_shared<TestRenderList>(64);
+
+    const Vec2 extent = renderer->AddText(actual, font, text, 5.f, 7.f, Color(255, 255, 255), flags, Color(0, 0, 0),
+                                          2.f, 1.f, maxWidth);
+
+    float width = 0.f;
+    float y = 7.f;
+
+    for (const wchar_t *line : lines)
+    {
+        const Vec2 lineExtent = renderer->AddText(expected, font, line, 5.f, y, Color(255, 255, 255));
+        width = max(width, lineExtent.x);
+        y += 12.f;
+    }
+
+    CHECK(extent.x == width);
+    CHECK(extent.y == 12.f * static_cast<float>(lines.size()));
+    CHECK(actual->GetGlyphInstances().size() == expected->GetGlyphInstances().size());
+    CHECK(memcmp(actual->GetGlyphInstances().data(), expected->GetGlyphInstances().data(),
+                 min(actual->GetGlyphInstances().size(), expected->GetGlyphInstances().size()) *
+                     sizeof(GlyphInstance)) == 0);
+}
+
+void TestWordWrap()
+{
+    auto renderer = std::make_shared<Renderer>(GetDevice(), 4096);
+    const FontHandle font = renderer->AddFont(std::make_shared<TestFontSource>());
+
+    // "the quick" is 55 pixels wide, the space after it would make it 61
+    CheckLines(renderer, font, L"the quick brown fox jumps", TEXT_FLAG_WORD_WRAP, 60.f,
+               {L"the quick", L"brown fox", L"jumps"});
+
+    // words longer than a line are split, a line filling maxWidth exactly still fits
+    CheckLines(renderer, font, L"abcdefghijklmnop", TEXT_FLAG_WORD_WRAP, 30.f, {L"abcde", L"fghij", L"klmno", L"p"});
+
+    // every paragraph is wrapped on its own
+    CheckLines(renderer, font, L"ab cd\nefgh ij kl", TEXT_FLAG_WORD_WRAP, 30.f, {L"ab", L"cd", L"efgh", L"ij kl"});
+
+    // a break at the space before a line break does not add an empty line
+    CheckLines(renderer, font, L"the quick \nfox", TEXT_FLAG_WORD_WRAP, 60.f, {L"the quick", L"fox"});
+
+    // text which fits is not touched, neither is text without a max width
+    CheckLines(renderer, font, L"the quick", TEXT_FLAG_WORD_WRAP, 60.f, {L"the quick"});
+    CheckLines(renderer, font, L"the quick brown fox jumps", TEXT_FLAG_WORD_WRAP, 0.f, {L"the quick brown fox jumps"});
+}
+
+void TestEllipsis()
+{
+    auto renderer = std::make_shared<Renderer>(GetDevice(), 4096);
+    const FontHandle font = renderer->AddFont(std::make_shared<TestFontSource>());
+
+    // the dots take 15 pixels, "ab" is the longest prefix fitting into the other 15
+    CheckLines(renderer, font, L"abcdefghijklmnop", TEXT_FLAG_ELLIPSIS, 30.f, {L"ab..."});
+    CheckLines(renderer, font, L"abcdefghijklmnop\nab\nabcdefghijklmnop", TEXT_FLAG_ELLIPSIS, 30.f,
+               {L"ab...", L"ab", L"ab..."});
+    CheckLines(renderer, font, L"abcde", TEXT_FLAG_ELLIPSIS, 30.f, {L"abcde"});
+}
+
+// Perspective projection looking down +z with the near plane at 1 and the far plane at 5, x is squeezed by half.
+static DirectX::XMFLOAT4X4 MakeTestProjection()
+{
+    DirectX::XMFLOAT4X4 m{};
+    m.m[0][0] = 0.5f;
+    m.m[1][1] = 1.f;
+    m.m[2][2] = 1.25f;
+    m.m[2][3] = 1.f;
+    m.m[3][2] = -1.25f;
+    return m;
+}
+
+void TestProjectPoints()
+{
+    const DirectX::XMFLOAT4X4 m = MakeTestProjection();
+
+    // center, corner and behind the viewport, in front of and past the far plane, behind and at the eye
+    const DirectX::XMFLOAT3 points[] = {{0.f, 0.f, 2.f}, {2.f, 1.f, 1.f},  {3.f, 1.5f, 1.f}, {0.f, 0.f, 0.5f},
+                                        {0.f, 0.f, 6.f}, {0.f, 0.f, -2.f}, {0.f, 0.f, 0.f},  {-1.f, 0.5f, 4.f}};
+    const uint8_t inFront = PROJECTION_FLAG_IN_FRONT;
+    const uint8_t onScreen = PROJECTION_FLAG_IN_FRONT | PROJECTION_FLAG_ON_SCREEN;
+    const uint8_t flags[] = {onScreen, onScreen, inFront, 0, inFront, 0, 0, onScreen};
+
+    DirectX::XMFLOAT2 out[std::size(points)];
+    uint8_t visible[std::size(points)];
+    detail::ProjectPoints(m, points, out, visible, std::size(points), 1920.f, 1080.f);
+
+    for (size_t i = 0; i < std::size(points); i++)
+    {
+        CHECK(visible[i] == flags[i]);
+    }
+
+    CHECK(out[0].x == 960.f && out[0].y == 540.f);
+    CHECK(out[1].x == 1920.f && out[1].y == 0.f);
+
+    // the SSE path takes four points at a time, every count covers another scalar tail
+    std::mt19937 rng(41);
+    std::uniform_real_distribution<float> coordinate(-8.f, 8.f);
+
+    std::vector<DirectX::XMFLOAT3> in(103);
+    for (DirectX::XMFLOAT3 &point : in)
+    {
+        point = DirectX::XMFLOAT3(coordinate(rng), coordinate(rng), coordinate(rng));
+    }
+
+    for (size_t count = 0; count <= in.size(); count += count < 16 ? 1 : 29)
+    {
+        std::vector<DirectX::XMFLOAT2> expected(count);
+        std::vector<DirectX::XMFLOAT2> actual(count);
+        std::vector<uint8_t> expectedVisible(count);
+        std::vector<uint8_t> actualVisible(count);
+
+        detail::ProjectPointsScalar(m, in.data(), expected.data(), expectedVisible.data(), count, 1920.f, 1080.f);
+        detail::ProjectPoints(m, in.data(), actual.data(), actualVisible.data(), count, 1920.f, 1080.f);
+
+        CHECK(expectedVisible == actualVisible);
+
+        // the sums are associated differently, only close to the same
+        for (size_t i = 0; i < count; i++)
+        {
+            if (expectedVisible[i] & PROJECTION_FLAG_IN_FRONT)
+            {
+                CHECK(std::fabs(expected[i].x - actual[i].x) <= 1e-3f * max(1.f, std::fabs(expected[i].x)));
+                CHECK(std::fabs(expected[i].y - actual[i].y) <= 1e-3f * max(1.f, std::fabs(expected[i].y)));
+            }
+        }
+    }
+}
+
+void TestRadixSortIsStable()
+{
+    std::mt19937_64 rng(45);
+    std::vector<uint32_t> scratch;
+
+    // few distinct keys so most of them tie, in the low byte, the high byte, spread over all bytes and all the same
+    const auto lowByte = [&] { return rng() % 4; };
+    const auto highByte = [&] { return (rng() % 4) << 56; };
+    const auto spread = [&] { return rng() & 0x0100010001000100ull; };
+    const auto same = [&] { return 0x1234ull; };
+    const auto full = [&] { return rng(); };
+
+    const std::function<uint64_t()> generators[] = {lowByte, highByte, spread, same, full};
+
+    for (const auto &generate : generators)
+    {
+        for (size_t count : {size_t(0), size_t(1), size_t(2), size_t(17), size_t(1000)})
+        {
+            std::vector<uint64_t> keys(count);
+            for (uint64_t &key : keys)
+            {
+                key = generate();
+            }
+
+            std::vector<uint32_t> expected(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                expected[i] = static_cast<uint32_t>(i);
+            }
+
+            std::stable_sort(expected.begin(), expected.end(),
+                             [&](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+
+            std::vector<uint32_t> order(count);
+            detail::RadixSort(keys.data(), count, order.data(), scratch);
+
+            CHECK(order == expected);
+        }
+    }
+}
+
+void TestTripleBufferExchange()
+{
+    TripleBufferedRenderList lists(64);
+
+    const RenderList *first = lists.GetBackList().get();
+    const RenderList *front = lists.Acquire().get();
+
+    CHECK(first != front);
+    CHECK(!lists.HasNewList());
+
+    // nothing published yet, the render thread keeps drawing its list
+    CHECK(lists.Acquire().get() == front);
+
+    lists.Publish();
+    const RenderList *second = lists.GetBackList().get();
+
+    CHECK(lists.HasNewList());
+    CHECK(second != first && second != front);
+    CHECK(lists.Acquire().get() == first);
+    CHECK(!lists.HasNewList());
+    CHECK(lists.Acquire().get() == first);
+
+    // the producer gets the list the render thread gave back
+    lists.Publish();
+    CHECK(lists.GetBackList().get() == front);
+
+    // of two frames published in between only the last is drawn, the skipped one is recorded into again
+    lists.Publish();
+    CHECK(lists.GetBackList().get() == second);
+    CHECK(lists.Acquire().get() == front);
+    CHECK(lists.GetBackList().get() == second);
+}
+
+// Frames published at one rate and drawn at another. Every list carries the number of the frame recorded into it, the
+// producer and the render thread must never share a list, so the render thread only ever sees whole frames in order.
+static void StressTripleBuffer(int producerSpin, int consumerSpin)
+{
+    const uint32_t frames = 20000;
+
+    TripleBufferedRenderList lists(64);
+
+    // the three lists in the order GetBackList(), Acquire() and the shared one hand them out
+    const RenderList *renderLists[3] = {lists.GetBackList().get(), lists.Acquire().get(), nullptr};
+    lists.Publish();
+    renderLists[2] = lists.GetBackList().get();
+    lists.Acquire();
+
+    // written by whichever thread owns the list, deliberately not atomic
+    std::array<uint32_t, 64> payloads[3] = {};
+    const auto payloadOf = [&](const RenderList *renderList) -> std::array<uint32_t, 64> & {
+        return payloads[std::find(std::begin(renderLists), std::end(renderLists), renderList) - renderLists];
+    };
+
+    std::atomic<bool> done = false;
+    std::atomic<uint32_t> sink = 0;
+
+    std::thread producer([&] {
+        for (uint32_t frame = 1; frame <= frames; frame++)
+        {
+            const RenderListPtr &renderList = lists.GetBackList();
+            const Vertex triangle[] = {Vertex(0.f, 0.f, Color(frame)), Vertex(1.f, 0.f, Color(frame)),
+                                       Vertex(0.f, 1.f, Color(frame))};
+            renderList->AddVertices(triangle, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, nullptr);
+
+            payloadOf(renderList.get()).fill(frame);
+
+            for (int i = 0; i < producerSpin; i++)
+            {
+                sink += static_cast<uint32_t>(i);
+            }
+
+            lists.Publish();
+        }
+
+        done = true;
+    });
+
+    uint32_t lastFrame = 0;
+    uint32_t drawnFrames = 0;
+
+    for (;;)
+    {
+        const bool finished = done;
+        const std::array<uint32_t, 64> &payload = payloadOf(lists.Acquire().get());
+
+        CHECK(std::all_of(payload.begin(), payload.end(), [&](uint32_t frame) { return frame == payload[0]; }));
+        CHECK(payload[0] >= lastFrame);
+
+        drawnFrames += payload[0] != lastFrame ? 1 : 0;
+        lastFrame = payload[0];
+
+        for (int i = 0; i < consumerSpin; i++)
+        {
+            sink += static_cast<uint32_t>(i);
+        }
+
+        // the last frame is drawn once the producer is done
+        if (finished)
+        {
+            break;
+        }
+    }
+
+    producer.join();
+
+    CHECK(lastFrame == frames);
+    CHECK(drawnFrames > 0);
+}
+
+void TestTripleBufferStress()
+{
+    StressTripleBuffer(0, 0);
+    StressTripleBuffer(0, 2000);
+    StressTripleBuffer(2000, 0);
+}
+
+// A frame of text nobody drew before, more than the smallest atlas holds, so every glyph which may be evicted is.
+static void FillAtlas(const std::shared_ptr<Renderer> &renderer, FontHandle font, uint32_t firstCodePoint)
+{
+    auto renderList = std::make_shared<RenderList>(64);
+
+    renderer->BeginFrame();
+
+    for (uint32_t c = firstCodePoint; c < firstCodePoint + 400; c++)
+    {
+        const wchar_t text[] = {static_cast<wchar_t>(c), 0};
+        renderer->AddText(renderList, font, text, 0.f, 0.f, Color(255, 255, 255));
+    }
+
+    renderer->Render(renderList);
+    renderer->EndFrame();
+}
+
+void TestPublishedListKeepsGlyphs()
+{
+    auto renderer = std::make_shared<Renderer>(GetDevice(), 4096, 0);
+    const FontHandle font = renderer->AddFont(std::make_shared<TestFontSource>());
+    TripleBufferedRenderList lists(64);
+
+    const std::wstring text = L"\u0100\u0101\u0102";
+    std::vector<std::array<float, 4>> uvs;
+
+    // the atlas is only reachable through a list holding text
+    auto probe = std::make_shared<TestRenderList>(64);
+    renderer->AddText(probe, font, L"a", 0.f, 0.f, Color(255, 255, 255));
+    const std::shared_ptr<FontAtlas> atlas = probe->GetGlyphAtlas();
+    CHECK(atlas != nullptr);
+
+    if (!atlas)
+    {
+        return;
+    }
+
+    renderer->BeginFrame();
+    renderer->AddText(lists.GetBackList(), font, text, 0.f, 0.f, Color(255, 255, 255));
+
+    for (const wchar_t c : text)
+    {
+        const AtlasGlyph *glyph = atlas->FindGlyph(FontAtlas::MakeGlyphKey(static_cast<uint32_t>(font), c));
+        CHECK(glyph != nullptr);
+        uvs.push_back(glyph ? glyph->uv : std::array<float, 4>{});
+    }
+
+    lists.Publish();
+    renderer->EndFrame();
+
+    // two frames of other text, the published list was neither drawn nor touched since
+    FillAtlas(renderer, font, 0x400);
+    FillAtlas(renderer, font, 0x800);
+
+    renderer->BeginFrame();
+    renderer->Render(lists.Acquire());
+    renderer->EndFrame();
+
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        const AtlasGlyph *glyph = atlas->FindGlyph(FontAtlas::MakeGlyphKey(static_cast<uint32_t>(font), text[i]));
+        CHECK(glyph != nullptr && glyph->uv == uvs[i]);
+    }
+
+    // once the render thread gave the list back, the glyphs can be evicted again
+    lists.Publish();
+    lists.Acquire();
+    lists.Publish();
+
+    FillAtlas(renderer, font, 0xc00);
+    FillAtlas(renderer, font, 0x1000);
+
+    for (const wchar_t c : text)
+    {
+        CHECK(atlas->FindGlyph(FontAtlas::MakeGlyphKey(static_cast<uint32_t>(font), c)) == nullptr);
+    }
+}
+
+void TestHashBytes()
+{
+    std::mt19937 rng(48);
+    std::vector<uint8_t> data(67);
+    for (uint8_t &byte : data)
+    {
+        byte = static_cast<uint8_t>(rng());
+    }
+
+    const uint64_t seed = 0x1234;
+    const uint64_t hash = detail::HashBytes(seed, data.data(), data.size());
+
+    CHECK(detail::HashBytes(seed, data.data(), data.size()) == hash);
+    CHECK(detail::HashBytes(seed + 1, data.data(), data.size()) != hash);
+
+    // records are hashed one after the other, splitting at whole words gives the same hash as one call
+    for (size_t split = 0; split <= data.size(); split += sizeof(uint64_t))
+    {
+        CHECK(detail::HashBytes(detail::HashBytes(seed, data.data(), split), data.data() + split,
+                                data.size() - split) == hash);
+    }
+
+    // every single bit and every length count, a trailing zero byte included
+    for (size_t bit = 0; bit < data.size() * 8; bit++)
+    {
+        data[bit / 8] ^= static_cast<uint8_t>(1 << (bit % 8));
+        CHECK(detail::HashBytes(seed, data.data(), data.size()) != hash);
+        data[bit / 8] ^= static_cast<uint8_t>(1 << (bit % 8));
+    }
+
+    std::vector<uint64_t> lengths;
+    data.push_back(0);
+    for (size_t size = 0; size <= data.size(); size++)
+    {
+        lengths.push_back(detail::HashBytes(seed, data.data(), size));
+    }
+
+    std::sort(lengths.begin(), lengths.end());
+    CHECK(std::adjacent_find(lengths.begin(), lengths.end()) == lengths.end());
+}
+
+void TestUnchangedListSkipsUpload()
+{
+    auto renderer = std::make_shared<Renderer>(GetDevice(), 4096);
+    auto renderList = std::make_shared<RenderList>(64);
+
+    const auto record = [&](float x) {
+        renderList->Clear();
+        renderer->AddRectFilled(renderList, Vec2(x, 10.f), Vec2(50.f, 50.f), Color(255, 0, 0));
+        renderer->AddLine(renderList, Vec2(0.f, 0.f), Vec2(100.f, 100.f), Color(0, 255, 0));
+    };
+
+    renderer->BeginFrame();
+
+    record(10.f);
+    renderer->Render(renderList);
+    CHECK(renderer->GetRenderStats().reusedRenders == 0);
+
+    const size_t uploadedBytes = renderer->GetRenderStats().uploadedBytes;
+    CHECK(uploadedBytes > 0);
+
+    // the same list again, and the same content recorded again
+    renderer->Render(renderList);
+    record(10.f);
+    renderer->Render(renderList);
+
+    CHECK(renderer->GetRenderStats().reusedRenders == 2);
+    CHECK(renderer->GetRenderStats().uploadedBytes == uploadedBytes);
+    CHECK(renderer->GetRenderStats().skippedBytes > 0);
+
+    // the rect moved by a pixel
+    record(11.f);
+    renderer->Render(renderList);
+
+    CHECK(renderer->GetRenderStats().reusedRenders == 2);
+    CHECK(renderer->GetRenderStats().uploadedBytes > uploadedBytes);
+
+    renderer->EndFrame();
+}
+
+using ByteRanges = std::vector<std::pair<size_t, size_t>>;
+
+void TestDiffChunks()
+{
+    const size_t chunk = 16;
+    std::vector<uint8_t> previous(100, 1);
+    std::vector<uint8_t> current = previous;
+    ByteRanges ranges;
+
+    detail::DiffChunks(previous.data(), previous.size(), current.data(), current.size(), chunk, ranges);
+    CHECK(ranges.empty());
+
+    // a change dirties its whole chunk, changes in neighbouring chunks end up in one range, the last chunk is short
+    current[20] = 2;
+    current[40] = 2;
+    current[50] = 2;
+    current[99] = 2;
+    detail::DiffChunks(previous.data(), previous.size(), current.data(), current.size(), chunk, ranges);
+    CHECK(ranges == ByteRanges({{16, 64}, {96, 100}}));
+
+    // everything past the end of previous is dirty, a shorter current only compares what it has
+    current = previous;
+    current.resize(120, 1);
+    detail::DiffChunks(previous.data(), previous.size(), current.data(), current.size(), chunk, ranges);
+    CHECK(ranges == ByteRanges({{96, 120}}));
+
+    current.resize(50);
+    detail::DiffChunks(previous.data(), previous.size(), current.data(), current.size(), chunk, ranges);
+    CHECK(ranges.empty());
+
+    detail::DiffChunks(nullptr, 0, current.data(), current.size(), chunk, ranges);
+    CHECK(ranges == ByteRanges({{0, 50}}));
+
+    // against the dirty chunks worked out one by one
+    std::mt19937 rng(49);
+    for (int round = 0; round < 200; round++)
+    {
+        previous.resize(rng() % 300);
+        current.resize(rng() % 300);
+        for (uint8_t &byte : previous)
+        {
+            byte = static_cast<uint8_t>(rng() % 2);
+        }
+        for (size_t i = 0; i < current.size(); i++)
+        {
+            current[i] = i < previous.size() && rng() % 64 ? previous[i] : static_cast<uint8_t>(rng() % 2);
+        }
+
+        ByteRanges expected;
+        for (size_t offset = 0; offset < current.size(); offset += chunk)
+        {
+            const size_t end = min(offset + chunk, current.size());
+            const bool dirty =
+                end > previous.size() || memcmp(&current[offset], &previous[offset], end - offset) != 0;
+
+            if (dirty && !expected.empty() && expected.back().second == offset)
+            {
+                expected.back().second = end;
+            }
+            else if (dirty)
+            {
+                expected.emplace_back(offset, end);
+            }
+        }
+
+        detail::DiffChunks(previous.data(), previous.size(), current.data(), current.size(), chunk, ranges);
+        CHECK(ranges == expected);
+    }
+}
+
+void TestMergeRanges()
+{
+    std::vector<size_t> gaps;
+
+    ByteRanges ranges = {{0, 10}, {12, 20}, {30, 40}, {41, 50}, {60, 70}};
+    detail::MergeRanges(ranges, 3, gaps);
+    CHECK(ranges == ByteRanges({{0, 20}, {30, 50}, {60, 70}}));
+
+    // nothing to do with few enough ranges or no limit
+    ranges = {{0, 10}, {20, 30}};
+    detail::MergeRanges(ranges, 2, gaps);
+    CHECK(ranges == ByteRanges({{0, 10}, {20, 30}}));
+    detail::MergeRanges(ranges, 0, gaps);
+    CHECK(ranges == ByteRanges({{0, 10}, {20, 30}}));
+
+    // equal gaps are only closed until the limit is reached
+    ranges = {{0, 10}, {15, 20}, {25, 30}, {35, 40}};
+    detail::MergeRanges(ranges, 2, gaps);
+    CHECK(ranges.size() == 2);
+    CHECK(ranges.front().first == 0 && ranges.back().second == 40);
+
+    // the merged ranges cover every range and write no more unchanged bytes than the smallest gaps
+    std::mt19937 rng(49);
+    for (int round = 0; round < 200; round++)
+    {
+        ranges.clear();
+        size_t offset = 0;
+        for (size_t i = 0, count = 1 + rng() % 40; i < count; i++)
+        {
+            offset += rng() % 50;
+            const size_t end = offset + 1 + rng() % 20;
+            ranges.emplace_back(offset, end);
+            offset = end + 1;
+        }
+
+        const ByteRanges original = ranges;
+        const size_t maxRanges = 1 + rng() % 20;
+
+        std::vector<size_t> sortedGaps;
+        size_t changedBytes = 0;
+        for (size_t i = 0; i < original.size(); i++)
+        {
+            changedBytes += original[i].second - original[i].first;
+            if (i > 0)
+            {
+                sortedGaps.push_back(original[i].first - original[i - 1].second);
+            }
+        }
+        std::sort(sortedGaps.begin(), sortedGaps.end());
+
+        detail::MergeRanges(ranges, maxRanges, gaps);
+
+        CHECK(ranges.size() == min(original.size(), maxRanges));
+
+        size_t writtenBytes = 0;
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            writtenBytes += ranges[i].second - ranges[i].first;
+            CHECK(i == 0 || ranges[i - 1].second < ranges[i].first);
+        }
+
+        for (const auto &range : original)
+        {
+            CHECK(std::any_of(ranges.begin(), ranges.end(), [&](const std::pair<size_t, size_t> &merged) {
+                return merged.first <= range.first && range.second <= merged.second;
+            }));
+        }
+
+        const size_t merges = original.size() - ranges.size();
+        CHECK(writtenBytes - changedBytes ==
+              std::accumulate(sortedGaps.begin(), sortedGaps.begin() + static_cast<ptrdiff_t>(merges), size_t(0)));
+    }
+}
+
+void TestPartialUploads()
+{
+    auto renderer = std::make_shared<Renderer>(GetDevice(), 65536);
+    renderer->SetPartialUploads(true);
+
+    auto renderList = std::make_shared<RenderList>(65536);
+
+    const auto record = [&](int moved) {
+        renderList->Clear();
+        for (int i = 0; i < 1000; i++)
+        {
+            const float x = static_cast<float>(i % 40) * 20.f + (i == moved ? 1.f : 0.f);
+            const float y = static_cast<float>(i / 40) * 20.f;
+            renderer->AddRectFilled(renderList, Vec2(x, y), Vec2(x + 15.f, y + 15.f), Color(255, 0, 0));
+        }
+    };
+
+    renderer->BeginFrame();
+    record(-1);
+    renderer->Render(renderList);
+    const size_t fullBytes = renderer->GetRenderStats().uploadedBytes;
+    renderer->EndFrame();
+
+    CHECK(fullBytes >= 1000 * sizeof(Vertex));
+
+    // one rect moved, only its chunk is written
+    renderer->BeginFrame();
+    record(500);
+    renderer->Render(renderList);
+    CHECK(renderer->GetRenderStats().uploadedBytes > 0);
+    CHECK(renderer->GetRenderStats().uploadedBytes <= 2 * g_uploadChunkSize);
+    renderer->EndFrame();
+}
+
+// Shapes of every kind with text and raw vertices in between, so the deferred commands are interleaved with vertices
+// written right away.
+static void RecordScene(const std::shared_ptr<Renderer> &renderer, FontHandle font, const RenderListPtr &renderList)
+{
+    std::mt19937 rng(50);
+    std::uniform_real_distribution<float> coordinate(0.f, 1000.f);
+
+    for (int i = 0; i < 2000; i++)
+    {
+        const Vec2 a(coordinate(rng), coordinate(rng));
+        const Vec2 b(a.x + coordinate(rng) * 0.1f, a.y + coordinate(rng) * 0.1f);
+        const Color color(static_cast<uint32_t>(rng()));
+
+        switch (i % 6)
+        {
+        case 0:
+            renderer->AddRectFilled(renderList, a, b, color);
+            break;
+        case 1:
+            renderer->AddRect(renderList, a, b, color, 1.f + static_cast<float>(i % 3));
+            break;
+        case 2:
+            renderer->AddLine(renderList, a, b, color);
+            break;
+        case 3:
+            renderer->AddCircle(renderList, a, b.x - a.x + 1.f, color, 8 + i % 24);
+            break;
+        case 4:
+            renderer->AddText(renderList, font, L"label", a.x, a.y, color);
+            break;
+        default: {
+            const Vertex triangle[] = {Vertex(a, color), Vertex(b, color), Vertex(a.x, b.y, color)};
+            renderList->AddVertices(triangle, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, nullptr);
+            break;
+        }
+        }
+
+        if (i % 500 == 499)
+        {
+            renderList->SetLayer(static_cast<uint8_t>(i / 500));
+        }
+    }
+}
+
+void TestDeferredTessellationMatchesImmediate()
+{
+    auto renderer = std::make_shared<Renderer>(GetDevice(), 65536);
+    const FontHandle font = renderer->AddFont(std::make_shared<TestFontSource>());
+
+    auto immediate = std::make_shared<TestRenderList>(65536);
+    auto deferred = std::make_shared<TestRenderList>(65536);
+    deferred->SetDeferredTessellation(true);
+
+    RecordScene(renderer, font, immediate);
+    RecordScene(renderer, font, deferred);
+
+    // the vertices are only reserved until Render(), which tessellates on the worker pool
+    CHECK(immediate->GetVertices().size() == deferred->GetVertices().size());
+    CHECK(immediate->GetVertices().size() > 2 * g_tessellateChunkSize);
+
+    // both lists hash the same, the second Render() reuses the upload of the first and would tessellate nothing
+    renderer->BeginFrame();
+    renderer->Render(deferred);
+    CHECK(renderer->GetRenderStats().reusedRenders == 0);
+    renderer->Render(immediate);
+    CHECK(renderer->GetRenderStats().reusedRenders == 1);
+    renderer->EndFrame();
+
+    const std::vector<Vertex> &expected = immediate->GetVertices();
+    const std::vector<Vertex> &actual = deferred->GetVertices();
+
+    CHECK(expected.size() == actual.size());
+    CHECK(memcmp(expected.data(), actual.data(), min(expected.size(), actual.size()) * sizeof(Vertex)) == 0);
+    CHECK(immediate->GetGlyphInstances().size() == deferred->GetGlyphInstances().size());
+}
+
+static const TestCase g_Tests[] = {
+    {"Font measures and rasterizes through its FontSource", TestFontSourceBacksFont},
+    {"Font cache is written once and mapped on the next start", TestFontCacheRoundTrip},
+    {"Async baking gives the same font as sync baking", TestAsyncBakeMatchesSync},
+    {"UTF-8 text is laid out like the same wide text", TestUtf8TextMatchesWideText},
+    {"AddTextFormat lays out the same text as std::format", TestAddTextFormat},
+    {"Word wrap breaks lines at the last space that fits", TestWordWrap},
+    {"Ellipsis cuts lines off with three dots", TestEllipsis},
+    {"ProjectPoints matches the scalar projection", TestProjectPoints},
+    {"RadixSort keeps the order of equal keys", TestRadixSortIsStable},
+    {"TripleBufferedRenderList hands out the latest list", TestTripleBufferExchange},
+    {"TripleBufferedRenderList under a producer and a render thread", TestTripleBufferStress},
+    {"TripleBufferedRenderList keeps the glyphs of a published list", TestPublishedListKeepsGlyphs},
+    {"HashBytes tells every bit and length apart", TestHashBytes},
+    {"Render() skips the upload of unchanged lists", TestUnchangedListSkipsUpload},
+    {"DiffChunks finds the changed chunks", TestDiffChunks},
+    {"MergeRanges closes the smallest gaps", TestMergeRanges},
+    {"Partial uploads only write what changed", TestPartialUploads},
+    {"Deferred tessellation writes the same vertices as immediate", TestDeferredTessellationMatchesImmediate},
+};
+
+int main()
+{
+    RunTests(g_PortableTests);
+    RunTests(g_Tests);
+
+    detail::SafeRelease(&g_pd3dDevice);
+
+    printf("%d failed check(s)\n", g_Failures);
+    return g_Failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+// Tests of the shared parts of the factories, built by the CMake project on any platform. Every failed check is
+// printed, the exit code is non-zero if any failed.
+#ifdef CRF_USE_STB_TRUETYPE
+#define STB_TRUETYPE_IMPLEMENTATION
+#endif
+
+#include "portable_tests.hpp"
+
+int main()
+{
+    RunTests(g_PortableTests);
+
+    printf("%d failed check(s)\n", g_Failures);
+    return g_Failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,714 @@
+// Tests of the parts shared by the factories, see factories/common/renderer_common.hpp. They need neither Windows nor
+// a device, the dx11 tests run them first and portable_main.cpp runs them on any platform.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <initializer_list>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../factories/common/renderer_common.hpp"
+
+using namespace CheatRenderFramework;
+
+static int g_Failures = 0;
+
+#define CHECK(expr)                                                                                                    \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (!(expr))                                                                                                   \
+        {                                                                                                              \
+            printf("  %s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #expr);                                         \
+            g_Failures++;                                                                                              \
+        }                                                                                                              \
+    } while (0)
+
+// Font with made up metrics, so layouts can be worked out by hand. A glyph is 4 + codePoint % 5 pixels wide and
+// advances by its width, lines are 12 pixels high. Clones share the rasterization counter.
+class TestFontSource : public FontSource
+{
+  public:
+    TestFontSource(const std::wstring &cacheKey = {}) : _cacheKey(cacheKey)
+    {
+    }
+
+    static float Advance(uint32_t codePoint)
+    {
+        return static_cast<float>(4 + codePoint % 5);
+    }
+
+    long GetLineHeight() const override
+    {
+        return 12;
+    }
+
+    GlyphMetrics MeasureGlyph(uint32_t codePoint) override
+    {
+        GlyphMetrics metrics;
+        metrics.width = static_cast<long>(4 + codePoint % 5);
+        metrics.advance = metrics.width;
+        metrics.offset = 0;
+        metrics.valid = true;
+        return metrics;
+    }
+
+    void RasterizeGlyph(uint32_t codePoint, const GlyphMetrics &metrics, uint8_t *pixels, long pitch) override
+    {
+        (*this->_rasterized)++;
+
+        for (long y = 0; y < this->GetLineHeight(); y++)
+        {
+            for (long x = 0; x < metrics.width; x++)
+            {
+                pixels[pitch * y + x] = static_cast<uint8_t>(codePoint * 31 + x * 7 + y * 13);
+            }
+        }
+    }
+
+    std::wstring GetCacheKey() const override
+    {
+        return this->_cacheKey;
+    }
+
+    FontSourcePtr Clone() const override
+    {
+        return std::make_shared<TestFontSource>(*this);
+    }
+
+    int GetRasterizedCount() const
+    {
+        return *this->_rasterized;
+    }
+
+  private:
+    std::wstring _cacheKey;
+    std::shared_ptr<std::atomic<int>> _rasterized = std::make_shared<std::atomic<int>>(0);
+};
+
+struct PackedRect
+{
+    long x, y, width, height;
+};
+
+static bool Overlaps(const PackedRect &a, const PackedRect &b)
+{
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+void TestSkylinePackerNoOverlaps()
+{
+    std::mt19937 rng(27);
+    std::uniform_int_distribution<long> size(4, 48);
+
+    detail::SkylinePacker packer;
+    packer.Reset(512, 512);
+
+    std::vector<PackedRect> rects;
+    long area = 0;
+
+    for (int i = 0; i < 2000; i++)
+    {
+        PackedRect rect{0, 0, size(rng), size(rng)};
+        if (!packer.Insert(rect.width, rect.height, rect.x, rect.y))
+        {
+            continue;
+        }
+
+        CHECK(rect.x >= 0 && rect.y >= 0 && rect.x + rect.width <= 512 && rect.y + rect.height <= 512);
+
+        for (const PackedRect &other : rects)
+        {
+            CHECK(!Overlaps(rect, other));
+        }
+
+        rects.push_back(rect);
+        area += rect.width * rect.height;
+    }
+
+    CHECK(!rects.empty());
+    CHECK(packer.GetOccupancy() == static_cast<float>(area) / (512.f * 512.f));
+}
+
+void TestSkylinePackerBottomLeft()
+{
+    detail::SkylinePacker packer;
+    packer.Reset(256, 256);
+
+    long x = -1;
+    long y = -1;
+
+    CHECK(packer.Insert(100, 10, x, y));
+    CHECK(x == 0 && y == 0);
+
+    // the free space right of the first rect is lower than its top edge
+    CHECK(packer.Insert(50, 20, x, y));
+    CHECK(x == 100 && y == 0);
+
+    // too wide for the space right of both, stacked on the lowest level
+    CHECK(packer.Insert(200, 5, x, y));
+    CHECK(x == 0 && y == 20);
+}
+
+void TestSkylinePackerFull()
+{
+    detail::SkylinePacker packer;
+    packer.Reset(256, 256);
+
+    long x = 0;
+    long y = 0;
+
+    CHECK(!packer.Insert(257, 1, x, y));
+    CHECK(!packer.Insert(1, 257, x, y));
+    CHECK(packer.Insert(256, 256, x, y));
+    CHECK(!packer.Insert(1, 1, x, y));
+    CHECK(packer.GetOccupancy() == 1.f);
+
+    packer.Reset(256, 256);
+    CHECK(packer.Insert(1, 1, x, y));
+    CHECK(x == 0 && y == 0);
+}
+
+// Packs the cells of the preloaded charset at several line heights, glyphs 35% to 75% of the line height wide like
+// in a proportional font. The charset has to fit into the smallest power of two rectangle with a quarter more room than
+// the cells take, and an atlas filled with it over and over has to end up mostly covered.
+void TestSkylinePackerOccupancy()
+{
+    const auto cellWidth = [](long lineHeight, uint32_t c) {
+        return lineHeight * static_cast<long>(35 + c % 41) / 100 + 2 + g_fontAtlasPadding;
+    };
+
+    for (long lineHeight : {12L, 16L, 24L, 32L, 48L})
+    {
+        const long cellHeight = lineHeight + g_fontAtlasPadding;
+
+        long area = 0;
+        for (uint32_t c = g_charRangeMin; c < g_charRangeMax; c++)
+        {
+            area += cellWidth(lineHeight, c) * cellHeight;
+        }
+
+        long textureWidth = 64;
+        long textureHeight = 64;
+        while (textureWidth * textureHeight < area + area / 4)
+        {
+            (textureWidth <= textureHeight ? textureWidth : textureHeight) *= 2;
+        }
+
+        detail::SkylinePacker packer;
+        packer.Reset(textureWidth, textureHeight);
+
+        long x = 0;
+        long y = 0;
+        bool packed = true;
+
+        for (uint32_t c = g_charRangeMin; c < g_charRangeMax; c++)
+        {
+            packed = packer.Insert(cellWidth(lineHeight, c), cellHeight, x, y) && packed;
+        }
+
+        CHECK(packed);
+
+        // keep going until a whole pass over the charset finds no room anymore
+        for (bool inserted = true; inserted;)
+        {
+            inserted = false;
+            for (uint32_t c = g_charRangeMin; c < g_charRangeMax; c++)
+            {
+                inserted = packer.Insert(cellWidth(lineHeight, c), cellHeight, x, y) || inserted;
+            }
+        }
+
+        CHECK(packer.GetOccupancy() >= 0.85f);
+    }
+}
+
+void TestAtlasFitSize()
+{
+    long width = 0;
+    long height = 0;
+
+    GlyphCache::FitSize(0, width, height);
+    CHECK(width == g_fontAtlasMinSize && height == g_fontAtlasMinSize);
+
+    // the smaller side grows first, so the result is never more than twice as wide as high
+    GlyphCache::FitSize(256 * 256 + 1, width, height);
+    CHECK(width == 512 && height == 256);
+
+    GlyphCache::FitSize(512 * 256 + 1, width, height);
+    CHECK(width == 512 && height == 512);
+
+    GlyphCache::FitSize(g_fontAtlasDefaultArea, width, height);
+    CHECK(width == 1024 && height == 1024);
+
+    GlyphCache::FitSize(LONG_MAX, width, height);
+    CHECK(width == g_fontAtlasMaxSize && height == g_fontAtlasMaxSize);
+}
+
+void TestConvertDibToAlpha()
+{
+    std::mt19937 rng(28);
+
+    // every length around the 16 pixel blocks and an unaligned start, the other channels hold noise
+    std::vector<uint32_t> dib(80);
+    for (uint32_t &pixel : dib)
+    {
+        pixel = static_cast<uint32_t>(rng());
+    }
+
+    for (size_t offset = 0; offset < 4; offset++)
+    {
+        for (size_t count = 0; count + offset <= dib.size(); count++)
+        {
+            std::vector<uint8_t> expected(count + 1, 0xcd);
+            std::vector<uint8_t> actual(count + 1, 0xcd);
+
+            detail::ConvertDibToAlphaScalar(&dib[offset], expected.data(), count);
+            detail::ConvertDibToAlpha(&dib[offset], actual.data(), count);
+
+            CHECK(expected == actual);
+        }
+    }
+
+    for (size_t i = 0; i < dib.size(); i++)
+    {
+        uint8_t alpha = 0;
+        detail::ConvertDibToAlphaScalar(&dib[i], &alpha, 1);
+        CHECK(alpha == (dib[i] & 0xff));
+    }
+}
+
+// Fills a cache with blocks of the same size, every block holds its key in all of its texels.
+static std::vector<uint64_t> FillGlyphCache(GlyphCache &cache, long size)
+{
+    std::vector<uint64_t> keys;
+
+    for (uint64_t key = 1;; key++)
+    {
+        const std::vector<uint8_t> texels(static_cast<size_t>(size) * size, static_cast<uint8_t>(key));
+        if (!cache.Insert(key, size, size, texels.data(), size))
+        {
+            return keys;
+        }
+
+        keys.push_back(key);
+    }
+}
+
+void TestGlyphCacheEviction()
+{
+    GlyphCache cache(256, 256, 1, g_fontAtlasPadding);
+    const std::vector<uint64_t> keys = FillGlyphCache(cache, 60);
+    const std::vector<uint8_t> texels(60 * 60, 0xaa);
+
+    CHECK(keys.size() > 2);
+
+    // nothing used in the current or the previous frame is evicted
+    CHECK(!cache.Insert(1000, 60, 60, texels.data(), 60));
+    cache.NewFrame();
+    CHECK(!cache.Insert(1000, 60, 60, texels.data(), 60));
+
+    std::vector<uint32_t> indices;
+    for (const uint64_t key : keys)
+    {
+        indices.push_back(cache.Peek(key)->index);
+    }
+
+    // two frames after their last use entries can go, the least recently used first but never a pinned one
+    cache.NewFrame();
+    cache.Pin(keys[1]);
+
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (i != 1 && i != 2)
+        {
+            cache.Touch(keys[i]);
+        }
+    }
+
+    cache.NewFrame();
+    cache.NewFrame();
+
+    const AtlasGlyph *glyph = cache.Insert(1000, 60, 60, texels.data(), 60);
+    CHECK(glyph != nullptr && glyph->index == indices[2]);
+
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        CHECK((cache.Peek(keys[i]) == nullptr) == (i == 2));
+    }
+
+    // the slot was cleared and filled with the new texels
+    std::vector<uint8_t> read(texels.size());
+    CHECK(cache.Read(1000, 0, read.data(), 60));
+    CHECK(read == texels);
+
+    // unpinned it is the next to go
+    cache.Unpin(keys[1]);
+    cache.Touch(1000);
+
+    for (size_t i = 3; i < keys.size(); i++)
+    {
+        cache.Touch(keys[i]);
+    }
+
+    cache.Touch(keys[0]);
+    cache.NewFrame();
+    cache.NewFrame();
+
+    CHECK(cache.Insert(1001, 60, 60, texels.data(), 60) != nullptr);
+    CHECK(cache.Peek(keys[1]) == nullptr && cache.Peek(keys[0]) != nullptr && cache.Peek(1000) != nullptr);
+}
+
+void TestGlyphCacheDirtyRect()
+{
+    GlyphCache cache(256, 256, 2, 3);
+
+    std::vector<detail::AtlasRect> rects;
+    std::vector<uint8_t> firstTexels;
+    const auto upload = [&](long level, const detail::AtlasRect &rect, const uint8_t *pixels, long levelWidth) {
+        CHECK(levelWidth == 256 >> level);
+        rects.push_back(rect);
+        firstTexels.push_back(pixels[(levelWidth * rect.top + rect.left) * 2]);
+    };
+
+    // the factories mark the whole texture after creating it, the solid block is white on every level
+    cache.MarkDirty(0, 0, 256, 256);
+    cache.Flush(upload);
+    CHECK(rects.size() == static_cast<size_t>(g_fontAtlasMipLevels));
+    CHECK(std::count(firstTexels.begin(), firstTexels.end(), 0xff) == g_fontAtlasMipLevels);
+    CHECK(!rects.empty() && rects[0].right == 256 && rects[0].bottom == 256);
+
+    // nothing changed since
+    rects.clear();
+    cache.Flush(upload);
+    CHECK(rects.empty());
+
+    // two glyphs end up in one rect covering both slots, every level halves it rounding outwards
+    const std::vector<uint8_t> texels(10 * 8 * 2, 0x80);
+    const AtlasGlyph *first = cache.Insert(1, 10, 8, texels.data(), 20);
+    const AtlasGlyph *second = cache.Insert(2, 10, 8, texels.data(), 20);
+    CHECK(first && second);
+
+    cache.Flush(upload);
+    CHECK(rects.size() == static_cast<size_t>(g_fontAtlasMipLevels));
+
+    if (first && second && rects.size() == static_cast<size_t>(g_fontAtlasMipLevels))
+    {
+        CHECK(rects[0].left == (std::min)(first->x, second->x) && rects[0].top == (std::min)(first->y, second->y));
+        CHECK(rects[0].right == (std::max)(first->x, second->x) + 10);
+        CHECK(rects[0].bottom == (std::max)(first->y, second->y) + 8);
+
+        for (size_t level = 1; level < rects.size(); level++)
+        {
+            CHECK(rects[level].left == rects[level - 1].left / 2 && rects[level].top == rects[level - 1].top / 2);
+            CHECK(rects[level].right == (rects[level - 1].right + 1) / 2);
+            CHECK(rects[level].bottom == (rects[level - 1].bottom + 1) / 2);
+        }
+    }
+
+    const AtlasStats stats = cache.GetStats();
+    CHECK(stats.glyphCount == 2);
+    CHECK(stats.textureBytes == (256 * 256 + 128 * 128 + 64 * 64) * 2);
+}
+
+template <typename CharT> static std::vector<uint32_t> DecodeAll(std::basic_string_view<CharT> text)
+{
+    std::vector<uint32_t> codePoints;
+
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        codePoints.push_back(detail::DecodeCodePoint(text, i));
+    }
+
+    return codePoints;
+}
+
+void TestDecodeUtf8()
+{
+    using CodePoints = std::vector<uint32_t>;
+
+    CHECK(DecodeAll(std::string_view("")).empty());
+    CHECK(DecodeAll(std::string_view("Ab\x7f")) == CodePoints({'A', 'b', 0x7f}));
+
+    // the shortest and longest sequence of every length
+    CHECK(DecodeAll(std::string_view("\xc2\x80\xdf\xbf")) == CodePoints({0x80, 0x7ff}));
+    CHECK(DecodeAll(std::string_view("\xe0\xa0\x80\xef\xbf\xbf")) == CodePoints({0x800, 0xffff}));
+    CHECK(DecodeAll(std::string_view("\xf0\x90\x80\x80\xf4\x8f\xbf\xbf")) == CodePoints({0x10000, 0x10ffff}));
+
+    // malformed sequences give one U+FFFD per byte and decoding resumes right after
+    CHECK(DecodeAll(std::string_view("\x80x")) == CodePoints({0xfffd, 'x'}));
+    CHECK(DecodeAll(std::string_view("\xc3x")) == CodePoints({0xfffd, 'x'}));
+    CHECK(DecodeAll(std::string_view("\xe2\x82")) == CodePoints({0xfffd, 0xfffd}));
+    CHECK(DecodeAll(std::string_view("\xff\xfe")) == CodePoints({0xfffd, 0xfffd}));
+
+    // overlong forms, surrogates and code points past U+10FFFF
+    CHECK(DecodeAll(std::string_view("\xc0\xaf")) == CodePoints({0xfffd, 0xfffd}));
+    CHECK(DecodeAll(std::string_view("\xe0\x80\xaf")) == CodePoints({0xfffd, 0xfffd, 0xfffd}));
+    CHECK(DecodeAll(std::string_view("\xed\xa0\x80")) == CodePoints({0xfffd, 0xfffd, 0xfffd}));
+    CHECK(DecodeAll(std::string_view("\xf4\x90\x80\x80")) == CodePoints({0xfffd, 0xfffd, 0xfffd, 0xfffd}));
+}
+
+void TestDecodeUtf16()
+{
+    using CodePoints = std::vector<uint32_t>;
+
+    const wchar_t pair[] = {L'a', 0xd83d, 0xde00, L'b'};
+    CHECK(DecodeAll(std::wstring_view(pair, 4)) == CodePoints({'a', 0x1f600, 'b'}));
+
+    // unpaired surrogates are passed through as they are
+    const wchar_t lonely[] = {0xd83d, L'a', 0xde00, 0xd83d};
+    CHECK(DecodeAll(std::wstring_view(lonely, 4)) == CodePoints({0xd83d, 'a', 0xde00, 0xd83d}));
+
+    for (uint32_t codePoint : {0x41u, 0xe9u, 0xffffu, 0x10000u, 0x1f600u, 0x10ffffu})
+    {
+        wchar_t chr[2];
+        const int length = detail::EncodeUtf16(codePoint, chr);
+
+        size_t index = 0;
+        CHECK(detail::DecodeUtf16(std::wstring_view(chr, static_cast<size_t>(length)), index) == codePoint);
+        CHECK(index == static_cast<size_t>(length - 1));
+    }
+}
+
+void TestTrimToCodePoint()
+{
+    // "a", U+00E9 and U+20AC in UTF-8, cut after every byte
+    const char utf8[] = "a\xc3\xa9\xe2\x82\xac";
+    const size_t utf8Expected[] = {0, 1, 1, 3, 3, 3, 6};
+
+    for (size_t length = 0; length < std::size(utf8Expected); length++)
+    {
+        CHECK(detail::TrimToCodePoint(utf8, length) == utf8Expected[length]);
+    }
+
+    // continuation bytes without a lead are left alone
+    CHECK(detail::TrimToCodePoint("\x80\x80", 2) == 2);
+
+    const wchar_t utf16[] = {L'a', 0xd83d, 0xde00};
+    CHECK(detail::TrimToCodePoint(utf16, 1) == 1);
+    CHECK(detail::TrimToCodePoint(utf16, 2) == 1);
+    CHECK(detail::TrimToCodePoint(utf16, 3) == 3);
+}
+
+// Breaks text with the metrics of TestFontSource and checks the lines, a line ending in "..." is expected to be cut
+// off with an ellipsis.
+static void CheckBreaks(const wchar_t *text, uint32_t flags, float maxWidth,
+                        std::initializer_list<const wchar_t *> expected)
+{
+    TestFontSource source;
+    std::unordered_map<uint32_t, GlyphMetrics> metrics;
+    const auto measure = [&](uint32_t c) { return &(metrics[c] = source.MeasureGlyph(c)); };
+
+    TextLayout layout;
+    const float width = layout.BreakLines(std::wstring_view(text), 0xffffffff, flags, 1.f, maxWidth, measure);
+    const std::vector<TextLine> &lines = layout.GetLines();
+
+    CHECK(lines.size() == expected.size());
+
+    float expectedWidth = 0.f;
+
+    for (size_t i = 0; i < (std::min)(lines.size(), expected.size()); i++)
+    {
+        std::wstring line;
+        for (size_t c = lines[i].begin; c < lines[i].end; c++)
+        {
+            line += static_cast<wchar_t>(layout.GetChars()[c].codePoint);
+        }
+
+        if (lines[i].ellipsis)
+        {
+            line += L"...";
+        }
+
+        float lineWidth = 0.f;
+        for (const wchar_t *c = expected.begin()[i]; *c; c++)
+        {
+            lineWidth += TestFontSource::Advance(*c);
+        }
+
+        CHECK(line == expected.begin()[i]);
+        CHECK(lines[i].width == lineWidth);
+        expectedWidth = (std::max)(expectedWidth, lineWidth);
+    }
+
+    CHECK(width == expectedWidth);
+}
+
+void TestTextLayoutWordWrap()
+{
+    // "the quick" is 55 pixels wide, the space after it would make it 61
+    CheckBreaks(L"the quick brown fox jumps", TEXT_FLAG_WORD_WRAP, 60.f, {L"the quick", L"brown fox", L"jumps"});
+
+    // words longer than a line are split, a line filling maxWidth exactly still fits
+    CheckBreaks(L"abcdefghijklmnop", TEXT_FLAG_WORD_WRAP, 30.f, {L"abcde", L"fghij", L"klmno", L"p"});
+
+    // every paragraph is wrapped on its own
+    CheckBreaks(L"ab cd\nefgh ij kl", TEXT_FLAG_WORD_WRAP, 30.f, {L"ab", L"cd", L"efgh", L"ij kl"});
+
+    // a break at the space before a line break does not add an empty line
+    CheckBreaks(L"the quick \nfox", TEXT_FLAG_WORD_WRAP, 60.f, {L"the quick", L"fox"});
+
+    // text which fits is not touched
+    CheckBreaks(L"the quick", TEXT_FLAG_WORD_WRAP, 60.f, {L"the quick"});
+}
+
+void TestTextLayoutEllipsis()
+{
+    // the dots take 15 pixels, "ab" is the longest prefix fitting into the other 15
+    CheckBreaks(L"abcdefghijklmnop", TEXT_FLAG_ELLIPSIS, 30.f, {L"ab..."});
+    CheckBreaks(L"abcdefghijklmnop\nab\nabcdefghijklmnop", TEXT_FLAG_ELLIPSIS, 30.f, {L"ab...", L"ab", L"ab..."});
+    CheckBreaks(L"abcde", TEXT_FLAG_ELLIPSIS, 30.f, {L"abcde"});
+}
+
+void TestTextLayoutScaleAndColors()
+{
+    TestFontSource source;
+    std::unordered_map<uint32_t, GlyphMetrics> metrics;
+    const auto measure = [&](uint32_t c) { return &(metrics[c] = source.MeasureGlyph(c)); };
+
+    // advances are scaled before they are compared with maxWidth
+    TextLayout layout;
+    const float width = layout.BreakLines(std::string_view("the quick brown fox"), 0xff000000, TEXT_FLAG_WORD_WRAP,
+                                          2.f, 120.f, measure);
+
+    CHECK(layout.GetLines().size() == 2);
+    CHECK(width == 110.f);
+
+    // tags take no room and color everything after them, chars below the space are dropped
+    uint32_t tagged = 0;
+    CHECK(detail::ParseColorTag(std::string_view("{#00ff00}"), 0, tagged) == 9);
+
+    layout.BreakLines(std::string_view("a{#00ff00}b\tc"), 0xff000000, TEXT_FLAG_WORD_WRAP, 1.f, 100.f, measure);
+    const std::vector<TextLayoutChar> &chars = layout.GetChars();
+
+    CHECK(chars.size() == 3);
+    CHECK(layout.GetLines().size() == 1 && layout.GetLines()[0].width == TestFontSource::Advance('a') +
+                                                                            TestFontSource::Advance('b') +
+                                                                            TestFontSource::Advance('c'));
+
+    if (chars.size() == 3)
+    {
+        CHECK(chars[0].codePoint == 'a' && chars[0].color == 0xff000000 && !chars[0].tagColor);
+        CHECK(chars[1].codePoint == 'b' && chars[1].color == tagged && chars[1].tagColor);
+        CHECK(chars[2].codePoint == 'c' && chars[2].color == tagged && chars[2].tagColor);
+    }
+}
+
+#if defined(CRF_USE_STB_TRUETYPE) && defined(CRF_TEST_FONT)
+// Rasterizes glyphs of the font the build found, see CRF_TEST_FONT in CMakeLists.txt.
+void TestTrueTypeFontSource()
+{
+    auto source = TrueTypeFontSource::FromFile(CRF_TEST_FONT, 16.f);
+    const long lineHeight = source->GetLineHeight();
+
+    CHECK(lineHeight >= 16 && lineHeight < 24);
+
+    const GlyphMetrics narrow = source->MeasureGlyph('i');
+    const GlyphMetrics wide = source->MeasureGlyph('m');
+
+    CHECK(narrow.valid && wide.valid);
+    CHECK(narrow.advance > 0 && narrow.advance < wide.advance);
+    // one column for anti-aliasing on each side of the advance
+    CHECK(wide.width >= wide.advance + 2 && wide.offset >= 1);
+
+    std::vector<uint8_t> cell(static_cast<size_t>(wide.width) * lineHeight, 0);
+    source->RasterizeGlyph('m', wide, cell.data(), wide.width);
+
+    // the stems are fully covered, the anti-aliasing columns are empty
+    CHECK(*std::max_element(cell.begin(), cell.end()) > 200);
+
+    for (long row = 0; row < lineHeight; row++)
+    {
+        CHECK(cell[wide.width * row] == 0 && cell[wide.width * row + wide.width - 1] == 0);
+    }
+
+    const GlyphMetrics space = source->MeasureGlyph(' ');
+    std::vector<uint8_t> blank(static_cast<size_t>(space.width) * lineHeight, 0);
+    source->RasterizeGlyph(' ', space, blank.data(), space.width);
+
+    CHECK(space.valid && space.advance > 0);
+    CHECK(std::count(blank.begin(), blank.end(), 0) == static_cast<ptrdiff_t>(blank.size()));
+
+    // clones rasterize the same coverage and share the cache key, another size does not
+    const FontSourcePtr clone = source->Clone();
+    std::vector<uint8_t> cloned(cell.size(), 0);
+    clone->RasterizeGlyph('m', clone->MeasureGlyph('m'), cloned.data(), wide.width);
+
+    CHECK(cloned == cell);
+    CHECK(clone->GetCacheKey() == source->GetCacheKey());
+    CHECK(TrueTypeFontSource::FromFile(CRF_TEST_FONT, 20.f)->GetCacheKey() != source->GetCacheKey());
+
+    // the coverage goes through the atlas unchanged
+    GlyphCache cache(256, 256, 1, g_fontAtlasPadding);
+    std::vector<uint8_t> read(cell.size(), 0);
+
+    CHECK(cache.Insert(1, wide.width, lineHeight, cell.data(), wide.width) != nullptr);
+    CHECK(cache.Read(1, 0, read.data(), wide.width));
+    CHECK(read == cell);
+
+    bool threw = false;
+    try
+    {
+        TrueTypeFontSource::FromMemory("nope", 4, 16.f);
+    }
+    catch (const std::runtime_error &)
+    {
+        threw = true;
+    }
+
+    CHECK(threw);
+}
+#endif
+
+struct TestCase
+{
+    const char *name;
+    void (*run)();
+};
+
+static const TestCase g_PortableTests[] = {
+    {"SkylinePacker keeps rects inside and apart", TestSkylinePackerNoOverlaps},
+    {"SkylinePacker places rects bottom-left", TestSkylinePackerBottomLeft},
+    {"SkylinePacker rejects rects once full", TestSkylinePackerFull},
+    {"SkylinePacker packs the preloaded charset tightly", TestSkylinePackerOccupancy},
+    {"GlyphCache::FitSize picks the smallest power of two", TestAtlasFitSize},
+    {"ConvertDibToAlpha matches the scalar conversion", TestConvertDibToAlpha},
+    {"GlyphCache evicts the least recently used unpinned entry", TestGlyphCacheEviction},
+    {"GlyphCache uploads the modified rect of every level", TestGlyphCacheDirtyRect},
+    {"DecodeUtf8 decodes valid and replaces malformed sequences", TestDecodeUtf8},
+    {"DecodeUtf16 joins surrogate pairs", TestDecodeUtf16},
+    {"TrimToCodePoint never splits a code point", TestTrimToCodePoint},
+    {"TextLayout breaks lines at the last space that fits", TestTextLayoutWordWrap},
+    {"TextLayout cuts lines off with three dots", TestTextLayoutEllipsis},
+    {"TextLayout scales advances and applies color tags", TestTextLayoutScaleAndColors},
+#if defined(CRF_USE_STB_TRUETYPE) && defined(CRF_TEST_FONT)
+    {"TrueTypeFontSource measures and rasterizes a font file", TestTrueTypeFontSource},
+#endif
+};
+
+// Runs every test and prints whether it passed, failed checks are counted in g_Failures.
+static void RunTests(std::span<const TestCase> tests)
+{
+    for (const TestCase &test : tests)
+    {
+        const int failures = g_Failures;
+
+        try
+        {
+            test.run();
+        }
+        catch (const std::exception &e)
+        {
+            printf("  exception: %s\n", e.what());
+            g_Failures++;
+        }
+
+        printf("%s %s\n", g_Failures == failures ? "[ OK ]" : "[FAIL]", test.name);
+    }
+}
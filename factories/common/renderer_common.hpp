@@ -0,0 +1,1151 @@
+#pragma once
+
+// Parts of the framework shared by the Direct3D factories which need neither Windows nor a graphics API: UTF decoding,
+// coverage conversion, glyph atlas bookkeeping, font sources and text layout. Included by the factory headers, it
+// builds on its own so it can be tested on any platform.
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Define CRF_USE_STB_TRUETYPE to enable TrueTypeFontSource. stb_truetype.h is not shipped with the framework and
+// STB_TRUETYPE_IMPLEMENTATION has to be defined in exactly one translation unit of the application.
+#if defined(CRF_USE_STB_TRUETYPE)
+#include <fstream>
+#include "stb_truetype.h"
+#endif
+
+namespace CheatRenderFramework
+{
+namespace detail
+{
+// GDI draws white text on black, so any channel of a DIB pixel holds the coverage
+inline void ConvertDibToAlphaScalar(const uint32_t *src, uint8_t *dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = static_cast<uint8_t>(src[i] & 0xff);
+    }
+}
+
+inline void ConvertDibToAlpha(const uint32_t *src, uint8_t *dst, size_t count)
+{
+    size_t i = 0;
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi32(0xff);
+
+    for (; i + 16 <= count; i += 16)
+    {
+        const __m128i p0 = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)), mask);
+        const __m128i p1 = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 4)), mask);
+        const __m128i p2 = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8)), mask);
+        const __m128i p3 = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 12)), mask);
+
+        // every lane is masked to 8 bits, so the saturating packs never clamp
+        const __m128i lo = _mm_packs_epi32(p0, p1);
+        const __m128i hi = _mm_packs_epi32(p2, p3);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    ConvertDibToAlphaScalar(src + i, dst + i, count - i);
+}
+
+// Returns the code point at index and moves index onto the low surrogate if it was a surrogate pair
+inline uint32_t DecodeUtf16(std::wstring_view text, size_t &index)
+{
+    const uint32_t c = text[index];
+
+    if (c >= 0xD800 && c <= 0xDBFF && index + 1 < text.size())
+    {
+        const uint32_t low = text[index + 1];
+        if (low >= 0xDC00 && low <= 0xDFFF)
+        {
+            index++;
+            return 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+        }
+    }
+
+    return c;
+}
+
+// Returns the code point starting at index and moves index onto its last byte. Malformed sequences decode to U+FFFD
+// one byte at a time.
+inline uint32_t DecodeUtf8(std::string_view text, size_t &index)
+{
+    const uint32_t lead = static_cast<uint8_t>(text[index]);
+    if (lead < 0x80)
+    {
+        return lead;
+    }
+
+    size_t length;
+    uint32_t codePoint;
+
+    if ((lead & 0xE0) == 0xC0)
+    {
+        length = 2;
+        codePoint = lead & 0x1F;
+    }
+    else if ((lead & 0xF0) == 0xE0)
+    {
+        length = 3;
+        codePoint = lead & 0x0F;
+    }
+    else if ((lead & 0xF8) == 0xF0)
+    {
+        length = 4;
+        codePoint = lead & 0x07;
+    }
+    else
+    {
+        return 0xFFFD;
+    }
+
+    if (index + length > text.size())
+    {
+        return 0xFFFD;
+    }
+
+    for (size_t i = 1; i < length; i++)
+    {
+        const uint32_t c = static_cast<uint8_t>(text[index + i]);
+        if ((c & 0xC0) != 0x80)
+        {
+            return 0xFFFD;
+        }
+
+        codePoint = (codePoint << 6) | (c & 0x3F);
+    }
+
+    // reject overlong forms, surrogates and anything past the unicode range
+    static constexpr uint32_t minimum[] = {0, 0, 0x80, 0x800, 0x10000};
+    if (codePoint < minimum[length] || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+    {
+        return 0xFFFD;
+    }
+
+    index += length - 1;
+    return codePoint;
+}
+
+inline uint32_t DecodeCodePoint(std::string_view text, size_t &index)
+{
+    return DecodeUtf8(text, index);
+}
+
+inline uint32_t DecodeCodePoint(std::wstring_view text, size_t &index)
+{
+    return DecodeUtf16(text, index);
+}
+
+// Length of text cut off after length units without splitting the last code point, for output truncated to a buffer.
+inline size_t TrimToCodePoint(const char *text, size_t length)
+{
+    size_t lead = length;
+    while (lead > 0 && (static_cast<uint8_t>(text[lead - 1]) & 0xc0) == 0x80)
+    {
+        lead--;
+    }
+
+    if (lead == 0)
+    {
+        return length;
+    }
+
+    const uint8_t c = static_cast<uint8_t>(text[lead - 1]);
+    const size_t sequence = c < 0xc0 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+
+    return lead - 1 + sequence > length ? lead - 1 : length;
+}
+
+inline size_t TrimToCodePoint(const wchar_t *text, size_t length)
+{
+    // a high surrogate without the low one following it
+    return length > 0 && text[length - 1] >= 0xd800 && text[length - 1] < 0xdc00 ? length - 1 : length;
+}
+
+// Parses a {#RRGGBB} or {#AARRGGBB} color tag at index, returns its length or 0 if there is none.
+template <typename CharT> inline size_t ParseColorTag(std::basic_string_view<CharT> text, size_t index, uint32_t &color)
+{
+    if (text[index] != '{' || index + 8 >= text.size() || text[index + 1] != '#')
+    {
+        return 0;
+    }
+
+    const auto parseHex = [&](size_t digits) -> bool {
+        if (index + 2 + digits >= text.size() || text[index + 2 + digits] != '}')
+        {
+            return false;
+        }
+
+        uint32_t value = 0;
+        for (size_t i = 0; i < digits; i++)
+        {
+            const CharT c = text[index + 2 + i];
+
+            if (c >= '0' && c <= '9')
+            {
+                value = (value << 4) | static_cast<uint32_t>(c - '0');
+            }
+            else if (c >= 'a' && c <= 'f')
+            {
+                value = (value << 4) | static_cast<uint32_t>(c - 'a' + 10);
+            }
+            else if (c >= 'A' && c <= 'F')
+            {
+                value = (value << 4) | static_cast<uint32_t>(c - 'A' + 10);
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        color = (digits == 6) ? (0xFF000000 | value) : value;
+        return true;
+    };
+
+    if (parseHex(8))
+    {
+        return 11;
+    }
+
+    return parseHex(6) ? 9 : 0;
+}
+
+inline int EncodeUtf16(uint32_t codePoint, wchar_t (&chr)[2])
+{
+    if (codePoint >= 0x10000)
+    {
+        codePoint -= 0x10000;
+        chr[0] = static_cast<wchar_t>(0xD800 + (codePoint >> 10));
+        chr[1] = static_cast<wchar_t>(0xDC00 + (codePoint & 0x3FF));
+        return 2;
+    }
+
+    chr[0] = static_cast<wchar_t>(codePoint);
+    return 1;
+}
+
+// Averages 2x2 blocks of src into the [left, right) x [top, bottom) rect of the next smaller mip level.
+inline void DownsampleMip(const uint8_t *src, long srcWidth, long srcHeight, uint8_t *dst, long dstWidth, long channels,
+                          long left, long top, long right, long bottom)
+{
+    for (long y = top; y < bottom; y++)
+    {
+        const uint8_t *row0 = src + srcWidth * channels * (std::min)(2 * y, srcHeight - 1);
+        const uint8_t *row1 = src + srcWidth * channels * (std::min)(2 * y + 1, srcHeight - 1);
+
+        for (long x = left; x < right; x++)
+        {
+            const long x0 = channels * (std::min)(2 * x, srcWidth - 1);
+            const long x1 = channels * (std::min)(2 * x + 1, srcWidth - 1);
+
+            for (long c = 0; c < channels; c++)
+            {
+                dst[(dstWidth * y + x) * channels + c] =
+                    static_cast<uint8_t>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+            }
+        }
+    }
+}
+
+inline uint64_t HashFnv1a(const void *data, size_t size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+// Bottom-left skyline rectangle packer. The skyline is a list of horizontal segments ordered by x which covers the
+// whole width, a rectangle is placed on the segment where its top edge ends up the lowest.
+class SkylinePacker
+{
+  public:
+    inline void Reset(long width, long height)
+    {
+        this->_width = width;
+        this->_height = height;
+        this->_usedArea = 0;
+        this->_skyline.clear();
+        this->_skyline.push_back({0, 0, width});
+    }
+
+    inline bool Insert(long width, long height, long &x, long &y)
+    {
+        bool found = false;
+        size_t bestIndex = 0;
+        long bestTop = 0;
+        long bestWidth = 0;
+
+        for (size_t i = 0; i < this->_skyline.size(); i++)
+        {
+            long top = 0;
+            if (!this->Fit(i, width, height, top))
+            {
+                continue;
+            }
+
+            if (!found || top + height < bestTop || (top + height == bestTop && this->_skyline[i].width < bestWidth))
+            {
+                found = true;
+                bestIndex = i;
+                bestTop = top + height;
+                bestWidth = this->_skyline[i].width;
+            }
+        }
+
+        if (!found)
+        {
+            return false;
+        }
+
+        x = this->_skyline[bestIndex].x;
+        y = bestTop - height;
+
+        this->AddLevel(bestIndex, x, bestTop, width);
+        this->_usedArea += width * height;
+        return true;
+    }
+
+    inline long GetWidth() const
+    {
+        return this->_width;
+    }
+
+    inline long GetHeight() const
+    {
+        return this->_height;
+    }
+
+    // ratio of the packed area to the whole area
+    inline float GetOccupancy() const
+    {
+        return static_cast<float>(this->_usedArea) / (static_cast<float>(this->_width) * this->_height);
+    }
+
+  private:
+    struct Segment
+    {
+        long x;
+        long y;
+        long width;
+    };
+
+    inline bool Fit(size_t index, long width, long height, long &y) const
+    {
+        if (this->_skyline[index].x + width > this->_width)
+        {
+            return false;
+        }
+
+        long remaining = width;
+        y = 0;
+
+        for (size_t i = index; remaining > 0 && i < this->_skyline.size(); i++)
+        {
+            if (this->_skyline[i].y > y)
+            {
+                y = this->_skyline[i].y;
+            }
+
+            if (y + height > this->_height)
+            {
+                return false;
+            }
+
+            remaining -= this->_skyline[i].width;
+        }
+
+        return true;
+    }
+
+    inline void AddLevel(size_t index, long x, long y, long width)
+    {
+        this->_skyline.insert(this->_skyline.begin() + index, {x, y, width});
+
+        // shrink or drop the segments which are now covered by the new one
+        for (size_t i = index + 1; i < this->_skyline.size();)
+        {
+            const long prevRight = this->_skyline[i - 1].x + this->_skyline[i - 1].width;
+            Segment &segment = this->_skyline[i];
+
+            if (segment.x >= prevRight)
+            {
+                break;
+            }
+
+            const long shrink = prevRight - segment.x;
+            if (segment.width <= shrink)
+            {
+                this->_skyline.erase(this->_skyline.begin() + i);
+                continue;
+            }
+
+            segment.x += shrink;
+            segment.width -= shrink;
+            break;
+        }
+
+        // merge neighbours on the same level
+        for (size_t i = 0; i + 1 < this->_skyline.size();)
+        {
+            if (this->_skyline[i].y == this->_skyline[i + 1].y)
+            {
+                this->_skyline[i].width += this->_skyline[i + 1].width;
+                this->_skyline.erase(this->_skyline.begin() + i + 1);
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+
+    std::vector<Segment> _skyline;
+    long _width = 0;
+    long _height = 0;
+    long _usedArea = 0;
+};
+
+// [left, right) x [top, bottom) in texels
+struct AtlasRect
+{
+    long left;
+    long top;
+    long right;
+    long bottom;
+};
+} // namespace detail
+
+class FontSource;
+
+using FontSourcePtr = std::shared_ptr<FontSource>;
+
+// Charset basic latin, rasterized up front. Everything else is rasterized when it is used for the first time.
+static constexpr wchar_t g_charRangeMin = 0x20;
+static constexpr wchar_t g_charRangeMax = 0x80;
+static constexpr long g_fontAtlasMinSize = 256;
+static constexpr long g_fontAtlasMaxSize = 4096;
+// area the shared atlas is fitted to when the renderer is not given one, 1024x1024
+static constexpr long g_fontAtlasDefaultArea = 1024 * 1024;
+static constexpr long g_fontAtlasPadding = 1;
+static constexpr long g_fontAtlasWhiteSize = 4;
+// mip levels of the atlas for text drawn scaled down
+static constexpr long g_fontAtlasMipLevels = 3;
+
+enum TextFlags : int32_t
+{
+    TEXT_FLAG_NONE = 0,
+    TEXT_FLAG_LEFT = 0 << 0,
+    TEXT_FLAG_RIGHT = 1 << 1,
+    TEXT_FLAG_CENTERED_X = 1 << 2,
+    TEXT_FLAG_CENTERED_Y = 1 << 3,
+    TEXT_FLAG_CENTERED = TEXT_FLAG_CENTERED_X | TEXT_FLAG_CENTERED_Y,
+    TEXT_FLAG_DROPSHADOW = 1 << 4,
+    TEXT_FLAG_OUTLINE = 1 << 5,
+    TEXT_FLAG_COLORTAGS = 1 << 6,
+    // lines longer than the max width passed to AddText() are broken at spaces or cut off with "..."
+    TEXT_FLAG_WORD_WRAP = 1 << 7,
+    TEXT_FLAG_ELLIPSIS = 1 << 8,
+    // interned texts are composed into a single atlas entry and drawn as one quad, see Renderer::InternText()
+    TEXT_FLAG_CACHED = 1 << 9,
+    TEXT_FLAG_MAX
+};
+
+struct AtlasStats
+{
+    long textureWidth = 0;
+    long textureHeight = 0;
+    size_t glyphCount = 0;
+    // area covered by glyphs relative to the texture area
+    float occupancy = 0.f;
+    // video memory of the texture, mip chain included
+    size_t textureBytes = 0;
+};
+
+struct AtlasGlyph
+{
+    long x = 0;
+    long y = 0;
+    long width = 0;
+    long height = 0;
+    long slotWidth = 0;
+    long slotHeight = 0;
+    std::array<float, 4> uv{};
+    uint64_t lastUsedFrame = 0;
+    // number of interned texts and published lists referencing the glyph, pinned glyphs are never evicted
+    uint32_t pinCount = 0;
+    // key of the entry, render lists keep it to mark the glyph as used when they are drawn again
+    uint64_t key = 0;
+    // index of the slot, an evicted glyph hands it over together with its place in the texture
+    uint32_t index = 0;
+};
+
+// CPU side of a glyph atlas: a copy of the texture in system memory with channels bytes per texel, slots handed out by
+// a skyline packer and the least recently used entries evicted once there is no free space left. The top-left corner
+// holds a solid block, so untextured shapes sampling uv (0, 0) end up in the same batch as the text. Not synchronized,
+// FontAtlas serializes all calls and uploads what Flush() hands it.
+class GlyphCache
+{
+  public:
+    GlyphCache(long width, long height, long channels, long whitePadding)
+        : _width(width), _height(height), _channels(channels), _frame(1), _slotCount(0), _dirty{}
+    {
+        this->_packer.Reset(this->_width, this->_height);
+        this->_pixels.resize(static_cast<size_t>(this->_width) * this->_height * this->_channels);
+        this->_mipPixels.resize(g_fontAtlasMipLevels - 1);
+
+        for (long level = 1; level < g_fontAtlasMipLevels; level++)
+        {
+            this->_mipPixels[level - 1].resize(static_cast<size_t>(this->_width >> level) * (this->_height >> level) *
+                                               this->_channels);
+        }
+
+        // the packer is empty, so the solid block always lands at (0, 0). It is padded like a glyph, so nothing drawn
+        // around a glyph next to it picks it up.
+        long x = 0;
+        long y = 0;
+        const long whiteSlotSize = g_fontAtlasWhiteSize + whitePadding;
+        this->_packer.Insert(whiteSlotSize, whiteSlotSize, x, y);
+
+        for (long row = y; row < y + g_fontAtlasWhiteSize; row++)
+        {
+            memset(&this->_pixels[(this->_width * row + x) * this->_channels], 0xff,
+                   g_fontAtlasWhiteSize * this->_channels);
+        }
+    }
+
+    // smallest power of two rectangle with enough area, the smaller side grows first (256x256, 512x256, 512x512, ...)
+    static inline void FitSize(long area, long &width, long &height)
+    {
+        width = g_fontAtlasMinSize;
+        height = g_fontAtlasMinSize;
+
+        while (width * height < area && height < g_fontAtlasMaxSize)
+        {
+            if (width <= height)
+            {
+                width *= 2;
+            }
+            else
+            {
+                height *= 2;
+            }
+        }
+    }
+
+    // Unlike Find() the entry is not marked as used.
+    inline const AtlasGlyph *Peek(uint64_t key) const
+    {
+        auto it = this->_glyphs.find(key);
+        return it != this->_glyphs.end() ? &it->second : nullptr;
+    }
+
+    // The returned glyph stays valid until the next NewFrame(), glyphs used in the current or the previous frame are
+    // never evicted.
+    inline AtlasGlyph *Find(uint64_t key)
+    {
+        auto it = this->_glyphs.find(key);
+        if (it == this->_glyphs.end())
+        {
+            return nullptr;
+        }
+
+        it->second.lastUsedFrame = this->_frame;
+        return &it->second;
+    }
+
+    // Copies texels into a free or evicted slot, rows are width * channels bytes long and pitch bytes apart.
+    inline AtlasGlyph *Insert(uint64_t key, long width, long height, const uint8_t *texels, long pitch)
+    {
+        AtlasGlyph glyph{};
+
+        if (!this->AllocateSlot(width, height, glyph))
+        {
+            return nullptr;
+        }
+
+        glyph.width = width;
+        glyph.height = height;
+        glyph.uv = {static_cast<float>(glyph.x) / this->_width, static_cast<float>(glyph.y) / this->_height,
+                    static_cast<float>(glyph.x + width) / this->_width,
+                    static_cast<float>(glyph.y + height) / this->_height};
+        glyph.lastUsedFrame = this->_frame;
+        glyph.key = key;
+
+        // clear whatever an evicted glyph left in the slot
+        for (long row = glyph.y; row < glyph.y + glyph.slotHeight; row++)
+        {
+            memset(&this->_pixels[(this->_width * row + glyph.x) * this->_channels], 0,
+                   glyph.slotWidth * this->_channels);
+        }
+
+        for (long row = 0; row < height; row++)
+        {
+            memcpy(&this->_pixels[(this->_width * (glyph.y + row) + glyph.x) * this->_channels], texels + pitch * row,
+                   width * this->_channels);
+        }
+
+        this->MarkDirty(glyph.x, glyph.y, glyph.x + glyph.slotWidth, glyph.y + glyph.slotHeight);
+
+        return &(this->_glyphs[key] = glyph);
+    }
+
+    inline void Touch(uint64_t key)
+    {
+        auto it = this->_glyphs.find(key);
+        if (it != this->_glyphs.end())
+        {
+            it->second.lastUsedFrame = this->_frame;
+        }
+    }
+
+    inline void Pin(uint64_t key)
+    {
+        auto it = this->_glyphs.find(key);
+        if (it != this->_glyphs.end())
+        {
+            it->second.pinCount++;
+        }
+    }
+
+    inline void Unpin(uint64_t key)
+    {
+        auto it = this->_glyphs.find(key);
+        if (it != this->_glyphs.end() && it->second.pinCount > 0)
+        {
+            it->second.pinCount--;
+        }
+    }
+
+    // Copies the first channel of an entry without inset texels on every side into pixels, rows are pitch bytes apart.
+    inline bool Read(uint64_t key, long inset, uint8_t *pixels, long pitch) const
+    {
+        const AtlasGlyph *glyph = this->Peek(key);
+        if (!glyph)
+        {
+            return false;
+        }
+
+        for (long row = 0; row < glyph->height - 2 * inset; row++)
+        {
+            const uint8_t *texel =
+                &this->_pixels[(this->_width * (glyph->y + inset + row) + glyph->x + inset) * this->_channels];
+
+            for (long column = 0; column < glyph->width - 2 * inset; column++)
+            {
+                pixels[pitch * row + column] = texel[column * this->_channels];
+            }
+        }
+
+        return true;
+    }
+
+    inline void NewFrame()
+    {
+        this->_frame++;
+    }
+
+    // Rebuilds the mip levels below the modified part and hands it to upload(level, rect, pixels, levelWidth) level by
+    // level. The copies have the same layout as the texture, rect is relative to the level's top-left corner.
+    template <typename Upload> inline void Flush(Upload &&upload)
+    {
+        if (this->_dirty.right <= this->_dirty.left || this->_dirty.bottom <= this->_dirty.top)
+        {
+            return;
+        }
+
+        detail::AtlasRect rect = this->_dirty;
+        const uint8_t *src = this->_pixels.data();
+
+        for (long level = 0; level < g_fontAtlasMipLevels; level++)
+        {
+            const long levelWidth = this->_width >> level;
+
+            if (level > 0)
+            {
+                rect = {rect.left / 2, rect.top / 2, (rect.right + 1) / 2, (rect.bottom + 1) / 2};
+
+                uint8_t *dst = this->_mipPixels[level - 1].data();
+                detail::DownsampleMip(src, levelWidth * 2, (this->_height >> level) * 2, dst, levelWidth,
+                                      this->_channels, rect.left, rect.top, rect.right, rect.bottom);
+                src = dst;
+            }
+
+            upload(level, rect, src, levelWidth);
+        }
+
+        this->_dirty = {};
+    }
+
+    inline void MarkDirty(long left, long top, long right, long bottom)
+    {
+        if (this->_dirty.right <= this->_dirty.left || this->_dirty.bottom <= this->_dirty.top)
+        {
+            this->_dirty = {left, top, right, bottom};
+            return;
+        }
+
+        this->_dirty.left = (std::min)(this->_dirty.left, left);
+        this->_dirty.top = (std::min)(this->_dirty.top, top);
+        this->_dirty.right = (std::max)(this->_dirty.right, right);
+        this->_dirty.bottom = (std::max)(this->_dirty.bottom, bottom);
+    }
+
+    // textureBytes assumes a texture with channels bytes per texel
+    inline AtlasStats GetStats() const
+    {
+        AtlasStats stats{};
+        stats.textureWidth = this->_width;
+        stats.textureHeight = this->_height;
+        stats.glyphCount = this->_glyphs.size();
+
+        long glyphArea = 0;
+
+        for (const auto &[_, glyph] : this->_glyphs)
+        {
+            glyphArea += glyph.width * glyph.height;
+        }
+
+        stats.occupancy = static_cast<float>(glyphArea) / (static_cast<float>(this->_width) * this->_height);
+
+        for (long level = 0; level < g_fontAtlasMipLevels; level++)
+        {
+            stats.textureBytes +=
+                static_cast<size_t>(this->_width >> level) * (this->_height >> level) * this->_channels;
+        }
+
+        return stats;
+    }
+
+    inline long GetWidth() const
+    {
+        return this->_width;
+    }
+
+    inline long GetHeight() const
+    {
+        return this->_height;
+    }
+
+    inline long GetChannels() const
+    {
+        return this->_channels;
+    }
+
+    // slot indices handed out so far, every glyph's index is below it
+    inline uint32_t GetSlotCount() const
+    {
+        return this->_slotCount;
+    }
+
+  private:
+    inline bool AllocateSlot(long width, long height, AtlasGlyph &glyph)
+    {
+        if (width > this->_width || height > this->_height)
+        {
+            return false;
+        }
+
+        long x = 0;
+        long y = 0;
+
+        // the padding keeps linear filtering from picking up texels of the neighbouring glyphs
+        if (this->_packer.Insert(width + g_fontAtlasPadding, height + g_fontAtlasPadding, x, y))
+        {
+            glyph.x = x;
+            glyph.y = y;
+            glyph.slotWidth = width;
+            glyph.slotHeight = height;
+            glyph.index = this->_slotCount++;
+            return true;
+        }
+
+        // the atlas is full, take over the slot of the least recently used glyph that is large enough. Glyphs used in
+        // the current frame are already referenced by queued vertices, the ones of the previous frame by lists which
+        // are drawn again before they are touched and pinned ones by interned texts or published lists, none of them
+        // can be evicted.
+        auto victim = this->_glyphs.end();
+
+        for (auto it = this->_glyphs.begin(); it != this->_glyphs.end(); ++it)
+        {
+            const AtlasGlyph &candidate = it->second;
+
+            if (candidate.lastUsedFrame + 1 < this->_frame && candidate.pinCount == 0 && candidate.slotWidth >= width &&
+                candidate.slotHeight >= height &&
+                (victim == this->_glyphs.end() || candidate.lastUsedFrame < victim->second.lastUsedFrame))
+            {
+                victim = it;
+            }
+        }
+
+        if (victim == this->_glyphs.end())
+        {
+            return false;
+        }
+
+        glyph = victim->second;
+        this->_glyphs.erase(victim);
+        return true;
+    }
+
+    long _width;
+    long _height;
+    long _channels;
+
+    std::vector<uint8_t> _pixels;
+    // levels 1 and up of the mip chain
+    std::vector<std::vector<uint8_t>> _mipPixels;
+
+    std::unordered_map<uint64_t, AtlasGlyph> _glyphs;
+    detail::SkylinePacker _packer;
+    uint64_t _frame;
+    uint32_t _slotCount;
+    detail::AtlasRect _dirty;
+};
+
+struct GlyphMetrics
+{
+    // width of the rasterized cell including overhangs
+    long width = 0;
+    long advance = 0;
+    // distance from the cell's left edge to the pen position
+    long offset = 0;
+    bool valid = false;
+};
+
+// Produces metrics and coverage for the glyphs of one font. A glyph cell is metrics.width pixels wide and
+// GetLineHeight() pixels high, the pen sits at metrics.offset on the top edge of the line.
+class FontSource
+{
+  public:
+    virtual ~FontSource() = default;
+
+    virtual long GetLineHeight() const = 0;
+    virtual GlyphMetrics MeasureGlyph(uint32_t codePoint) = 0;
+    // writes 8 bit coverage of the whole cell, rows are pitch bytes apart
+    virtual void RasterizeGlyph(uint32_t codePoint, const GlyphMetrics &metrics, uint8_t *pixels, long pitch) = 0;
+
+    // identifies the exact rasterizer output for the on-disk cache, sources returning an empty key are never cached
+    virtual std::wstring GetCacheKey() const
+    {
+        return {};
+    }
+
+    // independent copy for rasterizing on another thread, sources returning null are baked by a single worker
+    virtual FontSourcePtr Clone() const
+    {
+        return nullptr;
+    }
+};
+
+#if defined(CRF_USE_STB_TRUETYPE)
+#endif
+#if defined(CRF_USE_STB_TRUETYPE)
+// TrueType/OpenType font rasterized by stb_truetype, loaded from a file or a memory blob. Does not touch GDI, so
+// atlas generation and text layout behave the same on every platform.
+class TrueTypeFontSource : public FontSource
+{
+  public:
+    TrueTypeFontSource(std::vector<uint8_t> fontData, float pixelHeight, int fontIndex = 0)
+        : _fontData(std::move(fontData)), _fontInfo{}, _pixelHeight(pixelHeight), _fontIndex(fontIndex), _scale(0.f),
+          _baseline(0), _lineHeight(0)
+    {
+        const int offset = stbtt_GetFontOffsetForIndex(this->_fontData.data(), fontIndex);
+        if (offset < 0 || !stbtt_InitFont(&this->_fontInfo, this->_fontData.data(), offset))
+        {
+            throw std::runtime_error("TrueTypeFontSource::ctor(): Invalid font data!");
+        }
+
+        this->_scale = stbtt_ScaleForPixelHeight(&this->_fontInfo, pixelHeight);
+
+        int ascent = 0;
+        int descent = 0;
+        int lineGap = 0;
+        stbtt_GetFontVMetrics(&this->_fontInfo, &ascent, &descent, &lineGap);
+
+        this->_baseline = static_cast<long>(std::ceil(ascent * this->_scale));
+        this->_lineHeight = this->_baseline + static_cast<long>(std::ceil((lineGap - descent) * this->_scale));
+
+        this->_cacheKey = L"ttf|" + std::to_wstring(detail::HashFnv1a(this->_fontData.data(), this->_fontData.size())) +
+                          L"|" + std::to_wstring(fontIndex) + L"|" + std::to_wstring(pixelHeight);
+    }
+
+    static inline std::shared_ptr<TrueTypeFontSource> FromFile(const std::string &path, float pixelHeight,
+                                                               int fontIndex = 0)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            throw std::runtime_error("TrueTypeFontSource::FromFile(): Failed to open font file!");
+        }
+
+        std::vector<uint8_t> fontData((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return std::make_shared<TrueTypeFontSource>(std::move(fontData), pixelHeight, fontIndex);
+    }
+
+    static inline std::shared_ptr<TrueTypeFontSource> FromMemory(const void *data, size_t size, float pixelHeight,
+                                                                 int fontIndex = 0)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        return std::make_shared<TrueTypeFontSource>(std::vector<uint8_t>(bytes, bytes + size), pixelHeight,
+                                                    fontIndex);
+    }
+
+    inline long GetLineHeight() const override
+    {
+        return this->_lineHeight;
+    }
+
+    inline std::wstring GetCacheKey() const override
+    {
+        return this->_cacheKey;
+    }
+
+    inline FontSourcePtr Clone() const override
+    {
+        return std::make_shared<TrueTypeFontSource>(this->_fontData, this->_pixelHeight, this->_fontIndex);
+    }
+
+    inline GlyphMetrics MeasureGlyph(uint32_t codePoint) override
+    {
+        const int glyphIndex = stbtt_FindGlyphIndex(&this->_fontInfo, static_cast<int>(codePoint));
+
+        int advanceWidth = 0;
+        int leftSideBearing = 0;
+        stbtt_GetGlyphHMetrics(&this->_fontInfo, glyphIndex, &advanceWidth, &leftSideBearing);
+
+        int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+        stbtt_GetGlyphBitmapBox(&this->_fontInfo, glyphIndex, this->_scale, this->_scale, &x0, &y0, &x1, &y1);
+
+        GlyphMetrics metrics{};
+        metrics.advance = static_cast<long>(std::lround(advanceWidth * this->_scale));
+        // same cell layout as GDI, one extra column on each side for anti-aliasing
+        metrics.offset = (std::max)(0L, static_cast<long>(-x0)) + 1;
+        metrics.width = metrics.offset + (std::max)(metrics.advance, static_cast<long>(x1)) + 1;
+        metrics.valid = true;
+        return metrics;
+    }
+
+    inline void RasterizeGlyph(uint32_t codePoint, const GlyphMetrics &metrics, uint8_t *pixels, long pitch) override
+    {
+        const int glyphIndex = stbtt_FindGlyphIndex(&this->_fontInfo, static_cast<int>(codePoint));
+
+        int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+        stbtt_GetGlyphBitmapBox(&this->_fontInfo, glyphIndex, this->_scale, this->_scale, &x0, &y0, &x1, &y1);
+
+        const long width = x1 - x0;
+        const long height = y1 - y0;
+        if (width <= 0 || height <= 0)
+        {
+            return;
+        }
+
+        this->_scratch.assign(static_cast<size_t>(width) * height, 0);
+        stbtt_MakeGlyphBitmap(&this->_fontInfo, this->_scratch.data(), width, height, width, this->_scale, this->_scale,
+                              glyphIndex);
+
+        // the bitmap box is relative to the pen on the baseline, clip it against the cell
+        const long left = metrics.offset + x0;
+        const long top = this->_baseline + y0;
+
+        for (long y = (std::max)(0L, -top); y < height && top + y < this->_lineHeight; y++)
+        {
+            for (long x = (std::max)(0L, -left); x < width && left + x < metrics.width; x++)
+            {
+                pixels[pitch * (top + y) + left + x] = this->_scratch[width * y + x];
+            }
+        }
+    }
+
+  private:
+    std::vector<uint8_t> _fontData;
+    stbtt_fontinfo _fontInfo;
+    std::vector<uint8_t> _scratch;
+    float _pixelHeight;
+    int _fontIndex;
+    float _scale;
+    long _baseline;
+    long _lineHeight;
+    std::wstring _cacheKey;
+};
+#endif
+
+// Char of a text laid out against a max width, see TextLayout.
+struct TextLayoutChar
+{
+    uint32_t codePoint;
+    uint32_t color;
+    bool tagColor;
+};
+
+struct TextLine
+{
+    // chars [begin, end) of the text
+    size_t begin;
+    size_t end;
+    float width;
+    bool ellipsis;
+};
+
+// Breaks text into lines no wider than a max width, at spaces with TEXT_FLAG_WORD_WRAP and cut off with "..." with
+// TEXT_FLAG_ELLIPSIS. The advances are summed up once, so the break of every line is a binary search instead of
+// measuring substrings over and over. The vectors are kept, so wrapped text does not allocate every frame.
+class TextLayout
+{
+  public:
+    // Color tags are applied and the parsed chars stored with the color they are drawn with, measure(codePoint)
+    // returns the GlyphMetrics of a char or null for chars the font does not have, those are skipped. Returns the
+    // width of the widest line.
+    template <typename CharT, typename Measure>
+    inline float BreakLines(std::basic_string_view<CharT> text, uint32_t color, uint32_t flags, float scale,
+                            float maxWidth, Measure &&measure)
+    {
+        std::vector<TextLayoutChar> &chars = this->_chars;
+        std::vector<float> &advances = this->_advances;
+        std::vector<TextLine> &lines = this->_lines;
+
+        chars.clear();
+        lines.clear();
+        advances.assign(1, 0.f);
+
+        uint32_t currentColor = color;
+        bool tagColor = false;
+
+        // advances[i] is the width of chars [0, i), line breaks and tags take no room
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            uint32_t parsedColor;
+            if (const size_t tagLength = detail::ParseColorTag(text, i, parsedColor))
+            {
+                currentColor = parsedColor;
+                tagColor = true;
+                i += tagLength - 1;
+                continue;
+            }
+
+            const uint32_t c = detail::DecodeCodePoint(text, i);
+            float advance = 0.f;
+
+            if (c != '\n')
+            {
+                const GlyphMetrics *metrics = c >= L' ' ? measure(c) : nullptr;
+                if (!metrics)
+                {
+                    continue;
+                }
+
+                advance = static_cast<float>(metrics->advance) * scale;
+            }
+
+            chars.push_back({c, currentColor, tagColor});
+            advances.push_back(advances.back() + advance);
+        }
+
+        const GlyphMetrics *dot = (flags & TEXT_FLAG_ELLIPSIS) ? measure('.') : nullptr;
+        const float ellipsisWidth = dot ? 3.f * static_cast<float>(dot->advance) * scale : 0.f;
+        const size_t count = chars.size();
+        float width = 0.f;
+
+        size_t lineBreak = 0;
+
+        for (size_t begin = 0; begin <= count;)
+        {
+            // the wrapped lines of a paragraph share its line break, it is only searched for once per paragraph
+            if (begin == 0 || begin > lineBreak)
+            {
+                lineBreak = begin;
+                while (lineBreak < count && chars[lineBreak].codePoint != '\n')
+                {
+                    lineBreak++;
+                }
+            }
+
+            TextLine line = {begin, lineBreak, 0.f, false};
+            size_t next = lineBreak + 1;
+
+            if (advances[lineBreak] - advances[begin] > maxWidth)
+            {
+                const auto first = advances.begin() + begin + 1;
+                const auto last = advances.begin() + lineBreak + 1;
+
+                if (flags & TEXT_FLAG_WORD_WRAP)
+                {
+                    // chars [begin, fit) fit, a line always takes at least one so the loop makes progress
+                    size_t fit = std::upper_bound(first, last, advances[begin] + maxWidth) - advances.begin() - 1;
+                    fit = (std::max)(fit, begin + 1);
+
+                    if (fit < lineBreak)
+                    {
+                        // break at the last space, words longer than a line are split
+                        size_t space = fit;
+                        while (space > begin && chars[space].codePoint != L' ')
+                        {
+                            space--;
+                        }
+
+                        line.end = space > begin ? space : fit;
+                        next = space > begin ? space + 1 : fit;
+
+                        // nothing but the line break left
+                        if (next == lineBreak)
+                        {
+                            next++;
+                        }
+                    }
+                }
+                else
+                {
+                    line.end = std::upper_bound(first, last, advances[begin] + maxWidth - ellipsisWidth) -
+                               advances.begin() - 1;
+                    line.ellipsis = dot != nullptr;
+                }
+            }
+
+            line.width = advances[line.end] - advances[line.begin] + (line.ellipsis ? ellipsisWidth : 0.f);
+            width = (std::max)(width, line.width);
+
+            lines.push_back(line);
+            begin = next;
+        }
+
+        return width;
+    }
+
+    inline const std::vector<TextLayoutChar> &GetChars() const
+    {
+        return this->_chars;
+    }
+
+    inline const std::vector<TextLine> &GetLines() const
+    {
+        return this->_lines;
+    }
+
+  private:
+    std::vector<TextLayoutChar> _chars;
+    std::vector<float> _advances;
+    std::vector<TextLine> _lines;
+};
+} // namespace CheatRenderFramework
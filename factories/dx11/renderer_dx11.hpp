@@ -5,13 +5,30 @@
 #include <cmath>
 #include <unordered_map>
 #include <array>
-#include <map>
 #include <algorithm>
+#include <string>
+#include <string_view>
+#include <span>
+#include <format>
+#include <charconv>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
 
 #include <d3d11.h>
 #include <d3dcompiler.h>
 #include <DirectXMath.h>
 
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "../common/renderer_common.hpp"
+
 #pragma comment(lib, "d3dcompiler")
 
 namespace CheatRenderFramework
@@ -34,1153 +51,3712 @@ template <class T> void SafeRelease(T **ppT)
         *ppT = NULL;
     }
 }
-} // namespace detail
 
-class Renderer;
-class RenderList;
-class Font;
+// Projects points with a row-vector view-projection matrix, as DirectXMath builds them, to a width x height viewport.
+// Writes bit 0 of visible for points in front of the near plane and bit 1 for points inside the frustum, the screen
+// position is only meaningful for points in front of the near plane.
+inline void ProjectPointsScalar(const DirectX::XMFLOAT4X4 &m, const DirectX::XMFLOAT3 *in, DirectX::XMFLOAT2 *out,
+                                uint8_t *visible, size_t count, float width, float height)
+{
+    const float halfWidth = width * 0.5f;
+    const float halfHeight = height * 0.5f;
 
-using RenderListPtr = std::shared_ptr<RenderList>;
-using RendererPtr = std::shared_ptr<Renderer>;
-using FontPtr = std::shared_ptr<Font>;
-using FontHandle = size_t;
+    for (size_t i = 0; i < count; i++)
+    {
+        const DirectX::XMFLOAT3 &p = in[i];
+        const float cx = p.x * m.m[0][0] + p.y * m.m[1][0] + p.z * m.m[2][0] + m.m[3][0];
+        const float cy = p.x * m.m[0][1] + p.y * m.m[1][1] + p.z * m.m[2][1] + m.m[3][1];
+        const float cz = p.x * m.m[0][2] + p.y * m.m[1][2] + p.z * m.m[2][2] + m.m[3][2];
+        const float cw = p.x * m.m[0][3] + p.y * m.m[1][3] + p.z * m.m[2][3] + m.m[3][3];
+
+        const bool inFront = cz >= 0.f && cw > 0.f;
+        const bool onScreen = inFront && std::fabs(cx) <= cw && std::fabs(cy) <= cw && cz <= cw;
+        visible[i] = static_cast<uint8_t>((inFront ? 1 : 0) | (onScreen ? 2 : 0));
+
+        const float invW = 1.f / cw;
+        out[i] = DirectX::XMFLOAT2(cx * invW * halfWidth + halfWidth, halfHeight - cy * invW * halfHeight);
+    }
+}
 
-using TopologyType = D3D11_PRIMITIVE_TOPOLOGY;
+inline void ProjectPoints(const DirectX::XMFLOAT4X4 &m, const DirectX::XMFLOAT3 *in, DirectX::XMFLOAT2 *out,
+                          uint8_t *visible, size_t count, float width, float height)
+{
+    size_t i = 0;
 
-using Vec2 = DirectX::XMFLOAT2;
-using Vec3 = DirectX::XMFLOAT3;
-using Vec4 = DirectX::XMFLOAT4;
+#if defined(_M_IX86) || defined(_M_X64)
+    __m128 mat[4][4];
+    for (int row = 0; row < 4; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            mat[row][col] = _mm_set1_ps(m.m[row][col]);
+        }
+    }
 
-static constexpr wchar_t g_charRangeMin = 0x20;
-static constexpr wchar_t g_charRangeMax = 0x250;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 halfWidth = _mm_set1_ps(width * 0.5f);
+    const __m128 halfHeight = _mm_set1_ps(height * 0.5f);
 
-static constexpr const char g_vertexShader[] = "cbuffer vertexBuffer : register(b0) \
-            {\
-              float4x4 ProjectionMatrix; \
-            };\
-            struct VS_INPUT\
-            {\
-              float2 pos : POSITION;\
-              float4 col : COLOR0;\
-              float2 uv  : TEXCOORD0;\
-            };\
-            \
-            struct PS_INPUT\
-            {\
-              float4 pos : SV_POSITION;\
-              float4 col : COLOR0;\
-              float2 uv  : TEXCOORD0;\
-            };\
-            \
-            PS_INPUT main(VS_INPUT input)\
-            {\
-              PS_INPUT output;\
-              output.pos = mul( ProjectionMatrix, float4(input.pos.xy, 0.f, 1.f));\
-              output.col = input.col;\
-              output.uv  = input.uv;\
-              return output;\
-            }";
+    for (; i + 4 <= count; i += 4)
+    {
+        // x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3, shuffled into one register per component
+        const float *src = &in[i].x;
+        const __m128 p0 = _mm_loadu_ps(src);
+        const __m128 p1 = _mm_loadu_ps(src + 4);
+        const __m128 p2 = _mm_loadu_ps(src + 8);
+
+        const __m128 x = _mm_shuffle_ps(_mm_shuffle_ps(p0, p0, _MM_SHUFFLE(3, 3, 0, 0)),
+                                        _mm_shuffle_ps(p1, p2, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 y = _mm_shuffle_ps(_mm_shuffle_ps(p0, p1, _MM_SHUFFLE(0, 0, 0, 1)),
+                                        _mm_shuffle_ps(p1, p2, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 z = _mm_shuffle_ps(_mm_shuffle_ps(p0, p1, _MM_SHUFFLE(1, 1, 2, 2)),
+                                        _mm_shuffle_ps(p2, p2, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+
+        __m128 clip[4];
+        for (int col = 0; col < 4; col++)
+        {
+            clip[col] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, mat[0][col]), _mm_mul_ps(y, mat[1][col])),
+                                   _mm_add_ps(_mm_mul_ps(z, mat[2][col]), mat[3][col]));
+        }
 
-static constexpr const char g_pixelShader[] = "struct PS_INPUT\
-            {\
-            float4 pos : SV_POSITION;\
-            float4 col : COLOR0;\
-            float2 uv  : TEXCOORD0;\
-            };\
-            sampler sampler0;\
-            Texture2D texture0;\
-            \
-            float4 main(PS_INPUT input) : SV_Target\
-            {\
-            float4 out_col = input.col * texture0.Sample(sampler0, input.uv); \
-            return out_col; \
-            }";
+        const __m128 inFront = _mm_and_ps(_mm_cmpge_ps(clip[2], zero), _mm_cmpgt_ps(clip[3], zero));
+        const __m128 inside = _mm_and_ps(_mm_cmple_ps(_mm_and_ps(clip[0], absMask), clip[3]),
+                                         _mm_cmple_ps(_mm_and_ps(clip[1], absMask), clip[3]));
+        const __m128 onScreen = _mm_and_ps(_mm_and_ps(inFront, inside), _mm_cmple_ps(clip[2], clip[3]));
 
-enum FontFlags : int32_t
-{
-    FONT_FLAG_NONE = 0,
-    FONT_FLAG_BOLD = 1 << 0,
-    FONT_FLAG_ITALIC = 1 << 1,
-    FONT_FLAG_CLEAR_TYPE = 1 << 2,
-    FONT_FLAG_MAX
-};
+        const __m128 invW = _mm_div_ps(one, clip[3]);
+        const __m128 sx = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(clip[0], invW), halfWidth), halfWidth);
+        const __m128 sy = _mm_sub_ps(halfHeight, _mm_mul_ps(_mm_mul_ps(clip[1], invW), halfHeight));
+
+        float *dst = &out[i].x;
+        _mm_storeu_ps(dst, _mm_unpacklo_ps(sx, sy));
+        _mm_storeu_ps(dst + 4, _mm_unpackhi_ps(sx, sy));
+
+        const int frontMask = _mm_movemask_ps(inFront);
+        const int screenMask = _mm_movemask_ps(onScreen);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            visible[i + lane] = static_cast<uint8_t>(((frontMask >> lane) & 1) | (((screenMask >> lane) & 1) << 1));
+        }
+    }
+#endif
+
+    ProjectPointsScalar(m, in + i, out + i, visible + i, count - i, width, height);
+}
 
-enum TextFlags : int32_t
+// Two unit axes spanning the plane perpendicular to normal.
+inline void PlaneAxes(const DirectX::XMFLOAT3 &normal, DirectX::XMFLOAT3 &u, DirectX::XMFLOAT3 &w)
 {
-    TEXT_FLAG_NONE = 0,
-    TEXT_FLAG_LEFT = 0 << 0,
-    TEXT_FLAG_RIGHT = 1 << 1,
-    TEXT_FLAG_CENTERED_X = 1 << 2,
-    TEXT_FLAG_CENTERED_Y = 1 << 3,
-    TEXT_FLAG_CENTERED = TEXT_FLAG_CENTERED_X | TEXT_FLAG_CENTERED_Y,
-    TEXT_FLAG_DROPSHADOW = 1 << 4,
-    TEXT_FLAG_OUTLINE = 1 << 5,
-    TEXT_FLAG_COLORTAGS = 1 << 6,
-    TEXT_FLAG_MAX
-};
+    const float length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+    const DirectX::XMFLOAT3 n(normal.x / length, normal.y / length, normal.z / length);
 
-class Color
+    // cross the normal with the x or y axis, whichever is further from being parallel to it
+    u = std::fabs(n.x) < 0.9f ? DirectX::XMFLOAT3(0.f, -n.z, n.y) : DirectX::XMFLOAT3(n.z, 0.f, -n.x);
+
+    const float uLength = std::sqrt(u.x * u.x + u.y * u.y + u.z * u.z);
+    u = DirectX::XMFLOAT3(u.x / uLength, u.y / uLength, u.z / uLength);
+    w = DirectX::XMFLOAT3(n.y * u.z - n.z * u.y, n.z * u.x - n.x * u.z, n.x * u.y - n.y * u.x);
+}
+
+// Stable LSD radix sort, order receives the indices of the keys in ascending key order. Bytes which are the same in
+// every key are skipped, so keys differing in a few high bits only take a pass or two.
+inline void RadixSort(const uint64_t *keys, size_t count, uint32_t *order, std::vector<uint32_t> &scratch)
 {
-  public:
-    Color() = default;
+    scratch.resize(count);
 
-    Color(const uint32_t color) : _color(color)
-    {
-    }
+    uint32_t *src = order;
+    uint32_t *dst = scratch.data();
+    uint64_t differing = 0;
 
-    Color(const float r, const float g, const float b, const float a = 1.f)
+    for (size_t i = 0; i < count; i++)
     {
-        this->_color = ToHexColor(r, g, b, a);
+        src[i] = static_cast<uint32_t>(i);
+        differing |= keys[i] ^ keys[0];
     }
 
-    Color(const int r, const int g, const int b, const int a = 255)
+    for (int shift = 0; shift < 64; shift += 8)
     {
-        this->_color = ToHexColor(static_cast<float>(r) / 255.f, static_cast<float>(g) / 255.f,
-                                  static_cast<float>(b) / 255.f, static_cast<float>(a) / 255.f);
-    }
+        if (!((differing >> shift) & 0xff))
+        {
+            continue;
+        }
 
-    explicit operator uint32_t() const
-    {
-        return _color;
+        size_t offsets[257] = {};
+        for (size_t i = 0; i < count; i++)
+        {
+            offsets[((keys[i] >> shift) & 0xff) + 1]++;
+        }
+
+        for (size_t i = 1; i < 257; i++)
+        {
+            offsets[i] += offsets[i - 1];
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            dst[offsets[(keys[src[i]] >> shift) & 0xff]++] = src[i];
+        }
+
+        std::swap(src, dst);
     }
 
-    inline uint32_t ToHexColor() const
+    if (src != order)
     {
-        return _color;
+        memcpy(order, src, count * sizeof(uint32_t));
     }
+}
 
-    inline void FromHexColor(uint32_t color)
+// Incremental 64-bit hash of recorded data, good enough to tell frames apart but not collision resistant.
+inline uint64_t HashBytes(uint64_t hash, const void *data, size_t size)
+{
+    constexpr uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    for (; size >= sizeof(uint64_t); bytes += sizeof(uint64_t), size -= sizeof(uint64_t))
     {
-        this->_color = color;
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(uint64_t));
+        hash = (hash ^ word) * multiplier;
+        hash ^= hash >> 29;
     }
 
-  private:
-    inline uint32_t ToHexColor(float r, float g, float b, float a) const
+    if (size > 0)
     {
-        uint8_t aByte = static_cast<uint8_t>(a * 255.0f);
-        uint8_t rByte = static_cast<uint8_t>(r * 255.0f);
-        uint8_t gByte = static_cast<uint8_t>(g * 255.0f);
-        uint8_t bByte = static_cast<uint8_t>(b * 255.0f);
-
-        return (aByte << 24) | (bByte << 16) | (gByte << 8) | rByte;
+        uint64_t word = static_cast<uint64_t>(size) << 56;
+        memcpy(&word, bytes, size);
+        hash = (hash ^ word) * multiplier;
+        hash ^= hash >> 29;
     }
 
-    uint32_t _color = 0xFF000000;
-};
+    return hash;
+}
 
-struct Vertex
+// Byte ranges [begin, end) of current which differ from previous. Compared in chunks, so changes close to each other
+// end up in a single range, and everything past the end of previous is dirty.
+inline void DiffChunks(const uint8_t *previous, size_t previousSize, const uint8_t *current, size_t currentSize,
+                       size_t chunkSize, std::vector<std::pair<size_t, size_t>> &ranges)
 {
-    Vertex() = default;
+    ranges.clear();
 
-    Vertex(const Vec2 &pos, Color color, const Vec2 &uv) : pos(pos), color(color), uv(uv)
+    for (size_t offset = 0; offset < currentSize; offset += chunkSize)
     {
-    }
+        const size_t size = min(chunkSize, currentSize - offset);
 
-    Vertex(const Vec2 &pos, Color color) : pos(pos), color(color)
-    {
+        if (offset + size <= previousSize && memcmp(previous + offset, current + offset, size) == 0)
+        {
+            continue;
+        }
+
+        if (!ranges.empty() && ranges.back().second == offset)
+        {
+            ranges.back().second = offset + size;
+        }
+        else
+        {
+            ranges.emplace_back(offset, offset + size);
+        }
     }
+}
 
-    Vertex(const float x, const float y, Color color) : pos(x, y), color(color)
+// Merges neighbouring ranges sorted by offset until at most maxRanges are left. The smallest gaps are closed first, so
+// as few unchanged bytes as possible are written along with the changed ones. gaps is scratch.
+inline void MergeRanges(std::vector<std::pair<size_t, size_t>> &ranges, size_t maxRanges, std::vector<size_t> &gaps)
+{
+    if (maxRanges == 0 || ranges.size() <= maxRanges)
     {
+        return;
     }
 
-    Vec2 pos{};
-    Color color{};
-    Vec2 uv{};
-};
-
-struct Batch
-{
-    Batch(size_t count, const TopologyType topology, ID3D11ShaderResourceView *texture = nullptr)
-        : count(count), topology(topology), texture(texture)
+    gaps.clear();
+    for (size_t i = 1; i < ranges.size(); i++)
     {
+        gaps.push_back(ranges[i].first - ranges[i - 1].second);
     }
 
-    std::size_t count = 0;
-    TopologyType topology = TopologyType::D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
-    ID3D11ShaderResourceView *texture = nullptr;
-};
+    // every gap below the threshold is closed, gaps equal to it only until enough were
+    size_t merges = ranges.size() - maxRanges;
+    std::nth_element(gaps.begin(), gaps.begin() + (merges - 1), gaps.end());
+    const size_t threshold = gaps[merges - 1];
 
-class RenderList : public std::enable_shared_from_this<RenderList>
-{
-  public:
-    RenderList() = delete;
-    RenderList(size_t maxVertices)
+    for (size_t i = 1; i < ranges.size(); i++)
     {
-        this->_vertices.reserve(maxVertices);
+        if (ranges[i].first - ranges[i - 1].second < threshold)
+        {
+            merges--;
+        }
     }
 
-    template <size_t N>
-    inline void AddVertices(const Vertex (&vertexArray)[N], const TopologyType topology,
-                            ID3D11ShaderResourceView *texture)
+    size_t last = 0;
+    for (size_t i = 1; i < ranges.size(); i++)
     {
-        const size_t numVertices = this->_vertices.size();
+        const size_t gap = ranges[i].first - ranges[last].second;
+        bool merge = gap < threshold;
 
-        if (this->_batches.empty() || this->_batches.back().topology != topology ||
-            this->_batches.back().texture != texture)
+        if (gap == threshold && merges > 0)
         {
-            this->_batches.emplace_back(0, topology, texture);
+            merge = true;
+            merges--;
         }
 
-        this->_batches.back().count += N;
-        this->_vertices.resize(numVertices + N);
+        if (merge)
+        {
+            ranges[last].second = ranges[i].second;
+        }
+        else
+        {
+            ranges[++last] = ranges[i];
+        }
+    }
 
-        memcpy(&this->_vertices[this->_vertices.size() - N], &vertexArray[0], N * sizeof(Vertex));
+    ranges.resize(last + 1);
+}
 
-        switch (topology)
+// What was last uploaded to a buffer, kept on the CPU so the next upload only has to write the chunks which changed.
+struct RetainedBuffer
+{
+    std::vector<uint8_t> current;
+    std::vector<uint8_t> previous;
+    std::vector<std::pair<size_t, size_t>> dirtyRanges;
+    std::vector<size_t> gaps;
+};
+
+// Bakes the field outlines are drawn from into a cell padded by padding pixels on every side. It is 255 on the glyph
+// and falls off linearly to 0 at padding + 1 pixels away from it, so an outline as thick as the padding is the field.
+inline void BakeOutlineField(const uint8_t *src, long width, long height, long srcPitch, long padding, uint8_t *dst,
+                             long dstStride, long dstPitch)
+{
+    const float range = static_cast<float>(padding + 1);
+
+    for (long y = 0; y < height + 2 * padding; y++)
+    {
+        for (long x = 0; x < width + 2 * padding; x++)
         {
-        default:
-            break;
+            float distance = range;
 
-        case D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP:
-        case D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP_ADJ:
-        case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP:
-        case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP_ADJ:
-            // add a new empty batch to force the end of the strip
-            this->_batches.emplace_back(0, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, nullptr);
-            break;
+            // source pixels within padding of the cell pixel, partially covered ones count as farther away
+            for (long sy = max(y - 2 * padding, 0L); sy < min(y + 1, height); sy++)
+            {
+                for (long sx = max(x - 2 * padding, 0L); sx < min(x + 1, width); sx++)
+                {
+                    const uint8_t coverage = src[srcPitch * sy + sx];
+                    if (!coverage)
+                    {
+                        continue;
+                    }
+
+                    const float dx = static_cast<float>(sx + padding - x);
+                    const float dy = static_cast<float>(sy + padding - y);
+                    const float d = sqrtf(dx * dx + dy * dy) + 1.f - coverage / 255.f;
+
+                    distance = min(distance, d);
+                }
+            }
+
+            dst[dstPitch * y + dstStride * x] = static_cast<uint8_t>(255.f * (1.f - distance / range) + 0.5f);
         }
     }
+}
 
-    inline void AddVertices(Vertex *vertexArray, size_t vertexArrayCount, const TopologyType topology,
-                            ID3D11ShaderResourceView *texture)
+// Read-only mapping of a whole file.
+class MappedFile
+{
+  public:
+    MappedFile(const std::wstring &path) : _file(INVALID_HANDLE_VALUE), _mapping(nullptr), _data(nullptr), _size(0)
     {
-        const size_t numVertices = this->_vertices.size();
+        this->_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (this->_file == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
 
-        if (this->_batches.empty() || this->_batches.back().topology != topology ||
-            this->_batches.back().texture != texture)
+        LARGE_INTEGER fileSize{};
+        if (!GetFileSizeEx(this->_file, &fileSize) || fileSize.QuadPart == 0)
         {
-            this->_batches.emplace_back(0, topology, texture);
+            return;
         }
 
-        this->_batches.back().count += vertexArrayCount;
-        this->_vertices.resize(numVertices + vertexArrayCount);
+        this->_mapping = CreateFileMappingW(this->_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!this->_mapping)
+        {
+            return;
+        }
+
+        this->_data = static_cast<const uint8_t *>(MapViewOfFile(this->_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (this->_data)
+        {
+            this->_size = static_cast<size_t>(fileSize.QuadPart);
+        }
+    }
 
-        memcpy(&this->_vertices[this->_vertices.size() - vertexArrayCount], vertexArray,
-               vertexArrayCount * sizeof(Vertex));
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
 
-        switch (topology)
+    ~MappedFile()
+    {
+        if (this->_data)
         {
-        default:
-            break;
+            UnmapViewOfFile(this->_data);
+        }
 
-        case D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP:
-        case D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP_ADJ:
-        case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP:
-        case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP_ADJ:
-            // add a new empty batch to force the end of the strip
-            this->_batches.emplace_back(0, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, nullptr);
-            break;
+        if (this->_mapping)
+        {
+            CloseHandle(this->_mapping);
+        }
+
+        if (this->_file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(this->_file);
         }
     }
 
-    RenderListPtr MakePtr()
+    inline const uint8_t *GetData() const
     {
-        return shared_from_this();
+        return this->_data;
     }
 
-    void Clear()
+    inline size_t GetSize() const
     {
-        this->_vertices.clear();
-        this->_batches.clear();
+        return this->_size;
     }
 
-  protected:
-    friend class Renderer;
-
-    std::vector<Vertex> _vertices{};
-    std::vector<Batch> _batches{};
+  private:
+    HANDLE _file;
+    HANDLE _mapping;
+    const uint8_t *_data;
+    size_t _size;
 };
 
-class Font : public std::enable_shared_from_this<Font>
+// Fixed set of worker threads draining a FIFO queue. Pending tasks are dropped on destruction, running ones are
+// waited for.
+class ThreadPool
 {
   public:
-    using TextSegment = std::pair<std::wstring, Color>;
+    ThreadPool(size_t workerCount) : _stop(false)
+    {
+        for (size_t i = 0; i < workerCount; i++)
+        {
+            this->_workers.emplace_back([this]() { this->WorkerLoop(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
 
-    Font(const RenderListPtr &renderList, ID3D11Device *d3dDevice, const std::wstring &fontFamily, long fontHeigth,
-         uint32_t fontFlags = FONT_FLAG_NONE)
-        : _renderList(renderList), _d3dDevice(d3dDevice), _fontFamily(fontFamily), _fontHeigth(fontHeigth),
-          _fontFlags(fontFlags), _charSpacing(0), _fontTextureView(nullptr), _textScale(1.f), _textureWidth(1024),
-          _textureHeight(1024), _initialized(false)
+    ~ThreadPool()
     {
-        this->_d3dDevice->GetImmediateContext(&this->_d3dDeviceContext);
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            this->_stop = true;
+        }
+
+        this->_condition.notify_all();
 
-        this->Initialize();
+        for (std::thread &worker : this->_workers)
+        {
+            worker.join();
+        }
     }
 
-    ~Font()
+    inline void Submit(std::function<void()> task)
     {
-        this->Release();
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            this->_tasks.push_back(std::move(task));
+        }
+
+        this->_condition.notify_one();
+    }
+
+    inline size_t GetWorkerCount() const
+    {
+        return this->_workers.size();
+    }
+
+  private:
+    inline void WorkerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+
+            {
+                std::unique_lock<std::mutex> lock(this->_mutex);
+                this->_condition.wait(lock, [this]() { return this->_stop || !this->_tasks.empty(); });
+
+                if (this->_stop)
+                {
+                    return;
+                }
+
+                task = std::move(this->_tasks.front());
+                this->_tasks.pop_front();
+            }
+
+            // a failing task must not take the process down with it
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+            }
+        }
+    }
+
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _stop;
+};
+
+// Runs work(begin, end) over [0, count) in chunks on the calling thread and the pool, and returns once every chunk is
+// done. Chunks are claimed from a shared counter, so a pool busy with other tasks only means the calling thread does
+// more of them. Helpers which start after all chunks are claimed return without touching anything. The first exception
+// thrown by a chunk is rethrown on the calling thread once all chunks are done.
+inline void ParallelFor(ThreadPool *pool, size_t count, size_t chunkSize,
+                        const std::function<void(size_t, size_t)> &work)
+{
+    struct Job
+    {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        size_t chunks = 0;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::exception_ptr error;
+    };
+
+    auto job = std::make_shared<Job>();
+    job->chunks = (count + chunkSize - 1) / chunkSize;
+
+    auto run = [job, count, chunkSize, &work]() {
+        for (size_t chunk = job->next++; chunk < job->chunks; chunk = job->next++)
+        {
+            const size_t begin = chunk * chunkSize;
+
+            // a failed chunk still counts as done, otherwise the caller would wait forever
+            try
+            {
+                work(begin, min(begin + chunkSize, count));
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                if (!job->error)
+                {
+                    job->error = std::current_exception();
+                }
+            }
+
+            if (++job->done == job->chunks)
+            {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                job->condition.notify_all();
+            }
+        }
+    };
+
+    if (pool)
+    {
+        const size_t helpers = min(pool->GetWorkerCount(), job->chunks - 1);
+
+        for (size_t i = 0; i < helpers; i++)
+        {
+            pool->Submit(run);
+        }
+    }
+
+    run();
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->condition.wait(lock, [&job]() { return job->done == job->chunks; });
+
+    if (job->error)
+    {
+        std::rethrow_exception(job->error);
+    }
+}
+
+} // namespace detail
+
+class Renderer;
+class RenderList;
+class Font;
+class FontAtlas;
+
+using RenderListPtr = std::shared_ptr<RenderList>;
+using RendererPtr = std::shared_ptr<Renderer>;
+using FontPtr = std::shared_ptr<Font>;
+using FontHandle = size_t;
+using TextHandle = size_t;
+
+using TopologyType = D3D11_PRIMITIVE_TOPOLOGY;
+
+using Vec2 = DirectX::XMFLOAT2;
+using Vec3 = DirectX::XMFLOAT3;
+using Vec4 = DirectX::XMFLOAT4;
+
+// room around every glyph for its outline and shadow, also the thickest outline that can be drawn
+static constexpr long g_fontEffectPadding = 3;
+// bytes per atlas texel, the coverage and the outline field. The shadow is blurred from the coverage when drawing.
+static constexpr long g_fontAtlasChannels = 2;
+// smallest number of glyphs worth handing to a separate worker when baking asynchronously
+static constexpr uint32_t g_fontBakeChunkSize = 32;
+// shape commands tessellated by one task, fewer than this are tessellated on the render thread alone
+static constexpr size_t g_tessellateChunkSize = 256;
+static constexpr uint32_t g_fontCacheMagic = 0x43465243; // "CRFC"
+static constexpr uint32_t g_fontCacheVersion = 1;
+static constexpr uint32_t g_fontCacheNoPixels = 0xffffffff;
+// granularity of the comparison with the previous upload when partial uploads are enabled
+static constexpr size_t g_uploadChunkSize = 256;
+// more changed ranges than this are merged across the smallest gaps, every UpdateSubresource() call has a fixed cost
+static constexpr size_t g_uploadMaxRanges = 16;
+// characters AddTextFormat formats on the stack, longer output is cut off at the last whole code point
+static constexpr size_t g_textFormatBufferSize = 256;
+
+static constexpr const char g_vertexShader[] = "cbuffer vertexBuffer : register(b0) \
+            {\
+              float4x4 ProjectionMatrix; \
+            };\
+            struct VS_INPUT\
+            {\
+              float2 pos : POSITION;\
+              float4 col : COLOR0;\
+              float2 uv  : TEXCOORD0;\
+            };\
+            \
+            struct PS_INPUT\
+            {\
+              float4 pos : SV_POSITION;\
+              float4 col : COLOR0;\
+              float4 outlineCol : COLOR1;\
+              float2 uv  : TEXCOORD0;\
+              nointerpolation uint effect : EFFECT;\
+            };\
+            \
+            PS_INPUT main(VS_INPUT input)\
+            {\
+              PS_INPUT output;\
+              output.pos = mul( ProjectionMatrix, float4(input.pos.xy, 0.f, 1.f));\
+              output.col = input.col;\
+              output.outlineCol = float4(0.f, 0.f, 0.f, 0.f);\
+              output.uv  = input.uv;\
+              output.effect = 0;\
+              return output;\
+            }";
+
+// Expands one GlyphInstance into a quad, uv rect and padded size of the glyph come from the atlas' glyph buffer. The
+// quad is scaled and moved up-left by g_fontEffectPadding, so the glyph itself lands on the cell position.
+static constexpr const char g_glyphVertexShader[] = "cbuffer vertexBuffer : register(b0) \
+            {\
+              float4x4 ProjectionMatrix; \
+            };\
+            Buffer<float4> glyphs : register(t0);\
+            struct VS_INPUT\
+            {\
+              float2 pos        : POSITION;\
+              uint   glyph      : GLYPH;\
+              float4 col        : COLOR0;\
+              float4 outlineCol : COLOR1;\
+              uint   effect     : EFFECT;\
+              float  scale      : SCALE;\
+              uint   id         : SV_VertexID;\
+            };\
+            \
+            struct PS_INPUT\
+            {\
+              float4 pos : SV_POSITION;\
+              float4 col : COLOR0;\
+              float4 outlineCol : COLOR1;\
+              float2 uv  : TEXCOORD0;\
+              nointerpolation uint effect : EFFECT;\
+            };\
+            \
+            PS_INPUT main(VS_INPUT input)\
+            {\
+              float4 uvRect = glyphs.Load(input.glyph * 2);\
+              float2 size = glyphs.Load(input.glyph * 2 + 1).xy;\
+              float2 corner = float2(input.id & 1, input.id >> 1);\
+              PS_INPUT output;\
+              float2 pos = input.pos + (corner * size - 3.f) * input.scale - 0.5f;\
+              output.pos = mul( ProjectionMatrix, float4(pos, 0.f, 1.f));\
+              output.col = input.col;\
+              output.outlineCol = input.outlineCol;\
+              output.uv  = lerp(uvRect.xy, uvRect.zw, corner);\
+              output.effect = input.effect;\
+              return output;\
+            }";
+
+// World-space primitives, projected with the view-projection matrix of the frame. The rasterizer clips them against
+// the near plane before the perspective divide, so nothing behind the camera is mirrored onto the screen.
+static constexpr const char g_worldVertexShader[] = "cbuffer vertexBuffer : register(b0) \
+            {\
+              float4x4 ProjectionMatrix; \
+              float4x4 ViewProjectionMatrix; \
+            };\
+            struct VS_INPUT\
+            {\
+              float3 pos : POSITION;\
+              float4 col : COLOR0;\
+            };\
+            \
+            struct PS_INPUT\
+            {\
+              float4 pos : SV_POSITION;\
+              float4 col : COLOR0;\
+              float4 outlineCol : COLOR1;\
+              float2 uv  : TEXCOORD0;\
+              nointerpolation uint effect : EFFECT;\
+            };\
+            \
+            PS_INPUT main(VS_INPUT input)\
+            {\
+              PS_INPUT output;\
+              output.pos = mul( ViewProjectionMatrix, float4(input.pos, 1.f));\
+              output.col = input.col;\
+              output.outlineCol = float4(0.f, 0.f, 0.f, 0.f);\
+              output.uv  = float2(0.f, 0.f);\
+              output.effect = 0;\
+              return output;\
+            }";
+
+// Composites fill (red), outline (green) and shadow of the atlas in one pass. The outline field falls off over
+// g_fontEffectPadding + 1 pixels, see detail::BakeOutlineField(). The shadow is the coverage moved one pixel down and
+// right and blurred over 3x3 pixels by four bilinear taps.
+static constexpr const char g_pixelShader[] = "struct PS_INPUT\
+            {\
+            float4 pos : SV_POSITION;\
+            float4 col : COLOR0;\
+            float4 outlineCol : COLOR1;\
+            float2 uv  : TEXCOORD0;\
+            nointerpolation uint effect : EFFECT;\
+            };\
+            sampler sampler0;\
+            Texture2D texture0;\
+            \
+            float4 over(float4 src, float4 dst)\
+            {\
+            float a = src.a + dst.a * (1.f - src.a);\
+            return float4((src.rgb * src.a + dst.rgb * dst.a * (1.f - src.a)) / max(a, 1e-5f), a);\
+            }\
+            \
+            float4 main(PS_INPUT input) : SV_Target\
+            {\
+            float4 tex = texture0.Sample(sampler0, input.uv);\
+            float4 out_col = float4(input.col.rgb, input.col.a * tex.r); \
+            if (input.effect & 1)\
+            {\
+            float thickness = float(input.effect >> 8) / 256.f;\
+            float outline = max(saturate(thickness + 1.f - (1.f - tex.g) * 4.f), tex.r);\
+            out_col = over(out_col, float4(input.outlineCol.rgb, input.outlineCol.a * outline));\
+            }\
+            if (input.effect & 2)\
+            {\
+            float2 texel;\
+            texture0.GetDimensions(texel.x, texel.y);\
+            texel = 1.f / texel;\
+            float shadow = texture0.Sample(sampler0, input.uv - texel * 0.5f).r;\
+            shadow += texture0.Sample(sampler0, input.uv - texel * float2(1.5f, 0.5f)).r;\
+            shadow += texture0.Sample(sampler0, input.uv - texel * float2(0.5f, 1.5f)).r;\
+            shadow += texture0.Sample(sampler0, input.uv - texel * 1.5f).r;\
+            out_col = over(out_col, float4(0.f, 0.f, 0.f, input.col.a * shadow * 0.25f));\
+            }\
+            return out_col; \
+            }";
+
+enum FontFlags : int32_t
+{
+    FONT_FLAG_NONE = 0,
+    FONT_FLAG_BOLD = 1 << 0,
+    FONT_FLAG_ITALIC = 1 << 1,
+    FONT_FLAG_CLEAR_TYPE = 1 << 2,
+    FONT_FLAG_MAX
+};
+
+// Effects the pixel shader composites below a glyph, the upper 24 bits hold the outline thickness in 1/256 px.
+enum GlyphEffect : uint32_t
+{
+    GLYPH_EFFECT_NONE = 0,
+    GLYPH_EFFECT_OUTLINE = 1 << 0,
+    GLYPH_EFFECT_SHADOW = 1 << 1
+};
+
+// Per point result of Renderer::ProjectPoints()
+enum ProjectionFlags : uint8_t
+{
+    PROJECTION_FLAG_NONE = 0,
+    // in front of the near plane, the screen position is valid
+    PROJECTION_FLAG_IN_FRONT = 1 << 0,
+    // inside the view frustum
+    PROJECTION_FLAG_ON_SCREEN = 1 << 1
+};
+
+class Color
+{
+  public:
+    Color() = default;
+
+    Color(const uint32_t color) : _color(color)
+    {
+    }
+
+    Color(const float r, const float g, const float b, const float a = 1.f)
+    {
+        this->_color = ToHexColor(r, g, b, a);
+    }
+
+    Color(const int r, const int g, const int b, const int a = 255)
+    {
+        this->_color = ToHexColor(static_cast<float>(r) / 255.f, static_cast<float>(g) / 255.f,
+                                  static_cast<float>(b) / 255.f, static_cast<float>(a) / 255.f);
+    }
+
+    explicit operator uint32_t() const
+    {
+        return _color;
+    }
+
+    inline uint32_t ToHexColor() const
+    {
+        return _color;
+    }
+
+    inline void FromHexColor(uint32_t color)
+    {
+        this->_color = color;
+    }
+
+  private:
+    inline uint32_t ToHexColor(float r, float g, float b, float a) const
+    {
+        uint8_t aByte = static_cast<uint8_t>(a * 255.0f);
+        uint8_t rByte = static_cast<uint8_t>(r * 255.0f);
+        uint8_t gByte = static_cast<uint8_t>(g * 255.0f);
+        uint8_t bByte = static_cast<uint8_t>(b * 255.0f);
+
+        return (aByte << 24) | (bByte << 16) | (gByte << 8) | rByte;
+    }
+
+    uint32_t _color = 0xFF000000;
+};
+
+struct Vertex
+{
+    Vertex() = default;
+
+    Vertex(const Vec2 &pos, Color color, const Vec2 &uv) : pos(pos), color(color), uv(uv)
+    {
+    }
+
+    Vertex(const Vec2 &pos, Color color) : pos(pos), color(color)
+    {
+    }
+
+    Vertex(const float x, const float y, Color color) : pos(x, y), color(color)
+    {
+    }
+
+    Vec2 pos{};
+    Color color{};
+    Vec2 uv{};
+};
+
+// Text is recorded as one of these per glyph instead of six vertices, the glyph vertex shader expands it.
+struct GlyphInstance
+{
+    // top-left corner of the glyph cell
+    Vec2 pos;
+    // slot in the atlas' glyph buffer
+    uint32_t glyphIndex;
+    Color color;
+    Color outlineColor;
+    uint32_t effect;
+    // size relative to the size the font was baked at
+    float scale;
+};
+
+// Vertex of a world-space primitive, projected by the world vertex shader, see Renderer::SetViewProjection().
+struct WorldVertex
+{
+    WorldVertex() = default;
+
+    WorldVertex(const Vec3 &pos, Color color) : pos(pos), color(color)
+    {
+    }
+
+    Vec3 pos{};
+    Color color{};
+};
+
+enum class BatchType : int32_t
+{
+    Vertices = 0,
+    // count is the number of GlyphInstances drawn instanced rather than vertices
+    GlyphInstances,
+    // count is the number of WorldVertices
+    WorldVertices
+};
+
+struct Batch
+{
+    Batch(size_t count, const TopologyType topology, ID3D11ShaderResourceView *texture = nullptr,
+          BatchType type = BatchType::Vertices, uint8_t layer = 0)
+        : count(count), topology(topology), texture(texture), type(type), layer(layer)
+    {
+    }
+
+    std::size_t count = 0;
+    TopologyType topology = TopologyType::D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+    ID3D11ShaderResourceView *texture = nullptr;
+    BatchType type = BatchType::Vertices;
+    uint8_t layer = 0;
+};
+
+enum class ShapeCommandType : uint32_t
+{
+    RectFilled = 0,
+    Line,
+    Circle
+};
+
+// A shape recorded by a list with deferred tessellation, tessellated when the list is rendered into the vertices it
+// reserved. Laid out without padding, so it can be hashed as it is.
+struct ShapeCommand
+{
+    ShapeCommandType type = ShapeCommandType::RectFilled;
+    // first vertex reserved in the list
+    uint32_t offset = 0;
+    // min and max of a rect, the end points of a line or the center of a circle
+    Vec2 p1{};
+    Vec2 p2{};
+    Color color{};
+    // line thickness or circle radius
+    float size = 0.f;
+    // circle segments
+    int32_t segments = 0;
+};
+
+class RenderList : public std::enable_shared_from_this<RenderList>
+{
+  public:
+    RenderList() = delete;
+    RenderList(size_t maxVertices)
+    {
+        this->_vertices.reserve(maxVertices);
+    }
+
+    template <size_t N>
+    inline void AddVertices(const Vertex (&vertexArray)[N], const TopologyType topology,
+                            ID3D11ShaderResourceView *texture)
+    {
+        this->HashRecord(BatchType::Vertices, topology, texture, vertexArray, N * sizeof(Vertex));
+
+        const size_t offset = this->ReserveVertices(N, topology, texture);
+        memcpy(&this->_vertices[offset], &vertexArray[0], N * sizeof(Vertex));
+    }
+
+    inline void AddVertices(Vertex *vertexArray, size_t vertexArrayCount, const TopologyType topology,
+                            ID3D11ShaderResourceView *texture)
+    {
+        this->HashRecord(BatchType::Vertices, topology, texture, vertexArray, vertexArrayCount * sizeof(Vertex));
+
+        const size_t offset = this->ReserveVertices(vertexArrayCount, topology, texture);
+        memcpy(&this->_vertices[offset], vertexArray, vertexArrayCount * sizeof(Vertex));
+    }
+
+    inline void AddGlyphInstances(const GlyphInstance *instances, size_t count, ID3D11ShaderResourceView *texture)
+    {
+        this->HashRecord(BatchType::GlyphInstances, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP, texture, instances,
+                         count * sizeof(GlyphInstance));
+
+        if (this->_batches.empty() || this->_batches.back().type != BatchType::GlyphInstances ||
+            this->_batches.back().texture != texture || this->_batches.back().layer != this->_layer)
+        {
+            this->_batches.emplace_back(0, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP, texture, BatchType::GlyphInstances,
+                                        this->_layer);
+        }
+
+        this->_batches.back().count += count;
+        this->_glyphInstances.insert(this->_glyphInstances.end(), instances, instances + count);
+    }
+
+    // World-space primitives are recorded as line or triangle lists, consecutive ones end up in a single draw.
+    inline void AddWorldVertices(const WorldVertex *vertexArray, size_t vertexArrayCount, const TopologyType topology,
+                                 ID3D11ShaderResourceView *texture)
+    {
+        this->HashRecord(BatchType::WorldVertices, topology, texture, vertexArray,
+                         vertexArrayCount * sizeof(WorldVertex));
+
+        if (this->_batches.empty() || this->_batches.back().type != BatchType::WorldVertices ||
+            this->_batches.back().topology != topology || this->_batches.back().texture != texture ||
+            this->_batches.back().layer != this->_layer)
+        {
+            this->_batches.emplace_back(0, topology, texture, BatchType::WorldVertices, this->_layer);
+        }
+
+        this->_batches.back().count += vertexArrayCount;
+        this->_worldVertices.insert(this->_worldVertices.end(), vertexArray, vertexArray + vertexArrayCount);
+    }
+
+    // Reserves the vertices of a shape and returns the index of the first, the renderer tessellates the shape into
+    // them. With deferred tessellation the command is kept until the list is rendered.
+    inline size_t AddShape(const ShapeCommand &command, size_t count, const TopologyType topology,
+                           ID3D11ShaderResourceView *texture)
+    {
+        this->HashRecord(BatchType::Vertices, topology, texture, &command, sizeof(ShapeCommand));
+
+        const size_t offset = this->ReserveVertices(count, topology, texture);
+
+        if (this->_deferredTessellation)
+        {
+            this->_commands.push_back(command);
+            this->_commands.back().offset = static_cast<uint32_t>(offset);
+        }
+
+        return offset;
+    }
+
+    // Records rects, lines and circles as commands which Render() tessellates in parallel, instead of tessellating
+    // them on the calling thread. Their vertices are reserved right away, so the order and the result are the same as
+    // without. Kept across Clear().
+    inline void SetDeferredTessellation(bool deferredTessellation)
+    {
+        this->_deferredTessellation = deferredTessellation;
+    }
+
+    inline bool IsDeferredTessellation() const
+    {
+        return this->_deferredTessellation;
+    }
+
+    // Layer of everything added afterwards, 0 until the list is cleared. Render() draws lower layers first and keeps
+    // the recorded order within a layer, so a layer only has to be set for content drawn out of order.
+    inline void SetLayer(uint8_t layer)
+    {
+        this->_layer = layer;
+    }
+
+    inline uint8_t GetLayer() const
+    {
+        return this->_layer;
+    }
+
+    // Clips the list to rect (left, top, right, bottom) in pixels when it is rendered, kept across Clear().
+    inline void SetClipRect(const Vec4 &rect)
+    {
+        this->_clipRect = rect;
+        this->_clipped = true;
+    }
+
+    inline void ResetClipRect()
+    {
+        this->_clipped = false;
+    }
+
+    // 2D transform of the shapes and text of the list applied when it is rendered, e.g. to scroll or scale a menu
+    // without recording it again. World-space primitives keep the view-projection only. Kept across Clear().
+    inline void SetTransform(const DirectX::XMMATRIX &transform)
+    {
+        DirectX::XMStoreFloat4x4(&this->_transform, transform);
+        this->_transformed = true;
+    }
+
+    inline void ResetTransform()
+    {
+        this->_transformed = false;
+    }
+
+    RenderListPtr MakePtr()
+    {
+        return shared_from_this();
+    }
+
+    void Clear()
+    {
+        this->_vertices.clear();
+        this->_glyphInstances.clear();
+        this->_worldVertices.clear();
+        this->_batches.clear();
+        this->_commands.clear();
+        this->_layer = 0;
+        this->_contentHash = 0;
+        this->_rendered = false;
+    }
+
+  protected:
+    friend class Renderer;
+    friend class Font;
+    friend class TripleBufferedRenderList;
+
+    std::vector<Vertex> _vertices{};
+    std::vector<GlyphInstance> _glyphInstances{};
+    std::vector<WorldVertex> _worldVertices{};
+    std::vector<Batch> _batches{};
+    uint8_t _layer = 0;
+    Vec4 _clipRect{};
+    bool _clipped = false;
+    DirectX::XMFLOAT4X4 _transform{};
+    bool _transformed = false;
+    // hash of everything added since Clear(), lets the renderer tell whether its buffers already hold the list
+    uint64_t _contentHash = 0;
+    // shapes waiting to be tessellated into their vertices
+    std::vector<ShapeCommand> _commands{};
+    bool _deferredTessellation = false;
+    // drawn since Clear(), the glyphs of a list drawn again are marked as used so the atlas keeps them
+    bool _rendered = false;
+    // atlas the glyph instances point into, kept across Clear()
+    std::shared_ptr<FontAtlas> _glyphAtlas{};
+    // keys of the glyphs pinned while the list is published through a TripleBufferedRenderList
+    std::vector<uint64_t> _pinnedGlyphs{};
+
+  private:
+    // Appends count vertices to the batch of the given state, starting a new one if needed, and returns the index of
+    // the first.
+    inline size_t ReserveVertices(size_t count, const TopologyType topology, ID3D11ShaderResourceView *texture)
+    {
+        const size_t numVertices = this->_vertices.size();
+
+        if (this->_batches.empty() || this->_batches.back().type != BatchType::Vertices ||
+            this->_batches.back().topology != topology || this->_batches.back().texture != texture ||
+            this->_batches.back().layer != this->_layer)
+        {
+            this->_batches.emplace_back(0, topology, texture, BatchType::Vertices, this->_layer);
+        }
+
+        this->_batches.back().count += count;
+        this->_vertices.resize(numVertices + count);
+
+        switch (topology)
+        {
+        default:
+            break;
+
+        case D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP:
+        case D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP_ADJ:
+        case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP:
+        case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP_ADJ:
+            // add a new empty batch to force the end of the strip
+            this->_batches.emplace_back(0, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, nullptr);
+            break;
+        }
+
+        return numVertices;
+    }
+
+    inline void HashRecord(BatchType type, TopologyType topology, const void *texture, const void *data, size_t size)
+    {
+        const uint64_t state[] = {static_cast<uint64_t>(type), static_cast<uint64_t>(topology),
+                                  reinterpret_cast<uintptr_t>(texture), this->_layer};
+
+        this->_contentHash = detail::HashBytes(detail::HashBytes(this->_contentHash, state, sizeof(state)), data, size);
+    }
+};
+
+struct TextCacheStats
+{
+    // interned texts currently drawn from a single atlas entry
+    size_t cachedTexts = 0;
+    // atlas memory taken by those entries
+    size_t cachedBytes = 0;
+    // glyph quads not drawn since the last BeginFrame() because their text was cached
+    size_t quadsSaved = 0;
+};
+
+// Work of the Render() calls since the last BeginFrame()
+struct RenderStats
+{
+    size_t renderLists = 0;
+    // buffers mapped or updated to upload vertices, glyph instances or constants
+    size_t bufferMaps = 0;
+    size_t uploadedBytes = 0;
+    size_t drawCalls = 0;
+    // Render() calls which found the buffers already holding the same content and skipped the upload
+    size_t reusedRenders = 0;
+    // bytes those calls didn't upload, the skip ratio is skippedBytes / (skippedBytes + uploadedBytes)
+    size_t skippedBytes = 0;
+};
+
+// Entry of the atlas' glyph buffer read by the glyph vertex shader.
+struct GlyphRecord
+{
+    Vec4 uv;
+    // cell size in pixels, zw are unused
+    Vec4 size;
+};
+
+// Two channel glyph cache texture shared by all fonts of a renderer and filled on demand. Font sources rasterize
+// glyphs into the GlyphCache, only the modified part of it is uploaded. Every glyph also has a record in the glyph
+// buffer at the index of its slot.
+class FontAtlas
+{
+  public:
+    FontAtlas(ID3D11Device *d3dDevice, long textureWidth, long textureHeight)
+        : _d3dDevice(d3dDevice), _d3dDeviceContext(nullptr), _texture(nullptr), _textureView(nullptr),
+          _glyphBuffer(nullptr), _glyphBufferView(nullptr), _glyphBufferCapacity(0),
+          _cache(textureWidth, textureHeight, g_fontAtlasChannels, g_fontEffectPadding), _dirtyRecordsBegin(0),
+          _dirtyRecordsEnd(0)
+    {
+        this->_d3dDevice->GetImmediateContext(&this->_d3dDeviceContext);
+    }
+
+    ~FontAtlas()
+    {
+        this->Release();
+
+        detail::SafeRelease(&this->_d3dDeviceContext);
+    }
+
+    inline void Release()
+    {
+        detail::SafeRelease(&this->_textureView);
+        detail::SafeRelease(&this->_texture);
+        detail::SafeRelease(&this->_glyphBufferView);
+        detail::SafeRelease(&this->_glyphBuffer);
+    }
+
+    inline void Initialize()
+    {
+        D3D11_TEXTURE2D_DESC texDesc = {};
+        texDesc.Width = this->_cache.GetWidth();
+        texDesc.Height = this->_cache.GetHeight();
+        texDesc.MipLevels = g_fontAtlasMipLevels;
+        texDesc.ArraySize = 1;
+        texDesc.Format = DXGI_FORMAT_R8G8_UNORM;
+        texDesc.SampleDesc.Count = 1;
+        texDesc.Usage = D3D11_USAGE_DEFAULT;
+        texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+        texDesc.CPUAccessFlags = 0;
+
+        HRESULT hr = this->_d3dDevice->CreateTexture2D(&texDesc, nullptr, &this->_texture);
+        if (FAILED(hr))
+        {
+            throw std::runtime_error("FontAtlas::Initialize(): CreateTexture failed!");
+        }
+
+        D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+        srvDesc.Format = texDesc.Format;
+        srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+        srvDesc.Texture2D.MostDetailedMip = 0;
+        srvDesc.Texture2D.MipLevels = g_fontAtlasMipLevels;
+
+        hr = this->_d3dDevice->CreateShaderResourceView(this->_texture, &srvDesc, &this->_textureView);
+        if (FAILED(hr))
+        {
+            throw std::runtime_error("FontAtlas::Initialize(): CreateShaderResourceView failed!");
+        }
+
+        // the system memory copy survives a device reset, so the whole surface has to be uploaded again
+        this->_cache.MarkDirty(0, 0, this->_cache.GetWidth(), this->_cache.GetHeight());
+
+        this->CreateGlyphBuffer();
+    }
+
+    // glyphs of all fonts live in the same map, so the font id is part of the key
+    static inline uint64_t MakeGlyphKey(uint32_t fontId, uint32_t codePoint)
+    {
+        return (static_cast<uint64_t>(fontId) << 32) | codePoint;
+    }
+
+    // texts composed by Font::CacheRun() share the map, the high bit of the font id keeps them apart from glyphs
+    static inline uint64_t MakeStringKey(uint32_t fontId, uint32_t stringId)
+    {
+        return MakeGlyphKey(fontId | 0x80000000u, stringId);
+    }
+
+    // Size of an entry in bytes, 0 if it is not in the atlas. Unlike FindGlyph() the entry is not marked as used.
+    inline size_t GetGlyphBytes(uint64_t key) const
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+
+        const AtlasGlyph *glyph = this->_cache.Peek(key);
+        return glyph ? static_cast<size_t>(glyph->width) * glyph->height * g_fontAtlasChannels : 0;
+    }
+
+    // The returned glyph stays valid until the next NewFrame(), glyphs used in the current or the previous frame are
+    // never evicted.
+    inline AtlasGlyph *FindGlyph(uint64_t key)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_cache.Find(key);
+    }
+
+    // Copies a rasterized cell into a free or evicted slot, safe to call from any thread. The slot is padded by
+    // g_fontEffectPadding on every side and holds the coverage in red and the outline field in green, so fill, outline
+    // and shadow of a glyph are drawn by the same quad.
+    inline AtlasGlyph *AddGlyph(uint64_t key, long width, long height, const uint8_t *pixels, long pitch)
+    {
+        const long paddedWidth = width + 2 * g_fontEffectPadding;
+        const long paddedHeight = height + 2 * g_fontEffectPadding;
+        const long paddedPitch = paddedWidth * g_fontAtlasChannels;
+
+        // the effects are baked before taking the lock, workers add glyphs concurrently
+        std::vector<uint8_t> texels(static_cast<size_t>(paddedPitch) * paddedHeight);
+
+        for (long row = 0; row < height; row++)
+        {
+            for (long column = 0; column < width; column++)
+            {
+                const long offset = (column + g_fontEffectPadding) * g_fontAtlasChannels;
+                texels[paddedPitch * (row + g_fontEffectPadding) + offset] = pixels[pitch * row + column];
+            }
+        }
+
+        detail::BakeOutlineField(pixels, width, height, pitch, g_fontEffectPadding, &texels[1], g_fontAtlasChannels,
+                                 paddedPitch);
+
+        std::lock_guard<std::mutex> lock(this->_mutex);
+
+        AtlasGlyph *glyph = this->_cache.Insert(key, paddedWidth, paddedHeight, texels.data(), paddedPitch);
+        if (!glyph)
+        {
+            return nullptr;
+        }
+
+        if (glyph->index >= this->_glyphRecords.size())
+        {
+            this->_glyphRecords.resize(glyph->index + 1);
+            this->_recordKeys.resize(glyph->index + 1);
+        }
+
+        this->_recordKeys[glyph->index] = key;
+        this->_glyphRecords[glyph->index] = {
+            Vec4(glyph->uv[0], glyph->uv[1], glyph->uv[2], glyph->uv[3]),
+            Vec4(static_cast<float>(paddedWidth), static_cast<float>(paddedHeight), 0.f, 0.f)};
+        this->MarkRecordDirty(glyph->index);
+
+        return glyph;
+    }
+
+    // Marks the glyphs drawn by instances as used, for a list which is drawn again without being recorded.
+    inline void TouchGlyphs(std::span<const GlyphInstance> instances)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+
+        for (const GlyphInstance &instance : instances)
+        {
+            if (instance.glyphIndex < this->_recordKeys.size())
+            {
+                this->_cache.Touch(this->_recordKeys[instance.glyphIndex]);
+            }
+        }
+    }
+
+    inline void PinGlyph(uint64_t key)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_cache.Pin(key);
+    }
+
+    inline void UnpinGlyph(uint64_t key)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_cache.Unpin(key);
+    }
+
+    // Pins the glyphs drawn by instances and appends their keys, for a list drawn frames after it was recorded.
+    inline void PinGlyphs(std::span<const GlyphInstance> instances, std::vector<uint64_t> &keys)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+
+        for (const GlyphInstance &instance : instances)
+        {
+            if (instance.glyphIndex < this->_recordKeys.size())
+            {
+                const uint64_t key = this->_recordKeys[instance.glyphIndex];
+                this->_cache.Pin(key);
+                keys.push_back(key);
+            }
+        }
+    }
+
+    inline void UnpinGlyphs(std::span<const uint64_t> keys)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+
+        for (const uint64_t key : keys)
+        {
+            this->_cache.Unpin(key);
+        }
+    }
+
+    // only the coverage is read back, the effects are baked again when the glyph is added
+    inline bool ReadGlyph(uint64_t key, uint8_t *pixels, long pitch) const
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_cache.Read(key, g_fontEffectPadding, pixels, pitch);
+    }
+
+    inline void NewFrame()
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_cache.NewFrame();
+    }
+
+    inline void Flush()
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+
+        if (!this->_texture)
+        {
+            return;
+        }
+
+        this->FlushGlyphRecords();
+
+        this->_cache.Flush([this](long level, const detail::AtlasRect &rect, const uint8_t *src, long levelWidth) {
+            D3D11_BOX box{};
+            box.left = rect.left;
+            box.top = rect.top;
+            box.right = rect.right;
+            box.bottom = rect.bottom;
+            box.front = 0;
+            box.back = 1;
+
+            this->_d3dDeviceContext->UpdateSubresource(this->_texture, static_cast<UINT>(level), &box,
+                                                       &src[(levelWidth * rect.top + rect.left) * g_fontAtlasChannels],
+                                                       static_cast<UINT>(levelWidth * g_fontAtlasChannels), 0);
+        });
+    }
+
+    inline AtlasStats GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_cache.GetStats();
+    }
+
+    inline ID3D11ShaderResourceView *GetTextureView() const
+    {
+        return this->_textureView;
+    }
+
+    inline ID3D11ShaderResourceView *GetGlyphBufferView() const
+    {
+        return this->_glyphBufferView;
+    }
+
+  private:
+    // (Re)creates the glyph buffer large enough for every glyph record, all records are uploaded by the next Flush().
+    inline void CreateGlyphBuffer()
+    {
+        detail::SafeRelease(&this->_glyphBufferView);
+        detail::SafeRelease(&this->_glyphBuffer);
+
+        this->_glyphBufferCapacity = max(this->_glyphBufferCapacity, static_cast<uint32_t>(256));
+
+        while (this->_glyphBufferCapacity < this->_glyphRecords.size())
+        {
+            this->_glyphBufferCapacity *= 2;
+        }
+
+        D3D11_BUFFER_DESC desc{};
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.ByteWidth = sizeof(GlyphRecord) * this->_glyphBufferCapacity;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+        HRESULT hr = this->_d3dDevice->CreateBuffer(&desc, nullptr, &this->_glyphBuffer);
+        if (FAILED(hr))
+        {
+            throw std::runtime_error("FontAtlas::CreateGlyphBuffer(): CreateBuffer failed!");
+        }
+
+        D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+        srvDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+        srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+        srvDesc.Buffer.FirstElement = 0;
+        srvDesc.Buffer.NumElements = this->_glyphBufferCapacity * 2;
+
+        hr = this->_d3dDevice->CreateShaderResourceView(this->_glyphBuffer, &srvDesc, &this->_glyphBufferView);
+        if (FAILED(hr))
+        {
+            throw std::runtime_error("FontAtlas::CreateGlyphBuffer(): CreateShaderResourceView failed!");
+        }
+
+        this->_dirtyRecordsBegin = 0;
+        this->_dirtyRecordsEnd = static_cast<uint32_t>(this->_glyphRecords.size());
+    }
+
+    inline void FlushGlyphRecords()
+    {
+        if (this->_dirtyRecordsEnd <= this->_dirtyRecordsBegin)
+        {
+            return;
+        }
+
+        if (this->_glyphRecords.size() > this->_glyphBufferCapacity)
+        {
+            this->CreateGlyphBuffer();
+        }
+
+        D3D11_BOX box{};
+        box.left = sizeof(GlyphRecord) * this->_dirtyRecordsBegin;
+        box.right = sizeof(GlyphRecord) * this->_dirtyRecordsEnd;
+        box.top = 0;
+        box.bottom = 1;
+        box.front = 0;
+        box.back = 1;
+
+        this->_d3dDeviceContext->UpdateSubresource(this->_glyphBuffer, 0, &box,
+                                                   &this->_glyphRecords[this->_dirtyRecordsBegin], 0, 0);
+
+        this->_dirtyRecordsBegin = 0;
+        this->_dirtyRecordsEnd = 0;
+    }
+
+    inline void MarkRecordDirty(uint32_t index)
+    {
+        if (this->_dirtyRecordsEnd <= this->_dirtyRecordsBegin)
+        {
+            this->_dirtyRecordsBegin = index;
+            this->_dirtyRecordsEnd = index + 1;
+            return;
+        }
+
+        this->_dirtyRecordsBegin = min(this->_dirtyRecordsBegin, index);
+        this->_dirtyRecordsEnd = max(this->_dirtyRecordsEnd, index + 1);
+    }
+
+    ID3D11Device *_d3dDevice;
+    ID3D11DeviceContext *_d3dDeviceContext;
+    ID3D11Texture2D *_texture;
+    ID3D11ShaderResourceView *_textureView;
+    ID3D11Buffer *_glyphBuffer;
+    ID3D11ShaderResourceView *_glyphBufferView;
+    uint32_t _glyphBufferCapacity;
+
+    GlyphCache _cache;
+    std::vector<GlyphRecord> _glyphRecords;
+    // atlas key of the glyph owning each record
+    std::vector<uint64_t> _recordKeys;
+    uint32_t _dirtyRecordsBegin;
+    uint32_t _dirtyRecordsEnd;
+    // fonts baked asynchronously add glyphs from worker threads
+    mutable std::mutex _mutex;
+};
+
+// Hands render lists from a game thread to the render thread through three lists, neither side ever waits for the
+// other. The producer records into GetBackList() and calls Publish() once the frame is complete, the render thread
+// draws whatever Acquire() returns, which is the last published list or the previous one again if none was published.
+// Only one thread may produce and only one may render. The producer records with the Renderer overloads taking a list,
+// fonts lay out one text at a time, so the render thread may record text of its own meanwhile.
+class TripleBufferedRenderList
+{
+  public:
+    TripleBufferedRenderList(size_t maxVertices) : _back(0), _front(1), _middle(2)
+    {
+        for (auto &renderList : this->_renderLists)
+        {
+            renderList = std::make_shared<RenderList>(maxVertices);
+        }
+    }
+
+    ~TripleBufferedRenderList()
+    {
+        for (auto &renderList : this->_renderLists)
+        {
+            this->UnpinGlyphs(*renderList);
+        }
+    }
+
+    TripleBufferedRenderList(const TripleBufferedRenderList &) = delete;
+    TripleBufferedRenderList &operator=(const TripleBufferedRenderList &) = delete;
+
+    // producer side, the list is owned by the calling thread until the next Publish()
+    inline const RenderListPtr &GetBackList() const
+    {
+        return this->_renderLists[this->_back];
+    }
+
+    // Swaps the recorded list with the shared one and starts an empty back list. Clip rect and transform are per list
+    // and kept across frames, set them again after publishing when they are used. The glyphs of a published list are
+    // pinned until the list comes back to the producer, the render thread may draw it any number of frames later.
+    inline void Publish()
+    {
+        RenderList &published = *this->_renderLists[this->_back];
+        if (published._glyphAtlas)
+        {
+            published._glyphAtlas->PinGlyphs(published._glyphInstances, published._pinnedGlyphs);
+        }
+
+        this->_back = this->_middle.exchange(this->_back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+
+        // the render thread gave the list back or skipped it, nothing draws it anymore
+        this->UnpinGlyphs(*this->_renderLists[this->_back]);
+        this->_renderLists[this->_back]->Clear();
+    }
+
+    // render thread side, the list stays valid until the next Acquire()
+    inline const RenderListPtr &Acquire()
+    {
+        if (this->_middle.load(std::memory_order_relaxed) & FRESH)
+        {
+            this->_front = this->_middle.exchange(this->_front, std::memory_order_acq_rel) & INDEX_MASK;
+        }
+
+        return this->_renderLists[this->_front];
+    }
+
+    inline bool HasNewList() const
+    {
+        return (this->_middle.load(std::memory_order_relaxed) & FRESH) != 0;
+    }
+
+  private:
+    inline void UnpinGlyphs(RenderList &renderList)
+    {
+        if (renderList._glyphAtlas)
+        {
+            renderList._glyphAtlas->UnpinGlyphs(renderList._pinnedGlyphs);
+        }
+
+        renderList._pinnedGlyphs.clear();
+    }
+
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    // set on the shared index by Publish(), cleared when the render thread takes the list
+    static constexpr uint8_t FRESH = 0x4;
+
+    std::array<RenderListPtr, 3> _renderLists{};
+    uint8_t _back;
+    uint8_t _front;
+    std::atomic<uint8_t> _middle;
+};
+
+// Installed system font rendered by GDI into a private DIB.
+class GdiFontSource : public FontSource
+{
+  public:
+    GdiFontSource(const std::wstring &fontFamily, long fontHeigth, uint32_t fontFlags = FONT_FLAG_NONE)
+        : _hdc(nullptr), _gdiFont(nullptr), _prevGdiFont(nullptr), _bitmap(nullptr), _prevBitmap(nullptr),
+          _bitmapBits(nullptr), _bitmapWidth(0), _bitmapHeight(0), _lineHeight(0), _fontFamily(fontFamily),
+          _fontHeigth(fontHeigth), _fontFlags(fontFlags)
+    {
+        this->_hdc = CreateCompatibleDC(nullptr);
+        if (!this->_hdc)
+        {
+            throw std::runtime_error("GdiFontSource::ctor(): CreateCompatibleDC failed!");
+        }
+
+        SetMapMode(this->_hdc, MM_TEXT);
+
+        static const int pointsPerInch = 72;
+        int dpi = GetDeviceCaps(this->_hdc, LOGPIXELSY);
+        int pixelsHeight = -MulDiv(fontHeigth, dpi, pointsPerInch);
+
+        DWORD bold = (fontFlags & FONT_FLAG_BOLD) ? FW_BOLD : FW_NORMAL;
+        DWORD italic = (fontFlags & FONT_FLAG_ITALIC) ? TRUE : FALSE;
+
+        this->_gdiFont = CreateFontW(pixelsHeight, 0, 0, 0, bold, italic, FALSE, FALSE, DEFAULT_CHARSET,
+                                     OUT_OUTLINE_PRECIS, CLIP_DEFAULT_PRECIS,
+                                     (fontFlags & FONT_FLAG_CLEAR_TYPE) ? CLEARTYPE_QUALITY : ANTIALIASED_QUALITY,
+                                     VARIABLE_PITCH, fontFamily.c_str());
+        if (!this->_gdiFont)
+        {
+            DeleteDC(this->_hdc);
+            throw std::runtime_error("GdiFontSource::ctor(): CreateFontW failed!");
+        }
+
+        this->_prevGdiFont = SelectObject(this->_hdc, this->_gdiFont);
+
+        SetTextColor(this->_hdc, RGB(255, 255, 255));
+        SetBkColor(this->_hdc, 0x00000000);
+        SetTextAlign(this->_hdc, TA_TOP);
+
+        SIZE size{};
+        if (!GetTextExtentPoint32W(this->_hdc, L" ", 1, &size))
+        {
+            SelectObject(this->_hdc, this->_prevGdiFont);
+            DeleteObject(this->_gdiFont);
+            DeleteDC(this->_hdc);
+            throw std::runtime_error("GdiFontSource::ctor(): Failed to get text extent!");
+        }
+
+        this->_lineHeight = size.cy;
+        this->_cacheKey = L"gdi|" + fontFamily + L"|" + std::to_wstring(fontHeigth) + L"|" +
+                          std::to_wstring(fontFlags) + L"|" + std::to_wstring(dpi);
+    }
+
+    ~GdiFontSource()
+    {
+        if (this->_bitmap)
+        {
+            SelectObject(this->_hdc, this->_prevBitmap);
+            DeleteObject(this->_bitmap);
+        }
+
+        SelectObject(this->_hdc, this->_prevGdiFont);
+        DeleteObject(this->_gdiFont);
+        DeleteDC(this->_hdc);
+    }
+
+    inline long GetLineHeight() const override
+    {
+        return this->_lineHeight;
+    }
+
+    inline std::wstring GetCacheKey() const override
+    {
+        return this->_cacheKey;
+    }
+
+    inline FontSourcePtr Clone() const override
+    {
+        return std::make_shared<GdiFontSource>(this->_fontFamily, this->_fontHeigth, this->_fontFlags);
+    }
+
+    inline GlyphMetrics MeasureGlyph(uint32_t codePoint) override
+    {
+        wchar_t chr[2];
+        const int length = detail::EncodeUtf16(codePoint, chr);
+
+        SIZE size{};
+        GlyphMetrics metrics{};
+
+        if (!GetTextExtentPoint32W(this->_hdc, chr, length, &size))
+        {
+            return metrics;
+        }
+
+        long overhangLeft = 0;
+        long overhangRight = 0;
+
+        ABC abc{};
+        if (length == 1 && GetCharABCWidthsW(this->_hdc, chr[0], chr[0], &abc))
+        {
+            overhangLeft = max(0L, static_cast<long>(-abc.abcA));
+            overhangRight = max(0L, abc.abcA + static_cast<long>(abc.abcB) - size.cx);
+        }
+        else
+        {
+            // no ABC widths for raster fonts and surrogate pairs, guess generously for italic overhangs
+            overhangLeft = overhangRight = size.cy / 4;
+        }
+
+        // one extra column on each side for anti-aliasing and ClearType fringes
+        metrics.offset = overhangLeft + 1;
+        metrics.width = metrics.offset + size.cx + overhangRight + 1;
+        metrics.advance = size.cx;
+        metrics.valid = true;
+        return metrics;
+    }
+
+    inline void RasterizeGlyph(uint32_t codePoint, const GlyphMetrics &metrics, uint8_t *pixels, long pitch) override
+    {
+        if (!this->EnsureBitmap(metrics.width, this->_lineHeight))
+        {
+            return;
+        }
+
+        wchar_t chr[2];
+        const int length = detail::EncodeUtf16(codePoint, chr);
+
+        RECT rect = {0, 0, metrics.width, this->_lineHeight};
+        ExtTextOutW(this->_hdc, metrics.offset, 0, ETO_OPAQUE | ETO_CLIPPED, &rect, chr, length, nullptr);
+
+        // make sure GDI finished drawing into the DIB before reading from it
+        GdiFlush();
+
+        for (long y = 0; y < this->_lineHeight; y++)
+        {
+            detail::ConvertDibToAlpha(&this->_bitmapBits[this->_bitmapWidth * y], &pixels[pitch * y], metrics.width);
+        }
+    }
+
+  private:
+    inline bool EnsureBitmap(long width, long height)
+    {
+        if (width <= this->_bitmapWidth && height <= this->_bitmapHeight)
+        {
+            return true;
+        }
+
+        BITMAPINFO bitmapInfo{};
+        bitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bitmapInfo.bmiHeader.biWidth = max(width, this->_bitmapWidth);
+        bitmapInfo.bmiHeader.biHeight = -max(height, this->_bitmapHeight);
+        bitmapInfo.bmiHeader.biPlanes = 1;
+        bitmapInfo.bmiHeader.biCompression = BI_RGB;
+        bitmapInfo.bmiHeader.biBitCount = 32;
+
+        uint32_t *bitmapBits = nullptr;
+        HBITMAP bitmap = CreateDIBSection(this->_hdc, &bitmapInfo, DIB_RGB_COLORS,
+                                          reinterpret_cast<void **>(&bitmapBits), nullptr, 0);
+        if (!bitmap)
+        {
+            return false;
+        }
+
+        HGDIOBJ prevBitmap = SelectObject(this->_hdc, bitmap);
+
+        if (this->_bitmap)
+        {
+            DeleteObject(this->_bitmap);
+        }
+        else
+        {
+            this->_prevBitmap = prevBitmap;
+        }
+
+        this->_bitmap = bitmap;
+        this->_bitmapBits = bitmapBits;
+        this->_bitmapWidth = bitmapInfo.bmiHeader.biWidth;
+        this->_bitmapHeight = -bitmapInfo.bmiHeader.biHeight;
+        return true;
+    }
+
+    HDC _hdc;
+    HGDIOBJ _gdiFont;
+    HGDIOBJ _prevGdiFont;
+    HBITMAP _bitmap;
+    HGDIOBJ _prevBitmap;
+    uint32_t *_bitmapBits;
+    long _bitmapWidth;
+    long _bitmapHeight;
+    long _lineHeight;
+    std::wstring _cacheKey;
+
+    std::wstring _fontFamily;
+    long _fontHeigth;
+    uint32_t _fontFlags;
+};
+
+// Glyph of an interned text, positioned relative to the origin of the text.
+struct TextRunGlyph
+{
+    uint32_t codePoint;
+    Vec2 pos;
+    uint32_t glyphIndex;
+    Color color;
+    // set if the color came from a color tag, those are kept when the text is drawn with another color
+    bool tagColor;
+};
+
+// Text parsed and laid out once by Renderer::InternText(), drawing it only translates the stored glyphs.
+struct TextRun
+{
+    FontPtr font;
+    // kept until the font finished baking and the text could be laid out
+    std::wstring text;
+    Color color;
+    uint32_t flags;
+    Color outlineColor;
+    float outlineThickness;
+    std::vector<TextRunGlyph> glyphs;
+    bool laidOut = false;
+    // atlas entry of the composed text with TEXT_FLAG_CACHED, 0 if it is drawn glyph by glyph
+    uint32_t cacheId = 0;
+    // top-left corner of the composed text relative to the origin of the run
+    Vec2 cacheOrigin{};
+};
+
+class Font : public std::enable_shared_from_this<Font>
+{
+  public:
+    Font(const std::shared_ptr<FontAtlas> &atlas, uint32_t fontId, const FontSourcePtr &source,
+         const std::wstring &cacheDirectory = {})
+        : _atlas(atlas), _fontId(fontId), _source(source), _lineHeight(source->GetLineHeight()), _nextCacheId(0),
+          _pendingChunks(0), _initialized(false)
+    {
+        this->SetupCache(cacheDirectory);
+    }
+
+    // Bakes the preloaded charset on the calling thread.
+    inline void Initialize()
+    {
+        if (this->LoadCache())
+        {
+            this->_initialized = true;
+            return;
+        }
+
+        this->_pendingChunks = 1;
+        this->BakeChunk(*this->_source, g_charRangeMin, g_charRangeMax);
+    }
+
+    // Bakes the preloaded charset on the worker pool. The range is split into chunks rasterized in parallel by clones
+    // of the font source, text using the font is skipped until the last chunk finished.
+    inline void InitializeAsync(detail::ThreadPool &threadPool)
+    {
+        threadPool.Submit([self = this->shared_from_this(), &threadPool]() {
+            if (self->LoadCache())
+            {
+                self->_initialized = true;
+                return;
+            }
+
+            const uint32_t rangeSize = g_charRangeMax - g_charRangeMin;
+            const size_t chunksByRange = rangeSize / g_fontBakeChunkSize;
+            const size_t maxChunks = max(size_t(1), min(threadPool.GetWorkerCount(), chunksByRange));
+
+            std::vector<FontSourcePtr> sources{self->_source};
+
+            while (sources.size() < maxChunks)
+            {
+                FontSourcePtr clone = self->_source->Clone();
+                if (!clone)
+                {
+                    break;
+                }
+
+                sources.push_back(clone);
+            }
+
+            const uint32_t chunkCount = static_cast<uint32_t>(sources.size());
+            const auto chunkStart = [&](uint32_t chunk) { return g_charRangeMin + rangeSize * chunk / chunkCount; };
+
+            self->_pendingChunks = chunkCount;
+
+            for (uint32_t i = 1; i < chunkCount; i++)
+            {
+                threadPool.Submit([self, source = sources[i], first = chunkStart(i), last = chunkStart(i + 1)]() {
+                    self->BakeChunk(*source, first, last);
+                });
+            }
+
+            self->BakeChunk(*self->_source, chunkStart(0), chunkStart(1));
+        });
+    }
+
+    // scale is relative to the size the font was baked at, text drawn smaller samples the atlas' mip chain
+    inline Vec2 RenderText(const RenderListPtr &renderList, Vec2 pos, std::wstring_view text, const Color color,
+                           uint32_t flags, const Color outlineColor, float outlineThickness, float scale,
+                           float maxWidth)
+    {
+        return this->RenderTextImpl(renderList, pos, text, color, flags, outlineColor, outlineThickness, scale,
+                                    maxWidth);
+    }
+
+    // UTF-8 text is decoded while laying it out, no wide string is built
+    inline Vec2 RenderText(const RenderListPtr &renderList, Vec2 pos, std::string_view text, const Color color,
+                           uint32_t flags, const Color outlineColor, float outlineThickness, float scale,
+                           float maxWidth)
+    {
+        return this->RenderTextImpl(renderList, pos, text, color, flags, outlineColor, outlineThickness, scale,
+                                    maxWidth);
+    }
+
+    inline Vec2 CalculateTextExtent(std::wstring_view text, float scale)
+    {
+        std::lock_guard<std::mutex> lock(this->_layoutMutex);
+        return this->CalculateTextExtentImpl(text, scale);
+    }
+
+    inline Vec2 CalculateTextExtent(std::string_view text, float scale)
+    {
+        std::lock_guard<std::mutex> lock(this->_layoutMutex);
+        return this->CalculateTextExtentImpl(text, scale);
+    }
+
+    // Lays out an interned text, fails while the font is still baking or the atlas is too full for its glyphs. The
+    // glyphs of the run are pinned in the atlas until ReleaseRun(), so the stored uvs stay valid.
+    inline bool LayoutRun(TextRun &run)
+    {
+        if (!this->_initialized)
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(this->_layoutMutex);
+
+        run.glyphs.clear();
+
+        const auto addGlyph = [&](uint32_t c, float x, float y, float, float, const AtlasGlyph &glyph,
+                                  Color currentColor, bool tagColor) {
+            run.glyphs.push_back({c, Vec2(x, y), glyph.index, currentColor, tagColor});
+        };
+
+        Vec2 extent;
+        if (!this->LayoutText(Vec2(0.f, 0.f), std::wstring_view(run.text), run.color, run.flags, 1.f, 0.f, extent,
+                              addGlyph))
+        {
+            run.glyphs.clear();
+            return false;
+        }
+
+        for (const TextRunGlyph &glyph : run.glyphs)
+        {
+            this->_atlas->PinGlyph(FontAtlas::MakeGlyphKey(this->_fontId, glyph.codePoint));
+        }
+
+        run.laidOut = true;
+        std::wstring().swap(run.text);
+        this->PrepareRunCache(run);
+        return true;
+    }
+
+    inline void ReleaseRun(TextRun &run)
+    {
+        if (!run.laidOut)
+        {
+            return;
+        }
+
+        for (const TextRunGlyph &glyph : run.glyphs)
+        {
+            this->_atlas->UnpinGlyph(FontAtlas::MakeGlyphKey(this->_fontId, glyph.codePoint));
+        }
+
+        run.glyphs.clear();
+        run.laidOut = false;
+    }
+
+    // Runs are laid out at scale 1, the stored glyph positions scale around the run's origin. Returns the number of
+    // quads saved by drawing a cached run as one.
+    inline size_t RenderRun(const RenderListPtr &renderList, TextRun &run, Vec2 pos, const Color color, float scale)
+    {
+        std::lock_guard<std::mutex> lock(this->_layoutMutex);
+
+        if (run.cacheId)
+        {
+            const AtlasGlyph *image = this->CacheRun(run);
+            if (image)
+            {
+                this->AddGlyphInstance(renderList, pos.x + run.cacheOrigin.x * scale, pos.y + run.cacheOrigin.y * scale,
+                                       image->index, color, run.flags, run.outlineColor, run.outlineThickness, scale);
+                return run.glyphs.size() - 1;
+            }
+
+            // no room for the whole text, keep drawing it glyph by glyph instead of composing it every frame
+            run.cacheId = 0;
+        }
+
+        for (const TextRunGlyph &glyph : run.glyphs)
+        {
+            this->AddGlyphInstance(renderList, pos.x + glyph.pos.x * scale, pos.y + glyph.pos.y * scale,
+                                   glyph.glyphIndex, glyph.tagColor ? glyph.color : color, run.flags,
+                                   run.outlineColor, run.outlineThickness, scale);
+        }
+
+        return 0;
+    }
+
+    inline size_t GetCachedRunBytes(const TextRun &run) const
+    {
+        return run.cacheId ? this->_atlas->GetGlyphBytes(FontAtlas::MakeStringKey(this->_fontId, run.cacheId)) : 0;
+    }
+
+    inline std::shared_ptr<Font> MakePtr()
+    {
+        return shared_from_this();
+    }
+
+    inline bool IsInitialized() const
+    {
+        return this->_initialized;
+    }
+
+  private:
+    struct FontCacheHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t keyLength;
+        int32_t lineHeight;
+        uint32_t glyphCount;
+        uint32_t pixelSize;
+    };
+
+    struct FontCacheGlyph
+    {
+        uint32_t codePoint;
+        int32_t width;
+        int32_t advance;
+        int32_t offset;
+        uint32_t valid;
+        // offset into the pixel block, g_fontCacheNoPixels for glyphs without a bitmap
+        uint32_t pixelOffset;
+    };
+
+    inline void SetupCache(const std::wstring &cacheDirectory)
+    {
+        const std::wstring sourceKey = this->_source->GetCacheKey();
+        if (cacheDirectory.empty() || sourceKey.empty())
+        {
+            return;
+        }
+
+        this->_cacheKey = sourceKey + L"|" + std::to_wstring(g_charRangeMin) + L"-" + std::to_wstring(g_charRangeMax);
+        this->_cachePath =
+            cacheDirectory + L"\\" +
+            std::to_wstring(detail::HashFnv1a(this->_cacheKey.data(), this->_cacheKey.size() * sizeof(wchar_t))) +
+            L".fontcache";
+    }
+
+    // Cache layout: header, key characters, glyph records, pixel block with one line high cell per glyph.
+    inline bool LoadCache()
+    {
+        if (this->_cachePath.empty())
+        {
+            return false;
+        }
+
+        const std::wstring &key = this->_cacheKey;
+
+        detail::MappedFile file(this->_cachePath);
+
+        const uint8_t *data = file.GetData();
+        const size_t size = file.GetSize();
+
+        if (!data || size < sizeof(FontCacheHeader))
+        {
+            return false;
+        }
+
+        FontCacheHeader header{};
+        memcpy(&header, data, sizeof(header));
+
+        if (header.magic != g_fontCacheMagic || header.version != g_fontCacheVersion ||
+            header.keyLength != key.size() || header.lineHeight != this->_lineHeight)
+        {
+            return false;
+        }
+
+        const size_t keyOffset = sizeof(FontCacheHeader);
+        const size_t glyphsOffset = keyOffset + header.keyLength * sizeof(wchar_t);
+        const size_t pixelsOffset = glyphsOffset + static_cast<size_t>(header.glyphCount) * sizeof(FontCacheGlyph);
+
+        if (pixelsOffset + header.pixelSize != size ||
+            memcmp(data + keyOffset, key.data(), header.keyLength * sizeof(wchar_t)) != 0)
+        {
+            return false;
+        }
+
+        std::vector<FontCacheGlyph> records(header.glyphCount);
+        memcpy(records.data(), data + glyphsOffset, records.size() * sizeof(FontCacheGlyph));
+
+        // validate everything before touching the atlas, a damaged file is simply baked again
+        for (const FontCacheGlyph &record : records)
+        {
+            if (record.pixelOffset != g_fontCacheNoPixels &&
+                (record.width <= 0 || record.pixelOffset > header.pixelSize ||
+                 header.pixelSize - record.pixelOffset < static_cast<size_t>(record.width) * this->_lineHeight))
+            {
+                return false;
+            }
+        }
+
+        const uint8_t *pixels = data + pixelsOffset;
+
+        for (const FontCacheGlyph &record : records)
+        {
+            GlyphMetrics metrics{};
+            metrics.width = record.width;
+            metrics.advance = record.advance;
+            metrics.offset = record.offset;
+            metrics.valid = record.valid != 0;
+
+            this->_glyphMetrics[record.codePoint] = metrics;
+
+            if (record.pixelOffset == g_fontCacheNoPixels)
+            {
+                continue;
+            }
+
+            this->_atlas->AddGlyph(FontAtlas::MakeGlyphKey(this->_fontId, record.codePoint), metrics.width,
+                                   this->_lineHeight, pixels + record.pixelOffset, metrics.width);
+        }
+
+        return true;
+    }
+
+    inline void SaveCache()
+    {
+        if (this->_cachePath.empty())
+        {
+            return;
+        }
+
+        const std::wstring &path = this->_cachePath;
+        const std::wstring &key = this->_cacheKey;
+
+        std::vector<FontCacheGlyph> records;
+        std::vector<uint8_t> pixels;
+
+        for (wchar_t c = g_charRangeMin; c < g_charRangeMax; c++)
+        {
+            auto it = this->_glyphMetrics.find(c);
+            if (it == this->_glyphMetrics.end())
+            {
+                continue;
+            }
+
+            const GlyphMetrics &metrics = it->second;
+
+            FontCacheGlyph record{};
+            record.codePoint = c;
+            record.width = metrics.width;
+            record.advance = metrics.advance;
+            record.offset = metrics.offset;
+            record.valid = metrics.valid ? 1 : 0;
+            record.pixelOffset = g_fontCacheNoPixels;
+
+            if (metrics.valid && c != L' ')
+            {
+                record.pixelOffset = static_cast<uint32_t>(pixels.size());
+                pixels.resize(pixels.size() + static_cast<size_t>(metrics.width) * this->_lineHeight);
+
+                // already evicted from a crowded atlas, an incomplete cache is not worth writing
+                if (!this->_atlas->ReadGlyph(FontAtlas::MakeGlyphKey(this->_fontId, c), &pixels[record.pixelOffset],
+                                             metrics.width))
+                {
+                    return;
+                }
+            }
+
+            records.push_back(record);
+        }
+
+        FontCacheHeader header{};
+        header.magic = g_fontCacheMagic;
+        header.version = g_fontCacheVersion;
+        header.keyLength = static_cast<uint32_t>(key.size());
+        header.lineHeight = this->_lineHeight;
+        header.glyphCount = static_cast<uint32_t>(records.size());
+        header.pixelSize = static_cast<uint32_t>(pixels.size());
+
+        // write next to the final file and swap it in, so a concurrent start never maps a partial cache
+        const std::wstring tempPath = path + L".tmp";
+
+        HANDLE file =
+            CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
+
+        const auto write = [file](const void *data, size_t size) {
+            DWORD written = 0;
+            return size == 0 ||
+                   (WriteFile(file, data, static_cast<DWORD>(size), &written, nullptr) && written == size);
+        };
+
+        const bool written = write(&header, sizeof(header)) && write(key.data(), key.size() * sizeof(wchar_t)) &&
+                             write(records.data(), records.size() * sizeof(FontCacheGlyph)) &&
+                             write(pixels.data(), pixels.size());
+
+        CloseHandle(file);
+
+        if (!written || !MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            DeleteFileW(tempPath.c_str());
+        }
+    }
+
+    inline const GlyphMetrics *GetGlyphMetrics(uint32_t codePoint)
+    {
+        auto it = this->_glyphMetrics.find(codePoint);
+        if (it == this->_glyphMetrics.end())
+        {
+            it = this->_glyphMetrics.emplace(codePoint, this->_source->MeasureGlyph(codePoint)).first;
+        }
+
+        return it->second.valid ? &it->second : nullptr;
+    }
+
+    inline AtlasGlyph *GetGlyph(uint32_t codePoint, const GlyphMetrics &metrics)
+    {
+        AtlasGlyph *glyph = this->_atlas->FindGlyph(FontAtlas::MakeGlyphKey(this->_fontId, codePoint));
+        if (glyph)
+        {
+            return glyph;
+        }
+
+        return this->RasterizeGlyph(*this->_source, codePoint, metrics, this->_cell);
+    }
+
+    // Runs with TEXT_FLAG_CACHED get an id for their composed image. Color tags need a color per glyph, runs using
+    // them are drawn glyph by glyph.
+    inline void PrepareRunCache(TextRun &run)
+    {
+        run.cacheId = 0;
+
+        if (!(run.flags & TEXT_FLAG_CACHED) || run.glyphs.empty() ||
+            std::any_of(run.glyphs.begin(), run.glyphs.end(), [](const TextRunGlyph &glyph) { return glyph.tagColor; }))
+        {
+            return;
+        }
+
+        // 0 marks runs which are not cached
+        if (++this->_nextCacheId == 0)
+        {
+            this->_nextCacheId = 1;
+        }
+
+        run.cacheId = this->_nextCacheId;
+        run.cacheOrigin = run.glyphs.front().pos;
+
+        for (const TextRunGlyph &glyph : run.glyphs)
+        {
+            run.cacheOrigin.x = min(run.cacheOrigin.x, glyph.pos.x);
+            run.cacheOrigin.y = min(run.cacheOrigin.y, glyph.pos.y);
+        }
+    }
+
+    // The composed image is evicted from the atlas like any glyph and composed again from the pinned glyphs of the run
+    // once it is drawn after that.
+    inline const AtlasGlyph *CacheRun(const TextRun &run)
+    {
+        const uint64_t key = FontAtlas::MakeStringKey(this->_fontId, run.cacheId);
+
+        const AtlasGlyph *image = this->_atlas->FindGlyph(key);
+        if (image)
+        {
+            return image;
+        }
+
+        long width = 0;
+        long height = 0;
+        std::vector<uint8_t> pixels;
+
+        this->ComposeRun(run, pixels, width, height);
+        return this->_atlas->AddGlyph(key, width, height, pixels.data(), width);
+    }
+
+    // Copies the coverage of every glyph of a run into one image, laid out at scale 1 all glyphs sit on whole pixels.
+    inline void ComposeRun(const TextRun &run, std::vector<uint8_t> &pixels, long &width, long &height)
+    {
+        width = 0;
+        height = 0;
+
+        for (const TextRunGlyph &glyph : run.glyphs)
+        {
+            const GlyphMetrics *metrics = this->GetGlyphMetrics(glyph.codePoint);
+
+            width = max(width, lroundf(glyph.pos.x - run.cacheOrigin.x) + metrics->width);
+            height = max(height, lroundf(glyph.pos.y - run.cacheOrigin.y) + this->_lineHeight);
+        }
+
+        pixels.assign(static_cast<size_t>(width) * height, 0);
+
+        for (const TextRunGlyph &glyph : run.glyphs)
+        {
+            const GlyphMetrics *metrics = this->GetGlyphMetrics(glyph.codePoint);
+
+            this->_cell.assign(static_cast<size_t>(metrics->width) * this->_lineHeight, 0);
+            if (!this->_atlas->ReadGlyph(FontAtlas::MakeGlyphKey(this->_fontId, glyph.codePoint), this->_cell.data(),
+                                         metrics->width))
+            {
+                continue;
+            }
+
+            const long left = lroundf(glyph.pos.x - run.cacheOrigin.x);
+            const long top = lroundf(glyph.pos.y - run.cacheOrigin.y);
+
+            // neighbouring glyphs may overlap, keep the higher coverage
+            for (long row = 0; row < this->_lineHeight; row++)
+            {
+                uint8_t *dst = &pixels[width * (top + row) + left];
+                const uint8_t *src = &this->_cell[metrics->width * row];
+
+                for (long column = 0; column < metrics->width; column++)
+                {
+                    dst[column] = max(dst[column], src[column]);
+                }
+            }
+        }
+    }
+
+    inline AtlasGlyph *RasterizeGlyph(FontSource &source, uint32_t codePoint, const GlyphMetrics &metrics,
+                                      std::vector<uint8_t> &cell)
+    {
+        cell.assign(static_cast<size_t>(metrics.width) * this->_lineHeight, 0);
+        source.RasterizeGlyph(codePoint, metrics, cell.data(), metrics.width);
+
+        return this->_atlas->AddGlyph(FontAtlas::MakeGlyphKey(this->_fontId, codePoint), metrics.width,
+                                      this->_lineHeight, cell.data(), metrics.width);
+    }
+
+    inline void BakeChunk(FontSource &source, uint32_t first, uint32_t last)
+    {
+        std::vector<uint8_t> cell;
+
+        for (uint32_t c = first; c < last; c++)
+        {
+            const GlyphMetrics metrics = source.MeasureGlyph(c);
+
+            {
+                std::lock_guard<std::mutex> lock(this->_bakeMutex);
+                this->_glyphMetrics[c] = metrics;
+            }
+
+            if (metrics.valid && c != L' ')
+            {
+                this->RasterizeGlyph(source, c, metrics, cell);
+            }
+        }
+
+        // the last chunk to finish publishes the font
+        if (--this->_pendingChunks == 0)
+        {
+            this->SaveCache();
+            this->_initialized = true;
+        }
+    }
+
+    template <typename CharT>
+    inline Vec2 RenderTextImpl(const RenderListPtr &renderList, Vec2 pos, std::basic_string_view<CharT> text,
+                               const Color color, uint32_t flags, const Color outlineColor, float outlineThickness,
+                               float scale, float maxWidth)
+    {
+        // still baking, never wait for it
+        if (!this->_initialized)
+        {
+            return Vec2(0.f, 0.f);
+        }
+
+        std::lock_guard<std::mutex> lock(this->_layoutMutex);
+
+        const auto addGlyph = [&](uint32_t, float x, float y, float, float, const AtlasGlyph &glyph, Color currentColor,
+                                  bool) {
+            this->AddGlyphInstance(renderList, x, y, glyph.index, currentColor, flags, outlineColor, outlineThickness,
+                                   scale);
+        };
+
+        Vec2 extent;
+        this->LayoutText(pos, text, color, flags, scale, maxWidth, extent, addGlyph);
+        return extent;
+    }
+
+    // Walks the glyphs of text with color tags and alignment flags applied, extent receives the size of the laid out
+    // block. Glyphs which do not fit into the atlas anymore are skipped, the return value tells whether any was.
+    template <typename CharT, typename Callback>
+    inline bool LayoutText(Vec2 pos, std::basic_string_view<CharT> text, const Color color, uint32_t flags,
+                           float scale, float maxWidth, Vec2 &extent, Callback &&callback)
+    {
+        if (maxWidth > 0.f && (flags & (TEXT_FLAG_WORD_WRAP | TEXT_FLAG_ELLIPSIS)))
+        {
+            return this->LayoutLines(pos, text, color, flags, scale, maxWidth, extent, callback);
+        }
+
+        if (flags & (TEXT_FLAG_RIGHT | TEXT_FLAG_CENTERED))
+        {
+            AlignText(pos, this->CalculateTextExtentImpl(text, scale), flags);
+        }
+
+        const float lineHeight = static_cast<float>(this->_lineHeight) * scale;
+        float startX = pos.x;
+        float width = 0.f;
+        float height = lineHeight;
+        Color currentColor = color;
+        bool tagColor = false;
+        bool complete = true;
+
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            // color tags switch the color of everything after them
+            uint32_t parsedColor;
+            if (const size_t tagLength = detail::ParseColorTag(text, i, parsedColor))
+            {
+                currentColor = parsedColor;
+                tagColor = true;
+                i += tagLength - 1;
+                continue;
+            }
+
+            const uint32_t c = detail::DecodeCodePoint(text, i);
+
+            // jump to next line if asked
+            if (c == '\n')
+            {
+                width = max(width, pos.x - startX);
+                height += lineHeight;
+                pos.x = startX;
+                pos.y += lineHeight;
+            }
+
+            // ignore invalid chars
+            if (c < L' ')
+            {
+                continue;
+            }
+
+            pos.x += this->LayoutGlyph(c, pos, currentColor, tagColor, scale, complete, callback);
+        }
+
+        extent = Vec2(max(width, pos.x - startX), height);
+        return complete;
+    }
+
+    // Lays out text wrapped or cut off at maxWidth, see TextLayout.
+    template <typename CharT, typename Callback>
+    inline bool LayoutLines(Vec2 pos, std::basic_string_view<CharT> text, const Color color, uint32_t flags,
+                            float scale, float maxWidth, Vec2 &extent, Callback &callback)
+    {
+        const float width = this->_textLayout.BreakLines(text, static_cast<uint32_t>(color), flags, scale, maxWidth,
+                                                         [this](uint32_t c) { return this->GetGlyphMetrics(c); });
+
+        const std::vector<TextLayoutChar> &chars = this->_textLayout.GetChars();
+        const std::vector<TextLine> &lines = this->_textLayout.GetLines();
+
+        const float lineHeight = static_cast<float>(this->_lineHeight) * scale;
+        extent = Vec2(width, lineHeight * lines.size());
+
+        AlignText(pos, extent, flags);
+
+        bool complete = true;
+
+        for (const TextLine &line : lines)
+        {
+            float x = pos.x;
+
+            for (size_t i = line.begin; i < line.end; i++)
+            {
+                x += this->LayoutGlyph(chars[i].codePoint, Vec2(x, pos.y), chars[i].color, chars[i].tagColor, scale,
+                                       complete, callback);
+            }
+
+            // a cut off line always has a char after the cut, the dots take its color
+            if (line.ellipsis)
+            {
+                for (int i = 0; i < 3; i++)
+                {
+                    x += this->LayoutGlyph('.', Vec2(x, pos.y), chars[line.end].color, chars[line.end].tagColor, scale,
+                                           complete, callback);
+                }
+            }
+
+            pos.y += lineHeight;
+        }
+
+        return complete;
+    }
+
+    static inline void AlignText(Vec2 &pos, const Vec2 &size, uint32_t flags)
+    {
+        if (flags & TEXT_FLAG_RIGHT)
+        {
+            pos.x -= size.x;
+        }
+        else if (flags & TEXT_FLAG_CENTERED_X)
+        {
+            pos.x -= 0.5f * size.x;
+        }
+
+        if (flags & TEXT_FLAG_CENTERED_Y)
+        {
+            pos.y -= 0.5f * size.y;
+        }
+    }
+
+    // Hands a single char at pos to the callback and returns its advance, spaces and unknown chars only advance.
+    template <typename Callback>
+    inline float LayoutGlyph(uint32_t c, Vec2 pos, const Color color, bool tagColor, float scale, bool &complete,
+                             Callback &callback)
+    {
+        // try to measure the char, unknown ones are skipped
+        const GlyphMetrics *metrics = this->GetGlyphMetrics(c);
+        if (!metrics)
+        {
+            return 0.f;
+        }
+
+        // do not render space char
+        if (c != L' ')
+        {
+            const AtlasGlyph *glyph = this->GetGlyph(c, *metrics);
+            if (glyph)
+            {
+                callback(c, pos.x - static_cast<float>(metrics->offset) * scale, pos.y,
+                         static_cast<float>(metrics->width) * scale, static_cast<float>(this->_lineHeight) * scale,
+                         *glyph, color, tagColor);
+            }
+            else
+            {
+                complete = false;
+            }
+        }
+
+        return static_cast<float>(metrics->advance) * scale;
+    }
+
+    // Records the glyph as a single instance, outline and shadow are composited below it by the pixel shader.
+    inline void AddGlyphInstance(const RenderListPtr &renderList, float x, float y, uint32_t glyphIndex,
+                                 const Color currentColor, uint32_t flags, const Color outlineColor,
+                                 float outlineThickness, float scale)
+    {
+        uint32_t effect = GLYPH_EFFECT_NONE;
+
+        if (flags & TEXT_FLAG_OUTLINE)
+        {
+            const float thickness = min(max(outlineThickness, 0.f), static_cast<float>(g_fontEffectPadding));
+            effect |= GLYPH_EFFECT_OUTLINE | (static_cast<uint32_t>(thickness * 256.f) << 8);
+        }
+
+        if (flags & TEXT_FLAG_DROPSHADOW)
+        {
+            effect |= GLYPH_EFFECT_SHADOW;
+        }
+
+        // a published list pins its glyphs in the atlas they came from
+        if (renderList->_glyphAtlas != this->_atlas)
+        {
+            renderList->_glyphAtlas = this->_atlas;
+        }
+
+        const GlyphInstance instance = {Vec2(x, y), glyphIndex, currentColor, outlineColor, effect, scale};
+        renderList->AddGlyphInstances(&instance, 1, this->_atlas->GetTextureView());
+    }
+
+    template <typename CharT> inline Vec2 CalculateTextExtentImpl(std::basic_string_view<CharT> text, float scale)
+    {
+        if (!this->_initialized)
+        {
+            return Vec2(0.f, 0.f);
+        }
+
+        float rowWidth = 0.f;
+        float rowHeight = static_cast<float>(this->_lineHeight) * scale;
+        float width = 0.f;
+        float height = rowHeight;
+
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            uint32_t tagColor;
+            if (const size_t tagLength = detail::ParseColorTag(text, i, tagColor))
+            {
+                i += tagLength - 1;
+                continue;
+            }
+
+            const uint32_t c = detail::DecodeCodePoint(text, i);
+
+            if (c == L'\n')
+            {
+                height += rowHeight;
+                width = max(width, rowWidth);
+                rowWidth = 0.f;
+            }
+            else if (c >= L' ')
+            {
+                const GlyphMetrics *metrics = this->GetGlyphMetrics(c);
+                if (metrics)
+                {
+                    rowWidth += static_cast<float>(metrics->advance) * scale;
+                }
+            }
+        }
+
+        width = max(width, rowWidth);
+        return Vec2(width, height);
+    }
+
+    std::shared_ptr<FontAtlas> _atlas;
+    uint32_t _fontId;
+    FontSourcePtr _source;
+    std::wstring _cacheKey;
+    std::wstring _cachePath;
+    std::unordered_map<uint32_t, GlyphMetrics> _glyphMetrics;
+    std::vector<uint8_t> _cell;
+    long _lineHeight;
+    // scratch of LayoutLines()
+    TextLayout _textLayout;
+    uint32_t _nextCacheId;
+    // text may be recorded into different lists from several threads, the scratch above, the metrics measured on
+    // demand and the font source are shared by all of them
+    std::mutex _layoutMutex;
+
+    // chunks of an asynchronous bake fill the metrics concurrently, the render thread only reads them once the font
+    // is initialized
+    std::mutex _bakeMutex;
+    std::atomic<uint32_t> _pendingChunks;
+    std::atomic<bool> _initialized;
+};
+
+class Renderer : public std::enable_shared_from_this<Renderer>
+{
+  public:
+    // All fonts share one atlas that cannot grow once text was recorded, fontAtlasArea is the texture area it is fitted
+    // to. EstimateFontAtlasArea() gives the area of the fonts that are going to be added.
+    Renderer(ID3D11Device *d3dDevice, uint32_t maxVertices, long fontAtlasArea = g_fontAtlasDefaultArea)
+        : _displaySize(0.f, 0.f), _d3dDevice(d3dDevice), _d3dDeviceContext(nullptr), _inputLayout(nullptr),
+          _blendState(nullptr),
+          _vertexShader(nullptr), _pixelShader(nullptr), _vertexBuffer(nullptr), _vertexConstantBuffer(nullptr),
+          _glyphInputLayout(nullptr), _glyphVertexShader(nullptr), _instanceBuffer(nullptr), _maxGlyphInstances(0),
+          _worldInputLayout(nullptr), _worldVertexShader(nullptr), _worldVertexBuffer(nullptr), _maxWorldVertices(0),
+          _maxVertices(maxVertices), _renderList(std::make_shared<RenderList>(maxVertices)), _nextFontId(1),
+          _textQuadsSaved(0)
+    {
+        if (!d3dDevice)
+        {
+            throw std::exception("Renderer::ctor() d3dDevice is null!");
+        }
+
+        ID3DBlob *vsBlob = nullptr;
+        ID3DBlob *psBlob = nullptr;
+
+        this->_d3dDevice->GetImmediateContext(&this->_d3dDeviceContext);
+
+        detail::ThrowIfFailed(D3DCompile(g_vertexShader, strlen(g_vertexShader), nullptr, nullptr, nullptr, "main",
+                                         "vs_4_0", 0, 0, &vsBlob, nullptr));
+
+        detail::ThrowIfFailed(D3DCompile(g_pixelShader, strlen(g_pixelShader), nullptr, nullptr, nullptr, "main",
+                                         "ps_4_0", 0, 0, &psBlob, nullptr));
+
+        detail::ThrowIfFailed(this->_d3dDevice->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(),
+                                                                   nullptr, &this->_vertexShader));
+
+        detail::ThrowIfFailed(this->_d3dDevice->CreatePixelShader(psBlob->GetBufferPointer(), psBlob->GetBufferSize(),
+                                                                  nullptr, &this->_pixelShader));
+
+        D3D11_INPUT_ELEMENT_DESC layout[] = {
+            {"POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, (UINT)offsetof(Vertex, pos), D3D11_INPUT_PER_VERTEX_DATA, 0},
+            {"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, (UINT)offsetof(Vertex, uv), D3D11_INPUT_PER_VERTEX_DATA, 0},
+            {"COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, (UINT)offsetof(Vertex, color), D3D11_INPUT_PER_VERTEX_DATA, 0},
+        };
+
+        detail::ThrowIfFailed(this->_d3dDevice->CreateInputLayout(layout, ARRAYSIZE(layout), vsBlob->GetBufferPointer(),
+                                                                  vsBlob->GetBufferSize(), &this->_inputLayout));
+
+        detail::SafeRelease(&vsBlob);
+        detail::SafeRelease(&psBlob);
+
+        // Text is drawn instanced, every GlyphInstance becomes a 4 vertex strip carrying fill, outline and shadow
+        detail::ThrowIfFailed(D3DCompile(g_glyphVertexShader, strlen(g_glyphVertexShader), nullptr, nullptr, nullptr,
+                                         "main", "vs_4_0", 0, 0, &vsBlob, nullptr));
+
+        detail::ThrowIfFailed(this->_d3dDevice->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(),
+                                                                   nullptr, &this->_glyphVertexShader));
+
+        D3D11_INPUT_ELEMENT_DESC glyphLayout[] = {
+            {"POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, (UINT)offsetof(GlyphInstance, pos),
+             D3D11_INPUT_PER_INSTANCE_DATA, 1},
+            {"GLYPH", 0, DXGI_FORMAT_R32_UINT, 0, (UINT)offsetof(GlyphInstance, glyphIndex),
+             D3D11_INPUT_PER_INSTANCE_DATA, 1},
+            {"COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, (UINT)offsetof(GlyphInstance, color),
+             D3D11_INPUT_PER_INSTANCE_DATA, 1},
+            {"COLOR", 1, DXGI_FORMAT_R8G8B8A8_UNORM, 0, (UINT)offsetof(GlyphInstance, outlineColor),
+             D3D11_INPUT_PER_INSTANCE_DATA, 1},
+            {"EFFECT", 0, DXGI_FORMAT_R32_UINT, 0, (UINT)offsetof(GlyphInstance, effect),
+             D3D11_INPUT_PER_INSTANCE_DATA, 1},
+            {"SCALE", 0, DXGI_FORMAT_R32_FLOAT, 0, (UINT)offsetof(GlyphInstance, scale),
+             D3D11_INPUT_PER_INSTANCE_DATA, 1},
+        };
+
+        detail::ThrowIfFailed(this->_d3dDevice->CreateInputLayout(glyphLayout, ARRAYSIZE(glyphLayout),
+                                                                  vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(),
+                                                                  &this->_glyphInputLayout));
+
+        detail::SafeRelease(&vsBlob);
+
+        // World-space primitives keep their 3D positions, the vertex buffer is created once they are drawn
+        detail::ThrowIfFailed(D3DCompile(g_worldVertexShader, strlen(g_worldVertexShader), nullptr, nullptr, nullptr,
+                                         "main", "vs_4_0", 0, 0, &vsBlob, nullptr));
+
+        detail::ThrowIfFailed(this->_d3dDevice->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(),
+                                                                   nullptr, &this->_worldVertexShader));
+
+        D3D11_INPUT_ELEMENT_DESC worldLayout[] = {
+            {"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, (UINT)offsetof(WorldVertex, pos),
+             D3D11_INPUT_PER_VERTEX_DATA, 0},
+            {"COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, (UINT)offsetof(WorldVertex, color),
+             D3D11_INPUT_PER_VERTEX_DATA, 0},
+        };
+
+        detail::ThrowIfFailed(this->_d3dDevice->CreateInputLayout(worldLayout, ARRAYSIZE(worldLayout),
+                                                                  vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(),
+                                                                  &this->_worldInputLayout));
+
+        detail::SafeRelease(&vsBlob);
+
+        // Create the blender state
+        {
+            D3D11_BLEND_DESC desc{};
+            desc.RenderTarget->BlendEnable = TRUE;
+            desc.RenderTarget->SrcBlend = D3D11_BLEND_SRC_ALPHA;
+            desc.RenderTarget->DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
+            desc.RenderTarget->SrcBlendAlpha = D3D11_BLEND_ONE;
+            desc.RenderTarget->DestBlendAlpha = D3D11_BLEND_ZERO;
+            desc.RenderTarget->BlendOp = D3D11_BLEND_OP_ADD;
+            desc.RenderTarget->BlendOpAlpha = D3D11_BLEND_OP_ADD;
+            desc.RenderTarget->RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+
+            detail::ThrowIfFailed(this->_d3dDevice->CreateBlendState(&desc, &this->_blendState));
+        }
+
+        // Create the rasterizer state
+        {
+            D3D11_RASTERIZER_DESC desc{};
+            desc.FillMode = D3D11_FILL_SOLID;
+            desc.CullMode = D3D11_CULL_NONE;
+            desc.ScissorEnable = true;
+            desc.DepthClipEnable = true;
+
+            detail::ThrowIfFailed(this->_d3dDevice->CreateRasterizerState(&desc, &this->_rasterizerState));
+        }
+
+        // Create depth-stencil State
+        {
+            D3D11_DEPTH_STENCIL_DESC desc{};
+            desc.DepthEnable = false;
+            desc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+            desc.DepthFunc = D3D11_COMPARISON_ALWAYS;
+            desc.StencilEnable = false;
+            desc.FrontFace.StencilFailOp = desc.FrontFace.StencilDepthFailOp = desc.FrontFace.StencilPassOp =
+                D3D11_STENCIL_OP_KEEP;
+            desc.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+            desc.BackFace = desc.FrontFace;
+
+            detail::ThrowIfFailed(this->_d3dDevice->CreateDepthStencilState(&desc, &this->_depthStencilState));
+        }
+
+        // Create vertex buffer
+        this->CreateVertexBuffer(maxVertices);
+
+        // Create glyph instance buffer, a glyph used to take a quad of 6 vertices
+        this->CreateInstanceBuffer(max(static_cast<size_t>(maxVertices) / 6, static_cast<size_t>(1)));
+
+        // Create vertex constant buffer, holds the orthographic projection followed by the world view-projection
+        {
+            D3D11_BUFFER_DESC desc{};
+            desc.Usage = D3D11_USAGE_DYNAMIC;
+            desc.ByteWidth = sizeof(DirectX::XMMATRIX) * 2;
+            desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+            desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+            desc.MiscFlags = 0;
+
+            detail::ThrowIfFailed(this->_d3dDevice->CreateBuffer(&desc, nullptr, &this->_vertexConstantBuffer));
+        }
+
+        // Create font sampler
+        {
+            D3D11_SAMPLER_DESC desc{};
+            desc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+            desc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+            desc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+            desc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+            desc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+            desc.MinLOD = 0;
+            desc.MaxLOD = D3D11_FLOAT32_MAX;
+
+            detail::ThrowIfFailed(this->_d3dDevice->CreateSamplerState(&desc, &this->_fontSampler));
+        }
+
+        // Shapes and text of every font sample the same atlas, so a texture is always bound and they batch together
+        long atlasWidth = 0;
+        long atlasHeight = 0;
+        GlyphCache::FitSize(fontAtlasArea, atlasWidth, atlasHeight);
+
+        this->_fontAtlas = std::make_shared<FontAtlas>(this->_d3dDevice, atlasWidth, atlasHeight);
+        this->_fontAtlas->Initialize();
+
+        // Get viewport to create orthographic projection matrix
+        D3D11_VIEWPORT viewport{};
+        UINT numViewports = 1;
+
+        this->_d3dDeviceContext->RSGetViewports(&numViewports, &viewport);
+
+        this->_displaySize = {viewport.Width, viewport.Height};
+        this->_viewProjMatrix = DirectX::XMMatrixIdentity();
+
+        // Setup orthographic projection matrix into our constant buffer
+        this->UpdateProjection();
+    }
+
+    ~Renderer()
+    {
+        this->Release();
     }
 
     inline void Release()
     {
-        detail::SafeRelease(&this->_fontTextureView);
+        detail::SafeRelease(&this->_vertexShader);
+        detail::SafeRelease(&this->_pixelShader);
+        detail::SafeRelease(&this->_vertexBuffer);
+        detail::SafeRelease(&this->_vertexConstantBuffer);
+        detail::SafeRelease(&this->_inputLayout);
+        detail::SafeRelease(&this->_glyphVertexShader);
+        detail::SafeRelease(&this->_glyphInputLayout);
+        detail::SafeRelease(&this->_instanceBuffer);
+        detail::SafeRelease(&this->_worldVertexShader);
+        detail::SafeRelease(&this->_worldInputLayout);
+        detail::SafeRelease(&this->_worldVertexBuffer);
+        this->_maxWorldVertices = 0;
+        this->_uploadedHashes.clear();
+        detail::SafeRelease(&this->_fontSampler);
+        detail::SafeRelease(&this->_blendState);
+        detail::SafeRelease(&this->_depthStencilState);
+        detail::SafeRelease(&this->_rasterizerState);
     }
 
     inline void OnLostDevice()
     {
         this->Release();
+        this->_fontAtlas->Release();
     }
 
     inline void OnResetDevice()
     {
-        this->Initialize();
+        this->_fontAtlas->Initialize();
     }
 
-    inline void Initialize()
+    inline void BeginFrame()
     {
-        this->_initialized = false;
-
-        HGDIOBJ gdiFont = nullptr;
-        HGDIOBJ prevGdiFont = nullptr;
-        HBITMAP bitmap = nullptr;
-        HGDIOBJ prevBitmap = nullptr;
-
-        HDC hdc = CreateCompatibleDC(nullptr);
-        SetMapMode(hdc, MM_TEXT);
+        this->AcquireStateBlock();
 
-        this->CreateGdiFont(hdc, &gdiFont);
-        if (!gdiFont)
+        // follow the viewport of the game, so a resized window doesn't need a new renderer
+        if (this->_backupState.ViewportsCount > 0)
         {
-            throw std::runtime_error("Font::ctor(): CreateGdiFont failed!");
+            this->SetDisplaySize({this->_backupState.Viewports[0].Width, this->_backupState.Viewports[0].Height});
         }
 
-        prevGdiFont = SelectObject(hdc, gdiFont);
-
-        this->EstimateTextureSize(hdc);
-
-        D3D11_TEXTURE2D_DESC texDesc = {};
-        texDesc.Width = this->_textureWidth;
-        texDesc.Height = this->_textureHeight;
-        texDesc.MipLevels = 1;
-        texDesc.ArraySize = 1;
-        texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-        texDesc.SampleDesc.Count = 1;
-        texDesc.Usage = D3D11_USAGE_DYNAMIC;
-        texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-        texDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-
-        ID3D11Texture2D *texture = nullptr;
-
-        HRESULT hr = this->_d3dDevice->CreateTexture2D(&texDesc, nullptr, &texture);
-        if (FAILED(hr))
-        {
-            throw std::runtime_error("Font::ctor(): CreateTexture failed!");
-        }
+        this->_fontAtlas->NewFrame();
+        this->_textQuadsSaved = 0;
+        this->_renderStats = {};
 
-        D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-        srvDesc.Format = texDesc.Format;
-        srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-        srvDesc.Texture2D.MostDetailedMip = 0;
-        srvDesc.Texture2D.MipLevels = 1;
+        D3D11_VIEWPORT vp{};
+        vp.Width = this->_displaySize.x;
+        vp.Height = this->_displaySize.y;
+        vp.MinDepth = 0.0f;
+        vp.MaxDepth = 1.0f;
+        vp.TopLeftX = vp.TopLeftY = 0;
+        this->_d3dDeviceContext->RSSetViewports(1, &vp);
 
-        hr = this->_d3dDevice->CreateShaderResourceView(texture, &srvDesc, &this->_fontTextureView);
-        if (FAILED(hr))
-        {
-            throw std::runtime_error("Font::ctor(): CreateShaderResourceView failed!");
-        }
+        this->SetupPipeline(BatchType::Vertices);
+        this->_d3dDeviceContext->VSSetConstantBuffers(0, 1, &this->_vertexConstantBuffer);
+        this->_d3dDeviceContext->PSSetShader(this->_pixelShader, nullptr, 0);
+        this->_d3dDeviceContext->PSSetSamplers(0, 1, &this->_fontSampler);
 
-        BITMAPINFO bitmapInfo{};
-        bitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-        bitmapInfo.bmiHeader.biWidth = this->_textureWidth;
-        bitmapInfo.bmiHeader.biHeight = -this->_textureHeight;
-        bitmapInfo.bmiHeader.biPlanes = 1;
-        bitmapInfo.bmiHeader.biCompression = BI_RGB;
-        bitmapInfo.bmiHeader.biBitCount = 32;
+        const float blendFactor[4] = {0.f, 0.f, 0.f, 0.f};
+        this->_d3dDeviceContext->OMSetBlendState(this->_blendState, blendFactor, 0xffffffff);
+        this->_d3dDeviceContext->OMSetDepthStencilState(this->_depthStencilState, 0);
+        this->_d3dDeviceContext->RSSetState(this->_rasterizerState);
+    }
 
-        uint32_t *bitmapBips;
+    inline void EndFrame()
+    {
+        this->RestoreStateBlock();
+    }
 
-        bitmap = CreateDIBSection(hdc, &bitmapInfo, DIB_RGB_COLORS, reinterpret_cast<void **>(&bitmapBips), nullptr, 0);
-        if (!bitmap)
+    // Size of the area drawn to, e.g. after the back buffer was resized. Rebuilding the projection is a single constant
+    // buffer write and skipped while the size stays the same.
+    inline void SetDisplaySize(const Vec2 &displaySize)
+    {
+        if (displaySize.x == this->_displaySize.x && displaySize.y == this->_displaySize.y)
         {
-            throw std::runtime_error("Font::ctor(): CreateDIBSection failed!");
+            return;
         }
 
-        prevBitmap = SelectObject(hdc, bitmap);
-
-        SetTextColor(hdc, RGB(255, 255, 255));
-        SetBkColor(hdc, 0x00000000);
-        SetTextAlign(hdc, TA_TOP);
+        this->_displaySize = displaySize;
+        this->UpdateProjection();
+    }
 
-        hr = this->RenderAlphabet(hdc, false);
-        if (FAILED(hr))
-        {
-            throw std::runtime_error("Font::ctor(): RenderAlphabet failed!");
-        }
+    inline Vec2 GetDisplaySize() const
+    {
+        return this->_displaySize;
+    }
 
-        D3D11_MAPPED_SUBRESOURCE mappedResource;
-        this->_d3dDeviceContext->Map(texture, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+    // Atlas area the basic charset of a font takes, with room for a couple of times that for glyphs rasterized later.
+    // The sum over all fonts is the area to construct the renderer with.
+    static inline long EstimateFontAtlasArea(FontSource &fontSource)
+    {
+        const long lineHeight = fontSource.GetLineHeight();
 
-        uint8_t *dstRow = static_cast<uint8_t *>(mappedResource.pData);
+        long area = 0;
 
-        for (long y = 0; y < this->_textureHeight; y++)
+        for (wchar_t c = g_charRangeMin; c < g_charRangeMax; c++)
         {
-            uint32_t *dst = reinterpret_cast<uint32_t *>(dstRow);
-
-            for (long x = 0; x < this->_textureWidth; x++)
+            const GlyphMetrics metrics = fontSource.MeasureGlyph(c);
+            if (!metrics.valid)
             {
-                uint8_t alpha = bitmapBips[this->_textureWidth * y + x] & 0xff;
-                *dst++ = (alpha << 24) | 0x00FFFFFF;
+                continue;
             }
 
-            dstRow += mappedResource.RowPitch;
+            area += (metrics.width + 2 * g_fontEffectPadding + g_fontAtlasPadding) *
+                    (lineHeight + 2 * g_fontEffectPadding + g_fontAtlasPadding);
         }
 
-        this->_d3dDeviceContext->Unmap(texture, 0);
-
-        detail::SafeRelease(&texture);
-
-        SelectObject(hdc, prevBitmap);
-        SelectObject(hdc, prevGdiFont);
-        DeleteObject(bitmap);
-        DeleteObject(gdiFont);
-        DeleteDC(hdc);
+        return area * 4;
+    }
 
-        this->_initialized = true;
+    inline FontHandle AddFont(const std::wstring &fontFamily, long fontHeigth, uint32_t fontFlags = FONT_FLAG_NONE)
+    {
+        return this->AddFont(std::make_shared<GdiFontSource>(fontFamily, fontHeigth, fontFlags));
     }
 
-    inline void RenderText(Vec2 pos, const std::wstring &text, const Color color, uint32_t flags,
-                           const Color outlineColor, float outlineThickness)
+    // Fonts added afterwards load their preloaded glyphs from this directory and store them there after baking them
+    // for the first time. An empty directory disables the cache.
+    inline void SetFontCacheDirectory(const std::wstring &directory)
     {
-        size_t numToSkip = 0;
+        this->_fontCacheDirectory = directory;
+    }
 
-        std::vector<TextSegment> segments = PreprocessText(text, color);
-        std::wstring cleanedText;
+    inline FontHandle AddFont(const FontSourcePtr &fontSource)
+    {
+        const size_t fontHandle = this->_nextFontId++;
 
-        for (const auto &[textSegment, _] : segments)
-        {
-            cleanedText += textSegment;
-        }
+        std::shared_ptr<Font> fontPtr = std::make_shared<Font>(this->_fontAtlas, static_cast<uint32_t>(fontHandle),
+                                                               fontSource, this->_fontCacheDirectory);
+        fontPtr->Initialize();
 
-        if (flags & (TEXT_FLAG_RIGHT | TEXT_FLAG_CENTERED))
-        {
-            Vec2 size = this->CalculateTextExtent(cleanedText);
+        this->_fonts[fontHandle] = fontPtr;
+        return fontHandle;
+    }
 
-            if (flags & TEXT_FLAG_RIGHT)
-            {
-                pos.x -= size.x;
-            }
-            else if (flags & TEXT_FLAG_CENTERED_X)
-            {
-                pos.x -= 0.5f * size.x;
-            }
+    inline FontHandle AddFontAsync(const std::wstring &fontFamily, long fontHeigth,
+                                   uint32_t fontFlags = FONT_FLAG_NONE)
+    {
+        return this->AddFontAsync(std::make_shared<GdiFontSource>(fontFamily, fontHeigth, fontFlags));
+    }
 
-            if (flags & TEXT_FLAG_CENTERED_Y)
-            {
-                pos.y -= 0.5f * size.y;
-            }
-        }
+    // Returns immediately, the font is baked by a worker pool and text using it is skipped until IsFontReady().
+    inline FontHandle AddFontAsync(const FontSourcePtr &fontSource)
+    {
+        const size_t fontHandle = this->_nextFontId++;
 
-        pos.x -= this->_charSpacing;
+        std::shared_ptr<Font> fontPtr = std::make_shared<Font>(this->_fontAtlas, static_cast<uint32_t>(fontHandle),
+                                                               fontSource, this->_fontCacheDirectory);
+        fontPtr->InitializeAsync(this->GetThreadPool());
 
-        float startX = pos.x;
+        this->_fonts[fontHandle] = fontPtr;
+        return fontHandle;
+    }
 
-        for (const auto &[textSegment, currentColor] : segments)
+    inline bool IsFontReady(const FontHandle fontId) const
+    {
+        auto font = this->_fonts.find(fontId);
+        if (font == this->_fonts.end())
         {
-            for (const auto &c : textSegment)
-            {
-                if (numToSkip > 0 && numToSkip-- > 0)
-                {
-                    continue;
-                }
-
-                // jump to next line if asked
-                if (c == '\n')
-                {
-                    pos.x = startX;
-                    pos.y += (this->_charCoords[L' '][3] - this->_charCoords[L' '][1]) * this->_textureHeight;
-                }
-
-                // ignore invalid chars
-                if (c < L' ')
-                {
-                    continue;
-                }
-
-                // try to find char in coordinates map
-                auto it = this->_charCoords.find(c);
-                if (it == this->_charCoords.end())
-                {
-                    continue;
-                }
-
-                float tx1 = it->second[0];
-                float ty1 = it->second[1];
-                float tx2 = it->second[2];
-                float ty2 = it->second[3];
-
-                float w = (tx2 - tx1) * this->_textureWidth / this->_textScale;
-                float h = (ty2 - ty1) * this->_textureHeight / this->_textScale;
-
-                // do not render space char
-                if (c != L' ')
-                {
-                    Vertex v[] = {{Vec2{pos.x - 0.5f, pos.y - 0.5f + h}, currentColor, Vec2{tx1, ty2}},
-                                  {Vec2{pos.x - 0.5f, pos.y - 0.5f}, currentColor, Vec2{tx1, ty1}},
-                                  {Vec2{pos.x - 0.5f + w, pos.y - 0.5f + h}, currentColor, Vec2{tx2, ty2}},
-
-                                  {Vec2{pos.x - 0.5f + w, pos.y - 0.5f}, currentColor, Vec2{tx2, ty1}},
-                                  {Vec2{pos.x - 0.5f + w, pos.y - 0.5f + h}, currentColor, Vec2{tx2, ty2}},
-                                  {Vec2{pos.x - 0.5f, pos.y - 0.5f}, currentColor, Vec2{tx1, ty1}}};
-
-                    // Outline vertices
-                    Vertex outlineV[] = {
-                        {Vec2{pos.x - outlineThickness, pos.y - outlineThickness + h}, outlineColor, Vec2{tx1, ty2}},
-                        {Vec2{pos.x - outlineThickness, pos.y - outlineThickness}, outlineColor, Vec2{tx1, ty1}},
-                        {Vec2{pos.x - outlineThickness + w, pos.y - outlineThickness + h}, outlineColor,
-                         Vec2{tx2, ty2}},
-                        {Vec2{pos.x - outlineThickness + w, pos.y - outlineThickness}, outlineColor, Vec2{tx2, ty1}},
-                        {Vec2{pos.x - outlineThickness + w, pos.y - outlineThickness + h}, outlineColor,
-                         Vec2{tx2, ty2}},
-                        {Vec2{pos.x - outlineThickness, pos.y - outlineThickness}, outlineColor, Vec2{tx1, ty1}}};
-
-                    // Drop shadow vertices (slightly offset and darker)
-                    Color shadowColor = Color(0x00, 0x00, 0x00, (currentColor.ToHexColor() >> 24) & 0xff);
-
-                    Vertex shadowV[] = {{Vec2{pos.x + 1.0f, pos.y + 1.0f + h}, shadowColor, Vec2{tx1, ty2}},
-                                        {Vec2{pos.x + 1.0f, pos.y + 1.0f}, shadowColor, Vec2{tx1, ty1}},
-                                        {Vec2{pos.x + 1.0f + w, pos.y + 1.0f + h}, shadowColor, Vec2{tx2, ty2}},
-
-                                        {Vec2{pos.x + 1.0f + w, pos.y + 1.0f}, shadowColor, Vec2{tx2, ty1}},
-                                        {Vec2{pos.x + 1.0f + w, pos.y + 1.0f + h}, shadowColor, Vec2{tx2, ty2}},
-                                        {Vec2{pos.x + 1.0f, pos.y + 1.0f}, shadowColor, Vec2{tx1, ty1}}};
-
-                    if (flags & TEXT_FLAG_OUTLINE)
-                    {
-                        this->_renderList->AddVertices(outlineV, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
-                                                       this->_fontTextureView);
-                    }
-                    else if (flags & TEXT_FLAG_DROPSHADOW)
-                    {
-                        this->_renderList->AddVertices(shadowV, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
-                                                       this->_fontTextureView);
-                    }
-
-                    this->_renderList->AddVertices(v, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, this->_fontTextureView);
-                }
-
-                pos.x += w - (2.f * this->_charSpacing);
-            }
+            throw std::runtime_error("IsFontReady(): Font not found!");
         }
+
+        return font->second->IsInitialized();
     }
 
-    inline Vec2 CalculateTextExtent(const std::wstring &text)
+    // Returns the size of the laid out text. Lines longer than a positive maxWidth are wrapped with
+    // TEXT_FLAG_WORD_WRAP or cut off with TEXT_FLAG_ELLIPSIS.
+    inline Vec2 AddText(const RenderListPtr &renderList, const FontHandle fontId, std::wstring_view text, float x,
+                        float y, const Color color, uint32_t flags = FONT_FLAG_NONE,
+                        const Color outlineColor = Color(0, 0, 0), float outlineThickness = 2.0f, float scale = 1.f,
+                        float maxWidth = 0.f)
     {
-        float rowWidth = 0.f;
-        float rowHeight = (this->_charCoords[L' '][3] - this->_charCoords[L' '][1]) * this->_textureHeight;
-        float width = 0.f;
-        float height = rowHeight;
-
-        for (const auto &c : text)
+        auto font = this->_fonts.find(fontId);
+        if (font == this->_fonts.end())
         {
-            if (c == L'\n')
-            {
-                height += rowHeight;
-                width = max(width, rowWidth);
-                rowWidth = 0.f;
-            }
-            else if (c >= L' ')
-            {
-                auto it = this->_charCoords.find(c);
-                if (it != this->_charCoords.end())
-                {
-                    float charWidth = (it->second[2] - it->second[0]) * this->_textureWidth / this->_textScale;
-                    rowWidth += charWidth - (2.f * this->_charSpacing);
-                }
-            }
+            throw std::exception("AddText(): Font not found!");
         }
 
-        width = max(width, rowWidth);
-        return Vec2(width, height);
+        return font->second->RenderText(renderList, Vec2(x, y), text, color, flags, outlineColor, outlineThickness,
+                                        scale, maxWidth);
     }
 
-    inline std::shared_ptr<Font> MakePtr()
+    inline Vec2 AddText(const FontHandle fontId, std::wstring_view text, float x, float y, const Color color,
+                        uint32_t flags = FONT_FLAG_NONE, const Color outlineColor = Color(0, 0, 0),
+                        float outlineThickness = 2.0f, float scale = 1.f, float maxWidth = 0.f)
     {
-        return shared_from_this();
+        return this->AddText(this->_renderList, fontId, text, x, y, color, flags, outlineColor, outlineThickness,
+                             scale, maxWidth);
     }
 
-    inline bool IsInitialized() const
+    inline Vec2 AddText(const RenderListPtr &renderList, const FontHandle fontId, std::string_view text, float x,
+                        float y, const Color color, uint32_t flags = FONT_FLAG_NONE,
+                        const Color outlineColor = Color(0, 0, 0), float outlineThickness = 2.0f, float scale = 1.f,
+                        float maxWidth = 0.f)
     {
-        return this->_initialized;
+        auto font = this->_fonts.find(fontId);
+        if (font == this->_fonts.end())
+        {
+            throw std::exception("AddText(): Font not found!");
+        }
+
+        return font->second->RenderText(renderList, Vec2(x, y), text, color, flags, outlineColor, outlineThickness,
+                                        scale, maxWidth);
     }
 
-  private:
-    inline void EstimateTextureSize(HDC hdc)
+    inline Vec2 AddText(const FontHandle fontId, std::string_view text, float x, float y, const Color color,
+                        uint32_t flags = FONT_FLAG_NONE, const Color outlineColor = Color(0, 0, 0),
+                        float outlineThickness = 2.0f, float scale = 1.f, float maxWidth = 0.f)
     {
-        SIZE size;
-        wchar_t chr[] = L" ";
+        return this->AddText(this->_renderList, fontId, text, x, y, color, flags, outlineColor, outlineThickness,
+                             scale, maxWidth);
+    }
 
-        if (!GetTextExtentPoint32W(hdc, chr, static_cast<int>(wcslen(chr)), &size))
+    inline Vec2 CalculateTextExtent(const FontHandle fontId, std::wstring_view text, float scale = 1.f)
+    {
+        auto font = this->_fonts.find(fontId);
+        if (font == this->_fonts.end())
         {
-            throw std::runtime_error("EstimateTextureSize(): Failed to get text extent!");
+            throw std::exception("CalculateTextExtent(): Font not found!");
         }
 
-        long x = this->_charSpacing;
-        long y = 0;
-
-        for (wchar_t c = g_charRangeMin; c < g_charRangeMax; c++)
-        {
-            chr[0] = c;
-
-            if (!GetTextExtentPoint32W(hdc, chr, static_cast<int>(wcslen(chr)), &size))
-            {
-                continue;
-            }
-
-            if (x + size.cx + this->_charSpacing > this->_textureWidth)
-            {
-                x = this->_charSpacing;
-                y += size.cy + 1;
-            }
-
-            if (y + size.cy > this->_textureHeight)
-            {
-                this->_textureWidth = this->_textureWidth * 2;
-                this->_textureHeight = this->_textureHeight * 2;
-                x = this->_charSpacing;
-                y = 0;
-            }
-
-            x += size.cx + (2 * this->_charSpacing);
-        }
+        return font->second->CalculateTextExtent(text, scale);
     }
 
-    inline void CreateGdiFont(HDC hdc, HGDIOBJ *gdiFont)
+    inline Vec2 CalculateTextExtent(const FontHandle fontId, std::string_view text, float scale = 1.f)
     {
-        static const int pointsPerInch = 72;
-        int dpi = GetDeviceCaps(hdc, LOGPIXELSY);
-        int pixelsHeight = -MulDiv(this->_fontHeigth, dpi, pointsPerInch);
-
-        DWORD bold = (this->_fontFlags & FONT_FLAG_BOLD) ? FW_BOLD : FW_NORMAL;
-        DWORD italic = (this->_fontFlags & FONT_FLAG_ITALIC) ? TRUE : FALSE;
-
-        HFONT font = CreateFontW(pixelsHeight, 0, 0, 0, bold, italic, FALSE, FALSE, DEFAULT_CHARSET, OUT_OUTLINE_PRECIS,
-                                 CLIP_DEFAULT_PRECIS,
-                                 (this->_fontFlags & FONT_FLAG_CLEAR_TYPE) ? CLEARTYPE_QUALITY : ANTIALIASED_QUALITY,
-                                 VARIABLE_PITCH, this->_fontFamily.c_str());
-
-        if (font == NULL)
+        auto font = this->_fonts.find(fontId);
+        if (font == this->_fonts.end())
         {
-            throw std::runtime_error("CreateGdiFont(): CreateFontW failed!");
+            throw std::exception("CalculateTextExtent(): Font not found!");
         }
 
-        *gdiFont = font;
+        return font->second->CalculateTextExtent(text, scale);
     }
 
-    inline HRESULT RenderAlphabet(HDC hdc, bool onlyMeasure)
+    // Formats into a stack buffer with std::format syntax and lays the result out without any heap allocation, e.g.
+    // AddTextFormat(font, ..., "{} [{}m] {}hp", name, distance, health). Scale and max width work as with AddText(),
+    // they come before the format string since nothing can follow the arguments.
+    template <typename... Args>
+    inline void AddTextFormat(const RenderListPtr &renderList, const FontHandle fontId, float x, float y,
+                              const Color color, uint32_t flags, const Color outlineColor, float outlineThickness,
+                              float scale, float maxWidth, std::format_string<Args...> format, Args &&...args)
     {
-        SIZE size;
-        wchar_t chr[2] = L" ";
+        char buffer[g_textFormatBufferSize];
+        const auto result = std::format_to_n(buffer, g_textFormatBufferSize, format, std::forward<Args>(args)...);
+        size_t length = static_cast<size_t>(result.size);
 
-        if (!GetTextExtentPoint32W(hdc, chr, static_cast<int>(wcslen(chr)), &size))
+        // cut off output must not end in a partial character
+        if (length > g_textFormatBufferSize)
         {
-            return E_FAIL;
+            length = detail::TrimToCodePoint(buffer, g_textFormatBufferSize);
         }
 
-        // the result of the font width is used for spacing
-        this->_charSpacing = static_cast<long>(ceil(size.cy * 0.3f));
+        this->AddText(renderList, fontId, std::string_view(buffer, length), x, y, color, flags, outlineColor,
+                      outlineThickness, scale, maxWidth);
+    }
 
-        long x = this->_charSpacing;
-        long y = 0;
+    template <typename... Args>
+    inline void AddTextFormat(const RenderListPtr &renderList, const FontHandle fontId, float x, float y,
+                              const Color color, uint32_t flags, const Color outlineColor, float outlineThickness,
+                              std::format_string<Args...> format, Args &&...args)
+    {
+        this->AddTextFormat(renderList, fontId, x, y, color, flags, outlineColor, outlineThickness, 1.f, 0.f, format,
+                            std::forward<Args>(args)...);
+    }
 
-        for (wchar_t c = g_charRangeMin; c < g_charRangeMax; c++)
-        {
-            chr[0] = c;
+    template <typename... Args>
+    inline void AddTextFormat(const FontHandle fontId, float x, float y, const Color color, uint32_t flags,
+                              const Color outlineColor, float outlineThickness, float scale, float maxWidth,
+                              std::format_string<Args...> format, Args &&...args)
+    {
+        this->AddTextFormat(this->_renderList, fontId, x, y, color, flags, outlineColor, outlineThickness, scale,
+                            maxWidth, format, std::forward<Args>(args)...);
+    }
 
-            if (!GetTextExtentPoint32W(hdc, chr, static_cast<int>(wcslen(chr)), &size))
-            {
-                continue;
-            }
+    template <typename... Args>
+    inline void AddTextFormat(const FontHandle fontId, float x, float y, const Color color, uint32_t flags,
+                              const Color outlineColor, float outlineThickness, std::format_string<Args...> format,
+                              Args &&...args)
+    {
+        this->AddTextFormat(this->_renderList, fontId, x, y, color, flags, outlineColor, outlineThickness, format,
+                            std::forward<Args>(args)...);
+    }
 
-            if (x + size.cx + this->_charSpacing > this->_textureWidth)
-            {
-                x = this->_charSpacing;
-                y += size.cy + 1;
-            }
+    template <typename... Args>
+    inline void AddTextFormat(const FontHandle fontId, float x, float y, const Color color, uint32_t flags,
+                              std::format_string<Args...> format, Args &&...args)
+    {
+        this->AddTextFormat(this->_renderList, fontId, x, y, color, flags, Color(0, 0, 0), 2.0f, format,
+                            std::forward<Args>(args)...);
+    }
 
-            if (y + size.cy > this->_textureHeight)
-            {
-                return E_NOT_SUFFICIENT_BUFFER;
-            }
+    template <typename... Args>
+    inline void AddTextFormat(const RenderListPtr &renderList, const FontHandle fontId, float x, float y,
+                              const Color color, uint32_t flags, const Color outlineColor, float outlineThickness,
+                              float scale, float maxWidth, std::wformat_string<Args...> format, Args &&...args)
+    {
+        wchar_t buffer[g_textFormatBufferSize];
+        const auto result = std::format_to_n(buffer, g_textFormatBufferSize, format, std::forward<Args>(args)...);
+        size_t length = static_cast<size_t>(result.size);
 
-            if (!onlyMeasure)
-            {
-                if (!ExtTextOutW(hdc, x, y, ETO_OPAQUE, nullptr, chr, static_cast<int>(wcslen(chr)), nullptr))
-                {
-                    return E_FAIL;
-                }
+        // cut off output must not end in a partial character
+        if (length > g_textFormatBufferSize)
+        {
+            length = detail::TrimToCodePoint(buffer, g_textFormatBufferSize);
+        }
 
-                this->_charCoords[c] = {(static_cast<float>(x - this->_charSpacing)) / this->_textureWidth,
-                                        (static_cast<float>(y)) / this->_textureHeight,
-                                        (static_cast<float>(x + size.cx + this->_charSpacing)) / this->_textureWidth,
-                                        (static_cast<float>(y + size.cy)) / this->_textureHeight};
-            }
+        this->AddText(renderList, fontId, std::wstring_view(buffer, length), x, y, color, flags, outlineColor,
+                      outlineThickness, scale, maxWidth);
+    }
 
-            x += size.cx + (2 * this->_charSpacing);
-        }
+    template <typename... Args>
+    inline void AddTextFormat(const RenderListPtr &renderList, const FontHandle fontId, float x, float y,
+                              const Color color, uint32_t flags, const Color outlineColor, float outlineThickness,
+                              std::wformat_string<Args...> format, Args &&...args)
+    {
+        this->AddTextFormat(renderList, fontId, x, y, color, flags, outlineColor, outlineThickness, 1.f, 0.f, format,
+                            std::forward<Args>(args)...);
+    }
 
-        return S_OK;
+    template <typename... Args>
+    inline void AddTextFormat(const FontHandle fontId, float x, float y, const Color color, uint32_t flags,
+                              const Color outlineColor, float outlineThickness, float scale, float maxWidth,
+                              std::wformat_string<Args...> format, Args &&...args)
+    {
+        this->AddTextFormat(this->_renderList, fontId, x, y, color, flags, outlineColor, outlineThickness, scale,
+                            maxWidth, format, std::forward<Args>(args)...);
     }
 
-    inline std::vector<TextSegment> PreprocessText(const std::wstring &text, Color defaultColor)
+    template <typename... Args>
+    inline void AddTextFormat(const FontHandle fontId, float x, float y, const Color color, uint32_t flags,
+                              const Color outlineColor, float outlineThickness, std::wformat_string<Args...> format,
+                              Args &&...args)
     {
-        std::vector<TextSegment> segments;
-        std::wstring cleanText;
-        Color currentColor = defaultColor;
+        this->AddTextFormat(this->_renderList, fontId, x, y, color, flags, outlineColor, outlineThickness, format,
+                            std::forward<Args>(args)...);
+    }
 
-        for (size_t i = 0; i < text.size(); ++i)
-        {
-            if (text[i] == L'{' && text.size() > i + 11 && text[i + 1] == L'#')
-            {
-                bool hasAlpha = (text[i + 10] == L'}');
-                bool noAlpha = (text[i + 8] == L'}');
-                if (hasAlpha || noAlpha)
-                {
-                    if (!cleanText.empty())
-                    {
-                        segments.push_back({cleanText, currentColor});
-                        cleanText.clear();
-                    }
+    template <typename... Args>
+    inline void AddTextFormat(const FontHandle fontId, float x, float y, const Color color, uint32_t flags,
+                              std::wformat_string<Args...> format, Args &&...args)
+    {
+        this->AddTextFormat(this->_renderList, fontId, x, y, color, flags, Color(0, 0, 0), 2.0f, format,
+                            std::forward<Args>(args)...);
+    }
 
-                    std::wstring colorStr = text.substr(i + 2, hasAlpha ? 8 : 6);
-                    colorStr.erase(
-                        std::remove_if(colorStr.begin(), colorStr.end(), [](wchar_t c) { return !iswxdigit(c); }),
-                        colorStr.end());
+    // Integer labels bypass the formatter, the digits go straight from std::to_chars into layout
+    inline void AddNumber(const RenderListPtr &renderList, const FontHandle fontId, int64_t value, float x, float y,
+                          const Color color, uint32_t flags = FONT_FLAG_NONE, const Color outlineColor = Color(0, 0, 0),
+                          float outlineThickness = 2.0f)
+    {
+        char buffer[24];
+        const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
 
-                    if (!hasAlpha)
-                    {
-                        colorStr = L"ff" + colorStr;
-                    }
+        this->AddText(renderList, fontId, std::string_view(buffer, result.ptr - buffer), x, y, color, flags,
+                      outlineColor, outlineThickness);
+    }
 
-                    currentColor = std::wcstoul(colorStr.c_str(), nullptr, 16);
-                    i += hasAlpha ? 10 : 8;
-                    continue;
-                }
-            }
-            cleanText += text[i];
-        }
+    // Fixed-point variant of AddNumber, value is rounded to the given number of decimals
+    inline void AddDecimal(const RenderListPtr &renderList, const FontHandle fontId, double value, int decimals,
+                           float x, float y, const Color color, uint32_t flags = FONT_FLAG_NONE,
+                           const Color outlineColor = Color(0, 0, 0), float outlineThickness = 2.0f)
+    {
+        char buffer[64];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed, decimals);
 
-        if (!cleanText.empty())
+        // too large for fixed notation, fall back to the shortest representation
+        if (result.ec != std::errc())
         {
-            segments.push_back({cleanText, currentColor});
+            result = std::to_chars(buffer, buffer + sizeof(buffer), value);
         }
 
-        return segments;
+        this->AddText(renderList, fontId, std::string_view(buffer, result.ptr - buffer), x, y, color, flags,
+                      outlineColor, outlineThickness);
     }
 
-    RenderListPtr _renderList;
-    ID3D11Device *_d3dDevice;
-    ID3D11DeviceContext *_d3dDeviceContext;
-    ID3D11ShaderResourceView *_fontTextureView;
-    std::map<wchar_t, std::array<float, 4>> _charCoords;
-    long _textureWidth;
-    long _textureHeight;
-    float _textScale;
-    long _charSpacing;
+    inline void AddNumber(const FontHandle fontId, int64_t value, float x, float y, const Color color,
+                          uint32_t flags = FONT_FLAG_NONE, const Color outlineColor = Color(0, 0, 0),
+                          float outlineThickness = 2.0f)
+    {
+        this->AddNumber(this->_renderList, fontId, value, x, y, color, flags, outlineColor, outlineThickness);
+    }
 
-    std::wstring _fontFamily;
-    long _fontHeigth;
-    uint32_t _fontFlags;
-    bool _initialized;
-};
+    inline void AddDecimal(const FontHandle fontId, double value, int decimals, float x, float y, const Color color,
+                           uint32_t flags = FONT_FLAG_NONE, const Color outlineColor = Color(0, 0, 0),
+                           float outlineThickness = 2.0f)
+    {
+        this->AddDecimal(this->_renderList, fontId, value, decimals, x, y, color, flags, outlineColor,
+                         outlineThickness);
+    }
 
-class Renderer : public std::enable_shared_from_this<Renderer>
-{
-  public:
-    Renderer(ID3D11Device *d3dDevice, uint32_t maxVertices)
-        : _d3dDevice(d3dDevice), _d3dDeviceContext(nullptr), _inputLayout(nullptr), _blendState(nullptr),
-          _vertexShader(nullptr), _pixelShader(nullptr), _vertexBuffer(nullptr), _vertexConstantBuffer(nullptr),
-          _maxVertices(maxVertices), _renderList(std::make_shared<RenderList>(maxVertices)), _nextFontId(1)
+    // Parses and lays out a text that is drawn often, e.g. a menu caption, once. Drawing the returned handle only
+    // translates the stored glyphs, with TEXT_FLAG_CACHED the whole text is composed into a single atlas entry and
+    // drawn as one quad until it is updated or evicted, meant for large blocks that rarely change. Texts of fonts still
+    // baking are laid out when they are drawn first after that.
+    inline TextHandle InternText(const FontHandle fontId, std::wstring_view text, const Color color,
+                                 uint32_t flags = FONT_FLAG_NONE, const Color outlineColor = Color(0, 0, 0),
+                                 float outlineThickness = 2.0f)
     {
-        if (!d3dDevice)
+        auto font = this->_fonts.find(fontId);
+        if (font == this->_fonts.end())
         {
-            throw std::exception("Renderer::ctor() d3dDevice is null!");
+            throw std::exception("InternText(): Font not found!");
         }
 
-        ID3DBlob *vsBlob = nullptr;
-        ID3DBlob *psBlob = nullptr;
-
-        this->_d3dDevice->GetImmediateContext(&this->_d3dDeviceContext);
-
-        detail::ThrowIfFailed(D3DCompile(g_vertexShader, strlen(g_vertexShader), nullptr, nullptr, nullptr, "main",
-                                         "vs_4_0", 0, 0, &vsBlob, nullptr));
+        auto run = std::make_unique<TextRun>();
+        run->font = font->second;
+        run->text = text;
+        run->color = color;
+        run->flags = flags;
+        run->outlineColor = outlineColor;
+        run->outlineThickness = outlineThickness;
 
-        detail::ThrowIfFailed(D3DCompile(g_pixelShader, strlen(g_pixelShader), nullptr, nullptr, nullptr, "main",
-                                         "ps_4_0", 0, 0, &psBlob, nullptr));
+        run->font->LayoutRun(*run);
 
-        detail::ThrowIfFailed(this->_d3dDevice->CreateVertexShader(vsBlob->GetBufferPointer(), vsBlob->GetBufferSize(),
-                                                                   nullptr, &this->_vertexShader));
+        if (this->_freeTextHandles.empty())
+        {
+            this->_texts.push_back(std::move(run));
+            return this->_texts.size() - 1;
+        }
 
-        detail::ThrowIfFailed(this->_d3dDevice->CreatePixelShader(psBlob->GetBufferPointer(), psBlob->GetBufferSize(),
-                                                                  nullptr, &this->_pixelShader));
+        const TextHandle textHandle = this->_freeTextHandles.back();
+        this->_freeTextHandles.pop_back();
+        this->_texts[textHandle] = std::move(run);
+        return textHandle;
+    }
 
-        D3D11_INPUT_ELEMENT_DESC layout[] = {
-            {"POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, (UINT)offsetof(Vertex, pos), D3D11_INPUT_PER_VERTEX_DATA, 0},
-            {"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, (UINT)offsetof(Vertex, uv), D3D11_INPUT_PER_VERTEX_DATA, 0},
-            {"COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, (UINT)offsetof(Vertex, color), D3D11_INPUT_PER_VERTEX_DATA, 0},
-        };
+    inline TextHandle InternText(const FontHandle fontId, std::string_view text, const Color color,
+                                 uint32_t flags = FONT_FLAG_NONE, const Color outlineColor = Color(0, 0, 0),
+                                 float outlineThickness = 2.0f)
+    {
+        return this->InternText(fontId, WidenText(text), color, flags, outlineColor, outlineThickness);
+    }
 
-        detail::ThrowIfFailed(this->_d3dDevice->CreateInputLayout(layout, ARRAYSIZE(layout), vsBlob->GetBufferPointer(),
-                                                                  vsBlob->GetBufferSize(), &this->_inputLayout));
+    // Replaces the content of an interned text, a cached one is composed again the next time it is drawn.
+    inline void UpdateText(const TextHandle textHandle, std::wstring_view text)
+    {
+        TextRun &run = this->GetTextRun(textHandle, "UpdateText");
+        run.font->ReleaseRun(run);
 
-        detail::SafeRelease(&vsBlob);
-        detail::SafeRelease(&psBlob);
+        run.text = text;
+        run.font->LayoutRun(run);
+    }
 
-        // Create the blender state
-        {
-            D3D11_BLEND_DESC desc{};
-            desc.RenderTarget->BlendEnable = TRUE;
-            desc.RenderTarget->SrcBlend = D3D11_BLEND_SRC_ALPHA;
-            desc.RenderTarget->DestBlend = D3D11_BLEND_INV_SRC_ALPHA;
-            desc.RenderTarget->SrcBlendAlpha = D3D11_BLEND_ONE;
-            desc.RenderTarget->DestBlendAlpha = D3D11_BLEND_ZERO;
-            desc.RenderTarget->BlendOp = D3D11_BLEND_OP_ADD;
-            desc.RenderTarget->BlendOpAlpha = D3D11_BLEND_OP_ADD;
-            desc.RenderTarget->RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
+    inline void UpdateText(const TextHandle textHandle, std::string_view text)
+    {
+        this->UpdateText(textHandle, WidenText(text));
+    }
 
-            detail::ThrowIfFailed(this->_d3dDevice->CreateBlendState(&desc, &this->_blendState));
-        }
+    // Unpins the glyphs of the text, the handle may be handed out again afterwards.
+    inline void ReleaseText(const TextHandle textHandle)
+    {
+        TextRun &run = this->GetTextRun(textHandle, "ReleaseText");
+        run.font->ReleaseRun(run);
 
-        // Create the rasterizer state
-        {
-            D3D11_RASTERIZER_DESC desc{};
-            desc.FillMode = D3D11_FILL_SOLID;
-            desc.CullMode = D3D11_CULL_NONE;
-            desc.ScissorEnable = true;
-            desc.DepthClipEnable = true;
+        this->_texts[textHandle].reset();
+        this->_freeTextHandles.push_back(textHandle);
+    }
 
-            detail::ThrowIfFailed(this->_d3dDevice->CreateRasterizerState(&desc, &this->_rasterizerState));
-        }
+    inline void AddText(const RenderListPtr &renderList, const TextHandle textHandle, float x, float y)
+    {
+        TextRun &run = this->GetTextRun(textHandle, "AddText");
+        this->AddText(renderList, textHandle, x, y, run.color);
+    }
 
-        // Create depth-stencil State
-        {
-            D3D11_DEPTH_STENCIL_DESC desc{};
-            desc.DepthEnable = false;
-            desc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
-            desc.DepthFunc = D3D11_COMPARISON_ALWAYS;
-            desc.StencilEnable = false;
-            desc.FrontFace.StencilFailOp = desc.FrontFace.StencilDepthFailOp = desc.FrontFace.StencilPassOp =
-                D3D11_STENCIL_OP_KEEP;
-            desc.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
-            desc.BackFace = desc.FrontFace;
+    // Draws an interned text with another color and scale, colors set by tags in the text are kept
+    inline void AddText(const RenderListPtr &renderList, const TextHandle textHandle, float x, float y,
+                        const Color color, float scale = 1.f)
+    {
+        TextRun &run = this->GetTextRun(textHandle, "AddText");
 
-            detail::ThrowIfFailed(this->_d3dDevice->CreateDepthStencilState(&desc, &this->_depthStencilState));
+        if (run.laidOut || run.font->LayoutRun(run))
+        {
+            this->_textQuadsSaved += run.font->RenderRun(renderList, run, Vec2(x, y), color, scale);
         }
+    }
 
-        // Create vertex buffer
-        {
-            D3D11_BUFFER_DESC desc{};
-            desc.Usage = D3D11_USAGE_DYNAMIC;
-            desc.ByteWidth = sizeof(Vertex) * static_cast<UINT>(maxVertices);
-            desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-            desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-            desc.MiscFlags = 0;
+    inline void AddText(const TextHandle textHandle, float x, float y)
+    {
+        this->AddText(this->_renderList, textHandle, x, y);
+    }
 
-            detail::ThrowIfFailed(this->_d3dDevice->CreateBuffer(&desc, nullptr, &this->_vertexBuffer));
-        }
+    inline void AddText(const TextHandle textHandle, float x, float y, const Color color, float scale = 1.f)
+    {
+        this->AddText(this->_renderList, textHandle, x, y, color, scale);
+    }
 
-        // Create vertex constant buffer
-        {
-            D3D11_BUFFER_DESC desc{};
-            desc.Usage = D3D11_USAGE_DYNAMIC;
-            desc.ByteWidth = sizeof(DirectX::XMMATRIX);
-            desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-            desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-            desc.MiscFlags = 0;
+    inline void AddRectFilled(const RenderListPtr &renderList, const Vec2 &min, const Vec2 &max, const Color color)
+    {
+        ShapeCommand command{};
+        command.type = ShapeCommandType::RectFilled;
+        command.p1 = min;
+        command.p2 = max;
+        command.color = color;
 
-            detail::ThrowIfFailed(this->_d3dDevice->CreateBuffer(&desc, nullptr, &this->_vertexConstantBuffer));
-        }
+        this->AddShape(renderList, command, 6, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    }
 
-        // Create font sampler
-        {
-            D3D11_SAMPLER_DESC desc{};
-            desc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
-            desc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
-            desc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
-            desc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
-            desc.ComparisonFunc = D3D11_COMPARISON_NEVER;
-            desc.MinLOD = 0;
-            desc.MaxLOD = D3D11_FLOAT32_MAX;
+    inline void AddRectFilled(const Vec2 &min, const Vec2 &max, const Color color)
+    {
+        return this->AddRectFilled(this->_renderList, min, max, color);
+    }
 
-            detail::ThrowIfFailed(this->_d3dDevice->CreateSamplerState(&desc, &this->_fontSampler));
-        }
+    inline void AddRect(const RenderListPtr &renderList, const Vec2 &min, const Vec2 &max, const Color color,
+                        float strokeWidth = 1.f)
+    {
+        Vec2 topLineMin = {min.x, min.y};
+        Vec2 topLineMax = {max.x, min.y + strokeWidth};
+        Vec2 bottomLineMin = {min.x, max.y - strokeWidth};
+        Vec2 bottomLineMax = {max.x, max.y};
+        Vec2 leftLineMin = {min.x, min.y};
+        Vec2 leftLineMax = {min.x + strokeWidth, max.y};
+        Vec2 rightLineMin = {max.x - strokeWidth, min.y};
+        Vec2 rightLineMax = {max.x, max.y};
 
-        // We need to bind a texture because of texture sampling in shader, some implementations lack this functionality
-        // because it probably uses an already binded texture from whatever was rendering before!?
-        {
-            const UINT textureWidth = 128;
-            const UINT textureHeight = 128;
+        this->AddRectFilled(renderList, topLineMin, topLineMax, color);
+        this->AddRectFilled(renderList, bottomLineMin, bottomLineMax, color);
+        this->AddRectFilled(renderList, leftLineMin, leftLineMax, color);
+        this->AddRectFilled(renderList, rightLineMin, rightLineMax, color);
+    }
 
-            uint8_t whiteTexData[textureWidth * textureHeight * 4];
-            memset(whiteTexData, 255, sizeof(whiteTexData));
+    inline void AddRect(const Vec2 &min, const Vec2 &max, const Color color, float strokeWidth = 1.f)
+    {
+        return this->AddRect(this->_renderList, min, max, color, strokeWidth);
+    }
 
-            ID3D11Texture2D *texture = nullptr;
-            D3D11_TEXTURE2D_DESC texDesc = {};
-            texDesc.Width = textureWidth;
-            texDesc.Height = textureHeight;
-            texDesc.MipLevels = 1;
-            texDesc.ArraySize = 1;
-            texDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-            texDesc.SampleDesc.Count = 1;
-            texDesc.Usage = D3D11_USAGE_DEFAULT;
-            texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-            texDesc.CPUAccessFlags = 0;
-            texDesc.MiscFlags = 0;
+    inline void AddLine(const RenderListPtr &renderList, const Vec2 &v1, const Vec2 &v2, const Color color)
+    {
+        ShapeCommand command{};
+        command.type = ShapeCommandType::Line;
+        command.p1 = v1;
+        command.p2 = v2;
+        command.color = color;
 
-            D3D11_SUBRESOURCE_DATA initData = {};
-            initData.pSysMem = whiteTexData;
-            initData.SysMemPitch = textureWidth * 4;
+        this->AddShape(renderList, command, 2, D3D11_PRIMITIVE_TOPOLOGY_LINELIST);
+    }
 
-            detail::ThrowIfFailed(this->_d3dDevice->CreateTexture2D(&texDesc, &initData, &texture));
+    inline void AddLine(const Vec2 &v1, const Vec2 &v2, const Color color)
+    {
+        return this->AddLine(this->_renderList, v1, v2, color);
+    }
 
-            // Create renderer shader resource view
-            D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc{};
-            srvDesc.Format = texDesc.Format;
-            srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-            srvDesc.Texture2D.MostDetailedMip = 0;
-            srvDesc.Texture2D.MipLevels = 1;
+    inline void AddCircle(const RenderListPtr &renderList, const Vec2 &pos, float radius, const Color color,
+                          int segments = 64)
+    {
+        ShapeCommand command{};
+        command.type = ShapeCommandType::Circle;
+        command.p1 = pos;
+        command.color = color;
+        command.size = radius;
+        command.segments = segments;
+
+        this->AddShape(renderList, command, static_cast<size_t>(segments) + 1, D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP);
+    }
 
-            detail::ThrowIfFailed(
-                this->_d3dDevice->CreateShaderResourceView(texture, &srvDesc, &this->_renderResourceView));
+    inline void AddCircle(const Vec2 &pos, float radius, const Color color, int segments = 24)
+    {
+        return this->AddCircle(this->_renderList, pos, radius, color, segments);
+    }
 
-            detail::SafeRelease(&texture);
-        }
+    // Projects world positions to the current viewport with a view-projection matrix as DirectXMath builds it. visible
+    // receives the ProjectionFlags of every point, out is only meaningful for points in front of the near plane. The
+    // points are transformed four at a time, so large batches are far cheaper than projecting them one by one.
+    inline void ProjectPoints(const DirectX::XMMATRIX &viewProj, const Vec3 *in, Vec2 *out, uint8_t *visible,
+                              size_t count) const
+    {
+        DirectX::XMFLOAT4X4 m;
+        DirectX::XMStoreFloat4x4(&m, viewProj);
 
-        // Get viewport to create orthographic projection matrix
-        D3D11_VIEWPORT viewport{};
-        UINT numViewports = 1;
+        detail::ProjectPoints(m, in, out, visible, count, this->_displaySize.x, this->_displaySize.y);
+    }
 
-        this->_d3dDeviceContext->RSGetViewports(&numViewports, &viewport);
+    // Screen rect around an axis aligned box. False if the box is off screen or crosses the near plane, where its
+    // projection is unbounded.
+    inline bool ProjectBox(const DirectX::XMMATRIX &viewProj, const Vec3 &boxMin, const Vec3 &boxMax, Vec2 &rectMin,
+                           Vec2 &rectMax) const
+    {
+        const Vec3 corners[8] = {{boxMin.x, boxMin.y, boxMin.z}, {boxMax.x, boxMin.y, boxMin.z},
+                                 {boxMin.x, boxMax.y, boxMin.z}, {boxMax.x, boxMax.y, boxMin.z},
+                                 {boxMin.x, boxMin.y, boxMax.z}, {boxMax.x, boxMin.y, boxMax.z},
+                                 {boxMin.x, boxMax.y, boxMax.z}, {boxMax.x, boxMax.y, boxMax.z}};
+        Vec2 screen[8];
+        uint8_t visible[8];
 
-        this->_displaySize = {viewport.Width, viewport.Height};
+        this->ProjectPoints(viewProj, corners, screen, visible, 8);
 
-        this->_projMatrix =
-            DirectX::XMMatrixOrthographicOffCenterLH(viewport.TopLeftX, viewport.Width, viewport.Height,
-                                                     viewport.TopLeftY, viewport.MinDepth, viewport.MaxDepth);
+        rectMin = screen[0];
+        rectMax = screen[0];
 
-        // Setup orthographic projection matrix into our constant buffer
-        D3D11_MAPPED_SUBRESOURCE mappedResource;
-        detail::ThrowIfFailed(
-            this->_d3dDeviceContext->Map(this->_vertexConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource));
+        for (size_t i = 0; i < 8; i++)
         {
-            memcpy(mappedResource.pData, &this->_projMatrix, sizeof(DirectX::XMMATRIX));
+            if (!(visible[i] & PROJECTION_FLAG_IN_FRONT))
+            {
+                return false;
+            }
+
+            rectMin = {min(rectMin.x, screen[i].x), min(rectMin.y, screen[i].y)};
+            rectMax = {max(rectMax.x, screen[i].x), max(rectMax.y, screen[i].y)};
         }
-        this->_d3dDeviceContext->Unmap(this->_vertexConstantBuffer, 0);
+
+        return rectMax.x >= 0.f && rectMax.y >= 0.f && rectMin.x <= this->_displaySize.x &&
+               rectMin.y <= this->_displaySize.y;
     }
 
-    ~Renderer()
+    // Matrix the world-space primitives below are projected with, as DirectXMath builds it. Set it once per frame
+    // before Render(), the primitives are recorded in world space and only transformed on the GPU.
+    inline void SetViewProjection(const DirectX::XMMATRIX &viewProj)
     {
-        this->Release();
+        this->_viewProjMatrix = viewProj;
+        this->UpdateVertexConstants(this->_projMatrix);
     }
 
-    inline void Release()
+    inline void AddLine3D(const RenderListPtr &renderList, const Vec3 &v1, const Vec3 &v2, const Color color)
     {
-        detail::SafeRelease(&this->_vertexShader);
-        detail::SafeRelease(&this->_pixelShader);
-        detail::SafeRelease(&this->_vertexBuffer);
-        detail::SafeRelease(&this->_vertexConstantBuffer);
-        detail::SafeRelease(&this->_inputLayout);
-        detail::SafeRelease(&this->_fontSampler);
-        detail::SafeRelease(&this->_blendState);
-        detail::SafeRelease(&this->_depthStencilState);
-        detail::SafeRelease(&this->_rasterizerState);
+        const WorldVertex v[] = {{v1, color}, {v2, color}};
+
+        renderList->AddWorldVertices(v, 2, D3D11_PRIMITIVE_TOPOLOGY_LINELIST, this->_fontAtlas->GetTextureView());
     }
 
-    inline void OnLostDevice()
+    inline void AddLine3D(const Vec3 &v1, const Vec3 &v2, const Color color)
     {
-        this->Release();
-
-        for (auto &[_, font] : this->_fonts)
-        {
-            font->OnLostDevice();
-        }
+        return this->AddLine3D(this->_renderList, v1, v2, color);
     }
 
-    inline void OnResetDevice()
+    // Wireframe of an axis aligned box, one line list of its 12 edges.
+    inline void AddBox3D(const RenderListPtr &renderList, const Vec3 &boxMin, const Vec3 &boxMax, const Color color)
     {
-        for (auto &[_, font] : this->_fonts)
+        // corner i takes the max x for bit 0, the max y for bit 1 and the max z for bit 2
+        static constexpr uint8_t edges[24] = {0, 1, 2, 3, 4, 5, 6, 7, 0, 2, 1, 3, 4, 6, 5, 7, 0, 4, 1, 5, 2, 6, 3, 7};
+
+        WorldVertex v[24];
+        for (size_t i = 0; i < 24; i++)
         {
-            font->OnResetDevice();
+            const uint8_t corner = edges[i];
+            v[i] = {{corner & 1 ? boxMax.x : boxMin.x, corner & 2 ? boxMax.y : boxMin.y,
+                     corner & 4 ? boxMax.z : boxMin.z},
+                    color};
         }
+
+        renderList->AddWorldVertices(v, 24, D3D11_PRIMITIVE_TOPOLOGY_LINELIST, this->_fontAtlas->GetTextureView());
     }
 
-    inline void BeginFrame()
+    inline void AddBox3D(const Vec3 &boxMin, const Vec3 &boxMax, const Color color)
     {
-        this->AcquireStateBlock();
+        return this->AddBox3D(this->_renderList, boxMin, boxMax, color);
+    }
 
-        D3D11_VIEWPORT vp{};
-        vp.Width = this->_displaySize.x;
-        vp.Height = this->_displaySize.y;
-        vp.MinDepth = 0.0f;
-        vp.MaxDepth = 1.0f;
-        vp.TopLeftX = vp.TopLeftY = 0;
-        this->_d3dDeviceContext->RSSetViewports(1, &vp);
+    // Circle in the plane perpendicular to normal, which by default lies flat on the ground of a y-up world.
+    inline void AddCircle3D(const RenderListPtr &renderList, const Vec3 &center, float radius, const Color color,
+                            const Vec3 &normal = {0.f, 1.f, 0.f}, int segments = 24)
+    {
+        Vec3 u;
+        Vec3 w;
+        detail::PlaneAxes(normal, u, w);
 
-        UINT stride = sizeof(Vertex);
-        UINT offset = 0;
+        std::vector<WorldVertex> v(static_cast<size_t>(segments) * 2);
+        Vec3 prev = {center.x + u.x * radius, center.y + u.y * radius, center.z + u.z * radius};
 
-        this->_d3dDeviceContext->IASetVertexBuffers(0, 1, &this->_vertexBuffer, &stride, &offset);
-        this->_d3dDeviceContext->VSSetConstantBuffers(0, 1, &this->_vertexConstantBuffer);
-        this->_d3dDeviceContext->IASetInputLayout(this->_inputLayout);
-        this->_d3dDeviceContext->VSSetShader(this->_vertexShader, nullptr, 0);
-        this->_d3dDeviceContext->PSSetShader(this->_pixelShader, nullptr, 0);
-        this->_d3dDeviceContext->PSSetSamplers(0, 1, &this->_fontSampler);
+        for (int i = 0; i < segments; i++)
+        {
+            const float theta = 2.f * DirectX::XM_PI * static_cast<float>(i + 1) / static_cast<float>(segments);
+            const float c = radius * std::cos(theta);
+            const float s = radius * std::sin(theta);
+            const Vec3 next = {center.x + u.x * c + w.x * s, center.y + u.y * c + w.y * s,
+                               center.z + u.z * c + w.z * s};
+
+            v[i * 2] = {prev, color};
+            v[i * 2 + 1] = {next, color};
+            prev = next;
+        }
 
-        const float blendFactor[4] = {0.f, 0.f, 0.f, 0.f};
-        this->_d3dDeviceContext->OMSetBlendState(this->_blendState, blendFactor, 0xffffffff);
-        this->_d3dDeviceContext->OMSetDepthStencilState(this->_depthStencilState, 0);
-        this->_d3dDeviceContext->RSSetState(this->_rasterizerState);
+        renderList->AddWorldVertices(v.data(), v.size(), D3D11_PRIMITIVE_TOPOLOGY_LINELIST,
+                                     this->_fontAtlas->GetTextureView());
     }
 
-    inline void EndFrame()
+    inline void AddCircle3D(const Vec3 &center, float radius, const Color color,
+                            const Vec3 &normal = {0.f, 1.f, 0.f}, int segments = 24)
     {
-        this->RestoreStateBlock();
+        return this->AddCircle3D(this->_renderList, center, radius, color, normal, segments);
     }
 
-    inline FontHandle AddFont(const std::wstring &fontFamily, long fontHeigth, uint32_t fontFlags = FONT_FLAG_NONE)
+    inline void Render(const RenderListPtr &renderList)
     {
-        std::shared_ptr<Font> fontPtr =
-            std::make_shared<Font>(this->_renderList, this->_d3dDevice, fontFamily, fontHeigth, fontFlags);
-
-        const size_t fontHandle = this->_nextFontId++;
-        this->_fonts[fontHandle] = fontPtr;
-        return fontHandle;
+        this->Render(std::span<const RenderListPtr>(&renderList, 1));
     }
 
-    inline void AddText(const FontHandle fontId, const std::wstring &text, float x, float y, const Color color,
-                        uint32_t flags = FONT_FLAG_NONE, const Color outlineColor = Color(0, 0, 0),
-                        float outlineThickness = 2.0f)
+    // Submits several lists at once, e.g. background, world and menu. The batches of each list are sorted by layer,
+    // every buffer is mapped once for all lists and the lists are drawn in order, each with its own clip rect and
+    // transform.
+    inline void Render(std::span<const RenderListPtr> renderLists)
     {
-        auto font = this->_fonts.find(fontId);
-        if (font == this->_fonts.end())
+        // upload glyphs which were rasterized while recording
+        this->_fontAtlas->Flush();
+
+        // a list drawn again without being recorded keeps its glyphs through the next frame, as long as it is drawn
+        // every frame no text recorded meanwhile can take over their slots
+        for (const auto &renderList : renderLists)
         {
-            throw std::exception("AddText(): Font not found!");
+            if (renderList->_rendered)
+            {
+                this->_fontAtlas->TouchGlyphs(renderList->_glyphInstances);
+            }
+
+            renderList->_rendered = true;
         }
 
-        return font->second->RenderText(Vec2(x, y), text, color, flags, outlineColor, outlineThickness);
-    }
+        // the buffers still hold the same content when the lists were kept or recorded identically since the last
+        // Render(), e.g. a static menu or a game ticking slower than it presents
+        if (this->IsUploaded(renderLists))
+        {
+            for (const auto &renderList : renderLists)
+            {
+                this->_renderStats.skippedBytes += renderList->_vertices.size() * sizeof(Vertex) +
+                                                   renderList->_worldVertices.size() * sizeof(WorldVertex) +
+                                                   renderList->_glyphInstances.size() * sizeof(GlyphInstance);
+            }
 
-    inline void AddRectFilled(const RenderListPtr &renderList, const Vec2 &min, const Vec2 &max, const Color color)
-    {
-        float x1 = min.x;
-        float y1 = min.y;
-        float x2 = max.x;
-        float y2 = max.y;
+            this->_renderStats.reusedRenders++;
+        }
+        else
+        {
+            this->UploadRenderLists(renderLists);
+        }
+
+        size_t pos = 0;
+        size_t instancePos = 0;
+        size_t worldPos = 0;
+        size_t first = 0;
+        BatchType pipeline = BatchType::Vertices;
 
-        Vertex v[] = {
-            {x1, y1, color}, // Top-left vertex
-            {x2, y1, color}, // Top-right vertex
-            {x1, y2, color}, // Bottom-left vertex
+        for (const auto &renderList : renderLists)
+        {
+            D3D11_RECT scissorRect{};
+            scissorRect.left = 0;
+            scissorRect.top = 0;
+            scissorRect.right = static_cast<LONG>(this->_displaySize.x);
+            scissorRect.bottom = static_cast<LONG>(this->_displaySize.y);
 
-            {x2, y1, color}, // Top-right vertex
-            {x2, y2, color}, // Bottom-right vertex
-            {x1, y2, color}  // Bottom-left vertex
-        };
+            if (renderList->_clipped)
+            {
+                scissorRect.left = static_cast<LONG>(renderList->_clipRect.x);
+                scissorRect.top = static_cast<LONG>(renderList->_clipRect.y);
+                scissorRect.right = static_cast<LONG>(renderList->_clipRect.z);
+                scissorRect.bottom = static_cast<LONG>(renderList->_clipRect.w);
+            }
+
+            if (renderList->_transformed)
+            {
+                this->UpdateVertexConstants(
+                    DirectX::XMMatrixMultiply(DirectX::XMLoadFloat4x4(&renderList->_transform), this->_projMatrix));
+            }
+
+            const size_t numBatches = renderList->_batches.size();
+
+            for (size_t i = 0; i < numBatches; i++)
+            {
+                Batch batch = renderList->_batches[this->_batchOrder[first + i]];
+
+                // neighbours in draw order with the same state were uploaded back to back, lists of them are one draw
+                while (i + 1 < numBatches &&
+                       IsMergeable(batch, renderList->_batches[this->_batchOrder[first + i + 1]]))
+                {
+                    batch.count += renderList->_batches[this->_batchOrder[first + ++i]].count;
+                }
+
+                if (!batch.count)
+                {
+                    continue;
+                }
+
+                // this is needed for the rasterizer state
+                this->_d3dDeviceContext->RSSetScissorRects(1, &scissorRect);
+
+                if (batch.type != pipeline)
+                {
+                    pipeline = batch.type;
+                    this->SetupPipeline(pipeline);
+                }
+
+                this->_d3dDeviceContext->PSSetShaderResources(0, 1, &batch.texture);
+                this->_d3dDeviceContext->IASetPrimitiveTopology(batch.topology);
+
+                switch (batch.type)
+                {
+                case BatchType::GlyphInstances:
+                    this->_d3dDeviceContext->DrawInstanced(4, static_cast<uint32_t>(batch.count), 0,
+                                                           static_cast<uint32_t>(instancePos));
+                    instancePos += batch.count;
+                    break;
+
+                case BatchType::WorldVertices:
+                    this->_d3dDeviceContext->Draw(static_cast<uint32_t>(batch.count),
+                                                  static_cast<uint32_t>(worldPos));
+                    worldPos += batch.count;
+                    break;
+
+                default:
+                    this->_d3dDeviceContext->Draw(static_cast<uint32_t>(batch.count), static_cast<uint32_t>(pos));
+                    pos += batch.count;
+                    break;
+                }
+
+                this->_renderStats.drawCalls++;
+            }
+
+            if (renderList->_transformed)
+            {
+                this->UpdateVertexConstants(this->_projMatrix);
+            }
+
+            first += numBatches;
+            this->_renderStats.renderLists++;
+        }
 
-        renderList->AddVertices(v, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, this->_renderResourceView);
+        // leave the shape pipeline bound for the next render list
+        if (pipeline != BatchType::Vertices)
+        {
+            this->SetupPipeline(BatchType::Vertices);
+        }
     }
 
-    inline void AddRectFilled(const Vec2 &min, const Vec2 &max, const Color color)
+    inline void Render()
     {
-        return this->AddRectFilled(this->_renderList, min, max, color);
+        this->Render(_renderList);
+
+        if (!this->_keepLastList)
+        {
+            this->_renderList->Clear();
+        }
     }
 
-    inline void AddRect(const RenderListPtr &renderList, const Vec2 &min, const Vec2 &max, const Color color,
-                        float strokeWidth = 1.f)
+    // Keeps the renderer's list after Render() instead of clearing it. Record into it after ClearRenderList() when the
+    // game ticks, every frame in between redraws the buffers as they are. Clearing and recording have to happen on the
+    // rendering thread between two Render() calls, a game thread records into a TripleBufferedRenderList instead.
+    inline void SetKeepLastList(bool keepLastList)
     {
-        Vec2 topLineMin = {min.x, min.y};
-        Vec2 topLineMax = {max.x, min.y + strokeWidth};
-        Vec2 bottomLineMin = {min.x, max.y - strokeWidth};
-        Vec2 bottomLineMax = {max.x, max.y};
-        Vec2 leftLineMin = {min.x, min.y};
-        Vec2 leftLineMax = {min.x + strokeWidth, max.y};
-        Vec2 rightLineMin = {max.x - strokeWidth, min.y};
-        Vec2 rightLineMax = {max.x, max.y};
-
-        this->AddRectFilled(renderList, topLineMin, topLineMax, color);
-        this->AddRectFilled(renderList, bottomLineMin, bottomLineMax, color);
-        this->AddRectFilled(renderList, leftLineMin, leftLineMax, color);
-        this->AddRectFilled(renderList, rightLineMin, rightLineMax, color);
+        this->_keepLastList = keepLastList;
     }
 
-    inline void AddRect(const Vec2 &min, const Vec2 &max, const Color color, float strokeWidth = 1.f)
+    inline void ClearRenderList()
     {
-        return this->AddRect(this->_renderList, min, max, color, strokeWidth);
+        this->_renderList->Clear();
     }
 
-    inline void AddLine(const RenderListPtr &renderList, const Vec2 &v1, const Vec2 &v2, const Color color)
+    // Uploads only the parts of the buffers which changed since the previous upload, e.g. when a few labels move in an
+    // otherwise static scene. The buffers become default usage updated with UpdateSubresource() and a copy of their
+    // content is kept on the CPU. Call it outside of BeginFrame() and EndFrame().
+    inline void SetPartialUploads(bool partialUploads)
     {
-        Vertex v[]{{v1.x, v1.y, color}, {v2.x, v2.y, color}};
+        if (this->_partialUploads == partialUploads)
+        {
+            return;
+        }
+
+        this->_partialUploads = partialUploads;
+        this->_uploadedHashes.clear();
 
-        renderList->AddVertices(v, D3D11_PRIMITIVE_TOPOLOGY_LINELIST, this->_renderResourceView);
+        this->CreateVertexBuffer(this->_maxVertices);
+        this->CreateInstanceBuffer(this->_maxGlyphInstances);
+
+        if (this->_maxWorldVertices > 0)
+        {
+            this->CreateWorldVertexBuffer(this->_maxWorldVertices);
+        }
     }
 
-    inline void AddLine(const Vec2 &v1, const Vec2 &v2, const Color color)
+    inline void SetLayer(uint8_t layer)
     {
-        return this->AddLine(this->_renderList, v1, v2, color);
+        this->_renderList->SetLayer(layer);
     }
 
-    inline void AddCircle(const RenderListPtr &renderList, const Vec2 &pos, float radius, const Color color,
-                          int segments = 64)
+    inline AtlasStats GetAtlasStats() const
     {
-        std::vector<Vertex> v(segments + 1);
-
-        for (int i = 0; i <= segments; i++)
-        {
-            const float theta = 2.f * DirectX::XM_PI * static_cast<float>(i) / static_cast<float>(segments);
-
-            v[i] = Vertex{pos.x + radius * std::cos(theta), pos.y + radius * std::sin(theta), color};
-        }
-
-        renderList->AddVertices(v.data(), v.size(), D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP, this->_renderResourceView);
+        return this->_fontAtlas->GetStats();
     }
 
-    inline void AddCircle(const Vec2 &pos, float radius, const Color color, int segments = 24)
+    inline RenderStats GetRenderStats() const
     {
-        return this->AddCircle(this->_renderList, pos, radius, color, segments);
+        return this->_renderStats;
     }
 
-    inline void Render(const RenderListPtr &renderList)
+    inline TextCacheStats GetTextCacheStats() const
     {
-        size_t numVertices = renderList->_vertices.size();
-        if (numVertices > 0)
+        TextCacheStats stats{};
+        stats.quadsSaved = this->_textQuadsSaved;
+
+        for (const auto &run : this->_texts)
         {
-            D3D11_MAPPED_SUBRESOURCE mappedResource;
-            detail::ThrowIfFailed(
-                this->_d3dDeviceContext->Map(this->_vertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource));
+            const size_t bytes = run ? run->font->GetCachedRunBytes(*run) : 0;
+            if (bytes)
             {
-                memcpy(mappedResource.pData, renderList->_vertices.data(),
-                       sizeof(Vertex) * renderList->_vertices.size());
+                stats.cachedTexts++;
+                stats.cachedBytes += bytes;
             }
-            this->_d3dDeviceContext->Unmap(this->_vertexBuffer, 0);
-        }
-
-        D3D11_RECT scissorRect{};
-        scissorRect.left = 0;
-        scissorRect.top = 0;
-        scissorRect.right = static_cast<LONG>(this->_displaySize.x);
-        scissorRect.bottom = static_cast<LONG>(this->_displaySize.y);
-
-        size_t pos = 0;
-
-        for (const auto &batch : renderList->_batches)
-        {
-            // this is needed for the rasterizer state
-            this->_d3dDeviceContext->RSSetScissorRects(1, &scissorRect);
-
-            this->_d3dDeviceContext->PSSetShaderResources(0, 1, &batch.texture);
-            this->_d3dDeviceContext->IASetPrimitiveTopology(batch.topology);
-            this->_d3dDeviceContext->Draw(static_cast<uint32_t>(batch.count), static_cast<uint32_t>(pos));
-
-            pos += batch.count;
         }
-    }
 
-    inline void Render()
-    {
-        this->Render(_renderList);
-        this->_renderList->Clear();
+        return stats;
     }
 
     inline RendererPtr MakePtr()
@@ -1202,6 +3778,7 @@ class Renderer : public std::enable_shared_from_this<Renderer>
         UINT StencilRef;
         ID3D11DepthStencilState *DepthStencilState;
         ID3D11ShaderResourceView *PSShaderResource;
+        ID3D11ShaderResourceView *VSShaderResource;
         ID3D11SamplerState *PSSampler;
         ID3D11PixelShader *PS;
         ID3D11VertexShader *VS;
@@ -1229,6 +3806,7 @@ class Renderer : public std::enable_shared_from_this<Renderer>
                                                  &_backupState.SampleMask);
         this->_d3dDeviceContext->OMGetDepthStencilState(&_backupState.DepthStencilState, &_backupState.StencilRef);
         this->_d3dDeviceContext->PSGetShaderResources(0, 1, &_backupState.PSShaderResource);
+        this->_d3dDeviceContext->VSGetShaderResources(0, 1, &_backupState.VSShaderResource);
         this->_d3dDeviceContext->PSGetSamplers(0, 1, &_backupState.PSSampler);
         _backupState.PSInstancesCount = _backupState.VSInstancesCount = _backupState.GSInstancesCount = 256;
         this->_d3dDeviceContext->PSGetShader(&_backupState.PS, _backupState.PSInstances,
@@ -1257,6 +3835,9 @@ class Renderer : public std::enable_shared_from_this<Renderer>
         this->_d3dDeviceContext->PSSetShaderResources(0, 1, &_backupState.PSShaderResource);
         if (_backupState.PSShaderResource)
             _backupState.PSShaderResource->Release();
+        this->_d3dDeviceContext->VSSetShaderResources(0, 1, &_backupState.VSShaderResource);
+        if (_backupState.VSShaderResource)
+            _backupState.VSShaderResource->Release();
         this->_d3dDeviceContext->PSSetSamplers(0, 1, &_backupState.PSSampler);
         if (_backupState.PSSampler)
             _backupState.PSSampler->Release();
@@ -1293,8 +3874,464 @@ class Renderer : public std::enable_shared_from_this<Renderer>
     }
 
   private:
+    // Binds the shape, instanced glyph or world-space pipeline, all of them share pixel shader and constant buffer.
+    inline void SetupPipeline(BatchType type)
+    {
+        if (type == BatchType::WorldVertices)
+        {
+            UINT stride = sizeof(WorldVertex);
+            UINT offset = 0;
+
+            this->_d3dDeviceContext->IASetVertexBuffers(0, 1, &this->_worldVertexBuffer, &stride, &offset);
+            this->_d3dDeviceContext->IASetInputLayout(this->_worldInputLayout);
+            this->_d3dDeviceContext->VSSetShader(this->_worldVertexShader, nullptr, 0);
+        }
+        else if (type == BatchType::GlyphInstances)
+        {
+            UINT stride = sizeof(GlyphInstance);
+            UINT offset = 0;
+            ID3D11ShaderResourceView *glyphBufferView = this->_fontAtlas->GetGlyphBufferView();
+
+            this->_d3dDeviceContext->IASetVertexBuffers(0, 1, &this->_instanceBuffer, &stride, &offset);
+            this->_d3dDeviceContext->IASetInputLayout(this->_glyphInputLayout);
+            this->_d3dDeviceContext->VSSetShader(this->_glyphVertexShader, nullptr, 0);
+            this->_d3dDeviceContext->VSSetShaderResources(0, 1, &glyphBufferView);
+        }
+        else
+        {
+            UINT stride = sizeof(Vertex);
+            UINT offset = 0;
+
+            this->_d3dDeviceContext->IASetVertexBuffers(0, 1, &this->_vertexBuffer, &stride, &offset);
+            this->_d3dDeviceContext->IASetInputLayout(this->_inputLayout);
+            this->_d3dDeviceContext->VSSetShader(this->_vertexShader, nullptr, 0);
+        }
+    }
+
+    inline void CreateVertexBuffer(size_t maxVertices)
+    {
+        detail::SafeRelease(&this->_vertexBuffer);
+        this->_retainedVertices.previous.clear();
+
+        D3D11_BUFFER_DESC desc{};
+        desc.Usage = this->_partialUploads ? D3D11_USAGE_DEFAULT : D3D11_USAGE_DYNAMIC;
+        desc.ByteWidth = static_cast<UINT>(sizeof(Vertex) * maxVertices);
+        desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        desc.CPUAccessFlags = this->_partialUploads ? 0 : D3D11_CPU_ACCESS_WRITE;
+        desc.MiscFlags = 0;
+
+        detail::ThrowIfFailed(this->_d3dDevice->CreateBuffer(&desc, nullptr, &this->_vertexBuffer));
+        this->_maxVertices = static_cast<uint32_t>(maxVertices);
+    }
+
+    inline void CreateInstanceBuffer(size_t maxGlyphInstances)
+    {
+        detail::SafeRelease(&this->_instanceBuffer);
+        this->_retainedGlyphInstances.previous.clear();
+
+        D3D11_BUFFER_DESC desc{};
+        desc.Usage = this->_partialUploads ? D3D11_USAGE_DEFAULT : D3D11_USAGE_DYNAMIC;
+        desc.ByteWidth = static_cast<UINT>(sizeof(GlyphInstance) * maxGlyphInstances);
+        desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        desc.CPUAccessFlags = this->_partialUploads ? 0 : D3D11_CPU_ACCESS_WRITE;
+        desc.MiscFlags = 0;
+
+        detail::ThrowIfFailed(this->_d3dDevice->CreateBuffer(&desc, nullptr, &this->_instanceBuffer));
+        this->_maxGlyphInstances = maxGlyphInstances;
+    }
+
+    inline void CreateWorldVertexBuffer(size_t maxWorldVertices)
+    {
+        detail::SafeRelease(&this->_worldVertexBuffer);
+        this->_retainedWorldVertices.previous.clear();
+
+        D3D11_BUFFER_DESC desc{};
+        desc.Usage = this->_partialUploads ? D3D11_USAGE_DEFAULT : D3D11_USAGE_DYNAMIC;
+        desc.ByteWidth = static_cast<UINT>(sizeof(WorldVertex) * maxWorldVertices);
+        desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        desc.CPUAccessFlags = this->_partialUploads ? 0 : D3D11_CPU_ACCESS_WRITE;
+        desc.MiscFlags = 0;
+
+        detail::ThrowIfFailed(this->_d3dDevice->CreateBuffer(&desc, nullptr, &this->_worldVertexBuffer));
+        this->_maxWorldVertices = maxWorldVertices;
+    }
+
+    inline detail::ThreadPool &GetThreadPool()
+    {
+        if (!this->_threadPool)
+        {
+            this->_threadPool = std::make_unique<detail::ThreadPool>(max(2u, std::thread::hardware_concurrency()) - 1);
+        }
+
+        return *this->_threadPool;
+    }
+
+    inline void AddShape(const RenderListPtr &renderList, const ShapeCommand &command, size_t count,
+                         const TopologyType topology)
+    {
+        const size_t offset = renderList->AddShape(command, count, topology, this->_fontAtlas->GetTextureView());
+
+        if (!renderList->_deferredTessellation)
+        {
+            TessellateShape(command, &renderList->_vertices[offset]);
+        }
+    }
+
+    // Writes the vertices of a shape, the same whether it is tessellated when it is added or when it is rendered.
+    static inline void TessellateShape(const ShapeCommand &command, Vertex *v)
+    {
+        const Color color = command.color;
+
+        switch (command.type)
+        {
+        case ShapeCommandType::RectFilled: {
+            const float x1 = command.p1.x;
+            const float y1 = command.p1.y;
+            const float x2 = command.p2.x;
+            const float y2 = command.p2.y;
+
+            v[0] = {x1, y1, color}; // Top-left vertex
+            v[1] = {x2, y1, color}; // Top-right vertex
+            v[2] = {x1, y2, color}; // Bottom-left vertex
+
+            v[3] = {x2, y1, color}; // Top-right vertex
+            v[4] = {x2, y2, color}; // Bottom-right vertex
+            v[5] = {x1, y2, color}; // Bottom-left vertex
+            break;
+        }
+
+        case ShapeCommandType::Line:
+            v[0] = {command.p1.x, command.p1.y, color};
+            v[1] = {command.p2.x, command.p2.y, color};
+            break;
+
+        case ShapeCommandType::Circle:
+            for (int i = 0; i <= command.segments; i++)
+            {
+                const float theta = 2.f * DirectX::XM_PI * static_cast<float>(i) / static_cast<float>(command.segments);
+
+                v[i] = Vertex{command.p1.x + command.size * std::cos(theta),
+                              command.p1.y + command.size * std::sin(theta), color};
+            }
+            break;
+        }
+    }
+
+    // Tessellates the shapes of lists with deferred tessellation. Every command writes the vertex range it reserved,
+    // the prefix sum of the vertex counts recorded before it, so chunks of commands run on the worker pool next to the
+    // render thread without sharing anything.
+    inline void TessellateCommands(std::span<const RenderListPtr> renderLists)
+    {
+        for (const auto &renderList : renderLists)
+        {
+            const std::vector<ShapeCommand> &commands = renderList->_commands;
+
+            if (commands.empty())
+            {
+                continue;
+            }
+
+            Vertex *vertices = renderList->_vertices.data();
+            detail::ThreadPool *pool = commands.size() > g_tessellateChunkSize ? &this->GetThreadPool() : nullptr;
+
+            detail::ParallelFor(pool, commands.size(), g_tessellateChunkSize,
+                                [&commands, vertices](size_t begin, size_t end) {
+                                    for (size_t i = begin; i < end; i++)
+                                    {
+                                        TessellateShape(commands[i], vertices + commands[i].offset);
+                                    }
+                                });
+
+            renderList->_commands.clear();
+        }
+    }
+
+    // clip rect and transform are applied when drawing, only the recorded content has to match
+    static inline uint64_t GetUploadHash(const RenderList &renderList)
+    {
+        return renderList._contentHash;
+    }
+
+    inline bool IsUploaded(std::span<const RenderListPtr> renderLists) const
+    {
+        if (renderLists.size() != this->_uploadedHashes.size())
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < renderLists.size(); i++)
+        {
+            if (GetUploadHash(*renderLists[i]) != this->_uploadedHashes[i])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    inline void UploadRenderLists(std::span<const RenderListPtr> renderLists)
+    {
+        this->TessellateCommands(renderLists);
+
+        size_t numVertices = 0;
+        size_t numInstances = 0;
+        size_t numWorldVertices = 0;
+
+        for (const auto &renderList : renderLists)
+        {
+            numVertices += renderList->_vertices.size();
+            numInstances += renderList->_glyphInstances.size();
+            numWorldVertices += renderList->_worldVertices.size();
+        }
+
+        this->SortBatches(renderLists);
+
+        if (numVertices > 0)
+        {
+            if (numVertices > this->_maxVertices)
+            {
+                this->CreateVertexBuffer(max(numVertices, static_cast<size_t>(this->_maxVertices) * 2));
+                this->SetupPipeline(BatchType::Vertices);
+            }
+
+            this->UploadBatches(this->_vertexBuffer, this->_retainedVertices, renderLists, &RenderList::_vertices,
+                                BatchType::Vertices);
+        }
+
+        if (numInstances > 0)
+        {
+            if (numInstances > this->_maxGlyphInstances)
+            {
+                this->CreateInstanceBuffer(max(numInstances, this->_maxGlyphInstances * 2));
+            }
+
+            this->UploadBatches(this->_instanceBuffer, this->_retainedGlyphInstances, renderLists,
+                                &RenderList::_glyphInstances, BatchType::GlyphInstances);
+        }
+
+        if (numWorldVertices > 0)
+        {
+            if (numWorldVertices > this->_maxWorldVertices)
+            {
+                this->CreateWorldVertexBuffer(max(numWorldVertices, this->_maxWorldVertices * 2));
+            }
+
+            this->UploadBatches(this->_worldVertexBuffer, this->_retainedWorldVertices, renderLists,
+                                &RenderList::_worldVertices, BatchType::WorldVertices);
+        }
+
+        this->_uploadedHashes.clear();
+        for (const auto &renderList : renderLists)
+        {
+            this->_uploadedHashes.push_back(GetUploadHash(*renderList));
+        }
+    }
+
+    // Whether next may be appended to the draw of batch once their data is contiguous. Both need the same state and
+    // a list topology, strips would join into one shape.
+    static inline bool IsMergeable(const Batch &batch, const Batch &next)
+    {
+        if (batch.type != next.type || batch.topology != next.topology || batch.texture != next.texture)
+        {
+            return false;
+        }
+
+        return batch.type == BatchType::GlyphInstances || batch.topology == D3D11_PRIMITIVE_TOPOLOGY_POINTLIST ||
+               batch.topology == D3D11_PRIMITIVE_TOPOLOGY_LINELIST ||
+               batch.topology == D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+    }
+
+    // Stable sort of the batches of every list by layer, the recorded order is kept within a layer. Fills _batchOrder
+    // with the sorted indices and _batchOffsets with the start of every batch within its list's array.
+    inline void SortBatches(std::span<const RenderListPtr> renderLists)
+    {
+        this->_batchKeys.clear();
+        this->_batchOffsets.clear();
+        this->_batchOrder.clear();
+
+        for (const auto &renderList : renderLists)
+        {
+            const size_t first = this->_batchKeys.size();
+            size_t offsets[3] = {};
+
+            for (const auto &batch : renderList->_batches)
+            {
+                size_t &offset = offsets[static_cast<size_t>(batch.type)];
+
+                this->_batchKeys.push_back(batch.layer);
+                this->_batchOffsets.push_back(offset);
+                offset += batch.count;
+            }
+
+            this->_batchOrder.resize(this->_batchKeys.size());
+            detail::RadixSort(&this->_batchKeys[first], renderList->_batches.size(), &this->_batchOrder[first],
+                              this->_sortScratch);
+        }
+    }
+
+    // Copies the batches of one type from every list into buffer in the order they are drawn, with a single map.
+    template <typename T>
+    inline void UploadBatches(ID3D11Buffer *buffer, detail::RetainedBuffer &retained,
+                              std::span<const RenderListPtr> renderLists, std::vector<T> RenderList::*items,
+                              BatchType type)
+    {
+        if (this->_partialUploads)
+        {
+            this->UploadChangedBatches(buffer, retained, renderLists, items, type);
+            return;
+        }
+
+        D3D11_MAPPED_SUBRESOURCE mappedResource;
+        detail::ThrowIfFailed(this->_d3dDeviceContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource));
+        const size_t bytes = this->CopyBatches(static_cast<uint8_t *>(mappedResource.pData), renderLists, items, type);
+        this->_d3dDeviceContext->Unmap(buffer, 0);
+
+        this->_renderStats.bufferMaps++;
+        this->_renderStats.uploadedBytes += bytes;
+    }
+
+    // Lays the batches out in the retained copy, compares it with the previous upload and writes only the ranges
+    // which differ. When most of it changed one update spanning all of them is cheaper, too many ranges are merged
+    // across the smallest gaps.
+    template <typename T>
+    inline void UploadChangedBatches(ID3D11Buffer *buffer, detail::RetainedBuffer &retained,
+                                     std::span<const RenderListPtr> renderLists, std::vector<T> RenderList::*items,
+                                     BatchType type)
+    {
+        size_t count = 0;
+        for (const auto &renderList : renderLists)
+        {
+            count += ((*renderList).*items).size();
+        }
+
+        retained.current.resize(sizeof(T) * count);
+        const size_t bytes = this->CopyBatches(retained.current.data(), renderLists, items, type);
+        retained.current.resize(bytes);
+
+        detail::DiffChunks(retained.previous.data(), retained.previous.size(), retained.current.data(), bytes,
+                           g_uploadChunkSize, retained.dirtyRanges);
+
+        size_t dirtyBytes = 0;
+        for (const auto &range : retained.dirtyRanges)
+        {
+            dirtyBytes += range.second - range.first;
+        }
+
+        if (retained.dirtyRanges.size() > 1 && dirtyBytes * 2 > bytes)
+        {
+            retained.dirtyRanges.assign(1, {retained.dirtyRanges.front().first, retained.dirtyRanges.back().second});
+        }
+        else
+        {
+            detail::MergeRanges(retained.dirtyRanges, g_uploadMaxRanges, retained.gaps);
+        }
+
+        dirtyBytes = 0;
+        for (const auto &range : retained.dirtyRanges)
+        {
+            dirtyBytes += range.second - range.first;
+        }
+
+        for (const auto &range : retained.dirtyRanges)
+        {
+            D3D11_BOX box{};
+            box.left = static_cast<UINT>(range.first);
+            box.right = static_cast<UINT>(range.second);
+            box.top = 0;
+            box.bottom = 1;
+            box.front = 0;
+            box.back = 1;
+
+            this->_d3dDeviceContext->UpdateSubresource(buffer, 0, &box, retained.current.data() + range.first, 0, 0);
+            this->_renderStats.bufferMaps++;
+        }
+
+        this->_renderStats.uploadedBytes += dirtyBytes;
+        std::swap(retained.current, retained.previous);
+    }
+
+    // copies the batches of type in sorted order to dst, returns the number of bytes written
+    template <typename T>
+    inline size_t CopyBatches(uint8_t *dst, std::span<const RenderListPtr> renderLists,
+                              std::vector<T> RenderList::*items, BatchType type)
+    {
+        size_t bytes = 0;
+        size_t first = 0;
+
+        for (const auto &renderList : renderLists)
+        {
+            const std::vector<T> &listItems = (*renderList).*items;
+
+            for (size_t i = 0; i < renderList->_batches.size(); i++)
+            {
+                const uint32_t index = this->_batchOrder[first + i];
+                const Batch &batch = renderList->_batches[index];
+
+                if (batch.type == type && batch.count)
+                {
+                    memcpy(dst + bytes, &listItems[this->_batchOffsets[first + index]], sizeof(T) * batch.count);
+                    bytes += sizeof(T) * batch.count;
+                }
+            }
+
+            first += renderList->_batches.size();
+        }
+
+        return bytes;
+    }
+
+    inline void UpdateProjection()
+    {
+        this->_projMatrix = DirectX::XMMatrixOrthographicOffCenterLH(0.f, this->_displaySize.x, this->_displaySize.y,
+                                                                     0.f, 0.f, 1.f);
+        this->UpdateVertexConstants(this->_projMatrix);
+    }
+
+    // projection is the orthographic projection, possibly combined with the transform of a render list
+    inline void UpdateVertexConstants(const DirectX::XMMATRIX &projection)
+    {
+        D3D11_MAPPED_SUBRESOURCE mappedResource;
+        detail::ThrowIfFailed(
+            this->_d3dDeviceContext->Map(this->_vertexConstantBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource));
+        {
+            uint8_t *data = static_cast<uint8_t *>(mappedResource.pData);
+
+            memcpy(data, &projection, sizeof(DirectX::XMMATRIX));
+            memcpy(data + sizeof(DirectX::XMMATRIX), &this->_viewProjMatrix, sizeof(DirectX::XMMATRIX));
+        }
+        this->_d3dDeviceContext->Unmap(this->_vertexConstantBuffer, 0);
+
+        this->_renderStats.bufferMaps++;
+        this->_renderStats.uploadedBytes += sizeof(DirectX::XMMATRIX) * 2;
+    }
+
+    // converted once, the run keeps the text until it is laid out
+    static inline std::wstring WidenText(std::string_view text)
+    {
+        std::wstring wideText;
+        wideText.reserve(text.size());
+
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            wchar_t chr[2];
+            wideText.append(chr, detail::EncodeUtf16(detail::DecodeUtf8(text, i), chr));
+        }
+
+        return wideText;
+    }
+
+    inline TextRun &GetTextRun(const TextHandle textHandle, const std::string &caller)
+    {
+        if (textHandle >= this->_texts.size() || !this->_texts[textHandle])
+        {
+            throw std::runtime_error(caller + "(): Text not found!");
+        }
+
+        return *this->_texts[textHandle];
+    }
+
     Vec2 _displaySize;
-    ID3D11ShaderResourceView *_renderResourceView = nullptr;
     ID3D11DeviceContext *_d3dDeviceContext;
     ID3D11Device *_d3dDevice;
     ID3D11InputLayout *_inputLayout;
@@ -1303,15 +4340,47 @@ class Renderer : public std::enable_shared_from_this<Renderer>
     ID3D11PixelShader *_pixelShader;
     ID3D11Buffer *_vertexBuffer;
     ID3D11Buffer *_vertexConstantBuffer;
+    ID3D11InputLayout *_glyphInputLayout;
+    ID3D11VertexShader *_glyphVertexShader;
+    ID3D11Buffer *_instanceBuffer;
+    size_t _maxGlyphInstances;
+    ID3D11InputLayout *_worldInputLayout;
+    ID3D11VertexShader *_worldVertexShader;
+    ID3D11Buffer *_worldVertexBuffer;
+    size_t _maxWorldVertices;
     ID3D11SamplerState *_fontSampler;
     ID3D11RasterizerState *_rasterizerState;
     ID3D11DepthStencilState *_depthStencilState;
     DirectX::XMMATRIX _projMatrix;
+    DirectX::XMMATRIX _viewProjMatrix;
 
     uint32_t _maxVertices;
     RenderListPtr _renderList;
 
+    std::shared_ptr<FontAtlas> _fontAtlas;
+    std::wstring _fontCacheDirectory;
     std::unordered_map<FontHandle, FontPtr> _fonts;
     FontHandle _nextFontId;
+    // interned texts are indexed by their handle
+    std::vector<std::unique_ptr<TextRun>> _texts;
+    std::vector<TextHandle> _freeTextHandles;
+    std::atomic<size_t> _textQuadsSaved;
+    RenderStats _renderStats;
+    bool _keepLastList = false;
+    // upload hash of each list in the buffers
+    std::vector<uint64_t> _uploadedHashes;
+    bool _partialUploads = false;
+    detail::RetainedBuffer _retainedVertices;
+    detail::RetainedBuffer _retainedGlyphInstances;
+    detail::RetainedBuffer _retainedWorldVertices;
+
+    // scratch of SortBatches(), indexed by the batches of all lists passed to Render() back to back
+    std::vector<uint64_t> _batchKeys;
+    std::vector<size_t> _batchOffsets;
+    std::vector<uint32_t> _batchOrder;
+    std::vector<uint32_t> _sortScratch;
+
+    // declared last so the workers are joined before anything they reference is destroyed
+    std::unique_ptr<detail::ThreadPool> _threadPool;
 };
 } // namespace CheatRenderFramework
\ No newline at end of file
@@ -5,14 +5,31 @@
 #include <cmath>
 #include <unordered_map>
 #include <array>
-#include <map>
 #include <algorithm>
+#include <string>
+#include <string_view>
+#include <span>
+#include <format>
+#include <charconv>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
 #include <locale>
 #include <codecvt>
 
 #include <d3d9.h>
 #include <DirectXMath.h>
 
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "../common/renderer_common.hpp"
+
 namespace CheatRenderFramework
 {
 namespace detail
@@ -34,28 +51,471 @@ template <class T> __forceinline void SafeRelease(T **ppT)
     }
 }
 
-__forceinline std::wstring ConvertToWString(const std::string &str)
+// Projects points with a row-vector view-projection matrix, as DirectXMath builds them, to a width x height viewport.
+// Writes bit 0 of visible for points in front of the near plane and bit 1 for points inside the frustum, the screen
+// position is only meaningful for points in front of the near plane.
+__forceinline void ProjectPointsScalar(const DirectX::XMFLOAT4X4 &m, const DirectX::XMFLOAT3 *in,
+                                       DirectX::XMFLOAT2 *out, uint8_t *visible, size_t count, float width,
+                                       float height)
+{
+    const float halfWidth = width * 0.5f;
+    const float halfHeight = height * 0.5f;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const DirectX::XMFLOAT3 &p = in[i];
+        const float cx = p.x * m.m[0][0] + p.y * m.m[1][0] + p.z * m.m[2][0] + m.m[3][0];
+        const float cy = p.x * m.m[0][1] + p.y * m.m[1][1] + p.z * m.m[2][1] + m.m[3][1];
+        const float cz = p.x * m.m[0][2] + p.y * m.m[1][2] + p.z * m.m[2][2] + m.m[3][2];
+        const float cw = p.x * m.m[0][3] + p.y * m.m[1][3] + p.z * m.m[2][3] + m.m[3][3];
+
+        const bool inFront = cz >= 0.f && cw > 0.f;
+        const bool onScreen = inFront && std::fabs(cx) <= cw && std::fabs(cy) <= cw && cz <= cw;
+        visible[i] = static_cast<uint8_t>((inFront ? 1 : 0) | (onScreen ? 2 : 0));
+
+        const float invW = 1.f / cw;
+        out[i] = DirectX::XMFLOAT2(cx * invW * halfWidth + halfWidth, halfHeight - cy * invW * halfHeight);
+    }
+}
+
+__forceinline void ProjectPoints(const DirectX::XMFLOAT4X4 &m, const DirectX::XMFLOAT3 *in, DirectX::XMFLOAT2 *out,
+                                 uint8_t *visible, size_t count, float width, float height)
+{
+    size_t i = 0;
+
+#if defined(_M_IX86) || defined(_M_X64)
+    __m128 mat[4][4];
+    for (int row = 0; row < 4; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            mat[row][col] = _mm_set1_ps(m.m[row][col]);
+        }
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 halfWidth = _mm_set1_ps(width * 0.5f);
+    const __m128 halfHeight = _mm_set1_ps(height * 0.5f);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        // x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3, shuffled into one register per component
+        const float *src = &in[i].x;
+        const __m128 p0 = _mm_loadu_ps(src);
+        const __m128 p1 = _mm_loadu_ps(src + 4);
+        const __m128 p2 = _mm_loadu_ps(src + 8);
+
+        const __m128 x = _mm_shuffle_ps(_mm_shuffle_ps(p0, p0, _MM_SHUFFLE(3, 3, 0, 0)),
+                                        _mm_shuffle_ps(p1, p2, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 y = _mm_shuffle_ps(_mm_shuffle_ps(p0, p1, _MM_SHUFFLE(0, 0, 0, 1)),
+                                        _mm_shuffle_ps(p1, p2, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 z = _mm_shuffle_ps(_mm_shuffle_ps(p0, p1, _MM_SHUFFLE(1, 1, 2, 2)),
+                                        _mm_shuffle_ps(p2, p2, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+
+        __m128 clip[4];
+        for (int col = 0; col < 4; col++)
+        {
+            clip[col] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, mat[0][col]), _mm_mul_ps(y, mat[1][col])),
+                                   _mm_add_ps(_mm_mul_ps(z, mat[2][col]), mat[3][col]));
+        }
+
+        const __m128 inFront = _mm_and_ps(_mm_cmpge_ps(clip[2], zero), _mm_cmpgt_ps(clip[3], zero));
+        const __m128 inside = _mm_and_ps(_mm_cmple_ps(_mm_and_ps(clip[0], absMask), clip[3]),
+                                         _mm_cmple_ps(_mm_and_ps(clip[1], absMask), clip[3]));
+        const __m128 onScreen = _mm_and_ps(_mm_and_ps(inFront, inside), _mm_cmple_ps(clip[2], clip[3]));
+
+        const __m128 invW = _mm_div_ps(one, clip[3]);
+        const __m128 sx = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(clip[0], invW), halfWidth), halfWidth);
+        const __m128 sy = _mm_sub_ps(halfHeight, _mm_mul_ps(_mm_mul_ps(clip[1], invW), halfHeight));
+
+        float *dst = &out[i].x;
+        _mm_storeu_ps(dst, _mm_unpacklo_ps(sx, sy));
+        _mm_storeu_ps(dst + 4, _mm_unpackhi_ps(sx, sy));
+
+        const int frontMask = _mm_movemask_ps(inFront);
+        const int screenMask = _mm_movemask_ps(onScreen);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            visible[i + lane] = static_cast<uint8_t>(((frontMask >> lane) & 1) | (((screenMask >> lane) & 1) << 1));
+        }
+    }
+#endif
+
+    ProjectPointsScalar(m, in + i, out + i, visible + i, count - i, width, height);
+}
+
+// Two unit axes spanning the plane perpendicular to normal.
+__forceinline void PlaneAxes(const DirectX::XMFLOAT3 &normal, DirectX::XMFLOAT3 &u, DirectX::XMFLOAT3 &w)
+{
+    const float length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+    const DirectX::XMFLOAT3 n(normal.x / length, normal.y / length, normal.z / length);
+
+    // cross the normal with the x or y axis, whichever is further from being parallel to it
+    u = std::fabs(n.x) < 0.9f ? DirectX::XMFLOAT3(0.f, -n.z, n.y) : DirectX::XMFLOAT3(n.z, 0.f, -n.x);
+
+    const float uLength = std::sqrt(u.x * u.x + u.y * u.y + u.z * u.z);
+    u = DirectX::XMFLOAT3(u.x / uLength, u.y / uLength, u.z / uLength);
+    w = DirectX::XMFLOAT3(n.y * u.z - n.z * u.y, n.z * u.x - n.x * u.z, n.x * u.y - n.y * u.x);
+}
+
+// Stable LSD radix sort, order receives the indices of the keys in ascending key order. Bytes which are the same in
+// every key are skipped, so keys differing in a few high bits only take a pass or two.
+__forceinline void RadixSort(const uint64_t *keys, size_t count, uint32_t *order, std::vector<uint32_t> &scratch)
+{
+    scratch.resize(count);
+
+    uint32_t *src = order;
+    uint32_t *dst = scratch.data();
+    uint64_t differing = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        src[i] = static_cast<uint32_t>(i);
+        differing |= keys[i] ^ keys[0];
+    }
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        if (!((differing >> shift) & 0xff))
+        {
+            continue;
+        }
+
+        size_t offsets[257] = {};
+        for (size_t i = 0; i < count; i++)
+        {
+            offsets[((keys[i] >> shift) & 0xff) + 1]++;
+        }
+
+        for (size_t i = 1; i < 257; i++)
+        {
+            offsets[i] += offsets[i - 1];
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            dst[offsets[(keys[src[i]] >> shift) & 0xff]++] = src[i];
+        }
+
+        std::swap(src, dst);
+    }
+
+    if (src != order)
+    {
+        memcpy(order, src, count * sizeof(uint32_t));
+    }
+}
+
+// Incremental 64-bit hash of recorded data, good enough to tell frames apart but not collision resistant.
+__forceinline uint64_t HashBytes(uint64_t hash, const void *data, size_t size)
+{
+    constexpr uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    for (; size >= sizeof(uint64_t); bytes += sizeof(uint64_t), size -= sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(uint64_t));
+        hash = (hash ^ word) * multiplier;
+        hash ^= hash >> 29;
+    }
+
+    if (size > 0)
+    {
+        uint64_t word = static_cast<uint64_t>(size) << 56;
+        memcpy(&word, bytes, size);
+        hash = (hash ^ word) * multiplier;
+        hash ^= hash >> 29;
+    }
+
+    return hash;
+}
+
+// Bakes the field outlines are drawn from into a cell padded by padding pixels on every side. It is 255 on the glyph
+// and falls off linearly to 0 at padding + 1 pixels away from it, so an outline as thick as the padding is the field.
+__forceinline void BakeOutlineField(const uint8_t *src, long width, long height, long srcPitch, long padding,
+                                    uint8_t *dst, long dstStride, long dstPitch)
+{
+    const float range = static_cast<float>(padding + 1);
+
+    for (long y = 0; y < height + 2 * padding; y++)
+    {
+        for (long x = 0; x < width + 2 * padding; x++)
+        {
+            float distance = range;
+
+            // source pixels within padding of the cell pixel, partially covered ones count as farther away
+            for (long sy = std::max(y - 2 * padding, 0L); sy < std::min(y + 1, height); sy++)
+            {
+                for (long sx = std::max(x - 2 * padding, 0L); sx < std::min(x + 1, width); sx++)
+                {
+                    const uint8_t coverage = src[srcPitch * sy + sx];
+                    if (!coverage)
+                    {
+                        continue;
+                    }
+
+                    const float dx = static_cast<float>(sx + padding - x);
+                    const float dy = static_cast<float>(sy + padding - y);
+                    const float d = sqrtf(dx * dx + dy * dy) + 1.f - coverage / 255.f;
+
+                    distance = std::min(distance, d);
+                }
+            }
+
+            dst[dstPitch * y + dstStride * x] = static_cast<uint8_t>(255.f * (1.f - distance / range) + 0.5f);
+        }
+    }
+}
+
+// Bakes a drop shadow into a cell padded by padding (at least 2) pixels on every side, the coverage blurred by a 3x3
+// box and moved one pixel down and right.
+__forceinline void BakeShadowField(const uint8_t *src, long width, long height, long srcPitch, long padding,
+                                   uint8_t *dst, long dstStride, long dstPitch)
+{
+    for (long y = 0; y < height + 2 * padding; y++)
+    {
+        for (long x = 0; x < width + 2 * padding; x++)
+        {
+            uint32_t sum = 0;
+
+            for (long sy = std::max(y - padding - 2, 0L); sy < std::min(y - padding + 1, height); sy++)
+            {
+                for (long sx = std::max(x - padding - 2, 0L); sx < std::min(x - padding + 1, width); sx++)
+                {
+                    sum += src[srcPitch * sy + sx];
+                }
+            }
+
+            dst[dstPitch * y + dstStride * x] = static_cast<uint8_t>(sum / 9);
+        }
+    }
+}
+
+// Read-only mapping of a whole file.
+class MappedFile
+{
+  public:
+    MappedFile(const std::wstring &path) : _file(INVALID_HANDLE_VALUE), _mapping(nullptr), _data(nullptr), _size(0)
+    {
+        this->_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (this->_file == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
+
+        LARGE_INTEGER fileSize{};
+        if (!GetFileSizeEx(this->_file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            return;
+        }
+
+        this->_mapping = CreateFileMappingW(this->_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!this->_mapping)
+        {
+            return;
+        }
+
+        this->_data = static_cast<const uint8_t *>(MapViewOfFile(this->_mapping, FILE_MAP_READ, 0, 0, 0));
+        if (this->_data)
+        {
+            this->_size = static_cast<size_t>(fileSize.QuadPart);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        if (this->_data)
+        {
+            UnmapViewOfFile(this->_data);
+        }
+
+        if (this->_mapping)
+        {
+            CloseHandle(this->_mapping);
+        }
+
+        if (this->_file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(this->_file);
+        }
+    }
+
+    inline const uint8_t *GetData() const
+    {
+        return this->_data;
+    }
+
+    inline size_t GetSize() const
+    {
+        return this->_size;
+    }
+
+  private:
+    HANDLE _file;
+    HANDLE _mapping;
+    const uint8_t *_data;
+    size_t _size;
+};
+
+// Fixed set of worker threads draining a FIFO queue. Pending tasks are dropped on destruction, running ones are
+// waited for.
+class ThreadPool
 {
-    if (str.empty())
+  public:
+    ThreadPool(size_t workerCount) : _stop(false)
+    {
+        for (size_t i = 0; i < workerCount; i++)
+        {
+            this->_workers.emplace_back([this]() { this->WorkerLoop(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            this->_stop = true;
+        }
+
+        this->_condition.notify_all();
+
+        for (std::thread &worker : this->_workers)
+        {
+            worker.join();
+        }
+    }
+
+    inline void Submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->_mutex);
+            this->_tasks.push_back(std::move(task));
+        }
+
+        this->_condition.notify_one();
+    }
+
+    inline size_t GetWorkerCount() const
     {
-        return std::wstring();
+        return this->_workers.size();
     }
 
-    int sizeNeeded = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), static_cast<int>(str.length()), NULL, 0);
-    if (sizeNeeded <= 0)
+  private:
+    inline void WorkerLoop()
     {
-        throw std::runtime_error("MultiByteToWideChar failed");
+        for (;;)
+        {
+            std::function<void()> task;
+
+            {
+                std::unique_lock<std::mutex> lock(this->_mutex);
+                this->_condition.wait(lock, [this]() { return this->_stop || !this->_tasks.empty(); });
+
+                if (this->_stop)
+                {
+                    return;
+                }
+
+                task = std::move(this->_tasks.front());
+                this->_tasks.pop_front();
+            }
+
+            // a failing task must not take the process down with it
+            try
+            {
+                task();
+            }
+            catch (...)
+            {
+            }
+        }
     }
 
-    std::wstring wstrTo(sizeNeeded, 0);
-    int result = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), static_cast<int>(str.length()), &wstrTo[0], sizeNeeded);
-    if (result == 0)
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _stop;
+};
+
+// Runs work(begin, end) over [0, count) in chunks on the calling thread and the pool, and returns once every chunk is
+// done. Chunks are claimed from a shared counter, so a pool busy with other tasks only means the calling thread does
+// more of them. Helpers which start after all chunks are claimed return without touching anything. The first exception
+// thrown by a chunk is rethrown on the calling thread once all chunks are done.
+__forceinline void ParallelFor(ThreadPool *pool, size_t count, size_t chunkSize,
+                               const std::function<void(size_t, size_t)> &work)
+{
+    struct Job
+    {
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        size_t chunks = 0;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::exception_ptr error;
+    };
+
+    auto job = std::make_shared<Job>();
+    job->chunks = (count + chunkSize - 1) / chunkSize;
+
+    auto run = [job, count, chunkSize, &work]() {
+        for (size_t chunk = job->next++; chunk < job->chunks; chunk = job->next++)
+        {
+            const size_t begin = chunk * chunkSize;
+
+            // a failed chunk still counts as done, otherwise the caller would wait forever
+            try
+            {
+                work(begin, std::min(begin + chunkSize, count));
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                if (!job->error)
+                {
+                    job->error = std::current_exception();
+                }
+            }
+
+            if (++job->done == job->chunks)
+            {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                job->condition.notify_all();
+            }
+        }
+    };
+
+    if (pool)
     {
-        throw std::runtime_error("MultiByteToWideChar failed");
+        const size_t helpers = std::min(pool->GetWorkerCount(), job->chunks - 1);
+
+        for (size_t i = 0; i < helpers; i++)
+        {
+            pool->Submit(run);
+        }
     }
 
-    return wstrTo;
+    run();
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->condition.wait(lock, [&job]() { return job->done == job->chunks; });
+
+    if (job->error)
+    {
+        std::rethrow_exception(job->error);
+    }
 }
+
 } // namespace detail
 
 namespace util
@@ -90,11 +550,13 @@ __forceinline int GetTopologyOrder(const D3DPRIMITIVETYPE topology)
 class Renderer;
 class RenderList;
 class Font;
+class FontAtlas;
 
 using RenderListPtr = std::shared_ptr<RenderList>;
 using RendererPtr = std::shared_ptr<Renderer>;
 using FontPtr = std::shared_ptr<Font>;
 using FontHandle = size_t;
+using TextHandle = size_t;
 
 using TopologyType = D3DPRIMITIVETYPE;
 
@@ -102,10 +564,21 @@ using Vec2 = DirectX::XMFLOAT2;
 using Vec3 = DirectX::XMFLOAT3;
 using Vec4 = DirectX::XMFLOAT4;
 
-// Charset basic latin until latin extended B
-static constexpr wchar_t g_charRangeMin = 0x20;
-static constexpr wchar_t g_charRangeMax = 0x250;
+// outline and shadow are baked into the atlas as glyphs of their own, one per outline thickness
+static constexpr long g_fontOutlineMaxThickness = 8;
+static constexpr long g_fontShadowPadding = 2;
+// smallest number of glyphs worth handing to a separate worker when baking asynchronously
+static constexpr uint32_t g_fontBakeChunkSize = 32;
+// shape commands tessellated by one task, fewer than this are tessellated on the render thread alone
+static constexpr size_t g_tessellateChunkSize = 256;
+static constexpr uint32_t g_fontCacheMagic = 0x43465243; // "CRFC"
+static constexpr uint32_t g_fontCacheVersion = 1;
+static constexpr uint32_t g_fontCacheNoPixels = 0xffffffff;
+// characters AddTextFormat formats on the stack, longer output is cut off at the last whole code point
+static constexpr size_t g_textFormatBufferSize = 256;
 static constexpr ULONG g_vertexDefinition = D3DFVF_XYZRHW | D3DFVF_DIFFUSE | D3DFVF_TEX1;
+// world-space primitives are transformed and clipped by the fixed function pipeline
+static constexpr ULONG g_worldVertexDefinition = D3DFVF_XYZ | D3DFVF_DIFFUSE;
 
 enum FontFlags : int32_t
 {
@@ -116,18 +589,22 @@ enum FontFlags : int32_t
     FONT_FLAG_MAX
 };
 
-enum TextFlags : int32_t
+// Baked variants of a glyph in the atlas, outlines add their thickness to GLYPH_VARIANT_OUTLINE.
+enum GlyphVariant : uint32_t
+{
+    GLYPH_VARIANT_FILL = 0,
+    GLYPH_VARIANT_SHADOW = 1,
+    GLYPH_VARIANT_OUTLINE = 2
+};
+
+// Per point result of Renderer::ProjectPoints()
+enum ProjectionFlags : uint8_t
 {
-    TEXT_FLAG_NONE = 0,
-    TEXT_FLAG_LEFT = 0 << 0,
-    TEXT_FLAG_RIGHT = 1 << 1,
-    TEXT_FLAG_CENTERED_X = 1 << 2,
-    TEXT_FLAG_CENTERED_Y = 1 << 3,
-    TEXT_FLAG_CENTERED = TEXT_FLAG_CENTERED_X | TEXT_FLAG_CENTERED_Y,
-    TEXT_FLAG_DROPSHADOW = 1 << 4,
-    TEXT_FLAG_OUTLINE = 1 << 5,
-    TEXT_FLAG_COLORTAGS = 1 << 6,
-    TEXT_FLAG_MAX
+    PROJECTION_FLAG_NONE = 0,
+    // in front of the near plane, the screen position is valid
+    PROJECTION_FLAG_IN_FRONT = 1 << 0,
+    // inside the view frustum
+    PROJECTION_FLAG_ON_SCREEN = 1 << 1
 };
 
 enum class GradientDirection : int32_t
@@ -218,16 +695,65 @@ struct Vertex
     Vec2 tex{};
 };
 
+// Vertex of a world-space primitive, projected by the device, see Renderer::SetViewProjection().
+struct WorldVertex
+{
+    WorldVertex() = default;
+
+    WorldVertex(Vec3 position, Color color) : position(position), color(color)
+    {
+    }
+
+    Vec3 position{};
+    Color color{};
+};
+
+enum class BatchType : int32_t
+{
+    Vertices = 0,
+    // count is the number of WorldVertices
+    WorldVertices
+};
+
 struct Batch
 {
-    Batch(size_t count, const TopologyType topology, IDirect3DTexture9 *d3dTexture = nullptr)
-        : count(count), topology(topology), d3dTexture(d3dTexture)
+    Batch(size_t count, const TopologyType topology, IDirect3DTexture9 *d3dTexture = nullptr,
+          BatchType type = BatchType::Vertices, uint8_t layer = 0)
+        : count(count), topology(topology), d3dTexture(d3dTexture), type(type), layer(layer)
     {
     }
 
     std::size_t count = 0;
     TopologyType topology = static_cast<TopologyType>(0);
     IDirect3DTexture9 *d3dTexture = nullptr;
+    BatchType type = BatchType::Vertices;
+    uint8_t layer = 0;
+};
+
+enum class ShapeCommandType : uint32_t
+{
+    RectFilled = 0,
+    GradientRect,
+    Line,
+    Circle
+};
+
+// A shape recorded by a list with deferred tessellation, tessellated when the list is rendered into the vertices it
+// reserved. Laid out without padding, so it can be hashed as it is.
+struct ShapeCommand
+{
+    ShapeCommandType type = ShapeCommandType::RectFilled;
+    // first vertex reserved in the list
+    uint32_t offset = 0;
+    // min and max of a rect, the end points of a line or the center of a circle
+    Vec2 p1{};
+    Vec2 p2{};
+    Color color{};
+    Color color2{};
+    // line thickness or circle radius
+    float size = 0.f;
+    // circle segments or gradient direction
+    int32_t segments = 0;
 };
 
 class RenderList : public std::enable_shared_from_this<RenderList>
@@ -243,178 +769,419 @@ class RenderList : public std::enable_shared_from_this<RenderList>
     inline void AddVertices(const Vertex (&vertexArray)[N], const TopologyType topology,
                             IDirect3DTexture9 *d3dTexture = nullptr)
     {
-        const size_t numVertices = this->_vertices.size();
-
-        if (this->_batches.empty() || this->_batches.back().topology != topology ||
-            this->_batches.back().d3dTexture != d3dTexture)
-        {
-            this->_batches.emplace_back(0, topology, d3dTexture);
-        }
-
-        this->_batches.back().count += N;
-        this->_vertices.resize(numVertices + N);
-
-        memcpy(&this->_vertices[this->_vertices.size() - N], &vertexArray[0], N * sizeof(Vertex));
+        this->HashRecord(BatchType::Vertices, topology, d3dTexture, vertexArray, N * sizeof(Vertex));
 
-        switch (topology)
-        {
-        default:
-            break;
-
-        case D3DPT_LINESTRIP:
-        case D3DPT_TRIANGLESTRIP:
-            // add a new empty batch to force the end of the strip
-            this->_batches.emplace_back(0, D3DPT_FORCE_DWORD, nullptr);
-            break;
-        }
+        const size_t offset = this->ReserveVertices(N, topology, d3dTexture);
+        memcpy(&this->_vertices[offset], &vertexArray[0], N * sizeof(Vertex));
     }
 
     inline void AddVertices(Vertex *vertexArray, size_t vertexArrayCount, const TopologyType topology,
                             IDirect3DTexture9 *d3dTexture = nullptr)
     {
-        const size_t numVertices = this->_vertices.size();
+        this->HashRecord(BatchType::Vertices, topology, d3dTexture, vertexArray, vertexArrayCount * sizeof(Vertex));
+
+        const size_t offset = this->ReserveVertices(vertexArrayCount, topology, d3dTexture);
+        memcpy(&this->_vertices[offset], vertexArray, vertexArrayCount * sizeof(Vertex));
+    }
+
+    // World-space primitives are recorded as line or triangle lists, consecutive ones end up in a single draw.
+    inline void AddWorldVertices(const WorldVertex *vertexArray, size_t vertexArrayCount, const TopologyType topology,
+                                 IDirect3DTexture9 *d3dTexture = nullptr)
+    {
+        this->HashRecord(BatchType::WorldVertices, topology, d3dTexture, vertexArray,
+                         vertexArrayCount * sizeof(WorldVertex));
 
-        if (this->_batches.empty() || this->_batches.back().topology != topology ||
-            this->_batches.back().d3dTexture != d3dTexture)
+        if (this->_batches.empty() || this->_batches.back().type != BatchType::WorldVertices ||
+            this->_batches.back().topology != topology || this->_batches.back().d3dTexture != d3dTexture ||
+            this->_batches.back().layer != this->_layer)
         {
-            this->_batches.emplace_back(0, topology, d3dTexture);
+            this->_batches.emplace_back(0, topology, d3dTexture, BatchType::WorldVertices, this->_layer);
         }
 
         this->_batches.back().count += vertexArrayCount;
-        this->_vertices.resize(numVertices + vertexArrayCount);
+        this->_worldVertices.insert(this->_worldVertices.end(), vertexArray, vertexArray + vertexArrayCount);
+    }
+
+    // Reserves the vertices of a shape and returns the index of the first, the renderer tessellates the shape into
+    // them. With deferred tessellation the command is kept until the list is rendered.
+    inline size_t AddShape(const ShapeCommand &command, size_t count, const TopologyType topology,
+                           IDirect3DTexture9 *d3dTexture)
+    {
+        this->HashRecord(BatchType::Vertices, topology, d3dTexture, &command, sizeof(ShapeCommand));
 
-        memcpy(&this->_vertices[this->_vertices.size() - vertexArrayCount], vertexArray,
-               vertexArrayCount * sizeof(Vertex));
+        const size_t offset = this->ReserveVertices(count, topology, d3dTexture);
 
-        switch (topology)
+        if (this->_deferredTessellation)
         {
-        default:
-            break;
+            this->_commands.push_back(command);
+            this->_commands.back().offset = static_cast<uint32_t>(offset);
+        }
 
-        case D3DPT_LINESTRIP:
-        case D3DPT_TRIANGLESTRIP:
-            // add a new empty batch to force the end of the strip
-            this->_batches.emplace_back(0, D3DPT_FORCE_DWORD, nullptr);
-            break;
-        }
+        return offset;
+    }
+
+    // Records rects, lines and circles as commands which Render() tessellates in parallel, instead of tessellating
+    // them on the calling thread. Their vertices are reserved right away, so the order and the result are the same as
+    // without. Kept across Clear().
+    inline void SetDeferredTessellation(bool deferredTessellation)
+    {
+        this->_deferredTessellation = deferredTessellation;
+    }
+
+    inline bool IsDeferredTessellation() const
+    {
+        return this->_deferredTessellation;
+    }
+
+    // Layer of everything added afterwards, 0 until the list is cleared. Render() draws lower layers first and keeps
+    // the recorded order within a layer, so a layer only has to be set for content drawn out of order.
+    inline void SetLayer(uint8_t layer)
+    {
+        this->_layer = layer;
+    }
+
+    inline uint8_t GetLayer() const
+    {
+        return this->_layer;
+    }
+
+    // Clips the list to rect (left, top, right, bottom) in pixels when it is rendered, kept across Clear().
+    inline void SetClipRect(const Vec4 &rect)
+    {
+        this->_clipRect = rect;
+        this->_clipped = true;
+    }
+
+    inline void ResetClipRect()
+    {
+        this->_clipped = false;
+    }
+
+    // 2D transform of the shapes and text of the list applied when it is rendered, e.g. to scroll or scale a menu
+    // without recording it again. World-space primitives keep the view-projection only. Kept across Clear().
+    inline void SetTransform(const DirectX::XMMATRIX &transform)
+    {
+        DirectX::XMStoreFloat4x4(&this->_transform, transform);
+        this->_transformed = true;
+    }
+
+    inline void ResetTransform()
+    {
+        this->_transformed = false;
     }
 
     void Clear()
     {
         this->_vertices.clear();
+        this->_worldVertices.clear();
         this->_batches.clear();
+        this->_commands.clear();
+        this->_glyphKeys.clear();
+        this->_layer = 0;
+        this->_contentHash = 0;
+        this->_rendered = false;
     }
 
   protected:
     friend class Renderer;
+    friend class Font;
+    friend class TripleBufferedRenderList;
 
     std::vector<Vertex> _vertices{};
+    std::vector<WorldVertex> _worldVertices{};
     std::vector<Batch> _batches{};
+    uint8_t _layer = 0;
+    Vec4 _clipRect{};
+    bool _clipped = false;
+    DirectX::XMFLOAT4X4 _transform{};
+    bool _transformed = false;
+    // hash of everything added since Clear(), lets the renderer tell whether its buffers already hold the list
+    uint64_t _contentHash = 0;
+    // shapes waiting to be tessellated into their vertices
+    std::vector<ShapeCommand> _commands{};
+    bool _deferredTessellation = false;
+    // atlas keys of the glyph quads, marked as used when the list is drawn again
+    std::vector<uint64_t> _glyphKeys{};
+    // drawn since Clear(), the glyphs of a list drawn again are marked as used so the atlas keeps them
+    bool _rendered = false;
+    // atlas the glyph keys belong to, kept across Clear()
+    std::shared_ptr<FontAtlas> _glyphAtlas{};
+    // the glyph keys are pinned while the list is published through a TripleBufferedRenderList
+    bool _glyphsPinned = false;
+
+  private:
+    // Appends count vertices to the batch of the given state, starting a new one if needed, and returns the index of
+    // the first.
+    inline size_t ReserveVertices(size_t count, const TopologyType topology, IDirect3DTexture9 *d3dTexture)
+    {
+        const size_t numVertices = this->_vertices.size();
+
+        if (this->_batches.empty() || this->_batches.back().type != BatchType::Vertices ||
+            this->_batches.back().topology != topology || this->_batches.back().d3dTexture != d3dTexture ||
+            this->_batches.back().layer != this->_layer)
+        {
+            this->_batches.emplace_back(0, topology, d3dTexture, BatchType::Vertices, this->_layer);
+        }
+
+        this->_batches.back().count += count;
+        this->_vertices.resize(numVertices + count);
+
+        switch (topology)
+        {
+        default:
+            break;
+
+        case D3DPT_LINESTRIP:
+        case D3DPT_TRIANGLESTRIP:
+            // add a new empty batch to force the end of the strip
+            this->_batches.emplace_back(0, D3DPT_FORCE_DWORD, nullptr);
+            break;
+        }
+
+        return numVertices;
+    }
+
+    inline void HashRecord(BatchType type, TopologyType topology, const void *texture, const void *data, size_t size)
+    {
+        const uint64_t state[] = {static_cast<uint64_t>(type), static_cast<uint64_t>(topology),
+                                  reinterpret_cast<uintptr_t>(texture), this->_layer};
+
+        this->_contentHash = detail::HashBytes(detail::HashBytes(this->_contentHash, state, sizeof(state)), data, size);
+    }
 };
 
-class Font : public std::enable_shared_from_this<Font>
+struct TextCacheStats
 {
-  public:
-    using TextSegment = std::pair<std::wstring, Color>;
+    // interned texts currently drawn from a single atlas entry
+    size_t cachedTexts = 0;
+    // atlas memory taken by those entries
+    size_t cachedBytes = 0;
+    // glyph quads not drawn since the last BeginFrame() because their text was cached
+    size_t quadsSaved = 0;
+};
+
+// Work of the Render() calls since the last BeginFrame()
+struct RenderStats
+{
+    size_t renderLists = 0;
+    // vertex buffers locked to upload vertices
+    size_t bufferMaps = 0;
+    size_t uploadedBytes = 0;
+    size_t drawCalls = 0;
+    // Render() calls which found the buffers already holding the same content and skipped the upload
+    size_t reusedRenders = 0;
+    // bytes those calls didn't upload, the skip ratio is skippedBytes / (skippedBytes + uploadedBytes)
+    size_t skippedBytes = 0;
+};
 
-    Font(IDirect3DDevice9 *d3dDevice, const std::wstring &fontFamily, long fontHeigth,
-         uint32_t fontFlags = FONT_FLAG_NONE)
-        : _d3dDevice(d3dDevice), _fontFamily(fontFamily), _fontHeigth(fontHeigth), _fontFlags(fontFlags),
-          _charSpacing(0), _fontTexture(nullptr), _textScale(1.f), _textureWidth(1024), _textureHeight(1024),
-          _initialized(false)
+// Glyph cache texture (A8 where supported) shared by all fonts of a renderer and filled on demand. Font sources
+// rasterize glyphs into the coverage GlyphCache, only the modified part of it is uploaded.
+class FontAtlas
+{
+  public:
+    FontAtlas(IDirect3DDevice9 *d3dDevice, long textureWidth, long textureHeight)
+        : _d3dDevice(d3dDevice), _texture(nullptr), _format(D3DFMT_A8R8G8B8),
+          _cache(textureWidth, textureHeight, 1, g_fontAtlasPadding)
     {
-        this->Initialize();
     }
 
-    ~Font()
+    ~FontAtlas()
     {
         this->Release();
     }
 
     inline void Release()
     {
-        detail::SafeRelease(&this->_fontTexture);
+        detail::SafeRelease(&this->_texture);
     }
 
-    inline void OnLostDevice()
+    inline void Initialize()
     {
-        this->Release();
+        // a single alpha channel is a quarter of the memory, fall back to ARGB on devices without A8 textures
+        this->_format = this->IsFormatSupported(D3DFMT_A8) ? D3DFMT_A8 : D3DFMT_A8R8G8B8;
+
+        HRESULT hr = this->_d3dDevice->CreateTexture(this->_cache.GetWidth(), this->_cache.GetHeight(),
+                                                     g_fontAtlasMipLevels, D3DUSAGE_DYNAMIC, this->_format,
+                                                     D3DPOOL_DEFAULT, &this->_texture, nullptr);
+        if (FAILED(hr))
+        {
+            throw std::runtime_error("FontAtlas::Initialize(): CreateTexture failed!");
+        }
+
+        // the system memory copy survives a device reset, so the whole surface has to be uploaded again
+        this->_cache.MarkDirty(0, 0, this->_cache.GetWidth(), this->_cache.GetHeight());
     }
 
-    inline void OnResetDevice()
+    // glyphs of all fonts live in the same map, so the font id is part of the key, code points take 21 bits and
+    // leave the bits above for the variant
+    static inline uint64_t MakeGlyphKey(uint32_t fontId, uint32_t codePoint, uint32_t variant = GLYPH_VARIANT_FILL)
     {
-        this->Initialize();
+        return (static_cast<uint64_t>(fontId) << 32) | (variant << 24) | codePoint;
     }
 
-    inline void Initialize()
+    // texts composed by Font::GetRunImage() share the map, the high bit of the font id keeps them apart from glyphs
+    static inline uint64_t MakeStringKey(uint32_t fontId, uint32_t stringId, uint32_t variant = GLYPH_VARIANT_FILL)
+    {
+        return MakeGlyphKey(fontId | 0x80000000u, stringId & 0xffffff, variant);
+    }
+
+    // Size of an entry in bytes, 0 if it is not in the atlas. Unlike FindGlyph() the entry is not marked as used.
+    inline size_t GetGlyphBytes(uint64_t key) const
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+
+        const AtlasGlyph *glyph = this->_cache.Peek(key);
+        return glyph ? static_cast<size_t>(glyph->width) * glyph->height * (this->_format == D3DFMT_A8 ? 1 : 4) : 0;
+    }
+
+    // The returned glyph stays valid until the next NewFrame(), glyphs used in the current or the previous frame are
+    // never evicted.
+    inline AtlasGlyph *FindGlyph(uint64_t key)
     {
-        this->_initialized = false;
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_cache.Find(key);
+    }
 
-        HGDIOBJ gdiFont = nullptr;
-        HGDIOBJ prevGdiFont = nullptr;
-        HBITMAP bitmap = nullptr;
-        HGDIOBJ prevBitmap = nullptr;
+    // Copies a rasterized cell into a free or evicted slot, safe to call from any thread.
+    inline AtlasGlyph *AddGlyph(uint64_t key, long width, long height, const uint8_t *pixels, long pitch)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_cache.Insert(key, width, height, pixels, pitch);
+    }
 
-        HDC hdc = CreateCompatibleDC(nullptr);
-        SetMapMode(hdc, MM_TEXT);
+    // Marks the glyphs of keys as used, for a list which is drawn again without being recorded.
+    inline void TouchGlyphs(std::span<const uint64_t> keys)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
 
-        this->CreateGdiFont(hdc, &gdiFont);
-        if (!gdiFont)
+        for (const uint64_t key : keys)
         {
-            throw std::runtime_error("Font::ctor(): CreateGdiFont failed!");
+            this->_cache.Touch(key);
         }
+    }
+
+    inline void PinGlyph(uint64_t key)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_cache.Pin(key);
+    }
 
-        prevGdiFont = SelectObject(hdc, gdiFont);
+    inline void UnpinGlyph(uint64_t key)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_cache.Unpin(key);
+    }
 
-        this->EstimateTextureSize(hdc);
+    // Pins the glyphs of keys, for a list drawn frames after it was recorded.
+    inline void PinGlyphs(std::span<const uint64_t> keys)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
 
-        HRESULT hr = this->_d3dDevice->CreateTexture(this->_textureWidth, this->_textureHeight, 1, D3DUSAGE_DYNAMIC,
-                                                     D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT, &this->_fontTexture, nullptr);
-        if (FAILED(hr))
+        for (const uint64_t key : keys)
         {
-            throw std::runtime_error("Font::ctor(): CreateTexture failed!");
+            this->_cache.Pin(key);
         }
+    }
 
-        BITMAPINFO bitmapInfo{};
-        bitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-        bitmapInfo.bmiHeader.biWidth = this->_textureWidth;
-        bitmapInfo.bmiHeader.biHeight = -this->_textureHeight;
-        bitmapInfo.bmiHeader.biPlanes = 1;
-        bitmapInfo.bmiHeader.biCompression = BI_RGB;
-        bitmapInfo.bmiHeader.biBitCount = 32;
+    inline void UnpinGlyphs(std::span<const uint64_t> keys)
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
 
-        uint32_t *bitmapBips;
+        for (const uint64_t key : keys)
+        {
+            this->_cache.Unpin(key);
+        }
+    }
 
-        bitmap = CreateDIBSection(hdc, &bitmapInfo, DIB_RGB_COLORS, reinterpret_cast<void **>(&bitmapBips), nullptr, 0);
-        if (!bitmap)
+    inline bool ReadGlyph(uint64_t key, uint8_t *pixels, long pitch) const
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        return this->_cache.Read(key, 0, pixels, pitch);
+    }
+
+    inline void NewFrame()
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+        this->_cache.NewFrame();
+    }
+
+    inline void Flush()
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
+
+        if (!this->_texture)
         {
-            throw std::runtime_error("Font::ctor(): CreateDIBSection failed!");
+            return;
         }
 
-        prevBitmap = SelectObject(hdc, bitmap);
+        this->_cache.Flush([this](long level, const detail::AtlasRect &rect, const uint8_t *src, long levelWidth) {
+            this->UploadLevel(level, {rect.left, rect.top, rect.right, rect.bottom}, src, levelWidth);
+        });
+    }
+
+    inline AtlasStats GetStats() const
+    {
+        std::lock_guard<std::mutex> lock(this->_mutex);
 
-        SetTextColor(hdc, RGB(255, 255, 255));
-        SetBkColor(hdc, 0x00000000);
-        SetTextAlign(hdc, TA_TOP);
+        AtlasStats stats = this->_cache.GetStats();
+        stats.textureBytes *= this->_format == D3DFMT_A8 ? 1 : 4;
+        return stats;
+    }
 
-        hr = this->RenderAlphabet(hdc, false);
-        if (FAILED(hr))
+    inline IDirect3DTexture9 *GetTexture() const
+    {
+        return this->_texture;
+    }
+
+  private:
+    inline bool IsFormatSupported(D3DFORMAT format)
+    {
+        IDirect3D9 *d3d = nullptr;
+        if (FAILED(this->_d3dDevice->GetDirect3D(&d3d)))
         {
-            throw std::runtime_error("Font::ctor(): RenderAlphabet failed!");
+            return false;
         }
 
+        D3DDEVICE_CREATION_PARAMETERS params{};
+        D3DDISPLAYMODE displayMode{};
+
+        const bool supported = SUCCEEDED(this->_d3dDevice->GetCreationParameters(&params)) &&
+                               SUCCEEDED(this->_d3dDevice->GetDisplayMode(0, &displayMode)) &&
+                               SUCCEEDED(d3d->CheckDeviceFormat(params.AdapterOrdinal, params.DeviceType,
+                                                                displayMode.Format, D3DUSAGE_DYNAMIC, D3DRTYPE_TEXTURE,
+                                                                format));
+
+        detail::SafeRelease(&d3d);
+        return supported;
+    }
+
+    inline void UploadLevel(long level, const RECT &rect, const uint8_t *pixels, long levelWidth)
+    {
         D3DLOCKED_RECT lockedRect;
-        this->_fontTexture->LockRect(0, &lockedRect, nullptr, 0);
+        if (FAILED(this->_texture->LockRect(static_cast<UINT>(level), &lockedRect, &rect, 0)))
+        {
+            return;
+        }
 
+        const long width = rect.right - rect.left;
         uint8_t *dstRow = static_cast<uint8_t *>(lockedRect.pBits);
 
-        for (long y = 0; y < this->_textureHeight; y++)
+        for (long y = rect.top; y < rect.bottom; y++)
         {
+            const uint8_t *src = &pixels[levelWidth * y + rect.left];
+
+            if (this->_format == D3DFMT_A8)
+            {
+                memcpy(dstRow, src, width);
+                dstRow += lockedRect.Pitch;
+                continue;
+            }
+
             uint32_t *dst = reinterpret_cast<uint32_t *>(dstRow);
 
-            for (long x = 0; x < this->_textureWidth; x++)
+            for (long x = 0; x < width; x++)
             {
-                uint8_t alpha = (bitmapBips[this->_textureWidth * y + x] & 0xff);
+                uint8_t alpha = src[x];
 
                 if (alpha > 0)
                 {
@@ -429,651 +1196,2365 @@ class Font : public std::enable_shared_from_this<Font>
             dstRow += lockedRect.Pitch;
         }
 
-        this->_fontTexture->UnlockRect(0);
-
-        SelectObject(hdc, prevBitmap);
-        SelectObject(hdc, prevGdiFont);
-        DeleteObject(bitmap);
-        DeleteObject(gdiFont);
-        DeleteDC(hdc);
-
-        this->_initialized = true;
+        this->_texture->UnlockRect(static_cast<UINT>(level));
     }
 
-    inline void RenderText(const RenderListPtr &renderList, Vec2 pos, const std::wstring &text, const Color color,
-                           uint32_t flags, const Color outlineColor, float outlineThickness)
-    {
-        size_t numToSkip = 0;
+    IDirect3DDevice9 *_d3dDevice;
+    IDirect3DTexture9 *_texture;
+    D3DFORMAT _format;
 
-        std::vector<TextSegment> segments = PreprocessText(text, color);
-        std::wstring cleanedText;
+    GlyphCache _cache;
+    // fonts baked asynchronously add glyphs from worker threads
+    mutable std::mutex _mutex;
+};
 
-        for (const auto &[textSegment, _] : segments)
+// Hands render lists from a game thread to the render thread through three lists, neither side ever waits for the
+// other. The producer records into GetBackList() and calls Publish() once the frame is complete, the render thread
+// draws whatever Acquire() returns, which is the last published list or the previous one again if none was published.
+// Only one thread may produce and only one may render. The producer records with the Renderer overloads taking a list,
+// fonts lay out one text at a time, so the render thread may record text of its own meanwhile.
+class TripleBufferedRenderList
+{
+  public:
+    TripleBufferedRenderList(size_t maxVertices) : _back(0), _front(1), _middle(2)
+    {
+        for (auto &renderList : this->_renderLists)
         {
-            cleanedText += textSegment;
+            renderList = std::make_shared<RenderList>(maxVertices);
         }
+    }
 
-        if (flags & (TEXT_FLAG_RIGHT | TEXT_FLAG_CENTERED))
+    ~TripleBufferedRenderList()
+    {
+        for (auto &renderList : this->_renderLists)
         {
-            Vec2 size = this->CalculateTextExtent(cleanedText);
-
-            if (flags & TEXT_FLAG_RIGHT)
-            {
-                pos.x -= size.x;
-            }
-            else if (flags & TEXT_FLAG_CENTERED_X)
-            {
-                pos.x -= 0.5f * size.x;
-            }
-
-            if (flags & TEXT_FLAG_CENTERED_Y)
-            {
-                pos.y -= 0.5f * size.y;
-            }
+            this->UnpinGlyphs(*renderList);
         }
+    }
 
-        pos.x -= this->_charSpacing;
+    TripleBufferedRenderList(const TripleBufferedRenderList &) = delete;
+    TripleBufferedRenderList &operator=(const TripleBufferedRenderList &) = delete;
 
-        float startX = pos.x;
+    // producer side, the list is owned by the calling thread until the next Publish()
+    inline const RenderListPtr &GetBackList() const
+    {
+        return this->_renderLists[this->_back];
+    }
 
-        for (const auto &[textSegment, currentColor] : segments)
+    // Swaps the recorded list with the shared one and starts an empty back list. Clip rect and transform are per list
+    // and kept across frames, set them again after publishing when they are used. The glyphs of a published list are
+    // pinned until the list comes back to the producer, the render thread may draw it any number of frames later.
+    inline void Publish()
+    {
+        RenderList &published = *this->_renderLists[this->_back];
+        if (published._glyphAtlas)
         {
-            for (const auto &c : textSegment)
-            {
-                if (numToSkip > 0 && numToSkip-- > 0)
-                {
-                    continue;
-                }
-
-                // jump to next line if asked
-                if (c == '\n')
-                {
-                    pos.x = startX;
-                    pos.y += (this->_charCoords[L' '][3] - this->_charCoords[L' '][1]) * this->_textureHeight;
-                }
-
-                // ignore invalid chars
-                if (c < L' ')
-                {
-                    continue;
-                }
-
-                // try to find char in coordinates map
-                auto it = this->_charCoords.find(c);
-                if (it == this->_charCoords.end())
-                {
-                    continue;
-                }
-
-                float tx1 = it->second[0];
-                float ty1 = it->second[1];
-                float tx2 = it->second[2];
-                float ty2 = it->second[3];
-
-                float w = (tx2 - tx1) * this->_textureWidth / this->_textScale;
-                float h = (ty2 - ty1) * this->_textureHeight / this->_textScale;
-
-                // do not render space char
-                if (c != L' ')
-                {
-                    Vertex v[] = {{Vec4{pos.x - 0.5f, pos.y - 0.5f + h, 0.9f, 1.f}, currentColor, Vec2{tx1, ty2}},
-                                  {Vec4{pos.x - 0.5f, pos.y - 0.5f, 0.9f, 1.f}, currentColor, Vec2{tx1, ty1}},
-                                  {Vec4{pos.x - 0.5f + w, pos.y - 0.5f + h, 0.9f, 1.f}, currentColor, Vec2{tx2, ty2}},
-
-                                  {Vec4{pos.x - 0.5f + w, pos.y - 0.5f, 0.9f, 1.f}, currentColor, Vec2{tx2, ty1}},
-                                  {Vec4{pos.x - 0.5f + w, pos.y - 0.5f + h, 0.9f, 1.f}, currentColor, Vec2{tx2, ty2}},
-                                  {Vec4{pos.x - 0.5f, pos.y - 0.5f, 0.9f, 1.f}, currentColor, Vec2{tx1, ty1}}};
-
-                    // Outline vertices
-                    Vertex outlineV[] = {{Vec4{pos.x - outlineThickness, pos.y - outlineThickness + h, 0.89f, 1.f},
-                                          outlineColor, Vec2{tx1, ty2}},
-                                         {Vec4{pos.x - outlineThickness, pos.y - outlineThickness, 0.89f, 1.f},
-                                          outlineColor, Vec2{tx1, ty1}},
-                                         {Vec4{pos.x - outlineThickness + w, pos.y - outlineThickness + h, 0.89f, 1.f},
-                                          outlineColor, Vec2{tx2, ty2}},
-
-                                         {Vec4{pos.x - outlineThickness + w, pos.y - outlineThickness, 0.89f, 1.f},
-                                          outlineColor, Vec2{tx2, ty1}},
-                                         {Vec4{pos.x - outlineThickness + w, pos.y - outlineThickness + h, 0.89f, 1.f},
-                                          outlineColor, Vec2{tx2, ty2}},
-                                         {Vec4{pos.x - outlineThickness, pos.y - outlineThickness, 0.89f, 1.f},
-                                          outlineColor, Vec2{tx1, ty1}}};
-
-                    // Drop shadow vertices (slightly offset and darker)
-                    Color shadowColor = Color(0x00, 0x00, 0x00, (currentColor.ToHexColor() >> 24) & 0xff);
-
-                    Vertex shadowV[] = {
-                        {Vec4{pos.x + 1.0f, pos.y + 1.0f + h, 0.89f, 1.f}, shadowColor, Vec2{tx1, ty2}},
-                        {Vec4{pos.x + 1.0f, pos.y + 1.0f, 0.89f, 1.f}, shadowColor, Vec2{tx1, ty1}},
-                        {Vec4{pos.x + 1.0f + w, pos.y + 1.0f + h, 0.89f, 1.f}, shadowColor, Vec2{tx2, ty2}},
-
-                        {Vec4{pos.x + 1.0f + w, pos.y + 1.0f, 0.89f, 1.f}, shadowColor, Vec2{tx2, ty1}},
-                        {Vec4{pos.x + 1.0f + w, pos.y + 1.0f + h, 0.89f, 1.f}, shadowColor, Vec2{tx2, ty2}},
-                        {Vec4{pos.x + 1.0f, pos.y + 1.0f, 0.89f, 1.f}, shadowColor, Vec2{tx1, ty1}}};
-
-                    if (flags & TEXT_FLAG_OUTLINE)
-                    {
-                        renderList->AddVertices(outlineV, D3DPT_TRIANGLELIST, this->_fontTexture);
-                    }
-                    else if (flags & TEXT_FLAG_DROPSHADOW)
-                    {
-                        renderList->AddVertices(shadowV, D3DPT_TRIANGLELIST, this->_fontTexture);
-                    }
+            published._glyphAtlas->PinGlyphs(published._glyphKeys);
+            published._glyphsPinned = true;
+        }
 
-                    renderList->AddVertices(v, D3DPT_TRIANGLELIST, this->_fontTexture);
-                }
+        this->_back = this->_middle.exchange(this->_back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
 
-                pos.x += w - (2.f * this->_charSpacing);
-            }
-        }
+        // the render thread gave the list back or skipped it, nothing draws it anymore
+        this->UnpinGlyphs(*this->_renderLists[this->_back]);
+        this->_renderLists[this->_back]->Clear();
     }
 
-    inline Vec2 CalculateTextExtent(const std::wstring &text)
+    // render thread side, the list stays valid until the next Acquire()
+    inline const RenderListPtr &Acquire()
     {
-        float rowWidth = 0.f;
-        float rowHeight = (this->_charCoords[L' '][3] - this->_charCoords[L' '][1]) * this->_textureHeight;
-        float width = 0.f;
-        float height = rowHeight;
-
-        for (const auto &c : text)
+        if (this->_middle.load(std::memory_order_relaxed) & FRESH)
         {
-            if (c == L'\n')
-            {
-                height += rowHeight;
-                width = std::max(width, rowWidth);
-                rowWidth = 0.f;
-            }
-            else if (c >= L' ')
-            {
-                auto it = this->_charCoords.find(c);
-                if (it != this->_charCoords.end())
-                {
-                    float charWidth = (it->second[2] - it->second[0]) * this->_textureWidth / this->_textScale;
-                    rowWidth += charWidth - (2.f * this->_charSpacing);
-                }
-            }
+            this->_front = this->_middle.exchange(this->_front, std::memory_order_acq_rel) & INDEX_MASK;
         }
 
-        width = std::max(width, rowWidth);
-        return Vec2(width, height);
+        return this->_renderLists[this->_front];
     }
 
-    inline bool IsInitialized() const
+    inline bool HasNewList() const
     {
-        return this->_initialized;
+        return (this->_middle.load(std::memory_order_relaxed) & FRESH) != 0;
     }
 
   private:
-    inline void EstimateTextureSize(HDC hdc)
+    inline void UnpinGlyphs(RenderList &renderList)
     {
-        SIZE size;
-        wchar_t chr[] = L" ";
-
-        if (!GetTextExtentPoint32W(hdc, chr, static_cast<int>(wcslen(chr)), &size))
+        if (renderList._glyphsPinned)
         {
-            throw std::runtime_error("EstimateTextureSize(): Failed to get text extent!");
+            renderList._glyphAtlas->UnpinGlyphs(renderList._glyphKeys);
+            renderList._glyphsPinned = false;
         }
+    }
 
-        long x = this->_charSpacing;
-        long y = 0;
+    static constexpr uint8_t INDEX_MASK = 0x3;
+    // set on the shared index by Publish(), cleared when the render thread takes the list
+    static constexpr uint8_t FRESH = 0x4;
 
-        for (wchar_t c = g_charRangeMin; c < g_charRangeMax; c++)
+    std::array<RenderListPtr, 3> _renderLists{};
+    uint8_t _back;
+    uint8_t _front;
+    std::atomic<uint8_t> _middle;
+};
+
+// Installed system font rendered by GDI into a private DIB.
+class GdiFontSource : public FontSource
+{
+  public:
+    GdiFontSource(const std::wstring &fontFamily, long fontHeigth, uint32_t fontFlags = FONT_FLAG_NONE)
+        : _hdc(nullptr), _gdiFont(nullptr), _prevGdiFont(nullptr), _bitmap(nullptr), _prevBitmap(nullptr),
+          _bitmapBits(nullptr), _bitmapWidth(0), _bitmapHeight(0), _lineHeight(0), _fontFamily(fontFamily),
+          _fontHeigth(fontHeigth), _fontFlags(fontFlags)
+    {
+        this->_hdc = CreateCompatibleDC(nullptr);
+        if (!this->_hdc)
         {
-            chr[0] = c;
+            throw std::runtime_error("GdiFontSource::ctor(): CreateCompatibleDC failed!");
+        }
 
-            if (!GetTextExtentPoint32W(hdc, chr, static_cast<int>(wcslen(chr)), &size))
-            {
-                continue;
-            }
+        SetMapMode(this->_hdc, MM_TEXT);
 
-            if (x + size.cx + this->_charSpacing > this->_textureWidth)
-            {
-                x = this->_charSpacing;
-                y += size.cy + 1;
-            }
+        static const int pointsPerInch = 72;
+        int dpi = GetDeviceCaps(this->_hdc, LOGPIXELSY);
+        int pixelsHeight = -MulDiv(fontHeigth, dpi, pointsPerInch);
 
-            if (y + size.cy > this->_textureHeight)
-            {
-                this->_textureWidth = this->_textureWidth * 2;
-                this->_textureHeight = this->_textureHeight * 2;
-                x = this->_charSpacing;
-                y = 0;
-            }
+        DWORD bold = (fontFlags & FONT_FLAG_BOLD) ? FW_BOLD : FW_NORMAL;
+        DWORD italic = (fontFlags & FONT_FLAG_ITALIC) ? TRUE : FALSE;
 
-            x += size.cx + (2 * this->_charSpacing);
+        this->_gdiFont = CreateFontW(pixelsHeight, 0, 0, 0, bold, italic, FALSE, FALSE, DEFAULT_CHARSET,
+                                     OUT_OUTLINE_PRECIS, CLIP_DEFAULT_PRECIS,
+                                     (fontFlags & FONT_FLAG_CLEAR_TYPE) ? CLEARTYPE_QUALITY : ANTIALIASED_QUALITY,
+                                     VARIABLE_PITCH, fontFamily.c_str());
+        if (!this->_gdiFont)
+        {
+            DeleteDC(this->_hdc);
+            throw std::runtime_error("GdiFontSource::ctor(): CreateFontW failed!");
         }
-    }
-
-    inline void CreateGdiFont(HDC hdc, HGDIOBJ *gdiFont)
-    {
-        static const int pointsPerInch = 72;
-        int dpi = GetDeviceCaps(hdc, LOGPIXELSY);
-        int pixelsHeight = -MulDiv(this->_fontHeigth, dpi, pointsPerInch);
 
-        DWORD bold = (this->_fontFlags & FONT_FLAG_BOLD) ? FW_BOLD : FW_NORMAL;
-        DWORD italic = (this->_fontFlags & FONT_FLAG_ITALIC) ? TRUE : FALSE;
+        this->_prevGdiFont = SelectObject(this->_hdc, this->_gdiFont);
 
-        HFONT font = CreateFontW(pixelsHeight, 0, 0, 0, bold, italic, FALSE, FALSE, DEFAULT_CHARSET, OUT_OUTLINE_PRECIS,
-                                 CLIP_DEFAULT_PRECIS,
-                                 (this->_fontFlags & FONT_FLAG_CLEAR_TYPE) ? CLEARTYPE_QUALITY : ANTIALIASED_QUALITY,
-                                 VARIABLE_PITCH, this->_fontFamily.c_str());
+        SetTextColor(this->_hdc, RGB(255, 255, 255));
+        SetBkColor(this->_hdc, 0x00000000);
+        SetTextAlign(this->_hdc, TA_TOP);
 
-        if (font == NULL)
+        SIZE size{};
+        if (!GetTextExtentPoint32W(this->_hdc, L" ", 1, &size))
         {
-            throw std::runtime_error("CreateGdiFont(): CreateFontW failed!");
+            SelectObject(this->_hdc, this->_prevGdiFont);
+            DeleteObject(this->_gdiFont);
+            DeleteDC(this->_hdc);
+            throw std::runtime_error("GdiFontSource::ctor(): Failed to get text extent!");
         }
 
-        *gdiFont = font;
+        this->_lineHeight = size.cy;
+        this->_cacheKey = L"gdi|" + fontFamily + L"|" + std::to_wstring(fontHeigth) + L"|" +
+                          std::to_wstring(fontFlags) + L"|" + std::to_wstring(dpi);
     }
 
-    inline HRESULT RenderAlphabet(HDC hdc, bool onlyMeasure)
+    ~GdiFontSource()
     {
-        SIZE size;
-        wchar_t chr[2] = L" ";
-
-        if (!GetTextExtentPoint32W(hdc, chr, static_cast<int>(wcslen(chr)), &size))
+        if (this->_bitmap)
         {
-            return E_FAIL;
+            SelectObject(this->_hdc, this->_prevBitmap);
+            DeleteObject(this->_bitmap);
         }
 
-        // the result of the font width is used for spacing
-        this->_charSpacing = static_cast<long>(ceil(size.cy * 0.3f));
+        SelectObject(this->_hdc, this->_prevGdiFont);
+        DeleteObject(this->_gdiFont);
+        DeleteDC(this->_hdc);
+    }
 
-        long x = this->_charSpacing;
-        long y = 0;
+    inline long GetLineHeight() const override
+    {
+        return this->_lineHeight;
+    }
 
-        // cover basic latin till latin extended B
-        for (wchar_t c = g_charRangeMin; c < g_charRangeMax; c++)
-        {
-            chr[0] = c;
+    inline std::wstring GetCacheKey() const override
+    {
+        return this->_cacheKey;
+    }
 
-            if (!GetTextExtentPoint32W(hdc, chr, static_cast<int>(wcslen(chr)), &size))
-            {
-                continue;
-            }
+    inline FontSourcePtr Clone() const override
+    {
+        return std::make_shared<GdiFontSource>(this->_fontFamily, this->_fontHeigth, this->_fontFlags);
+    }
 
-            if (x + size.cx + this->_charSpacing > this->_textureWidth)
-            {
-                x = this->_charSpacing;
-                y += size.cy + 1;
-            }
+    inline GlyphMetrics MeasureGlyph(uint32_t codePoint) override
+    {
+        wchar_t chr[2];
+        const int length = detail::EncodeUtf16(codePoint, chr);
 
-            if (y + size.cy > this->_textureHeight)
-            {
-                return E_NOT_SUFFICIENT_BUFFER;
-            }
+        SIZE size{};
+        GlyphMetrics metrics{};
 
-            if (!onlyMeasure)
-            {
-                if (!ExtTextOutW(hdc, x, y, ETO_OPAQUE, nullptr, chr, static_cast<int>(wcslen(chr)), nullptr))
-                {
-                    return E_FAIL;
-                }
+        if (!GetTextExtentPoint32W(this->_hdc, chr, length, &size))
+        {
+            return metrics;
+        }
 
-                this->_charCoords[c] = {(static_cast<float>(x - this->_charSpacing)) / this->_textureWidth,
-                                        (static_cast<float>(y)) / this->_textureHeight,
-                                        (static_cast<float>(x + size.cx + this->_charSpacing)) / this->_textureWidth,
-                                        (static_cast<float>(y + size.cy)) / this->_textureHeight};
-            }
+        long overhangLeft = 0;
+        long overhangRight = 0;
 
-            x += size.cx + (2 * this->_charSpacing);
+        ABC abc{};
+        if (length == 1 && GetCharABCWidthsW(this->_hdc, chr[0], chr[0], &abc))
+        {
+            overhangLeft = std::max(0L, static_cast<long>(-abc.abcA));
+            overhangRight = std::max(0L, abc.abcA + static_cast<long>(abc.abcB) - size.cx);
+        }
+        else
+        {
+            // no ABC widths for raster fonts and surrogate pairs, guess generously for italic overhangs
+            overhangLeft = overhangRight = size.cy / 4;
         }
 
-        return S_OK;
+        // one extra column on each side for anti-aliasing and ClearType fringes
+        metrics.offset = overhangLeft + 1;
+        metrics.width = metrics.offset + size.cx + overhangRight + 1;
+        metrics.advance = size.cx;
+        metrics.valid = true;
+        return metrics;
     }
 
-    inline std::vector<TextSegment> PreprocessText(const std::wstring &text, Color defaultColor)
+    inline void RasterizeGlyph(uint32_t codePoint, const GlyphMetrics &metrics, uint8_t *pixels, long pitch) override
     {
-        std::vector<TextSegment> segments;
-        std::wstring cleanText;
-        Color currentColor = defaultColor;
+        if (!this->EnsureBitmap(metrics.width, this->_lineHeight))
+        {
+            return;
+        }
+
+        wchar_t chr[2];
+        const int length = detail::EncodeUtf16(codePoint, chr);
+
+        RECT rect = {0, 0, metrics.width, this->_lineHeight};
+        ExtTextOutW(this->_hdc, metrics.offset, 0, ETO_OPAQUE | ETO_CLIPPED, &rect, chr, length, nullptr);
+
+        // make sure GDI finished drawing into the DIB before reading from it
+        GdiFlush();
+
+        for (long y = 0; y < this->_lineHeight; y++)
+        {
+            detail::ConvertDibToAlpha(&this->_bitmapBits[this->_bitmapWidth * y], &pixels[pitch * y], metrics.width);
+        }
+    }
+
+  private:
+    inline bool EnsureBitmap(long width, long height)
+    {
+        if (width <= this->_bitmapWidth && height <= this->_bitmapHeight)
+        {
+            return true;
+        }
+
+        BITMAPINFO bitmapInfo{};
+        bitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bitmapInfo.bmiHeader.biWidth = std::max(width, this->_bitmapWidth);
+        bitmapInfo.bmiHeader.biHeight = -std::max(height, this->_bitmapHeight);
+        bitmapInfo.bmiHeader.biPlanes = 1;
+        bitmapInfo.bmiHeader.biCompression = BI_RGB;
+        bitmapInfo.bmiHeader.biBitCount = 32;
+
+        uint32_t *bitmapBits = nullptr;
+        HBITMAP bitmap = CreateDIBSection(this->_hdc, &bitmapInfo, DIB_RGB_COLORS,
+                                          reinterpret_cast<void **>(&bitmapBits), nullptr, 0);
+        if (!bitmap)
+        {
+            return false;
+        }
+
+        HGDIOBJ prevBitmap = SelectObject(this->_hdc, bitmap);
+
+        if (this->_bitmap)
+        {
+            DeleteObject(this->_bitmap);
+        }
+        else
+        {
+            this->_prevBitmap = prevBitmap;
+        }
+
+        this->_bitmap = bitmap;
+        this->_bitmapBits = bitmapBits;
+        this->_bitmapWidth = bitmapInfo.bmiHeader.biWidth;
+        this->_bitmapHeight = -bitmapInfo.bmiHeader.biHeight;
+        return true;
+    }
+
+    HDC _hdc;
+    HGDIOBJ _gdiFont;
+    HGDIOBJ _prevGdiFont;
+    HBITMAP _bitmap;
+    HGDIOBJ _prevBitmap;
+    uint32_t *_bitmapBits;
+    long _bitmapWidth;
+    long _bitmapHeight;
+    long _lineHeight;
+    std::wstring _cacheKey;
+
+    std::wstring _fontFamily;
+    long _fontHeigth;
+    uint32_t _fontFlags;
+};
+
+// Glyph of an interned text, positioned relative to the origin of the text.
+struct TextRunGlyph
+{
+    uint32_t codePoint;
+    Vec2 pos;
+    Vec2 size;
+    std::array<float, 4> uv;
+    Color color;
+    // set if the color came from a color tag, those are kept when the text is drawn with another color
+    bool tagColor;
+};
+
+// Text parsed and laid out once by Renderer::InternText(), drawing it only translates the stored glyphs.
+struct TextRun
+{
+    FontPtr font;
+    // kept until the font finished baking and the text could be laid out
+    std::wstring text;
+    Color color;
+    uint32_t flags;
+    Color outlineColor;
+    float outlineThickness;
+    std::vector<TextRunGlyph> glyphs;
+    bool laidOut = false;
+    // atlas entries of the composed text with TEXT_FLAG_CACHED, 0 if it is drawn glyph by glyph
+    uint32_t cacheId = 0;
+    // top-left corner of the composed text relative to the origin of the run
+    Vec2 cacheOrigin{};
+};
+
+class Font : public std::enable_shared_from_this<Font>
+{
+  public:
+    Font(const std::shared_ptr<FontAtlas> &atlas, uint32_t fontId, const FontSourcePtr &source,
+         const std::wstring &cacheDirectory = {})
+        : _atlas(atlas), _fontId(fontId), _source(source), _lineHeight(source->GetLineHeight()),
+          _nextCacheId(0), _pendingChunks(0), _initialized(false)
+    {
+        this->SetupCache(cacheDirectory);
+    }
+
+    // Bakes the preloaded charset on the calling thread.
+    inline void Initialize()
+    {
+        if (this->LoadCache())
+        {
+            this->_initialized = true;
+            return;
+        }
+
+        this->_pendingChunks = 1;
+        this->BakeChunk(*this->_source, g_charRangeMin, g_charRangeMax);
+    }
+
+    // Bakes the preloaded charset on the worker pool. The range is split into chunks rasterized in parallel by clones
+    // of the font source, text using the font is skipped until the last chunk finished.
+    inline void InitializeAsync(detail::ThreadPool &threadPool)
+    {
+        threadPool.Submit([self = this->shared_from_this(), &threadPool]() {
+            if (self->LoadCache())
+            {
+                self->_initialized = true;
+                return;
+            }
+
+            const uint32_t rangeSize = g_charRangeMax - g_charRangeMin;
+            const size_t chunksByRange = rangeSize / g_fontBakeChunkSize;
+            const size_t maxChunks = std::max(size_t(1), std::min(threadPool.GetWorkerCount(), chunksByRange));
+
+            std::vector<FontSourcePtr> sources{self->_source};
+
+            while (sources.size() < maxChunks)
+            {
+                FontSourcePtr clone = self->_source->Clone();
+                if (!clone)
+                {
+                    break;
+                }
+
+                sources.push_back(clone);
+            }
+
+            const uint32_t chunkCount = static_cast<uint32_t>(sources.size());
+            const auto chunkStart = [&](uint32_t chunk) { return g_charRangeMin + rangeSize * chunk / chunkCount; };
+
+            self->_pendingChunks = chunkCount;
+
+            for (uint32_t i = 1; i < chunkCount; i++)
+            {
+                threadPool.Submit([self, source = sources[i], first = chunkStart(i), last = chunkStart(i + 1)]() {
+                    self->BakeChunk(*source, first, last);
+                });
+            }
+
+            self->BakeChunk(*self->_source, chunkStart(0), chunkStart(1));
+        });
+    }
+
+    // scale is relative to the size the font was baked at, text drawn smaller samples the atlas' mip chain
+    inline Vec2 RenderText(const RenderListPtr &renderList, Vec2 pos, std::wstring_view text, const Color color,
+                           uint32_t flags, const Color outlineColor, float outlineThickness, float scale,
+                           float maxWidth)
+    {
+        return this->RenderTextImpl(renderList, pos, text, color, flags, outlineColor, outlineThickness, scale,
+                                    maxWidth);
+    }
+
+    // UTF-8 text is decoded while laying it out, no wide string is built
+    inline Vec2 RenderText(const RenderListPtr &renderList, Vec2 pos, std::string_view text, const Color color,
+                           uint32_t flags, const Color outlineColor, float outlineThickness, float scale,
+                           float maxWidth)
+    {
+        return this->RenderTextImpl(renderList, pos, text, color, flags, outlineColor, outlineThickness, scale,
+                                    maxWidth);
+    }
+
+    inline Vec2 CalculateTextExtent(std::wstring_view text, float scale)
+    {
+        std::lock_guard<std::mutex> lock(this->_layoutMutex);
+        return this->CalculateTextExtentImpl(text, scale);
+    }
+
+    inline Vec2 CalculateTextExtent(std::string_view text, float scale)
+    {
+        std::lock_guard<std::mutex> lock(this->_layoutMutex);
+        return this->CalculateTextExtentImpl(text, scale);
+    }
+
+    // Lays out an interned text, fails while the font is still baking or the atlas is too full for its glyphs. The
+    // glyphs of the run are pinned in the atlas until ReleaseRun(), so the stored uvs stay valid.
+    inline bool LayoutRun(TextRun &run)
+    {
+        if (!this->_initialized)
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(this->_layoutMutex);
+
+        run.glyphs.clear();
+
+        const auto addGlyph = [&](uint32_t c, float x, float y, float w, float h, const AtlasGlyph &glyph,
+                                  Color currentColor, bool tagColor) {
+            run.glyphs.push_back({c, Vec2(x, y), Vec2(w, h), glyph.uv, currentColor, tagColor});
+        };
+
+        Vec2 extent;
+        if (!this->LayoutText(Vec2(0.f, 0.f), std::wstring_view(run.text), run.color, run.flags, 1.f, 0.f, extent,
+                              addGlyph))
+        {
+            run.glyphs.clear();
+            return false;
+        }
+
+        for (const TextRunGlyph &glyph : run.glyphs)
+        {
+            this->_atlas->PinGlyph(FontAtlas::MakeGlyphKey(this->_fontId, glyph.codePoint));
+        }
+
+        run.laidOut = true;
+        std::wstring().swap(run.text);
+        this->PrepareRunCache(run);
+        return true;
+    }
+
+    inline void ReleaseRun(TextRun &run)
+    {
+        if (!run.laidOut)
+        {
+            return;
+        }
+
+        for (const TextRunGlyph &glyph : run.glyphs)
+        {
+            this->_atlas->UnpinGlyph(FontAtlas::MakeGlyphKey(this->_fontId, glyph.codePoint));
+        }
+
+        run.glyphs.clear();
+        run.laidOut = false;
+    }
+
+    // runs are laid out at scale 1, the stored glyph positions scale around the run's origin
+    inline size_t RenderRun(const RenderListPtr &renderList, TextRun &run, Vec2 pos, const Color color,
+                            float scale)
+    {
+        std::lock_guard<std::mutex> lock(this->_layoutMutex);
+
+        if (run.cacheId)
+        {
+            const AtlasGlyph *image = this->GetRunImage(run, GLYPH_VARIANT_FILL, 0);
+            if (image)
+            {
+                const auto getVariant = [&](uint32_t variant, long padding) {
+                    return this->GetRunImage(run, variant, padding);
+                };
+
+                this->AddTextQuads(renderList, pos.x + run.cacheOrigin.x * scale, pos.y + run.cacheOrigin.y * scale,
+                                   image->width * scale, image->height * scale, image->uv, image->key, color,
+                                   run.flags, run.outlineColor, run.outlineThickness, scale, getVariant);
+
+                const size_t quadsPerGlyph =
+                    1 + ((run.flags & TEXT_FLAG_OUTLINE) ? 1 : 0) + ((run.flags & TEXT_FLAG_DROPSHADOW) ? 1 : 0);
+                return (run.glyphs.size() - 1) * quadsPerGlyph;
+            }
+
+            // no room for the whole text, keep drawing it glyph by glyph instead of composing it every frame
+            run.cacheId = 0;
+        }
+
+        for (const TextRunGlyph &glyph : run.glyphs)
+        {
+            this->AddGlyphQuad(renderList, glyph.codePoint, pos.x + glyph.pos.x * scale, pos.y + glyph.pos.y * scale,
+                               glyph.size.x * scale, glyph.size.y * scale, glyph.uv,
+                               glyph.tagColor ? glyph.color : color, run.flags, run.outlineColor,
+                               run.outlineThickness, scale);
+        }
+
+        return 0;
+    }
+
+    // the composed text and the variants baked for its outline and shadow
+    inline size_t GetCachedRunBytes(const TextRun &run) const
+    {
+        if (!run.cacheId)
+        {
+            return 0;
+        }
+
+        const long thickness = std::min(std::max(lroundf(run.outlineThickness), 1L), g_fontOutlineMaxThickness);
+
+        return this->_atlas->GetGlyphBytes(FontAtlas::MakeStringKey(this->_fontId, run.cacheId)) +
+               this->_atlas->GetGlyphBytes(FontAtlas::MakeStringKey(this->_fontId, run.cacheId, GLYPH_VARIANT_SHADOW)) +
+               this->_atlas->GetGlyphBytes(
+                   FontAtlas::MakeStringKey(this->_fontId, run.cacheId, GLYPH_VARIANT_OUTLINE + thickness));
+    }
+
+    inline bool IsInitialized() const
+    {
+        return this->_initialized;
+    }
+
+  private:
+    struct FontCacheHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t keyLength;
+        int32_t lineHeight;
+        uint32_t glyphCount;
+        uint32_t pixelSize;
+    };
+
+    struct FontCacheGlyph
+    {
+        uint32_t codePoint;
+        int32_t width;
+        int32_t advance;
+        int32_t offset;
+        uint32_t valid;
+        // offset into the pixel block, g_fontCacheNoPixels for glyphs without a bitmap
+        uint32_t pixelOffset;
+    };
+
+    inline void SetupCache(const std::wstring &cacheDirectory)
+    {
+        const std::wstring sourceKey = this->_source->GetCacheKey();
+        if (cacheDirectory.empty() || sourceKey.empty())
+        {
+            return;
+        }
+
+        this->_cacheKey = sourceKey + L"|" + std::to_wstring(g_charRangeMin) + L"-" + std::to_wstring(g_charRangeMax);
+        this->_cachePath =
+            cacheDirectory + L"\\" +
+            std::to_wstring(detail::HashFnv1a(this->_cacheKey.data(), this->_cacheKey.size() * sizeof(wchar_t))) +
+            L".fontcache";
+    }
+
+    // Cache layout: header, key characters, glyph records, pixel block with one line high cell per glyph.
+    inline bool LoadCache()
+    {
+        if (this->_cachePath.empty())
+        {
+            return false;
+        }
+
+        const std::wstring &key = this->_cacheKey;
+
+        detail::MappedFile file(this->_cachePath);
+
+        const uint8_t *data = file.GetData();
+        const size_t size = file.GetSize();
+
+        if (!data || size < sizeof(FontCacheHeader))
+        {
+            return false;
+        }
+
+        FontCacheHeader header{};
+        memcpy(&header, data, sizeof(header));
+
+        if (header.magic != g_fontCacheMagic || header.version != g_fontCacheVersion ||
+            header.keyLength != key.size() || header.lineHeight != this->_lineHeight)
+        {
+            return false;
+        }
+
+        const size_t keyOffset = sizeof(FontCacheHeader);
+        const size_t glyphsOffset = keyOffset + header.keyLength * sizeof(wchar_t);
+        const size_t pixelsOffset = glyphsOffset + static_cast<size_t>(header.glyphCount) * sizeof(FontCacheGlyph);
+
+        if (pixelsOffset + header.pixelSize != size ||
+            memcmp(data + keyOffset, key.data(), header.keyLength * sizeof(wchar_t)) != 0)
+        {
+            return false;
+        }
+
+        std::vector<FontCacheGlyph> records(header.glyphCount);
+        memcpy(records.data(), data + glyphsOffset, records.size() * sizeof(FontCacheGlyph));
+
+        // validate everything before touching the atlas, a damaged file is simply baked again
+        for (const FontCacheGlyph &record : records)
+        {
+            if (record.pixelOffset != g_fontCacheNoPixels &&
+                (record.width <= 0 || record.pixelOffset > header.pixelSize ||
+                 header.pixelSize - record.pixelOffset < static_cast<size_t>(record.width) * this->_lineHeight))
+            {
+                return false;
+            }
+        }
+
+        const uint8_t *pixels = data + pixelsOffset;
+
+        for (const FontCacheGlyph &record : records)
+        {
+            GlyphMetrics metrics{};
+            metrics.width = record.width;
+            metrics.advance = record.advance;
+            metrics.offset = record.offset;
+            metrics.valid = record.valid != 0;
+
+            this->_glyphMetrics[record.codePoint] = metrics;
+
+            if (record.pixelOffset == g_fontCacheNoPixels)
+            {
+                continue;
+            }
+
+            this->_atlas->AddGlyph(FontAtlas::MakeGlyphKey(this->_fontId, record.codePoint), metrics.width,
+                                   this->_lineHeight, pixels + record.pixelOffset, metrics.width);
+        }
+
+        return true;
+    }
+
+    inline void SaveCache()
+    {
+        if (this->_cachePath.empty())
+        {
+            return;
+        }
+
+        const std::wstring &path = this->_cachePath;
+        const std::wstring &key = this->_cacheKey;
+
+        std::vector<FontCacheGlyph> records;
+        std::vector<uint8_t> pixels;
+
+        for (wchar_t c = g_charRangeMin; c < g_charRangeMax; c++)
+        {
+            auto it = this->_glyphMetrics.find(c);
+            if (it == this->_glyphMetrics.end())
+            {
+                continue;
+            }
+
+            const GlyphMetrics &metrics = it->second;
+
+            FontCacheGlyph record{};
+            record.codePoint = c;
+            record.width = metrics.width;
+            record.advance = metrics.advance;
+            record.offset = metrics.offset;
+            record.valid = metrics.valid ? 1 : 0;
+            record.pixelOffset = g_fontCacheNoPixels;
+
+            if (metrics.valid && c != L' ')
+            {
+                record.pixelOffset = static_cast<uint32_t>(pixels.size());
+                pixels.resize(pixels.size() + static_cast<size_t>(metrics.width) * this->_lineHeight);
+
+                // already evicted from a crowded atlas, an incomplete cache is not worth writing
+                if (!this->_atlas->ReadGlyph(FontAtlas::MakeGlyphKey(this->_fontId, c), &pixels[record.pixelOffset],
+                                             metrics.width))
+                {
+                    return;
+                }
+            }
+
+            records.push_back(record);
+        }
+
+        FontCacheHeader header{};
+        header.magic = g_fontCacheMagic;
+        header.version = g_fontCacheVersion;
+        header.keyLength = static_cast<uint32_t>(key.size());
+        header.lineHeight = this->_lineHeight;
+        header.glyphCount = static_cast<uint32_t>(records.size());
+        header.pixelSize = static_cast<uint32_t>(pixels.size());
+
+        // write next to the final file and swap it in, so a concurrent start never maps a partial cache
+        const std::wstring tempPath = path + L".tmp";
+
+        HANDLE file =
+            CreateFileW(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return;
+        }
+
+        const auto write = [file](const void *data, size_t size) {
+            DWORD written = 0;
+            return size == 0 ||
+                   (WriteFile(file, data, static_cast<DWORD>(size), &written, nullptr) && written == size);
+        };
+
+        const bool written = write(&header, sizeof(header)) && write(key.data(), key.size() * sizeof(wchar_t)) &&
+                             write(records.data(), records.size() * sizeof(FontCacheGlyph)) &&
+                             write(pixels.data(), pixels.size());
+
+        CloseHandle(file);
+
+        if (!written || !MoveFileExW(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            DeleteFileW(tempPath.c_str());
+        }
+    }
+
+    inline const GlyphMetrics *GetGlyphMetrics(uint32_t codePoint)
+    {
+        auto it = this->_glyphMetrics.find(codePoint);
+        if (it == this->_glyphMetrics.end())
+        {
+            it = this->_glyphMetrics.emplace(codePoint, this->_source->MeasureGlyph(codePoint)).first;
+        }
+
+        return it->second.valid ? &it->second : nullptr;
+    }
+
+    inline AtlasGlyph *GetGlyph(uint32_t codePoint, const GlyphMetrics &metrics)
+    {
+        AtlasGlyph *glyph = this->_atlas->FindGlyph(FontAtlas::MakeGlyphKey(this->_fontId, codePoint));
+        if (glyph)
+        {
+            return glyph;
+        }
+
+        return this->RasterizeGlyph(*this->_source, codePoint, metrics, this->_cell);
+    }
+
+    // The fixed function pipeline cannot build outline or shadow from the coverage, so both are baked into glyphs of
+    // their own, padded by padding pixels on every side.
+    inline AtlasGlyph *GetGlyphVariant(uint32_t codePoint, const GlyphMetrics &metrics, uint32_t variant, long padding)
+    {
+        const uint64_t key = FontAtlas::MakeGlyphKey(this->_fontId, codePoint, variant);
+
+        AtlasGlyph *glyph = this->_atlas->FindGlyph(key);
+        if (glyph)
+        {
+            return glyph;
+        }
+
+        this->_cell.assign(static_cast<size_t>(metrics.width) * this->_lineHeight, 0);
+        this->_source->RasterizeGlyph(codePoint, metrics, this->_cell.data(), metrics.width);
+
+        return this->AddVariant(key, this->_cell.data(), metrics.width, this->_lineHeight, variant, padding);
+    }
+
+    // Bakes the shadow or outline of a coverage image into an atlas entry padded by padding pixels on every side.
+    inline AtlasGlyph *AddVariant(uint64_t key, const uint8_t *pixels, long width, long height, uint32_t variant,
+                                  long padding)
+    {
+        const long paddedWidth = width + 2 * padding;
+        const long paddedHeight = height + 2 * padding;
+
+        this->_effectCell.assign(static_cast<size_t>(paddedWidth) * paddedHeight, 0);
+
+        if (variant == GLYPH_VARIANT_SHADOW)
+        {
+            detail::BakeShadowField(pixels, width, height, width, padding, this->_effectCell.data(), 1, paddedWidth);
+        }
+        else
+        {
+            detail::BakeOutlineField(pixels, width, height, width, padding, this->_effectCell.data(), 1, paddedWidth);
+
+            // the field reaches 0 at padding + 1 pixels, scaled up it covers padding pixels and antialiases the next
+            for (uint8_t &texel : this->_effectCell)
+            {
+                texel = static_cast<uint8_t>(std::min(texel * (padding + 1), 255L));
+            }
+        }
+
+        return this->_atlas->AddGlyph(key, paddedWidth, paddedHeight, this->_effectCell.data(), paddedWidth);
+    }
+
+    // Runs with TEXT_FLAG_CACHED get an id for their composed image. Color tags need a color per glyph, runs using
+    // them are drawn glyph by glyph.
+    inline void PrepareRunCache(TextRun &run)
+    {
+        run.cacheId = 0;
+
+        if (!(run.flags & TEXT_FLAG_CACHED) || run.glyphs.empty() ||
+            std::any_of(run.glyphs.begin(), run.glyphs.end(), [](const TextRunGlyph &glyph) { return glyph.tagColor; }))
+        {
+            return;
+        }
+
+        // 0 marks runs which are not cached
+        if (++this->_nextCacheId == 0)
+        {
+            this->_nextCacheId = 1;
+        }
+
+        run.cacheId = this->_nextCacheId;
+        run.cacheOrigin = run.glyphs.front().pos;
+
+        for (const TextRunGlyph &glyph : run.glyphs)
+        {
+            run.cacheOrigin.x = std::min(run.cacheOrigin.x, glyph.pos.x);
+            run.cacheOrigin.y = std::min(run.cacheOrigin.y, glyph.pos.y);
+        }
+    }
+
+    // The composed image and its variants are evicted from the atlas like any glyph and composed again from the pinned
+    // glyphs of the run once they are drawn after that.
+    inline const AtlasGlyph *GetRunImage(const TextRun &run, uint32_t variant, long padding)
+    {
+        const uint64_t key = FontAtlas::MakeStringKey(this->_fontId, run.cacheId, variant);
+
+        const AtlasGlyph *image = this->_atlas->FindGlyph(key);
+        if (image)
+        {
+            return image;
+        }
+
+        long width = 0;
+        long height = 0;
+        std::vector<uint8_t> pixels;
+
+        this->ComposeRun(run, pixels, width, height);
+
+        if (variant == GLYPH_VARIANT_FILL)
+        {
+            return this->_atlas->AddGlyph(key, width, height, pixels.data(), width);
+        }
+
+        return this->AddVariant(key, pixels.data(), width, height, variant, padding);
+    }
+
+    // Copies the coverage of every glyph of a run into one image, laid out at scale 1 all glyphs sit on whole pixels.
+    inline void ComposeRun(const TextRun &run, std::vector<uint8_t> &pixels, long &width, long &height)
+    {
+        width = 0;
+        height = 0;
+
+        for (const TextRunGlyph &glyph : run.glyphs)
+        {
+            const GlyphMetrics *metrics = this->GetGlyphMetrics(glyph.codePoint);
+
+            width = std::max(width, lroundf(glyph.pos.x - run.cacheOrigin.x) + metrics->width);
+            height = std::max(height, lroundf(glyph.pos.y - run.cacheOrigin.y) + this->_lineHeight);
+        }
+
+        pixels.assign(static_cast<size_t>(width) * height, 0);
+
+        for (const TextRunGlyph &glyph : run.glyphs)
+        {
+            const GlyphMetrics *metrics = this->GetGlyphMetrics(glyph.codePoint);
+
+            this->_cell.assign(static_cast<size_t>(metrics->width) * this->_lineHeight, 0);
+            if (!this->_atlas->ReadGlyph(FontAtlas::MakeGlyphKey(this->_fontId, glyph.codePoint), this->_cell.data(),
+                                         metrics->width))
+            {
+                continue;
+            }
+
+            const long left = lroundf(glyph.pos.x - run.cacheOrigin.x);
+            const long top = lroundf(glyph.pos.y - run.cacheOrigin.y);
+
+            // neighbouring glyphs may overlap, keep the higher coverage
+            for (long row = 0; row < this->_lineHeight; row++)
+            {
+                uint8_t *dst = &pixels[width * (top + row) + left];
+                const uint8_t *src = &this->_cell[metrics->width * row];
+
+                for (long column = 0; column < metrics->width; column++)
+                {
+                    dst[column] = std::max(dst[column], src[column]);
+                }
+            }
+        }
+    }
+
+    inline AtlasGlyph *RasterizeGlyph(FontSource &source, uint32_t codePoint, const GlyphMetrics &metrics,
+                                      std::vector<uint8_t> &cell)
+    {
+        cell.assign(static_cast<size_t>(metrics.width) * this->_lineHeight, 0);
+        source.RasterizeGlyph(codePoint, metrics, cell.data(), metrics.width);
+
+        return this->_atlas->AddGlyph(FontAtlas::MakeGlyphKey(this->_fontId, codePoint), metrics.width,
+                                      this->_lineHeight, cell.data(), metrics.width);
+    }
+
+    inline void BakeChunk(FontSource &source, uint32_t first, uint32_t last)
+    {
+        std::vector<uint8_t> cell;
+
+        for (uint32_t c = first; c < last; c++)
+        {
+            const GlyphMetrics metrics = source.MeasureGlyph(c);
+
+            {
+                std::lock_guard<std::mutex> lock(this->_bakeMutex);
+                this->_glyphMetrics[c] = metrics;
+            }
+
+            if (metrics.valid && c != L' ')
+            {
+                this->RasterizeGlyph(source, c, metrics, cell);
+            }
+        }
+
+        // the last chunk to finish publishes the font
+        if (--this->_pendingChunks == 0)
+        {
+            this->SaveCache();
+            this->_initialized = true;
+        }
+    }
+
+    template <typename CharT>
+    inline Vec2 RenderTextImpl(const RenderListPtr &renderList, Vec2 pos, std::basic_string_view<CharT> text,
+                               const Color color, uint32_t flags, const Color outlineColor, float outlineThickness,
+                               float scale, float maxWidth)
+    {
+        // still baking, never wait for it
+        if (!this->_initialized)
+        {
+            return Vec2(0.f, 0.f);
+        }
+
+        std::lock_guard<std::mutex> lock(this->_layoutMutex);
+
+        const auto addGlyph = [&](uint32_t c, float x, float y, float w, float h, const AtlasGlyph &glyph,
+                                  Color currentColor, bool) {
+            this->AddGlyphQuad(renderList, c, x, y, w, h, glyph.uv, currentColor, flags, outlineColor,
+                               outlineThickness, scale);
+        };
+
+        Vec2 extent;
+        this->LayoutText(pos, text, color, flags, scale, maxWidth, extent, addGlyph);
+        return extent;
+    }
+
+    // Walks the glyphs of text with color tags and alignment flags applied, extent receives the size of the laid out
+    // block. Glyphs which do not fit into the atlas anymore are skipped, the return value tells whether any was.
+    template <typename CharT, typename Callback>
+    inline bool LayoutText(Vec2 pos, std::basic_string_view<CharT> text, const Color color, uint32_t flags,
+                           float scale, float maxWidth, Vec2 &extent, Callback &&callback)
+    {
+        if (maxWidth > 0.f && (flags & (TEXT_FLAG_WORD_WRAP | TEXT_FLAG_ELLIPSIS)))
+        {
+            return this->LayoutLines(pos, text, color, flags, scale, maxWidth, extent, callback);
+        }
+
+        if (flags & (TEXT_FLAG_RIGHT | TEXT_FLAG_CENTERED))
+        {
+            AlignText(pos, this->CalculateTextExtentImpl(text, scale), flags);
+        }
+
+        const float lineHeight = static_cast<float>(this->_lineHeight) * scale;
+        float startX = pos.x;
+        float width = 0.f;
+        float height = lineHeight;
+        Color currentColor = color;
+        bool tagColor = false;
+        bool complete = true;
+
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            // color tags switch the color of everything after them
+            uint32_t parsedColor;
+            if (const size_t tagLength = detail::ParseColorTag(text, i, parsedColor))
+            {
+                currentColor = parsedColor;
+                tagColor = true;
+                i += tagLength - 1;
+                continue;
+            }
+
+            const uint32_t c = detail::DecodeCodePoint(text, i);
+
+            // jump to next line if asked
+            if (c == '\n')
+            {
+                width = std::max(width, pos.x - startX);
+                height += lineHeight;
+                pos.x = startX;
+                pos.y += lineHeight;
+            }
+
+            // ignore invalid chars
+            if (c < L' ')
+            {
+                continue;
+            }
+
+            pos.x += this->LayoutGlyph(c, pos, currentColor, tagColor, scale, complete, callback);
+        }
+
+        extent = Vec2(std::max(width, pos.x - startX), height);
+        return complete;
+    }
+
+    // Lays out text wrapped or cut off at maxWidth, see TextLayout.
+    template <typename CharT, typename Callback>
+    inline bool LayoutLines(Vec2 pos, std::basic_string_view<CharT> text, const Color color, uint32_t flags,
+                            float scale, float maxWidth, Vec2 &extent, Callback &callback)
+    {
+        const float width = this->_textLayout.BreakLines(text, static_cast<uint32_t>(color), flags, scale, maxWidth,
+                                                         [this](uint32_t c) { return this->GetGlyphMetrics(c); });
+
+        const std::vector<TextLayoutChar> &chars = this->_textLayout.GetChars();
+        const std::vector<TextLine> &lines = this->_textLayout.GetLines();
+
+        const float lineHeight = static_cast<float>(this->_lineHeight) * scale;
+        extent = Vec2(width, lineHeight * lines.size());
+
+        AlignText(pos, extent, flags);
+
+        bool complete = true;
+
+        for (const TextLine &line : lines)
+        {
+            float x = pos.x;
+
+            for (size_t i = line.begin; i < line.end; i++)
+            {
+                x += this->LayoutGlyph(chars[i].codePoint, Vec2(x, pos.y), chars[i].color, chars[i].tagColor, scale,
+                                       complete, callback);
+            }
+
+            // a cut off line always has a char after the cut, the dots take its color
+            if (line.ellipsis)
+            {
+                for (int i = 0; i < 3; i++)
+                {
+                    x += this->LayoutGlyph('.', Vec2(x, pos.y), chars[line.end].color, chars[line.end].tagColor, scale,
+                                           complete, callback);
+                }
+            }
+
+            pos.y += lineHeight;
+        }
+
+        return complete;
+    }
+
+    static inline void AlignText(Vec2 &pos, const Vec2 &size, uint32_t flags)
+    {
+        if (flags & TEXT_FLAG_RIGHT)
+        {
+            pos.x -= size.x;
+        }
+        else if (flags & TEXT_FLAG_CENTERED_X)
+        {
+            pos.x -= 0.5f * size.x;
+        }
+
+        if (flags & TEXT_FLAG_CENTERED_Y)
+        {
+            pos.y -= 0.5f * size.y;
+        }
+    }
+
+    // Hands a single char at pos to the callback and returns its advance, spaces and unknown chars only advance.
+    template <typename Callback>
+    inline float LayoutGlyph(uint32_t c, Vec2 pos, const Color color, bool tagColor, float scale, bool &complete,
+                             Callback &callback)
+    {
+        // try to measure the char, unknown ones are skipped
+        const GlyphMetrics *metrics = this->GetGlyphMetrics(c);
+        if (!metrics)
+        {
+            return 0.f;
+        }
+
+        // do not render space char
+        if (c != L' ')
+        {
+            const AtlasGlyph *glyph = this->GetGlyph(c, *metrics);
+            if (glyph)
+            {
+                callback(c, pos.x - static_cast<float>(metrics->offset) * scale, pos.y,
+                         static_cast<float>(metrics->width) * scale, static_cast<float>(this->_lineHeight) * scale,
+                         *glyph, color, tagColor);
+            }
+            else
+            {
+                complete = false;
+            }
+        }
+
+        return static_cast<float>(metrics->advance) * scale;
+    }
+
+    inline void AddGlyphQuad(const RenderListPtr &renderList, uint32_t c, float x, float y, float w, float h,
+                             const std::array<float, 4> &uv, const Color currentColor, uint32_t flags,
+                             const Color outlineColor, float outlineThickness, float scale)
+    {
+        const GlyphMetrics *metrics =
+            (flags & (TEXT_FLAG_DROPSHADOW | TEXT_FLAG_OUTLINE)) ? this->GetGlyphMetrics(c) : nullptr;
+
+        const auto getVariant = [&](uint32_t variant, long padding) -> const AtlasGlyph * {
+            return metrics ? this->GetGlyphVariant(c, *metrics, variant, padding) : nullptr;
+        };
+
+        this->AddTextQuads(renderList, x, y, w, h, uv, FontAtlas::MakeGlyphKey(this->_fontId, c), currentColor, flags,
+                           outlineColor, outlineThickness, scale, getVariant);
+    }
+
+    // Draws a glyph or a composed text stored under key, getVariant(variant, padding) provides the baked outline and
+    // shadow.
+    template <typename GetVariant>
+    inline void AddTextQuads(const RenderListPtr &renderList, float x, float y, float w, float h,
+                             const std::array<float, 4> &uv, uint64_t key, const Color currentColor, uint32_t flags,
+                             const Color outlineColor, float outlineThickness, float scale, GetVariant &&getVariant)
+    {
+        IDirect3DTexture9 *texture = this->_atlas->GetTexture();
+
+        // a published list pins its glyphs in the atlas they came from
+        if (renderList->_glyphAtlas != this->_atlas)
+        {
+            renderList->_glyphAtlas = this->_atlas;
+        }
+
+        // the effects are drawn behind the glyph, their variants are only baked once they were asked for
+        if (flags & TEXT_FLAG_DROPSHADOW)
+        {
+            const AtlasGlyph *shadow = getVariant(GLYPH_VARIANT_SHADOW, g_fontShadowPadding);
+
+            if (shadow)
+            {
+                const float padding = g_fontShadowPadding * scale;
+
+                // black, with the alpha of the text
+                Color shadowColor = Color(0x00, 0x00, 0x00, (currentColor.ToHexColor() >> 24) & 0xff);
+
+                AddTexturedQuad(renderList, x - padding, y - padding, w + 2.f * padding, h + 2.f * padding,
+                                shadow->uv, shadow->key, shadowColor, 0.88f, texture);
+            }
+        }
+
+        if (flags & TEXT_FLAG_OUTLINE)
+        {
+            const long thickness = std::min(std::max(lroundf(outlineThickness), 1L), g_fontOutlineMaxThickness);
+            const AtlasGlyph *outline = getVariant(GLYPH_VARIANT_OUTLINE + thickness, thickness);
+
+            if (outline)
+            {
+                const float padding = thickness * scale;
+
+                AddTexturedQuad(renderList, x - padding, y - padding, w + 2.f * padding, h + 2.f * padding,
+                                outline->uv, outline->key, outlineColor, 0.89f, texture);
+            }
+        }
+
+        AddTexturedQuad(renderList, x, y, w, h, uv, key, currentColor, 0.9f, texture);
+    }
+
+    static inline void AddTexturedQuad(const RenderListPtr &renderList, float x, float y, float w, float h,
+                                       const std::array<float, 4> &uv, uint64_t key, const Color color, float z,
+                                       IDirect3DTexture9 *texture)
+    {
+        Vertex v[] = {{Vec4{x - 0.5f, y - 0.5f + h, z, 1.f}, color, Vec2{uv[0], uv[3]}},
+                      {Vec4{x - 0.5f, y - 0.5f, z, 1.f}, color, Vec2{uv[0], uv[1]}},
+                      {Vec4{x - 0.5f + w, y - 0.5f + h, z, 1.f}, color, Vec2{uv[2], uv[3]}},
+
+                      {Vec4{x - 0.5f + w, y - 0.5f, z, 1.f}, color, Vec2{uv[2], uv[1]}},
+                      {Vec4{x - 0.5f + w, y - 0.5f + h, z, 1.f}, color, Vec2{uv[2], uv[3]}},
+                      {Vec4{x - 0.5f, y - 0.5f, z, 1.f}, color, Vec2{uv[0], uv[1]}}};
+
+        renderList->AddVertices(v, D3DPT_TRIANGLELIST, texture);
+        renderList->_glyphKeys.push_back(key);
+    }
+
+    template <typename CharT> inline Vec2 CalculateTextExtentImpl(std::basic_string_view<CharT> text, float scale)
+    {
+        if (!this->_initialized)
+        {
+            return Vec2(0.f, 0.f);
+        }
+
+        float rowWidth = 0.f;
+        float rowHeight = static_cast<float>(this->_lineHeight) * scale;
+        float width = 0.f;
+        float height = rowHeight;
+
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            uint32_t tagColor;
+            if (const size_t tagLength = detail::ParseColorTag(text, i, tagColor))
+            {
+                i += tagLength - 1;
+                continue;
+            }
+
+            const uint32_t c = detail::DecodeCodePoint(text, i);
+
+            if (c == L'\n')
+            {
+                height += rowHeight;
+                width = std::max(width, rowWidth);
+                rowWidth = 0.f;
+            }
+            else if (c >= L' ')
+            {
+                const GlyphMetrics *metrics = this->GetGlyphMetrics(c);
+                if (metrics)
+                {
+                    rowWidth += static_cast<float>(metrics->advance) * scale;
+                }
+            }
+        }
+
+        width = std::max(width, rowWidth);
+        return Vec2(width, height);
+    }
+
+    std::shared_ptr<FontAtlas> _atlas;
+    uint32_t _fontId;
+    FontSourcePtr _source;
+    std::wstring _cacheKey;
+    std::wstring _cachePath;
+    std::unordered_map<uint32_t, GlyphMetrics> _glyphMetrics;
+    std::vector<uint8_t> _cell;
+    std::vector<uint8_t> _effectCell;
+    long _lineHeight;
+    // scratch of LayoutLines()
+    TextLayout _textLayout;
+    uint32_t _nextCacheId;
+    // text may be recorded into different lists from several threads, the scratch above, the metrics measured on
+    // demand and the font source are shared by all of them
+    std::mutex _layoutMutex;
+
+    // chunks of an asynchronous bake fill the metrics concurrently, the render thread only reads them once the font
+    // is initialized
+    std::mutex _bakeMutex;
+    std::atomic<uint32_t> _pendingChunks;
+    std::atomic<bool> _initialized;
+};
+
+class Renderer : public std::enable_shared_from_this<Renderer>
+{
+  public:
+    // All fonts share one atlas that cannot grow once text was recorded, fontAtlasArea is the texture area it is fitted
+    // to. EstimateFontAtlasArea() gives the area of the fonts that are going to be added.
+    Renderer(IDirect3DDevice9 *d3dDevice, uint32_t maxVertices, long fontAtlasArea = g_fontAtlasDefaultArea)
+        : _d3dDevice(d3dDevice), _d3dVertexBuffer(nullptr), _d3dWorldVertexBuffer(nullptr), _maxVertices(maxVertices),
+          _maxWorldVertices(0), _renderList(std::make_shared<RenderList>(maxVertices)), _d3dPreviousStateBlock(nullptr),
+          _d3dRenderStateBlock(nullptr), _viewProjMatrix{}, _nextFontId(1), _textQuadsSaved(0)
+    {
+        if (!d3dDevice)
+        {
+            throw std::runtime_error("Renderer::ctor() d3dDevice is null!");
+        }
+
+        for (int i = 0; i < 4; i++)
+        {
+            this->_viewProjMatrix.m[i][i] = 1.f;
+        }
+
+        this->AcquireStateBlock();
+
+        long atlasWidth = 0;
+        long atlasHeight = 0;
+        GlyphCache::FitSize(fontAtlasArea, atlasWidth, atlasHeight);
+
+        this->_fontAtlas = std::make_shared<FontAtlas>(this->_d3dDevice, atlasWidth, atlasHeight);
+        this->_fontAtlas->Initialize();
+    }
+
+    ~Renderer()
+    {
+        this->Release();
+    }
+
+    inline void Release()
+    {
+        detail::SafeRelease(&this->_d3dVertexBuffer);
+        detail::SafeRelease(&this->_d3dWorldVertexBuffer);
+        this->_maxWorldVertices = 0;
+        this->_uploadedHashes.clear();
+        detail::SafeRelease(&this->_d3dPreviousStateBlock);
+        detail::SafeRelease(&this->_d3dRenderStateBlock);
+    }
+
+    inline void OnLostDevice()
+    {
+        this->Release();
+        this->_fontAtlas->Release();
+    }
+
+    inline void OnResetDevice()
+    {
+        this->AcquireStateBlock();
+        this->_fontAtlas->Initialize();
+    }
+
+    inline void BeginFrame()
+    {
+        this->_d3dPreviousStateBlock->Capture();
+        this->_d3dRenderStateBlock->Apply();
+
+        // follow the viewport of the game, so a resized window doesn't need a new renderer
+        D3DVIEWPORT9 vp = {};
+        if (SUCCEEDED(this->_d3dDevice->GetViewport(&vp)))
+        {
+            this->SetDisplaySize({static_cast<float>(vp.Width), static_cast<float>(vp.Height)});
+        }
+
+        this->_fontAtlas->NewFrame();
+        this->_textQuadsSaved = 0;
+        this->_renderStats = {};
+    }
+
+    inline void EndFrame()
+    {
+        this->_d3dPreviousStateBlock->Apply();
+    }
+
+    // Size of the area drawn to, e.g. after the back buffer was resized. Shapes are pretransformed, so this only
+    // affects the screen mapping of ProjectPoints() and ProjectBox().
+    inline void SetDisplaySize(const Vec2 &displaySize)
+    {
+        this->_displaySize = displaySize;
+    }
+
+    inline Vec2 GetDisplaySize() const
+    {
+        return this->_displaySize;
+    }
+
+    // Atlas area the basic charset of a font takes, with room for a couple of times that for glyphs rasterized later.
+    // The sum over all fonts is the area to construct the renderer with.
+    static inline long EstimateFontAtlasArea(FontSource &fontSource)
+    {
+        const long lineHeight = fontSource.GetLineHeight();
+
+        long area = 0;
+
+        for (wchar_t c = g_charRangeMin; c < g_charRangeMax; c++)
+        {
+            const GlyphMetrics metrics = fontSource.MeasureGlyph(c);
+            if (!metrics.valid)
+            {
+                continue;
+            }
+
+            area += (metrics.width + g_fontAtlasPadding) * (lineHeight + g_fontAtlasPadding);
+        }
+
+        return area * 4;
+    }
+
+    inline FontHandle AddFont(const std::wstring &fontFamily, long fontHeigth, uint32_t fontFlags = FONT_FLAG_NONE)
+    {
+        return this->AddFont(std::make_shared<GdiFontSource>(fontFamily, fontHeigth, fontFlags));
+    }
+
+    // Fonts added afterwards load their preloaded glyphs from this directory and store them there after baking them
+    // for the first time. An empty directory disables the cache.
+    inline void SetFontCacheDirectory(const std::wstring &directory)
+    {
+        this->_fontCacheDirectory = directory;
+    }
+
+    inline FontHandle AddFont(const FontSourcePtr &fontSource)
+    {
+        const size_t fontHandle = this->_nextFontId++;
+
+        std::shared_ptr<Font> fontPtr = std::make_shared<Font>(this->_fontAtlas, static_cast<uint32_t>(fontHandle),
+                                                               fontSource, this->_fontCacheDirectory);
+        fontPtr->Initialize();
+
+        this->_fonts[fontHandle] = fontPtr;
+        return fontHandle;
+    }
+
+    inline FontHandle AddFontAsync(const std::wstring &fontFamily, long fontHeigth,
+                                   uint32_t fontFlags = FONT_FLAG_NONE)
+    {
+        return this->AddFontAsync(std::make_shared<GdiFontSource>(fontFamily, fontHeigth, fontFlags));
+    }
+
+    // Returns immediately, the font is baked by a worker pool and text using it is skipped until IsFontReady().
+    inline FontHandle AddFontAsync(const FontSourcePtr &fontSource)
+    {
+        const size_t fontHandle = this->_nextFontId++;
+
+        std::shared_ptr<Font> fontPtr = std::make_shared<Font>(this->_fontAtlas, static_cast<uint32_t>(fontHandle),
+                                                               fontSource, this->_fontCacheDirectory);
+        fontPtr->InitializeAsync(this->GetThreadPool());
+
+        this->_fonts[fontHandle] = fontPtr;
+        return fontHandle;
+    }
+
+    inline bool IsFontReady(const FontHandle fontId) const
+    {
+        auto font = this->_fonts.find(fontId);
+        if (font == this->_fonts.end())
+        {
+            throw std::runtime_error("IsFontReady(): Font not found!");
+        }
+
+        return font->second->IsInitialized();
+    }
+
+    // Returns the size of the laid out text. Lines longer than a positive maxWidth are wrapped with
+    // TEXT_FLAG_WORD_WRAP or cut off with TEXT_FLAG_ELLIPSIS.
+    inline Vec2 AddText(const RenderListPtr &renderList, const FontHandle fontId, std::wstring_view text, Vec2 pos,
+                        const Color &color, uint32_t flags = FONT_FLAG_NONE, const Color &outlineColor = Color(0, 0, 0),
+                        float outlineThickness = 2.0f, float scale = 1.f, float maxWidth = 0.f)
+    {
+        auto font = this->_fonts.find(fontId);
+        if (font == this->_fonts.end())
+        {
+            throw std::runtime_error("AddText(): Font not found!");
+        }
+
+        return font->second->RenderText(renderList, pos, text, color, flags, outlineColor, outlineThickness, scale,
+                                        maxWidth);
+    }
+
+    inline Vec2 AddText(const FontHandle fontId, std::wstring_view text, Vec2 pos, const Color &color,
+                        uint32_t flags = FONT_FLAG_NONE, const Color &outlineColor = Color(0, 0, 0),
+                        float outlineThickness = 2.0f, float scale = 1.f, float maxWidth = 0.f)
+    {
+        return this->AddText(this->_renderList, fontId, text, pos, color, flags, outlineColor, outlineThickness,
+                             scale, maxWidth);
+    }
+
+    inline Vec2 AddText(const RenderListPtr &renderList, const FontHandle fontId, std::string_view text, Vec2 pos,
+                        const Color &color, uint32_t flags = FONT_FLAG_NONE, const Color &outlineColor = Color(0, 0, 0),
+                        float outlineThickness = 2.0f, float scale = 1.f, float maxWidth = 0.f)
+    {
+        auto font = this->_fonts.find(fontId);
+        if (font == this->_fonts.end())
+        {
+            throw std::runtime_error("AddText(): Font not found!");
+        }
+
+        return font->second->RenderText(renderList, pos, text, color, flags, outlineColor, outlineThickness, scale,
+                                        maxWidth);
+    }
+
+    inline Vec2 AddText(const FontHandle fontId, std::string_view text, Vec2 pos, const Color &color,
+                        uint32_t flags = FONT_FLAG_NONE, const Color &outlineColor = Color(0, 0, 0),
+                        float outlineThickness = 2.0f, float scale = 1.f, float maxWidth = 0.f)
+    {
+        return this->AddText(this->_renderList, fontId, text, pos, color, flags, outlineColor, outlineThickness,
+                             scale, maxWidth);
+    }
+
+    inline Vec2 CalculateTextExtent(const FontHandle fontId, std::wstring_view text, float scale = 1.f)
+    {
+        auto font = this->_fonts.find(fontId);
+        if (font == this->_fonts.end())
+        {
+            throw std::runtime_error("CalculateTextExtent(): Font not found!");
+        }
+
+        return font->second->CalculateTextExtent(text, scale);
+    }
+
+    inline Vec2 CalculateTextExtent(const FontHandle fontId, std::string_view text, float scale = 1.f)
+    {
+        auto font = this->_fonts.find(fontId);
+        if (font == this->_fonts.end())
+        {
+            throw std::runtime_error("CalculateTextExtent(): Font not found!");
+        }
+
+        return font->second->CalculateTextExtent(text, scale);
+    }
+
+    // Formats into a stack buffer with std::format syntax and lays the result out without any heap allocation, e.g.
+    // AddTextFormat(font, ..., "{} [{}m] {}hp", name, distance, health). Scale and max width work as with AddText(),
+    // they come before the format string since nothing can follow the arguments.
+    template <typename... Args>
+    inline void AddTextFormat(const RenderListPtr &renderList, const FontHandle fontId, Vec2 pos, const Color &color,
+                              uint32_t flags, const Color &outlineColor, float outlineThickness, float scale,
+                              float maxWidth, std::format_string<Args...> format, Args &&...args)
+    {
+        char buffer[g_textFormatBufferSize];
+        const auto result = std::format_to_n(buffer, g_textFormatBufferSize, format, std::forward<Args>(args)...);
+        size_t length = static_cast<size_t>(result.size);
+
+        // cut off output must not end in a partial character
+        if (length > g_textFormatBufferSize)
+        {
+            length = detail::TrimToCodePoint(buffer, g_textFormatBufferSize);
+        }
+
+        this->AddText(renderList, fontId, std::string_view(buffer, length), pos, color, flags, outlineColor,
+                      outlineThickness, scale, maxWidth);
+    }
+
+    template <typename... Args>
+    inline void AddTextFormat(const RenderListPtr &renderList, const FontHandle fontId, Vec2 pos, const Color &color,
+                              uint32_t flags, const Color &outlineColor, float outlineThickness,
+                              std::format_string<Args...> format, Args &&...args)
+    {
+        this->AddTextFormat(renderList, fontId, pos, color, flags, outlineColor, outlineThickness, 1.f, 0.f, format,
+                            std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    inline void AddTextFormat(const FontHandle fontId, Vec2 pos, const Color &color, uint32_t flags,
+                              const Color &outlineColor, float outlineThickness, float scale, float maxWidth,
+                              std::format_string<Args...> format, Args &&...args)
+    {
+        this->AddTextFormat(this->_renderList, fontId, pos, color, flags, outlineColor, outlineThickness, scale,
+                            maxWidth, format, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    inline void AddTextFormat(const FontHandle fontId, Vec2 pos, const Color &color, uint32_t flags,
+                              std::format_string<Args...> format, Args &&...args)
+    {
+        this->AddTextFormat(this->_renderList, fontId, pos, color, flags, Color(0, 0, 0), 2.0f, format,
+                            std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    inline void AddTextFormat(const RenderListPtr &renderList, const FontHandle fontId, Vec2 pos, const Color &color,
+                              uint32_t flags, const Color &outlineColor, float outlineThickness, float scale,
+                              float maxWidth, std::wformat_string<Args...> format, Args &&...args)
+    {
+        wchar_t buffer[g_textFormatBufferSize];
+        const auto result = std::format_to_n(buffer, g_textFormatBufferSize, format, std::forward<Args>(args)...);
+        size_t length = static_cast<size_t>(result.size);
+
+        // cut off output must not end in a partial character
+        if (length > g_textFormatBufferSize)
+        {
+            length = detail::TrimToCodePoint(buffer, g_textFormatBufferSize);
+        }
+
+        this->AddText(renderList, fontId, std::wstring_view(buffer, length), pos, color, flags, outlineColor,
+                      outlineThickness, scale, maxWidth);
+    }
+
+    template <typename... Args>
+    inline void AddTextFormat(const RenderListPtr &renderList, const FontHandle fontId, Vec2 pos, const Color &color,
+                              uint32_t flags, const Color &outlineColor, float outlineThickness,
+                              std::wformat_string<Args...> format, Args &&...args)
+    {
+        this->AddTextFormat(renderList, fontId, pos, color, flags, outlineColor, outlineThickness, 1.f, 0.f, format,
+                            std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    inline void AddTextFormat(const FontHandle fontId, Vec2 pos, const Color &color, uint32_t flags,
+                              const Color &outlineColor, float outlineThickness, float scale, float maxWidth,
+                              std::wformat_string<Args...> format, Args &&...args)
+    {
+        this->AddTextFormat(this->_renderList, fontId, pos, color, flags, outlineColor, outlineThickness, scale,
+                            maxWidth, format, std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    inline void AddTextFormat(const FontHandle fontId, Vec2 pos, const Color &color, uint32_t flags,
+                              std::wformat_string<Args...> format, Args &&...args)
+    {
+        this->AddTextFormat(this->_renderList, fontId, pos, color, flags, Color(0, 0, 0), 2.0f, format,
+                            std::forward<Args>(args)...);
+    }
+
+    // Integer labels bypass the formatter, the digits go straight from std::to_chars into layout
+    inline void AddNumber(const RenderListPtr &renderList, const FontHandle fontId, int64_t value, Vec2 pos,
+                          const Color &color, uint32_t flags = FONT_FLAG_NONE,
+                          const Color &outlineColor = Color(0, 0, 0), float outlineThickness = 2.0f)
+    {
+        char buffer[24];
+        const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+
+        this->AddText(renderList, fontId, std::string_view(buffer, result.ptr - buffer), pos, color, flags,
+                      outlineColor, outlineThickness);
+    }
+
+    // Fixed-point variant of AddNumber, value is rounded to the given number of decimals
+    inline void AddDecimal(const RenderListPtr &renderList, const FontHandle fontId, double value, int decimals,
+                           Vec2 pos, const Color &color, uint32_t flags = FONT_FLAG_NONE,
+                           const Color &outlineColor = Color(0, 0, 0), float outlineThickness = 2.0f)
+    {
+        char buffer[64];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed, decimals);
+
+        // too large for fixed notation, fall back to the shortest representation
+        if (result.ec != std::errc())
+        {
+            result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        }
+
+        this->AddText(renderList, fontId, std::string_view(buffer, result.ptr - buffer), pos, color, flags,
+                      outlineColor, outlineThickness);
+    }
+
+    inline void AddNumber(const FontHandle fontId, int64_t value, Vec2 pos, const Color &color,
+                          uint32_t flags = FONT_FLAG_NONE, const Color &outlineColor = Color(0, 0, 0),
+                          float outlineThickness = 2.0f)
+    {
+        this->AddNumber(this->_renderList, fontId, value, pos, color, flags, outlineColor, outlineThickness);
+    }
+
+    inline void AddDecimal(const FontHandle fontId, double value, int decimals, Vec2 pos, const Color &color,
+                           uint32_t flags = FONT_FLAG_NONE, const Color &outlineColor = Color(0, 0, 0),
+                           float outlineThickness = 2.0f)
+    {
+        this->AddDecimal(this->_renderList, fontId, value, decimals, pos, color, flags, outlineColor, outlineThickness);
+    }
+
+    // Parses and lays out a text that is drawn often, e.g. a menu caption, once. Drawing the returned handle only
+    // translates the stored glyphs, with TEXT_FLAG_CACHED the whole text is composed into a single atlas entry and
+    // drawn as one quad until it is updated or evicted, meant for large blocks that rarely change. Texts of fonts still
+    // baking are laid out when they are drawn first after that.
+    inline TextHandle InternText(const FontHandle fontId, std::wstring_view text, const Color &color,
+                                 uint32_t flags = FONT_FLAG_NONE, const Color &outlineColor = Color(0, 0, 0),
+                                 float outlineThickness = 2.0f)
+    {
+        auto font = this->_fonts.find(fontId);
+        if (font == this->_fonts.end())
+        {
+            throw std::runtime_error("InternText(): Font not found!");
+        }
+
+        auto run = std::make_unique<TextRun>();
+        run->font = font->second;
+        run->text = text;
+        run->color = color;
+        run->flags = flags;
+        run->outlineColor = outlineColor;
+        run->outlineThickness = outlineThickness;
+
+        run->font->LayoutRun(*run);
+
+        if (this->_freeTextHandles.empty())
+        {
+            this->_texts.push_back(std::move(run));
+            return this->_texts.size() - 1;
+        }
+
+        const TextHandle textHandle = this->_freeTextHandles.back();
+        this->_freeTextHandles.pop_back();
+        this->_texts[textHandle] = std::move(run);
+        return textHandle;
+    }
+
+    inline TextHandle InternText(const FontHandle fontId, std::string_view text, const Color &color,
+                                 uint32_t flags = FONT_FLAG_NONE, const Color &outlineColor = Color(0, 0, 0),
+                                 float outlineThickness = 2.0f)
+    {
+        return this->InternText(fontId, WidenText(text), color, flags, outlineColor, outlineThickness);
+    }
+
+    // Replaces the content of an interned text, a cached one is composed again the next time it is drawn.
+    inline void UpdateText(const TextHandle textHandle, std::wstring_view text)
+    {
+        TextRun &run = this->GetTextRun(textHandle, "UpdateText");
+        run.font->ReleaseRun(run);
+
+        run.text = text;
+        run.font->LayoutRun(run);
+    }
+
+    inline void UpdateText(const TextHandle textHandle, std::string_view text)
+    {
+        this->UpdateText(textHandle, WidenText(text));
+    }
+
+    // Unpins the glyphs of the text, the handle may be handed out again afterwards.
+    inline void ReleaseText(const TextHandle textHandle)
+    {
+        TextRun &run = this->GetTextRun(textHandle, "ReleaseText");
+        run.font->ReleaseRun(run);
+
+        this->_texts[textHandle].reset();
+        this->_freeTextHandles.push_back(textHandle);
+    }
+
+    inline void AddText(const RenderListPtr &renderList, const TextHandle textHandle, Vec2 pos)
+    {
+        TextRun &run = this->GetTextRun(textHandle, "AddText");
+        this->AddText(renderList, textHandle, pos, run.color);
+    }
+
+    // Draws an interned text with another color and scale, colors set by tags in the text are kept
+    inline void AddText(const RenderListPtr &renderList, const TextHandle textHandle, Vec2 pos, const Color &color,
+                        float scale = 1.f)
+    {
+        TextRun &run = this->GetTextRun(textHandle, "AddText");
+
+        if (run.laidOut || run.font->LayoutRun(run))
+        {
+            this->_textQuadsSaved += run.font->RenderRun(renderList, run, pos, color, scale);
+        }
+    }
+
+    inline void AddText(const TextHandle textHandle, Vec2 pos)
+    {
+        this->AddText(this->_renderList, textHandle, pos);
+    }
+
+    inline void AddText(const TextHandle textHandle, Vec2 pos, const Color &color, float scale = 1.f)
+    {
+        this->AddText(this->_renderList, textHandle, pos, color, scale);
+    }
+
+    inline void AddGradientRect(const RenderListPtr &renderList, const Vec2 &min, const Vec2 &max, const Color &color1,
+                                const Color &color2, const GradientDirection direction)
+    {
+        ShapeCommand command{};
+        command.type = ShapeCommandType::GradientRect;
+        command.p1 = min;
+        command.p2 = max;
+        command.color = color1;
+        command.color2 = color2;
+        command.segments = static_cast<int32_t>(direction);
+
+        this->AddShape(renderList, command, 6, D3DPT_TRIANGLELIST);
+    }
+
+    inline void AddGradientRect(const Vec2 &min, const Vec2 &max, const Color &color1, const Color &color2,
+                                const GradientDirection direction)
+    {
+        return this->AddGradientRect(this->_renderList, min, max, color1, color2, direction);
+    }
+
+    inline void AddGradientRect(const RenderListPtr &renderList, const Vec4 &rect, const Color &color1,
+                                const Color &color2, const GradientDirection direction)
+    {
+        return this->AddGradientRect(renderList, Vec2(rect.x, rect.y), Vec2(rect.x + rect.z, rect.y + rect.w), color1,
+                                     color2, direction);
+    }
+
+    inline void AddGradientRect(const Vec4 &rect, const Color &color1, const Color &color2,
+                                const GradientDirection direction)
+    {
+        return this->AddGradientRect(this->_renderList, Vec2(rect.x, rect.y), Vec2(rect.x + rect.z, rect.y + rect.w),
+                                     color1, color2, direction);
+    }
+
+    inline void AddRectFilled(const RenderListPtr &renderList, const Vec2 &min, const Vec2 &max, const Color &color)
+    {
+        ShapeCommand command{};
+        command.type = ShapeCommandType::RectFilled;
+        command.p1 = min;
+        command.p2 = max;
+        command.color = color;
+
+        this->AddShape(renderList, command, 6, D3DPT_TRIANGLELIST);
+    }
+
+    inline void AddRectFilled(const Vec2 &min, const Vec2 &max, const Color &color)
+    {
+        return this->AddRectFilled(this->_renderList, min, max, color);
+    }
+
+    inline void AddRectFilled(const RenderListPtr &renderList, const Vec4 &rect, const Color &color)
+    {
+        return this->AddRectFilled(renderList, Vec2(rect.x, rect.y), Vec2(rect.x + rect.z, rect.y + rect.w), color);
+    }
+
+    inline void AddRectFilled(const Vec4 &rect, const Color &color)
+    {
+        return this->AddRectFilled(this->_renderList, Vec2(rect.x, rect.y), Vec2(rect.x + rect.z, rect.y + rect.w),
+                                   color);
+    }
+
+    inline void AddRect(const RenderListPtr &renderList, const Vec2 &min, const Vec2 &max, const Color &color,
+                        float strokeWidth = 1.f)
+    {
+        Vec2 topLineMin = {min.x, min.y};
+        Vec2 topLineMax = {max.x, min.y + strokeWidth};
+        Vec2 bottomLineMin = {min.x, max.y - strokeWidth};
+        Vec2 bottomLineMax = {max.x, max.y};
+        Vec2 leftLineMin = {min.x, min.y};
+        Vec2 leftLineMax = {min.x + strokeWidth, max.y};
+        Vec2 rightLineMin = {max.x - strokeWidth, min.y};
+        Vec2 rightLineMax = {max.x, max.y};
+
+        this->AddRectFilled(renderList, topLineMin, topLineMax, color);
+        this->AddRectFilled(renderList, bottomLineMin, bottomLineMax, color);
+        this->AddRectFilled(renderList, leftLineMin, leftLineMax, color);
+        this->AddRectFilled(renderList, rightLineMin, rightLineMax, color);
+    }
+
+    inline void AddRect(const Vec2 &min, const Vec2 &max, const Color &color, float strokeWidth = 1.f)
+    {
+        return this->AddRect(this->_renderList, min, max, color, strokeWidth);
+    }
+
+    inline void AddRect(const RenderListPtr &renderList, const Vec4 &rect, const Color &color, float strokeWidth = 1.f)
+    {
+        return this->AddRect(renderList, Vec2(rect.x, rect.y), Vec2(rect.x + rect.z, rect.y + rect.w), color,
+                             strokeWidth);
+    }
+
+    inline void AddRect(const Vec4 &rect, const Color &color, float strokeWidth = 1.f)
+    {
+        return this->AddRect(this->_renderList, Vec2(rect.x, rect.y), Vec2(rect.x + rect.z, rect.y + rect.w), color,
+                             strokeWidth);
+    }
+
+    inline void AddLine(const RenderListPtr &renderList, const Vec2 &v1, const Vec2 &v2, const Color &color,
+                        const float thickness = 1.f)
+    {
+        ShapeCommand command{};
+        command.type = ShapeCommandType::Line;
+        command.p1 = v1;
+        command.p2 = v2;
+        command.color = color;
+        command.size = thickness;
+
+        this->AddShape(renderList, command, 4, D3DPT_TRIANGLESTRIP);
+    }
+
+    inline void AddLine(const Vec2 &v1, const Vec2 &v2, const Color &color, const float thickness = 1.f)
+    {
+        return this->AddLine(this->_renderList, v1, v2, color, thickness);
+    }
+
+    inline void AddCircle(const RenderListPtr &renderList, const Vec2 &pos, float radius, const Color &color,
+                          int segments = 64)
+    {
+        ShapeCommand command{};
+        command.type = ShapeCommandType::Circle;
+        command.p1 = pos;
+        command.color = color;
+        command.size = radius;
+        command.segments = segments;
+
+        this->AddShape(renderList, command, static_cast<size_t>(segments) + 1, D3DPT_LINESTRIP);
+    }
+
+    inline void AddCircle(const Vec2 &pos, float radius, const Color &color, int segments = 24)
+    {
+        return this->AddCircle(this->_renderList, pos, radius, color, segments);
+    }
+
+    // Projects world positions to the current viewport with a view-projection matrix as DirectXMath builds it. visible
+    // receives the ProjectionFlags of every point, out is only meaningful for points in front of the near plane. The
+    // points are transformed four at a time, so large batches are far cheaper than projecting them one by one.
+    inline void ProjectPoints(const DirectX::XMMATRIX &viewProj, const Vec3 *in, Vec2 *out, uint8_t *visible,
+                              size_t count) const
+    {
+        DirectX::XMFLOAT4X4 m;
+        DirectX::XMStoreFloat4x4(&m, viewProj);
+
+        detail::ProjectPoints(m, in, out, visible, count, this->_displaySize.x, this->_displaySize.y);
+    }
+
+    // Screen rect around an axis aligned box. False if the box is off screen or crosses the near plane, where its
+    // projection is unbounded.
+    inline bool ProjectBox(const DirectX::XMMATRIX &viewProj, const Vec3 &boxMin, const Vec3 &boxMax, Vec2 &rectMin,
+                           Vec2 &rectMax) const
+    {
+        const Vec3 corners[8] = {{boxMin.x, boxMin.y, boxMin.z}, {boxMax.x, boxMin.y, boxMin.z},
+                                 {boxMin.x, boxMax.y, boxMin.z}, {boxMax.x, boxMax.y, boxMin.z},
+                                 {boxMin.x, boxMin.y, boxMax.z}, {boxMax.x, boxMin.y, boxMax.z},
+                                 {boxMin.x, boxMax.y, boxMax.z}, {boxMax.x, boxMax.y, boxMax.z}};
+        Vec2 screen[8];
+        uint8_t visible[8];
+
+        this->ProjectPoints(viewProj, corners, screen, visible, 8);
+
+        rectMin = screen[0];
+        rectMax = screen[0];
+
+        for (size_t i = 0; i < 8; i++)
+        {
+            if (!(visible[i] & PROJECTION_FLAG_IN_FRONT))
+            {
+                return false;
+            }
+
+            rectMin = {std::min(rectMin.x, screen[i].x), std::min(rectMin.y, screen[i].y)};
+            rectMax = {std::max(rectMax.x, screen[i].x), std::max(rectMax.y, screen[i].y)};
+        }
+
+        return rectMax.x >= 0.f && rectMax.y >= 0.f && rectMin.x <= this->_displaySize.x &&
+               rectMin.y <= this->_displaySize.y;
+    }
+
+    // Matrix the world-space primitives below are projected with, as DirectXMath builds it. Set it once per frame
+    // before Render(), the primitives are recorded in world space and only transformed by the device.
+    inline void SetViewProjection(const DirectX::XMMATRIX &viewProj)
+    {
+        DirectX::XMFLOAT4X4 m;
+        DirectX::XMStoreFloat4x4(&m, viewProj);
+
+        memcpy(&this->_viewProjMatrix, &m, sizeof(D3DMATRIX));
+    }
+
+    inline void AddLine3D(const RenderListPtr &renderList, const Vec3 &v1, const Vec3 &v2, const Color &color)
+    {
+        const WorldVertex v[] = {{v1, color}, {v2, color}};
+
+        renderList->AddWorldVertices(v, 2, D3DPT_LINELIST);
+    }
+
+    inline void AddLine3D(const Vec3 &v1, const Vec3 &v2, const Color &color)
+    {
+        return this->AddLine3D(this->_renderList, v1, v2, color);
+    }
+
+    // Wireframe of an axis aligned box, one line list of its 12 edges.
+    inline void AddBox3D(const RenderListPtr &renderList, const Vec3 &boxMin, const Vec3 &boxMax, const Color &color)
+    {
+        // corner i takes the max x for bit 0, the max y for bit 1 and the max z for bit 2
+        static constexpr uint8_t edges[24] = {0, 1, 2, 3, 4, 5, 6, 7, 0, 2, 1, 3, 4, 6, 5, 7, 0, 4, 1, 5, 2, 6, 3, 7};
+
+        WorldVertex v[24];
+        for (size_t i = 0; i < 24; i++)
+        {
+            const uint8_t corner = edges[i];
+            v[i] = {{corner & 1 ? boxMax.x : boxMin.x, corner & 2 ? boxMax.y : boxMin.y,
+                     corner & 4 ? boxMax.z : boxMin.z},
+                    color};
+        }
+
+        renderList->AddWorldVertices(v, 24, D3DPT_LINELIST);
+    }
+
+    inline void AddBox3D(const Vec3 &boxMin, const Vec3 &boxMax, const Color &color)
+    {
+        return this->AddBox3D(this->_renderList, boxMin, boxMax, color);
+    }
+
+    // Circle in the plane perpendicular to normal, which by default lies flat on the ground of a y-up world.
+    inline void AddCircle3D(const RenderListPtr &renderList, const Vec3 &center, float radius, const Color &color,
+                            const Vec3 &normal = {0.f, 1.f, 0.f}, int segments = 24)
+    {
+        Vec3 u;
+        Vec3 w;
+        detail::PlaneAxes(normal, u, w);
+
+        std::vector<WorldVertex> v(static_cast<size_t>(segments) * 2);
+        Vec3 prev = {center.x + u.x * radius, center.y + u.y * radius, center.z + u.z * radius};
+
+        for (int i = 0; i < segments; i++)
+        {
+            const float theta = 2.f * DirectX::XM_PI * static_cast<float>(i + 1) / static_cast<float>(segments);
+            const float c = radius * std::cos(theta);
+            const float s = radius * std::sin(theta);
+            const Vec3 next = {center.x + u.x * c + w.x * s, center.y + u.y * c + w.y * s,
+                               center.z + u.z * c + w.z * s};
+
+            v[i * 2] = {prev, color};
+            v[i * 2 + 1] = {next, color};
+            prev = next;
+        }
+
+        renderList->AddWorldVertices(v.data(), v.size(), D3DPT_LINELIST);
+    }
+
+    inline void AddCircle3D(const Vec3 &center, float radius, const Color &color,
+                            const Vec3 &normal = {0.f, 1.f, 0.f}, int segments = 24)
+    {
+        return this->AddCircle3D(this->_renderList, center, radius, color, normal, segments);
+    }
+
+    inline void Render(const RenderListPtr &renderList)
+    {
+        this->Render(std::span<const RenderListPtr>(&renderList, 1));
+    }
+
+    // Submits several lists at once, e.g. background, world and menu. The batches of each list are sorted by layer,
+    // every vertex buffer is locked once for all lists and the lists are drawn in order, each with its own clip rect
+    // and transform.
+    inline void Render(std::span<const RenderListPtr> renderLists)
+    {
+        // upload glyphs which were rasterized while recording
+        this->_fontAtlas->Flush();
+
+        // a list drawn again without being recorded keeps its glyphs through the next frame, as long as it is drawn
+        // every frame no text recorded meanwhile can take over their slots
+        for (const auto &renderList : renderLists)
+        {
+            if (renderList->_rendered)
+            {
+                this->_fontAtlas->TouchGlyphs(renderList->_glyphKeys);
+            }
+
+            renderList->_rendered = true;
+        }
+
+        // the buffers still hold the same content when the lists were kept or recorded identically since the last
+        // Render(), e.g. a static menu or a game ticking slower than it presents
+        if (this->IsUploaded(renderLists))
+        {
+            for (const auto &renderList : renderLists)
+            {
+                this->_renderStats.skippedBytes += renderList->_vertices.size() * sizeof(Vertex) +
+                                                   renderList->_worldVertices.size() * sizeof(WorldVertex);
+            }
+
+            this->_renderStats.reusedRenders++;
+        }
+        else
+        {
+            this->UploadRenderLists(renderLists);
+        }
+
+        size_t pos = 0;
+        size_t worldPos = 0;
+        size_t first = 0;
+        BatchType pipeline = BatchType::Vertices;
+
+        for (const auto &renderList : renderLists)
+        {
+            if (renderList->_clipped)
+            {
+                const RECT clipRect = {static_cast<LONG>(renderList->_clipRect.x),
+                                       static_cast<LONG>(renderList->_clipRect.y),
+                                       static_cast<LONG>(renderList->_clipRect.z),
+                                       static_cast<LONG>(renderList->_clipRect.w)};
+
+                this->_d3dDevice->SetScissorRect(&clipRect);
+                this->_d3dDevice->SetRenderState(D3DRS_SCISSORTESTENABLE, TRUE);
+            }
+
+            const size_t numBatches = renderList->_batches.size();
 
-        for (size_t i = 0; i < text.size(); ++i)
-        {
-            if (text[i] == L'{' && text.size() > i + 11 && text[i + 1] == L'#')
+            for (size_t i = 0; i < numBatches; i++)
             {
-                bool hasAlpha = (text[i + 10] == L'}');
-                bool noAlpha = (text[i + 8] == L'}');
-                if (hasAlpha || noAlpha)
+                Batch batch = renderList->_batches[this->_batchOrder[first + i]];
+
+                // neighbours in draw order with the same state were uploaded back to back, lists of them are one draw
+                while (i + 1 < numBatches &&
+                       IsMergeable(batch, renderList->_batches[this->_batchOrder[first + i + 1]]))
+                {
+                    batch.count += renderList->_batches[this->_batchOrder[first + ++i]].count;
+                }
+
+                int order = util::GetTopologyOrder(batch.topology);
+                if (batch.count && order > 0)
                 {
-                    if (!cleanText.empty())
+                    uint32_t primitiveCount = static_cast<uint32_t>(batch.count);
+
+                    if (util::IsTopologyList(batch.topology))
                     {
-                        segments.push_back({cleanText, currentColor});
-                        cleanText.clear();
+                        primitiveCount /= order;
+                    }
+                    else
+                    {
+                        primitiveCount -= (order - 1);
                     }
 
-                    std::wstring colorStr = text.substr(i + 2, hasAlpha ? 8 : 6);
-                    colorStr.erase(
-                        std::remove_if(colorStr.begin(), colorStr.end(), [](wchar_t c) { return !iswxdigit(c); }),
-                        colorStr.end());
-
-                    if (!hasAlpha)
+                    if (batch.type != pipeline)
                     {
-                        colorStr = L"ff" + colorStr;
+                        pipeline = batch.type;
+                        this->SetupPipeline(pipeline);
                     }
 
-                    currentColor = std::wcstoul(colorStr.c_str(), nullptr, 16);
-                    i += hasAlpha ? 10 : 8;
-                    continue;
+                    size_t &batchPos = batch.type == BatchType::WorldVertices ? worldPos : pos;
+
+                    this->_d3dDevice->SetTexture(0, batch.d3dTexture);
+                    this->_d3dDevice->DrawPrimitive(batch.topology, static_cast<uint32_t>(batchPos), primitiveCount);
+
+                    batchPos += batch.count;
+                    this->_renderStats.drawCalls++;
                 }
             }
-            cleanText += text[i];
+
+            if (renderList->_clipped)
+            {
+                this->_d3dDevice->SetRenderState(D3DRS_SCISSORTESTENABLE, FALSE);
+            }
+
+            first += numBatches;
+            this->_renderStats.renderLists++;
         }
 
-        if (!cleanText.empty())
+        // leave the shape pipeline bound for the next render list
+        if (pipeline != BatchType::Vertices)
         {
-            segments.push_back({cleanText, currentColor});
+            this->SetupPipeline(BatchType::Vertices);
         }
-
-        return segments;
     }
 
-    IDirect3DDevice9 *_d3dDevice;
-    IDirect3DTexture9 *_fontTexture;
-    std::map<wchar_t, std::array<float, 4>> _charCoords;
-    long _textureWidth;
-    long _textureHeight;
-    float _textScale;
-    long _charSpacing;
-
-    std::wstring _fontFamily;
-    long _fontHeigth;
-    uint32_t _fontFlags;
-    bool _initialized;
-};
-
-class Renderer : public std::enable_shared_from_this<Renderer>
-{
-  public:
-    Renderer(IDirect3DDevice9 *d3dDevice, uint32_t maxVertices)
-        : _d3dDevice(d3dDevice), _d3dVertexBuffer(nullptr), _maxVertices(maxVertices),
-          _renderList(std::make_shared<RenderList>(maxVertices)), _d3dPreviousStateBlock(nullptr),
-          _d3dRenderStateBlock(nullptr), _nextFontId(1)
+    inline void Render()
     {
-        if (!d3dDevice)
+        this->Render(_renderList);
+
+        if (!this->_keepLastList)
         {
-            throw std::runtime_error("Renderer::ctor() d3dDevice is null!");
+            this->_renderList->Clear();
         }
-
-        this->AcquireStateBlock();
-    }
-
-    ~Renderer()
-    {
-        this->Release();
     }
 
-    inline void Release()
+    // Keeps the renderer's list after Render() instead of clearing it. Record into it after ClearRenderList() when the
+    // game ticks, every frame in between redraws the buffers as they are. Clearing and recording have to happen on the
+    // rendering thread between two Render() calls, a game thread records into a TripleBufferedRenderList instead.
+    inline void SetKeepLastList(bool keepLastList)
     {
-        detail::SafeRelease(&this->_d3dVertexBuffer);
-        detail::SafeRelease(&this->_d3dPreviousStateBlock);
-        detail::SafeRelease(&this->_d3dRenderStateBlock);
+        this->_keepLastList = keepLastList;
     }
 
-    inline void OnLostDevice()
+    inline void ClearRenderList()
     {
-        this->Release();
-
-        for (auto &[_, font] : this->_fonts)
-        {
-            font->OnLostDevice();
-        }
+        this->_renderList->Clear();
     }
 
-    inline void OnResetDevice()
+    inline void SetLayer(uint8_t layer)
     {
-        this->AcquireStateBlock();
-
-        for (auto &[_, font] : this->_fonts)
-        {
-            font->OnResetDevice();
-        }
+        this->_renderList->SetLayer(layer);
     }
 
-    inline void BeginFrame()
+    inline AtlasStats GetAtlasStats() const
     {
-        this->_d3dPreviousStateBlock->Capture();
-        this->_d3dRenderStateBlock->Apply();
+        return this->_fontAtlas->GetStats();
     }
 
-    inline void EndFrame()
+    inline RenderStats GetRenderStats() const
     {
-        this->_d3dPreviousStateBlock->Apply();
+        return this->_renderStats;
     }
 
-    inline FontHandle AddFont(const std::wstring &fontFamily, long fontHeigth, uint32_t fontFlags = FONT_FLAG_NONE)
+    inline TextCacheStats GetTextCacheStats() const
     {
-        std::shared_ptr<Font> fontPtr = std::make_shared<Font>(this->_d3dDevice, fontFamily, fontHeigth, fontFlags);
-
-        const size_t fontHandle = this->_nextFontId++;
-        this->_fonts[fontHandle] = fontPtr;
-        return fontHandle;
-    }
+        TextCacheStats stats{};
+        stats.quadsSaved = this->_textQuadsSaved;
 
-    inline void AddText(const RenderListPtr &renderList, const FontHandle fontId, const std::wstring &text, Vec2 pos,
-                        const Color &color, uint32_t flags = FONT_FLAG_NONE, const Color &outlineColor = Color(0, 0, 0),
-                        float outlineThickness = 2.0f)
-    {
-        auto font = this->_fonts.find(fontId);
-        if (font == this->_fonts.end())
+        for (const auto &run : this->_texts)
         {
-            throw std::runtime_error("AddText(): Font not found!");
+            const size_t bytes = run ? run->font->GetCachedRunBytes(*run) : 0;
+            if (bytes)
+            {
+                stats.cachedTexts++;
+                stats.cachedBytes += bytes;
+            }
         }
 
-        return font->second->RenderText(renderList, pos, text, color, flags, outlineColor, outlineThickness);
+        return stats;
     }
 
-    inline void AddText(const FontHandle fontId, const std::wstring &text, Vec2 pos, const Color &color,
-                        uint32_t flags = FONT_FLAG_NONE, const Color &outlineColor = Color(0, 0, 0),
-                        float outlineThickness = 2.0f)
+    inline RenderListPtr CreateRenderList()
     {
-        return this->AddText(this->_renderList, fontId, text, pos, color, flags, outlineColor, outlineThickness);
+        return std::make_shared<RenderList>(this->_maxVertices);
     }
 
-    inline void AddText(const RenderListPtr &renderList, const FontHandle fontId, const std::string &text, Vec2 pos,
-                        const Color &color, uint32_t flags = FONT_FLAG_NONE, const Color &outlineColor = Color(0, 0, 0),
-                        float outlineThickness = 2.0f)
+  private:
+    // converted once, the run keeps the text until it is laid out
+    static inline std::wstring WidenText(std::string_view text)
     {
-        auto font = this->_fonts.find(fontId);
-        if (font == this->_fonts.end())
+        std::wstring wideText;
+        wideText.reserve(text.size());
+
+        for (size_t i = 0; i < text.size(); i++)
         {
-            throw std::runtime_error("AddText(): Font not found!");
+            wchar_t chr[2];
+            wideText.append(chr, detail::EncodeUtf16(detail::DecodeUtf8(text, i), chr));
         }
 
-        return font->second->RenderText(renderList, pos, detail::ConvertToWString(text), color, flags, outlineColor,
-                                        outlineThickness);
+        return wideText;
     }
 
-    inline void AddText(const FontHandle fontId, const std::string &text, Vec2 pos, const Color &color,
-                        uint32_t flags = FONT_FLAG_NONE, const Color &outlineColor = Color(0, 0, 0),
-                        float outlineThickness = 2.0f)
+    inline TextRun &GetTextRun(const TextHandle textHandle, const std::string &caller)
     {
-        return this->AddText(this->_renderList, fontId, text, pos, color, flags, outlineColor, outlineThickness);
+        if (textHandle >= this->_texts.size() || !this->_texts[textHandle])
+        {
+            throw std::runtime_error(caller + "(): Text not found!");
+        }
+
+        return *this->_texts[textHandle];
     }
 
-    inline Vec2 CalculateTextExtent(const FontHandle fontId, const std::wstring &text)
+    inline detail::ThreadPool &GetThreadPool()
     {
-        auto font = this->_fonts.find(fontId);
-        if (font == this->_fonts.end())
+        if (!this->_threadPool)
         {
-            throw std::runtime_error("AddText(): Font not found!");
+            this->_threadPool =
+                std::make_unique<detail::ThreadPool>(std::max(2u, std::thread::hardware_concurrency()) - 1);
         }
 
-        return font->second->CalculateTextExtent(text);
+        return *this->_threadPool;
     }
 
-    inline Vec2 CalculateTextExtent(const FontHandle fontId, const std::string &text)
+    inline void AddShape(const RenderListPtr &renderList, const ShapeCommand &command, size_t count,
+                         const TopologyType topology)
     {
-        return this->CalculateTextExtent(fontId, detail::ConvertToWString(text));
+        const size_t offset = renderList->AddShape(command, count, topology, this->_fontAtlas->GetTexture());
+
+        if (!renderList->_deferredTessellation)
+        {
+            TessellateShape(command, &renderList->_vertices[offset]);
+        }
     }
 
-    inline void AddGradientRect(const RenderListPtr &renderList, const Vec2 &min, const Vec2 &max, const Color &color1,
-                                const Color &color2, const GradientDirection direction)
+    // Writes the vertices of a shape, the same whether it is tessellated when it is added or when it is rendered.
+    static inline void TessellateShape(const ShapeCommand &command, Vertex *v)
     {
-        float x1 = min.x;
-        float y1 = min.y;
-        float x2 = max.x;
-        float y2 = max.y;
+        const Color &color = command.color;
+        const float x1 = command.p1.x;
+        const float y1 = command.p1.y;
+        const float x2 = command.p2.x;
+        const float y2 = command.p2.y;
 
-        Vertex v[6];
-
-        if (direction == GradientDirection::Horizontal)
+        switch (command.type)
         {
-            v[0] = {x1, y1, 0.5f, color1};
-            v[1] = {x2, y1, 0.5f, color1};
-            v[2] = {x1, y2, 0.5f, color2};
+        case ShapeCommandType::RectFilled:
+            v[0] = {x1, y1, color};
+            v[1] = {x2, y1, color};
+            v[2] = {x1, y2, color};
+
+            v[3] = {x2, y1, color};
+            v[4] = {x2, y2, color};
+            v[5] = {x1, y2, color};
+            break;
 
-            v[3] = {x2, y1, 0.5f, color1};
-            v[4] = {x2, y2, 0.5f, color2};
-            v[5] = {x1, y2, 0.5f, color2};
-        }
-        else
-        {
-            v[0] = {x1, y1, 0.5f, color1};
-            v[1] = {x2, y1, 0.5f, color2};
-            v[2] = {x1, y2, 0.5f, color1};
+        case ShapeCommandType::GradientRect: {
+            const Color &color2 = command.color2;
 
-            v[3] = {x2, y1, 0.5f, color2};
-            v[4] = {x2, y2, 0.5f, color2};
-            v[5] = {x1, y2, 0.5f, color1};
-        }
+            if (static_cast<GradientDirection>(command.segments) == GradientDirection::Horizontal)
+            {
+                v[0] = {x1, y1, 0.5f, color};
+                v[1] = {x2, y1, 0.5f, color};
+                v[2] = {x1, y2, 0.5f, color2};
 
-        renderList->AddVertices(v, 6, D3DPT_TRIANGLELIST);
-    }
+                v[3] = {x2, y1, 0.5f, color};
+                v[4] = {x2, y2, 0.5f, color2};
+                v[5] = {x1, y2, 0.5f, color2};
+            }
+            else
+            {
+                v[0] = {x1, y1, 0.5f, color};
+                v[1] = {x2, y1, 0.5f, color2};
+                v[2] = {x1, y2, 0.5f, color};
 
-    inline void AddGradientRect(const Vec2 &min, const Vec2 &max, const Color &color1, const Color &color2,
-                                const GradientDirection direction)
-    {
-        return this->AddGradientRect(this->_renderList, min, max, color1, color2, direction);
-    }
+                v[3] = {x2, y1, 0.5f, color2};
+                v[4] = {x2, y2, 0.5f, color2};
+                v[5] = {x1, y2, 0.5f, color};
+            }
+            break;
+        }
 
-    inline void AddGradientRect(const RenderListPtr &renderList, const Vec4 &rect, const Color &color1,
-                                const Color &color2, const GradientDirection direction)
-    {
-        return this->AddGradientRect(renderList, Vec2(rect.x, rect.y), Vec2(rect.x + rect.z, rect.y + rect.w), color1,
-                                     color2, direction);
-    }
+        case ShapeCommandType::Line: {
+            float dx = x2 - x1;
+            float dy = y2 - y1;
+            float length = std::sqrtf(dx * dx + dy * dy);
 
-    inline void AddGradientRect(const Vec4 &rect, const Color &color1, const Color &color2,
-                                const GradientDirection direction)
-    {
-        return this->AddGradientRect(this->_renderList, Vec2(rect.x, rect.y), Vec2(rect.x + rect.z, rect.y + rect.w),
-                                     color1, color2, direction);
-    }
+            dx /= length;
+            dy /= length;
 
-    inline void AddRectFilled(const RenderListPtr &renderList, const Vec2 &min, const Vec2 &max, const Color &color)
-    {
-        float x1 = min.x;
-        float y1 = min.y;
-        float x2 = max.x;
-        float y2 = max.y;
+            float px = -dy * command.size * 0.5f;
+            float py = dx * command.size * 0.5f;
 
-        Vertex v[] = {{x1, y1, color}, {x2, y1, color}, {x1, y2, color},
-                      {x2, y1, color}, {x2, y2, color}, {x1, y2, color}};
+            v[0] = {{x1 + px, y1 + py, 0.0f, 1.0f}, color};
+            v[1] = {{x1 - px, y1 - py, 0.0f, 1.0f}, color};
+            v[2] = {{x2 + px, y2 + py, 0.0f, 1.0f}, color};
+            v[3] = {{x2 - px, y2 - py, 0.0f, 1.0f}, color};
+            break;
+        }
 
-        renderList->AddVertices(v, D3DPT_TRIANGLELIST);
-    }
+        case ShapeCommandType::Circle:
+            for (int i = 0; i <= command.segments; i++)
+            {
+                const float theta = 2.f * DirectX::XM_PI * static_cast<float>(i) / static_cast<float>(command.segments);
 
-    inline void AddRectFilled(const Vec2 &min, const Vec2 &max, const Color &color)
-    {
-        return this->AddRectFilled(this->_renderList, min, max, color);
+                v[i] = Vertex{x1 + command.size * std::cos(theta), y1 + command.size * std::sin(theta), color};
+            }
+            break;
+        }
     }
 
-    inline void AddRectFilled(const RenderListPtr &renderList, const Vec4 &rect, const Color &color)
+    // Tessellates the shapes of lists with deferred tessellation. Every command writes the vertex range it reserved,
+    // the prefix sum of the vertex counts recorded before it, so chunks of commands run on the worker pool next to the
+    // render thread without sharing anything.
+    inline void TessellateCommands(std::span<const RenderListPtr> renderLists)
     {
-        return this->AddRectFilled(renderList, Vec2(rect.x, rect.y), Vec2(rect.x + rect.z, rect.y + rect.w), color);
-    }
+        for (const auto &renderList : renderLists)
+        {
+            const std::vector<ShapeCommand> &commands = renderList->_commands;
 
-    inline void AddRectFilled(const Vec4 &rect, const Color &color)
-    {
-        return this->AddRectFilled(this->_renderList, Vec2(rect.x, rect.y), Vec2(rect.x + rect.z, rect.y + rect.w),
-                                   color);
-    }
+            if (commands.empty())
+            {
+                continue;
+            }
 
-    inline void AddRect(const RenderListPtr &renderList, const Vec2 &min, const Vec2 &max, const Color &color,
-                        float strokeWidth = 1.f)
-    {
-        Vec2 topLineMin = {min.x, min.y};
-        Vec2 topLineMax = {max.x, min.y + strokeWidth};
-        Vec2 bottomLineMin = {min.x, max.y - strokeWidth};
-        Vec2 bottomLineMax = {max.x, max.y};
-        Vec2 leftLineMin = {min.x, min.y};
-        Vec2 leftLineMax = {min.x + strokeWidth, max.y};
-        Vec2 rightLineMin = {max.x - strokeWidth, min.y};
-        Vec2 rightLineMax = {max.x, max.y};
+            Vertex *vertices = renderList->_vertices.data();
+            detail::ThreadPool *pool = commands.size() > g_tessellateChunkSize ? &this->GetThreadPool() : nullptr;
 
-        this->AddRectFilled(renderList, topLineMin, topLineMax, color);
-        this->AddRectFilled(renderList, bottomLineMin, bottomLineMax, color);
-        this->AddRectFilled(renderList, leftLineMin, leftLineMax, color);
-        this->AddRectFilled(renderList, rightLineMin, rightLineMax, color);
-    }
+            detail::ParallelFor(pool, commands.size(), g_tessellateChunkSize,
+                                [&commands, vertices](size_t begin, size_t end) {
+                                    for (size_t i = begin; i < end; i++)
+                                    {
+                                        TessellateShape(commands[i], vertices + commands[i].offset);
+                                    }
+                                });
 
-    inline void AddRect(const Vec2 &min, const Vec2 &max, const Color &color, float strokeWidth = 1.f)
-    {
-        return this->AddRect(this->_renderList, min, max, color, strokeWidth);
+            renderList->_commands.clear();
+        }
     }
 
-    inline void AddRect(const RenderListPtr &renderList, const Vec4 &rect, const Color &color, float strokeWidth = 1.f)
+    // the transform is baked into the uploaded vertices, so it is part of what has to match
+    static inline uint64_t GetUploadHash(const RenderList &renderList)
     {
-        return this->AddRect(renderList, Vec2(rect.x, rect.y), Vec2(rect.x + rect.z, rect.y + rect.w), color,
-                             strokeWidth);
-    }
+        if (!renderList._transformed)
+        {
+            return renderList._contentHash;
+        }
 
-    inline void AddRect(const Vec4 &rect, const Color &color, float strokeWidth = 1.f)
-    {
-        return this->AddRect(this->_renderList, Vec2(rect.x, rect.y), Vec2(rect.x + rect.z, rect.y + rect.w), color,
-                             strokeWidth);
+        return detail::HashBytes(renderList._contentHash, &renderList._transform, sizeof(renderList._transform));
     }
 
-    inline void AddLine(const RenderListPtr &renderList, const Vec2 &v1, const Vec2 &v2, const Color &color,
-                        const float thickness = 1.f)
+    inline bool IsUploaded(std::span<const RenderListPtr> renderLists) const
     {
-        float dx = v2.x - v1.x;
-        float dy = v2.y - v1.y;
-        float length = std::sqrtf(dx * dx + dy * dy);
-
-        dx /= length;
-        dy /= length;
-
-        float px = -dy * thickness * 0.5f;
-        float py = dx * thickness * 0.5f;
+        if (renderLists.size() != this->_uploadedHashes.size())
+        {
+            return false;
+        }
 
-        Vertex v[] = {{{v1.x + px, v1.y + py, 0.0f, 1.0f}, color},
-                      {{v1.x - px, v1.y - py, 0.0f, 1.0f}, color},
-                      {{v2.x + px, v2.y + py, 0.0f, 1.0f}, color},
-                      {{v2.x - px, v2.y - py, 0.0f, 1.0f}, color}};
+        for (size_t i = 0; i < renderLists.size(); i++)
+        {
+            if (GetUploadHash(*renderLists[i]) != this->_uploadedHashes[i])
+            {
+                return false;
+            }
+        }
 
-        renderList->AddVertices(v, D3DPT_TRIANGLESTRIP);
+        return true;
     }
 
-    inline void AddLine(const Vec2 &v1, const Vec2 &v2, const Color &color, const float thickness = 1.f)
+    inline void UploadRenderLists(std::span<const RenderListPtr> renderLists)
     {
-        return this->AddLine(this->_renderList, v1, v2, color, thickness);
-    }
+        this->TessellateCommands(renderLists);
 
-    inline void AddCircle(const RenderListPtr &renderList, const Vec2 &pos, float radius, const Color &color,
-                          int segments = 64)
-    {
-        std::vector<Vertex> v(segments + 1);
+        size_t numVertices = 0;
+        size_t numWorldVertices = 0;
 
-        for (int i = 0; i <= segments; i++)
+        for (const auto &renderList : renderLists)
         {
-            const float theta = 2.f * DirectX::XM_PI * static_cast<float>(i) / static_cast<float>(segments);
-
-            v[i] = Vertex{pos.x + radius * std::cos(theta), pos.y + radius * std::sin(theta), color};
+            numVertices += renderList->_vertices.size();
+            numWorldVertices += renderList->_worldVertices.size();
         }
 
-        renderList->AddVertices(v.data(), v.size(), D3DPT_LINESTRIP);
-    }
-
-    inline void AddCircle(const Vec2 &pos, float radius, const Color &color, int segments = 24)
-    {
-        return this->AddCircle(this->_renderList, pos, radius, color, segments);
-    }
+        this->SortBatches(renderLists);
 
-    inline void Render(const RenderListPtr &renderList)
-    {
-        size_t numVertices = renderList->_vertices.size();
         if (numVertices > 0)
         {
             void *data;
@@ -1083,53 +3564,167 @@ class Renderer : public std::enable_shared_from_this<Renderer>
                 this->_maxVertices = static_cast<uint32_t>(numVertices);
                 this->Release();
                 this->AcquireStateBlock();
+                this->SetupPipeline(BatchType::Vertices);
             }
 
             detail::ThrowIfFailed(this->_d3dVertexBuffer->Lock(0, 0, &data, D3DLOCK_DISCARD));
             {
-                memcpy(data, renderList->_vertices.data(), sizeof(Vertex) * numVertices);
+                Vertex *dst = static_cast<Vertex *>(data);
+                size_t first = 0;
+
+                for (const auto &renderList : renderLists)
+                {
+                    for (size_t i = 0; i < renderList->_batches.size(); i++)
+                    {
+                        const uint32_t index = this->_batchOrder[first + i];
+                        const Batch &batch = renderList->_batches[index];
+
+                        if (batch.type != BatchType::Vertices || !batch.count)
+                        {
+                            continue;
+                        }
+
+                        const Vertex *src = &renderList->_vertices[this->_batchOffsets[first + index]];
+
+                        if (!renderList->_transformed)
+                        {
+                            memcpy(dst, src, sizeof(Vertex) * batch.count);
+                        }
+                        else
+                        {
+                            // vertices are pretransformed, so the transform is applied while copying
+                            const DirectX::XMFLOAT4X4 &m = renderList->_transform;
+
+                            for (size_t j = 0; j < batch.count; j++)
+                            {
+                                Vertex vertex = src[j];
+                                vertex.position.x = src[j].position.x * m.m[0][0] + src[j].position.y * m.m[1][0] +
+                                                    m.m[3][0];
+                                vertex.position.y = src[j].position.x * m.m[0][1] + src[j].position.y * m.m[1][1] +
+                                                    m.m[3][1];
+                                dst[j] = vertex;
+                            }
+                        }
+
+                        dst += batch.count;
+                    }
+
+                    first += renderList->_batches.size();
+                }
             }
             this->_d3dVertexBuffer->Unlock();
-        }
 
-        size_t pos = 0;
+            this->_renderStats.bufferMaps++;
+            this->_renderStats.uploadedBytes += sizeof(Vertex) * numVertices;
+        }
 
-        for (const auto &batch : renderList->_batches)
+        if (numWorldVertices > 0)
         {
-            int order = util::GetTopologyOrder(batch.topology);
-            if (batch.count && order > 0)
+            void *data;
+
+            if (numWorldVertices > this->_maxWorldVertices)
             {
-                uint32_t primitiveCount = static_cast<uint32_t>(batch.count);
+                this->CreateWorldVertexBuffer(std::max(numWorldVertices, this->_maxWorldVertices * 2));
+            }
 
-                if (util::IsTopologyList(batch.topology))
-                {
-                    primitiveCount /= order;
-                }
-                else
+            detail::ThrowIfFailed(this->_d3dWorldVertexBuffer->Lock(0, 0, &data, D3DLOCK_DISCARD));
+            {
+                WorldVertex *dst = static_cast<WorldVertex *>(data);
+                size_t first = 0;
+
+                for (const auto &renderList : renderLists)
                 {
-                    primitiveCount -= (order - 1);
+                    for (size_t i = 0; i < renderList->_batches.size(); i++)
+                    {
+                        const uint32_t index = this->_batchOrder[first + i];
+                        const Batch &batch = renderList->_batches[index];
+
+                        if (batch.type == BatchType::WorldVertices && batch.count)
+                        {
+                            memcpy(dst, &renderList->_worldVertices[this->_batchOffsets[first + index]],
+                                   sizeof(WorldVertex) * batch.count);
+                            dst += batch.count;
+                        }
+                    }
+
+                    first += renderList->_batches.size();
                 }
+            }
+            this->_d3dWorldVertexBuffer->Unlock();
+
+            this->_renderStats.bufferMaps++;
+            this->_renderStats.uploadedBytes += sizeof(WorldVertex) * numWorldVertices;
+        }
+
+        this->_uploadedHashes.clear();
+        for (const auto &renderList : renderLists)
+        {
+            this->_uploadedHashes.push_back(GetUploadHash(*renderList));
+        }
+    }
+
+    // Whether next may be appended to the draw of batch once their data is contiguous. Both need the same state and
+    // a list topology, strips would join into one shape.
+    static inline bool IsMergeable(const Batch &batch, const Batch &next)
+    {
+        return batch.type == next.type && batch.topology == next.topology && batch.d3dTexture == next.d3dTexture &&
+               util::IsTopologyList(batch.topology);
+    }
 
-                this->_d3dDevice->SetTexture(0, batch.d3dTexture);
-                this->_d3dDevice->DrawPrimitive(batch.topology, static_cast<uint32_t>(pos), primitiveCount);
+    // Stable sort of the batches of every list by layer, the recorded order is kept within a layer. Fills _batchOrder
+    // with the sorted indices and _batchOffsets with the start of every batch within its list's array.
+    inline void SortBatches(std::span<const RenderListPtr> renderLists)
+    {
+        this->_batchKeys.clear();
+        this->_batchOffsets.clear();
+        this->_batchOrder.clear();
+
+        for (const auto &renderList : renderLists)
+        {
+            const size_t first = this->_batchKeys.size();
+            size_t offsets[2] = {};
+
+            for (const auto &batch : renderList->_batches)
+            {
+                size_t &offset = offsets[static_cast<size_t>(batch.type)];
 
-                pos += batch.count;
+                this->_batchKeys.push_back(batch.layer);
+                this->_batchOffsets.push_back(offset);
+                offset += batch.count;
             }
+
+            this->_batchOrder.resize(this->_batchKeys.size());
+            detail::RadixSort(&this->_batchKeys[first], renderList->_batches.size(), &this->_batchOrder[first],
+                              this->_sortScratch);
         }
     }
 
-    inline void Render()
+    // Binds either the pretransformed shape vertices or the world-space ones the device transforms and clips.
+    inline void SetupPipeline(BatchType type)
     {
-        this->Render(_renderList);
-        this->_renderList->Clear();
+        if (type == BatchType::WorldVertices)
+        {
+            this->_d3dDevice->SetTransform(D3DTS_PROJECTION, &this->_viewProjMatrix);
+            this->_d3dDevice->SetFVF(g_worldVertexDefinition);
+            this->_d3dDevice->SetStreamSource(0, this->_d3dWorldVertexBuffer, 0, sizeof(WorldVertex));
+        }
+        else
+        {
+            this->_d3dDevice->SetFVF(g_vertexDefinition);
+            this->_d3dDevice->SetStreamSource(0, this->_d3dVertexBuffer, 0, sizeof(Vertex));
+        }
     }
 
-    inline RenderListPtr CreateRenderList()
+    inline void CreateWorldVertexBuffer(size_t maxWorldVertices)
     {
-        return std::make_shared<RenderList>(this->_maxVertices);
+        detail::SafeRelease(&this->_d3dWorldVertexBuffer);
+
+        detail::ThrowIfFailed(this->_d3dDevice->CreateVertexBuffer(
+            static_cast<UINT>(maxWorldVertices * sizeof(WorldVertex)), D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY,
+            g_worldVertexDefinition, D3DPOOL_DEFAULT, &this->_d3dWorldVertexBuffer, nullptr));
+        this->_maxWorldVertices = maxWorldVertices;
     }
 
-  private:
     inline void AcquireStateBlock()
     {
         D3DVIEWPORT9 vp = {};
@@ -1160,6 +3755,10 @@ class Renderer : public std::enable_shared_from_this<Renderer>
             this->_d3dDevice->SetRenderState(D3DRS_FILLMODE, D3DFILL_SOLID);
             this->_d3dDevice->SetRenderState(D3DRS_CULLMODE, D3DCULL_CCW);
             this->_d3dDevice->SetRenderState(D3DRS_STENCILENABLE, FALSE);
+            // render lists with a clip rect enable it, recorded so the previous state block restores it
+            const RECT scissorRect = {0, 0, static_cast<LONG>(vp.Width), static_cast<LONG>(vp.Height)};
+            this->_d3dDevice->SetScissorRect(&scissorRect);
+            this->_d3dDevice->SetRenderState(D3DRS_SCISSORTESTENABLE, FALSE);
             this->_d3dDevice->SetRenderState(D3DRS_CLIPPING, TRUE);
             this->_d3dDevice->SetRenderState(D3DRS_CLIPPLANEENABLE, FALSE);
             this->_d3dDevice->SetRenderState(D3DRS_VERTEXBLEND, D3DVBF_DISABLE);
@@ -1169,7 +3768,8 @@ class Renderer : public std::enable_shared_from_this<Renderer>
                                              D3DCOLORWRITEENABLE_RED | D3DCOLORWRITEENABLE_GREEN |
                                                  D3DCOLORWRITEENABLE_BLUE | D3DCOLORWRITEENABLE_ALPHA);
 
-            this->_d3dDevice->SetTextureStageState(0, D3DTSS_COLOROP, D3DTOP_MODULATE);
+            // the font atlas may only carry coverage, so the colour always comes from the vertex
+            this->_d3dDevice->SetTextureStageState(0, D3DTSS_COLOROP, D3DTOP_SELECTARG2);
             this->_d3dDevice->SetTextureStageState(0, D3DTSS_COLORARG1, D3DTA_TEXTURE);
             this->_d3dDevice->SetTextureStageState(0, D3DTSS_COLORARG2, D3DTA_DIFFUSE);
             this->_d3dDevice->SetTextureStageState(0, D3DTSS_ALPHAOP, D3DTOP_MODULATE);
@@ -1179,9 +3779,23 @@ class Renderer : public std::enable_shared_from_this<Renderer>
             this->_d3dDevice->SetTextureStageState(0, D3DTSS_TEXTURETRANSFORMFLAGS, D3DTTFF_DISABLE);
             this->_d3dDevice->SetTextureStageState(1, D3DTSS_COLOROP, D3DTOP_DISABLE);
             this->_d3dDevice->SetTextureStageState(1, D3DTSS_ALPHAOP, D3DTOP_DISABLE);
-            this->_d3dDevice->SetSamplerState(0, D3DSAMP_MINFILTER, D3DTEXF_POINT);
-            this->_d3dDevice->SetSamplerState(0, D3DSAMP_MAGFILTER, D3DTEXF_POINT);
-            this->_d3dDevice->SetSamplerState(0, D3DSAMP_MIPFILTER, D3DTEXF_NONE);
+            // scaled text samples the atlas' mip chain, clamping keeps the solid block at (0, 0) from wrapping around
+            this->_d3dDevice->SetSamplerState(0, D3DSAMP_MINFILTER, D3DTEXF_LINEAR);
+            this->_d3dDevice->SetSamplerState(0, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR);
+            this->_d3dDevice->SetSamplerState(0, D3DSAMP_MIPFILTER, D3DTEXF_LINEAR);
+            this->_d3dDevice->SetSamplerState(0, D3DSAMP_ADDRESSU, D3DTADDRESS_CLAMP);
+            this->_d3dDevice->SetSamplerState(0, D3DSAMP_ADDRESSV, D3DTADDRESS_CLAMP);
+
+            // recorded so the previous state block restores the transforms world-space primitives replace
+            D3DMATRIX identity{};
+            for (int j = 0; j < 4; j++)
+            {
+                identity.m[j][j] = 1.f;
+            }
+
+            this->_d3dDevice->SetTransform(D3DTS_WORLD, &identity);
+            this->_d3dDevice->SetTransform(D3DTS_VIEW, &identity);
+            this->_d3dDevice->SetTransform(D3DTS_PROJECTION, &identity);
 
             this->_d3dDevice->SetFVF(g_vertexDefinition);
             this->_d3dDevice->SetTexture(0, nullptr);
@@ -1202,14 +3816,36 @@ class Renderer : public std::enable_shared_from_this<Renderer>
     Vec2 _displaySize;
     IDirect3DDevice9 *_d3dDevice;
     IDirect3DVertexBuffer9 *_d3dVertexBuffer;
+    IDirect3DVertexBuffer9 *_d3dWorldVertexBuffer;
 
     uint32_t _maxVertices;
+    size_t _maxWorldVertices;
     RenderListPtr _renderList;
 
     IDirect3DStateBlock9 *_d3dPreviousStateBlock;
     IDirect3DStateBlock9 *_d3dRenderStateBlock;
+    D3DMATRIX _viewProjMatrix;
 
+    std::shared_ptr<FontAtlas> _fontAtlas;
+    std::wstring _fontCacheDirectory;
     std::unordered_map<FontHandle, FontPtr> _fonts;
     FontHandle _nextFontId;
+    // interned texts are indexed by their handle
+    std::vector<std::unique_ptr<TextRun>> _texts;
+    std::vector<TextHandle> _freeTextHandles;
+    std::atomic<size_t> _textQuadsSaved;
+    RenderStats _renderStats;
+    bool _keepLastList = false;
+    // upload hash of each list in the buffers
+    std::vector<uint64_t> _uploadedHashes;
+
+    // scratch of SortBatches(), indexed by the batches of all lists passed to Render() back to back
+    std::vector<uint64_t> _batchKeys;
+    std::vector<size_t> _batchOffsets;
+    std::vector<uint32_t> _batchOrder;
+    std::vector<uint32_t> _sortScratch;
+
+    // declared last so the workers are joined before anything they reference is destroyed
+    std::unique_ptr<detail::ThreadPool> _threadPool;
 };
 } // namespace CheatRenderFramework
\ No newline at end of file